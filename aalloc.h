@@ -2,6 +2,8 @@
 #define AALLOC_H
 #include <cstdlib>
 #include <cassert>
+#include <cstddef>
+#include <new>
 
 // SSE requires 16-bytes alignment so we have to be carefull when
 // allocating any structure containig vector on the heap.
@@ -41,4 +43,52 @@ inline void afree(void *ptr)
 }
 #endif
 
+// Standard allocator honouring alignof(T) (or a stricter Alignment), so
+// containers of aligned types such as Matrix4f stay aligned even where
+// operator new does not guarantee over-alignment:
+//
+//   std::vector<Matrix4f, AlignedAllocator<Matrix4f> > transforms;
+template <typename T, size_t Alignment = alignof(T)>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    static const size_t alignment = Alignment < sizeof(void*) ? sizeof(void*) : Alignment;
+
+    template <typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T* allocate(size_t n)
+    {
+        void *ptr = aalloc(n*sizeof(T), alignment);
+        if (!ptr)
+            throw std::bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t)
+    {
+        afree(ptr);
+    }
+
+    template <typename U>
+    bool operator == (const AlignedAllocator<U, Alignment> &) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator != (const AlignedAllocator<U, Alignment> &) const
+    {
+        return false;
+    }
+};
+
 #endif
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include "animation.h"
+#include "instrument.h"
+
+namespace math {
+
+static const float QUAT_RANGE = 0.70710678118f; // 1/sqrt(2)
+static const float QUAT_STEPS = 32767.0f;
+static const float VEC_STEPS = 65535.0f;
+
+PackedQuaternion PackedQuaternion::pack(const Quaternion &q)
+{
+    float c[4] = { q.m_v.x(), q.m_v.y(), q.m_v.z(), q.m_w };
+
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+        if (fabsf(c[i]) > fabsf(c[largest]))
+            largest = i;
+
+    // q and -q are the same rotation, keep the dropped component positive
+    float sign = c[largest] < 0 ? -1.0f : 1.0f;
+
+    PackedQuaternion p;
+    for (int i = 0, n = 0; i < 4; i++) {
+        if (i == largest)
+            continue;
+        float v = clamp(c[i]*sign, -QUAT_RANGE, QUAT_RANGE);
+        float u = (v/QUAT_RANGE + 1.0f)*0.5f;
+        p.m_data[n++] = (uint16_t)(u*QUAT_STEPS + 0.5f);
+    }
+    p.m_data[0] |= (largest & 1) << 15;
+    p.m_data[1] |= (largest >> 1) << 15;
+
+    return p;
+}
+
+Quaternion PackedQuaternion::unpack() const
+{
+    int largest = (m_data[0] >> 15) | ((m_data[1] >> 15) << 1);
+
+    float c[4];
+    float sum = 0;
+    for (int i = 0, n = 0; i < 4; i++) {
+        if (i == largest)
+            continue;
+        float u = (m_data[n++] & 0x7fff)/QUAT_STEPS;
+        c[i] = (u*2.0f - 1.0f)*QUAT_RANGE;
+        sum += c[i]*c[i];
+    }
+    c[largest] = sqrtf(std::max(0.0f, 1.0f - sum));
+
+    return Quaternion(c[3], vec3f(c[0], c[1], c[2]));
+}
+
+size_t seekKey(const float *times, size_t count, float t, TrackCursor &cursor)
+{
+    if (count < 2)
+        return 0;
+
+    size_t k = cursor.key;
+    if (k+1 < count && times[k] <= t) {
+        if (t < times[k+1])
+            return k;
+        if (k+2 < count && t < times[k+2]) {
+            cursor.key = k+1;
+            return k+1;
+        }
+    }
+
+    k = std::upper_bound(times, times+count, t) - times;
+    k = k == 0 ? 0 : std::min(k-1, count-2);
+    cursor.key = k;
+    return k;
+}
+
+static float keyAlpha(const std::vector<float> &times, size_t k, float t)
+{
+    if (times.size() < 2)
+        return 0.0f;
+    float t0 = times[k];
+    float t1 = times[k+1];
+    return clamp((t-t0)/(t1-t0), 0.0f, 1.0f);
+}
+
+void RotationTrack::set(const float *times, const Quaternion *keys, size_t count)
+{
+    m_times.assign(times, times+count);
+    m_keys.resize(count);
+    for (size_t i = 0; i < count; i++)
+        m_keys[i] = PackedQuaternion::pack(keys[i]);
+}
+
+void RotationTrack::keys(float t, TrackCursor &cursor,
+                         Quaternion &a, Quaternion &b, float &alpha) const
+{
+    if (m_keys.empty()) {
+        a.loadIdentity();
+        b.loadIdentity();
+        alpha = 0.0f;
+        return;
+    }
+
+    size_t k = seekKey(&m_times[0], m_times.size(), t, cursor);
+    a = m_keys[k].unpack();
+    b = k+1 < m_keys.size() ? m_keys[k+1].unpack() : a;
+    alpha = keyAlpha(m_times, k, t);
+}
+
+Quaternion RotationTrack::sample(float t, TrackCursor &cursor) const
+{
+    Quaternion a, b;
+    float alpha;
+    keys(t, cursor, a, b, alpha);
+
+    // nlerp along the shortest arc
+    if (a.m_w*b.m_w + dot(a.m_v, b.m_v) < 0)
+        b = b*-1.0f;
+    Quaternion q = a + (b-a)*alpha;
+    return q*(1.0f/q.length());
+}
+
+void VectorTrack::set(const float *times, const vec3f *keys, size_t count)
+{
+    m_times.assign(times, times+count);
+    m_keys.resize(count);
+    if (count == 0)
+        return;
+
+    vec3f lo = keys[0], hi = keys[0];
+    for (size_t i = 1; i < count; i++)
+        for (size_t j = 0; j < 3; j++) {
+            lo[j] = std::min(lo[j], keys[i][j]);
+            hi[j] = std::max(hi[j], keys[i][j]);
+        }
+    m_min = lo;
+    m_extent = hi-lo;
+
+    for (size_t i = 0; i < count; i++)
+        for (size_t j = 0; j < 3; j++) {
+            float u = m_extent[j] > 0 ? (keys[i][j]-lo[j])/m_extent[j] : 0.0f;
+            m_keys[i].m_data[j] = (uint16_t)(u*VEC_STEPS + 0.5f);
+        }
+}
+
+vec3f VectorTrack::unpack(size_t i) const
+{
+    const uint16_t *d = m_keys[i].m_data;
+    return m_min + m_extent*vec3f(d[0], d[1], d[2])*(1.0f/VEC_STEPS);
+}
+
+void VectorTrack::keys(float t, TrackCursor &cursor,
+                       vec3f &a, vec3f &b, float &alpha) const
+{
+    if (m_keys.empty()) {
+        a.assign(0.0f);
+        b.assign(0.0f);
+        alpha = 0.0f;
+        return;
+    }
+
+    size_t k = seekKey(&m_times[0], m_times.size(), t, cursor);
+    a = unpack(k);
+    b = k+1 < m_keys.size() ? unpack(k+1) : a;
+    alpha = keyAlpha(m_times, k, t);
+}
+
+vec3f VectorTrack::sample(float t, TrackCursor &cursor) const
+{
+    vec3f a, b;
+    float alpha;
+    keys(t, cursor, a, b, alpha);
+    return lerp(a, b, alpha);
+}
+
+void Pose::resize(size_t boneCount)
+{
+    Channel *channels[] = { &rx, &ry, &rz, &rw, &tx, &ty, &tz, &sx, &sy, &sz };
+    for (size_t i = 0; i < sizeof(channels)/sizeof(channels[0]); i++)
+        channels[i]->resize(boneCount);
+}
+
+Animation::Animation(size_t boneCount)
+    : m_tracks(boneCount)
+{
+}
+
+void Animation::resize(size_t boneCount)
+{
+    m_tracks.resize(boneCount);
+}
+
+void Animation::sample(float t, AnimationCursor &cursor, Pose &pose) const
+{
+    size_t n = m_tracks.size();
+    GFXMATH_TIME(TIMER_ANIMATION_SAMPLE, n);
+    pose.resize(n);
+    if (n == 0)
+        return;
+
+    cursor.cursors.resize(n*3);
+    cursor.next.resize(n);
+    for (int c = 0; c < 3; c++)
+        cursor.alpha[c].resize(n);
+
+    Pose &next = cursor.next;
+    float *ra = &cursor.alpha[0][0];
+    float *ta = &cursor.alpha[1][0];
+    float *sa = &cursor.alpha[2][0];
+
+    // Decode the keys around t for every bone into structure of arrays
+    for (size_t i = 0; i < n; i++) {
+        const BoneTrack &track = m_tracks[i];
+        TrackCursor *tc = &cursor.cursors[i*3];
+
+        Quaternion qa, qb;
+        track.rotation.keys(t, tc[0], qa, qb, ra[i]);
+        pose.rx[i] = qa.m_v.x(); next.rx[i] = qb.m_v.x();
+        pose.ry[i] = qa.m_v.y(); next.ry[i] = qb.m_v.y();
+        pose.rz[i] = qa.m_v.z(); next.rz[i] = qb.m_v.z();
+        pose.rw[i] = qa.m_w;     next.rw[i] = qb.m_w;
+
+        vec3f va, vb;
+        track.translation.keys(t, tc[1], va, vb, ta[i]);
+        pose.tx[i] = va.x(); next.tx[i] = vb.x();
+        pose.ty[i] = va.y(); next.ty[i] = vb.y();
+        pose.tz[i] = va.z(); next.tz[i] = vb.z();
+
+        if (track.scale.size() == 0) {
+            va.assign(1.0f);
+            vb.assign(1.0f);
+            sa[i] = 0.0f;
+        } else {
+            track.scale.keys(t, tc[2], va, vb, sa[i]);
+        }
+        pose.sx[i] = va.x(); next.sx[i] = vb.x();
+        pose.sy[i] = va.y(); next.sy[i] = vb.y();
+        pose.sz[i] = va.z(); next.sz[i] = vb.z();
+    }
+
+    // Interpolate all bones at once, straight loops over the channels
+    // so the compiler can vectorize them
+    float *rx = &pose.rx[0], *ry = &pose.ry[0], *rz = &pose.rz[0], *rw = &pose.rw[0];
+    const float *nx = &next.rx[0], *ny = &next.ry[0], *nz = &next.rz[0], *nw = &next.rw[0];
+    for (size_t i = 0; i < n; i++) {
+        float d = rx[i]*nx[i] + ry[i]*ny[i] + rz[i]*nz[i] + rw[i]*nw[i];
+        float s = d < 0 ? -ra[i] : ra[i];
+        float a = 1.0f - ra[i];
+        float x = rx[i]*a + nx[i]*s;
+        float y = ry[i]*a + ny[i]*s;
+        float z = rz[i]*a + nz[i]*s;
+        float w = rw[i]*a + nw[i]*s;
+        float inv = 1.0f/sqrtf(x*x + y*y + z*z + w*w);
+        rx[i] = x*inv;
+        ry[i] = y*inv;
+        rz[i] = z*inv;
+        rw[i] = w*inv;
+    }
+
+    Pose::Channel *vcur[] = { &pose.tx, &pose.ty, &pose.tz, &pose.sx, &pose.sy, &pose.sz };
+    Pose::Channel *vnext[] = { &next.tx, &next.ty, &next.tz, &next.sx, &next.sy, &next.sz };
+    for (int c = 0; c < 6; c++) {
+        float *cur = &(*vcur[c])[0];
+        const float *nv = &(*vnext[c])[0];
+        const float *alpha = c < 3 ? ta : sa;
+        for (size_t i = 0; i < n; i++)
+            cur[i] += (nv[i]-cur[i])*alpha[i];
+    }
+}
+
+}; // namespace math
@@ -0,0 +1,135 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "vec.h"
+#include "quaternion.h"
+#include "aalloc.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace math {
+
+/// Unit quaternion packed in 48 bits ("smallest three"): the component
+/// with the largest magnitude is dropped and rebuilt from unit length,
+/// the other three are quantized to 15 bits in [-1/sqrt(2), 1/sqrt(2)].
+/// The index of the dropped component is kept in the spare top bits.
+/// Max error per component is about 2.2e-5.
+struct PackedQuaternion {
+    uint16_t m_data[3];
+
+    static PackedQuaternion pack(const Quaternion &q);
+    Quaternion unpack() const;
+};
+
+/// Vector quantized to 16 bits per component against a range
+struct PackedVec3 {
+    uint16_t m_data[3];
+};
+
+/// Last key interval used by a track. Sequential playback finds the next
+/// interval in O(1), random access falls back to a binary search.
+struct TrackCursor {
+    uint32_t key;
+
+    TrackCursor()
+        : key(0)
+    {}
+};
+
+/// Keyframe curve of unit quaternions, interpolated with nlerp
+class RotationTrack {
+public:
+    /// times must be increasing
+    void set(const float *times, const Quaternion *keys, size_t count);
+
+    Quaternion sample(float t, TrackCursor &cursor) const;
+
+    size_t size() const { return m_times.size(); }
+
+    /// Keys surrounding t and the interpolation factor between them
+    void keys(float t, TrackCursor &cursor,
+              Quaternion &a, Quaternion &b, float &alpha) const;
+
+private:
+    std::vector<float> m_times;
+    std::vector<PackedQuaternion> m_keys;
+};
+
+/// Keyframe curve of vectors (translation, scale), linearly interpolated.
+/// Keys are quantized to 16 bits against the bounding range of the track.
+class VectorTrack {
+public:
+    /// times must be increasing
+    void set(const float *times, const vec3f *keys, size_t count);
+
+    vec3f sample(float t, TrackCursor &cursor) const;
+
+    size_t size() const { return m_times.size(); }
+
+    void keys(float t, TrackCursor &cursor,
+              vec3f &a, vec3f &b, float &alpha) const;
+
+private:
+    std::vector<float> m_times;
+    std::vector<PackedVec3> m_keys;
+    vec3f m_min, m_extent;
+
+    vec3f unpack(size_t i) const;
+};
+
+/// Find the key interval containing t, returns the index of its first key
+size_t seekKey(const float *times, size_t count, float t, TrackCursor &cursor);
+
+/// Local pose of a skeleton as structure of arrays, one entry per bone,
+/// ready for SIMD blending
+struct Pose {
+    typedef std::vector<float, AlignedAllocator<float, 16> > Channel;
+
+    Channel rx, ry, rz, rw;     // rotation
+    Channel tx, ty, tz;         // translation
+    Channel sx, sy, sz;         // scale
+
+    void resize(size_t boneCount);
+
+    size_t size() const { return rw.size(); }
+};
+
+/// Animation channels of one bone. Empty channels sample to identity
+/// rotation, zero translation and unit scale.
+struct BoneTrack {
+    RotationTrack rotation;
+    VectorTrack translation;
+    VectorTrack scale;
+};
+
+/// Per-instance playback state of an Animation
+struct AnimationCursor {
+    std::vector<TrackCursor> cursors;   // rotation, translation, scale per bone
+
+    // Scratch space: second key and interpolation factor of every channel
+    Pose next;
+    Pose::Channel alpha[3];
+};
+
+class Animation {
+public:
+    explicit Animation(size_t boneCount = 0);
+
+    void resize(size_t boneCount);
+
+    size_t boneCount() const { return m_tracks.size(); }
+
+    BoneTrack& track(size_t bone) { return m_tracks[bone]; }
+    const BoneTrack& track(size_t bone) const { return m_tracks[bone]; }
+
+    /// Sample every bone at time t into pose
+    void sample(float t, AnimationCursor &cursor, Pose &pose) const;
+
+private:
+    std::vector<BoneTrack> m_tracks;
+};
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,401 @@
+#include "blob.h"
+#include "aalloc.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define GFXMATH_BIG_ENDIAN
+#endif
+
+namespace math {
+
+static const char BLOB_MAGIC[4] = { 'G', 'F', 'X', 'M' };
+static const uint8_t BLOB_ZEROS[BLOB_ALIGNMENT] = { 0 };
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const void *data, size_t size, uint32_t crc)
+{
+    static const Crc32Table table;
+
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef GFXMATH_BIG_ENDIAN
+static inline uint16_t swapBytes(uint16_t v)
+{
+    return (v >> 8) | (v << 8);
+}
+
+static inline uint32_t swapBytes(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+static inline uint64_t swapBytes(uint64_t v)
+{
+    return __builtin_bswap64(v);
+}
+
+static void toLittleEndian(BlobHeader &h)
+{
+    h.version = swapBytes(h.version);
+    h.headerSize = swapBytes(h.headerSize);
+    h.arrayCount = swapBytes(h.arrayCount);
+    h.checksum = swapBytes(h.checksum);
+    h.tableOffset = swapBytes(h.tableOffset);
+    h.fileSize = swapBytes(h.fileSize);
+}
+
+static void toLittleEndian(BlobArray &a)
+{
+    a.type = swapBytes(a.type);
+    a.elementSize = swapBytes(a.elementSize);
+    a.count = swapBytes(a.count);
+    a.offset = swapBytes(a.offset);
+    a.checksum = swapBytes(a.checksum);
+}
+#else
+static inline void toLittleEndian(BlobHeader &) {}
+static inline void toLittleEndian(BlobArray &) {}
+#endif
+
+/////
+// BlobWriter
+
+BlobWriter::BlobWriter()
+    : m_file(NULL)
+    , m_inArray(false)
+    , m_offset(0)
+    , m_error(NULL)
+{
+    memset(&m_current, 0, sizeof(m_current));
+}
+
+BlobWriter::~BlobWriter()
+{
+    if (m_file)
+        close();
+}
+
+bool BlobWriter::fail(const char *error)
+{
+    m_error = error;
+    return false;
+}
+
+bool BlobWriter::writeBytes(const void *data, size_t size)
+{
+    if (fwrite(data, 1, size, m_file) != size)
+        return fail("write failed");
+    m_offset += size;
+    return true;
+}
+
+bool BlobWriter::pad()
+{
+    size_t rem = m_offset % BLOB_ALIGNMENT;
+    return rem == 0 || writeBytes(BLOB_ZEROS, BLOB_ALIGNMENT - rem);
+}
+
+bool BlobWriter::open(const char *path)
+{
+    if (m_file)
+        return fail("already open");
+    m_file = fopen(path, "wb");
+    if (!m_file)
+        return fail("can't open file for writing");
+
+    m_arrays.clear();
+    m_inArray = false;
+    m_offset = 0;
+    m_error = NULL;
+
+    // Placeholder, the header is written by close()
+    return writeBytes(BLOB_ZEROS, BLOB_ALIGNMENT);
+}
+
+bool BlobWriter::beginArray(const char *name, uint32_t type, uint32_t elementSize)
+{
+    if (!m_file)
+        return fail("not open");
+    if (m_inArray)
+        return fail("previous array not ended");
+    if (strlen(name) >= sizeof(m_current.name))
+        return fail("array name too long");
+    if (!pad())
+        return false;
+
+    memset(&m_current, 0, sizeof(m_current));
+    strcpy(m_current.name, name);
+    m_current.type = type;
+    m_current.elementSize = elementSize;
+    m_current.offset = m_offset;
+    m_inArray = true;
+    return true;
+}
+
+bool BlobWriter::writeData(const void *data, size_t size)
+{
+    if (!m_inArray)
+        return fail("no array begun");
+
+#ifdef GFXMATH_BIG_ENDIAN
+    // All element types are made of 32-bit floats
+    const uint32_t *words = static_cast<const uint32_t*>(data);
+    uint32_t buf[256];
+    for (size_t i = 0; i < size/4; i += 256) {
+        size_t n = size/4 - i < 256 ? size/4 - i : 256;
+        for (size_t k = 0; k < n; k++)
+            buf[k] = swapBytes(words[i+k]);
+        m_current.checksum = crc32(buf, n*4, m_current.checksum);
+        if (!writeBytes(buf, n*4))
+            return false;
+    }
+#else
+    m_current.checksum = crc32(data, size, m_current.checksum);
+    if (!writeBytes(data, size))
+        return false;
+#endif
+    m_current.count += size/m_current.elementSize;
+    return true;
+}
+
+bool BlobWriter::endArray()
+{
+    if (!m_inArray)
+        return fail("no array begun");
+    m_arrays.push_back(m_current);
+    m_inArray = false;
+    return true;
+}
+
+bool BlobWriter::close()
+{
+    if (!m_file)
+        return fail("not open");
+
+    bool ok = (!m_inArray || endArray()) && pad();
+
+    BlobHeader header;
+    memcpy(header.magic, BLOB_MAGIC, sizeof(header.magic));
+    header.version = BLOB_VERSION;
+    header.headerSize = sizeof(BlobHeader);
+    header.arrayCount = m_arrays.size();
+    header.checksum = 0;
+    header.tableOffset = m_offset;
+    header.fileSize = m_offset + m_arrays.size()*sizeof(BlobArray);
+    toLittleEndian(header);
+
+    uint32_t checksum = crc32(&header, sizeof(header));
+    for (size_t i = 0; ok && i < m_arrays.size(); i++) {
+        BlobArray entry = m_arrays[i];
+        toLittleEndian(entry);
+        checksum = crc32(&entry, sizeof(entry), checksum);
+        ok = writeBytes(&entry, sizeof(entry));
+    }
+
+    header.checksum = checksum;
+#ifdef GFXMATH_BIG_ENDIAN
+    header.checksum = swapBytes(header.checksum);
+#endif
+    if (ok && (fseek(m_file, 0, SEEK_SET) != 0 ||
+               fwrite(&header, sizeof(header), 1, m_file) != 1))
+        ok = fail("write failed");
+
+    if (fclose(m_file) != 0 && ok)
+        ok = fail("write failed");
+    m_file = NULL;
+    return ok;
+}
+
+/////
+// BlobReader
+
+BlobReader::BlobReader()
+    : m_data(NULL)
+    , m_size(0)
+    , m_header(NULL)
+    , m_table(NULL)
+    , m_mapping(NULL)
+    , m_mappingSize(0)
+    , m_error(NULL)
+{}
+
+BlobReader::~BlobReader()
+{
+    close();
+}
+
+bool BlobReader::fail(const char *error) const
+{
+    m_error = error;
+    return false;
+}
+
+void BlobReader::close()
+{
+    if (m_mapping) {
+#ifdef _WIN32
+        afree(m_mapping);
+#else
+        munmap(m_mapping, m_mappingSize);
+#endif
+    }
+    m_mapping = NULL;
+    m_mappingSize = 0;
+    m_data = NULL;
+    m_size = 0;
+    m_header = NULL;
+    m_table = NULL;
+}
+
+bool BlobReader::open(const char *path)
+{
+    close();
+
+#ifdef _WIN32
+    // No mmap, read into an aligned buffer instead
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return fail("can't open file");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(f);
+        return fail("empty file");
+    }
+    m_mapping = aalloc(size, BLOB_ALIGNMENT);
+    m_mappingSize = size;
+    bool ok = fread(m_mapping, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok) {
+        close();
+        return fail("read failed");
+    }
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return fail("can't open file");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return fail("empty file");
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return fail("mmap failed");
+    m_mapping = p;
+    m_mappingSize = st.st_size;
+#endif
+
+    m_data = static_cast<const uint8_t*>(m_mapping);
+    if (!validate(m_mappingSize)) {
+        const char *error = m_error;
+        close();
+        return fail(error);
+    }
+    return true;
+}
+
+bool BlobReader::openMemory(const void *data, size_t size)
+{
+    close();
+    if ((uintptr_t)data % 16 != 0)
+        return fail("blob is not 16-byte aligned");
+
+    m_data = static_cast<const uint8_t*>(data);
+    if (!validate(size)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool BlobReader::validate(size_t size)
+{
+#ifdef GFXMATH_BIG_ENDIAN
+    return fail("big-endian hosts can't use blobs in place");
+#endif
+    if (size < sizeof(BlobHeader))
+        return fail("truncated header");
+
+    const BlobHeader *h = reinterpret_cast<const BlobHeader*>(m_data);
+    if (memcmp(h->magic, BLOB_MAGIC, sizeof(h->magic)) != 0)
+        return fail("not a blob");
+    if (h->version == 0 || h->version > BLOB_VERSION)
+        return fail("unsupported version");
+    if (h->headerSize < sizeof(BlobHeader) || h->fileSize > size)
+        return fail("truncated file");
+    if (h->tableOffset > h->fileSize ||
+        (h->fileSize - h->tableOffset)/sizeof(BlobArray) < h->arrayCount)
+        return fail("truncated table");
+    if (h->tableOffset % alignof(BlobArray) != 0)
+        return fail("misaligned table");
+
+    const BlobArray *table = reinterpret_cast<const BlobArray*>(m_data + h->tableOffset);
+    BlobHeader copy = *h;
+    copy.checksum = 0;
+    uint32_t checksum = crc32(&copy, sizeof(copy));
+    checksum = crc32(table, h->arrayCount*sizeof(BlobArray), checksum);
+    if (checksum != h->checksum)
+        return fail("header checksum mismatch");
+
+    for (size_t i = 0; i < h->arrayCount; i++) {
+        const BlobArray &a = table[i];
+        if (memchr(a.name, 0, sizeof(a.name)) == NULL)
+            return fail("bad array name");
+        if (a.elementSize == 0 || a.offset % BLOB_ALIGNMENT != 0 ||
+            a.offset > h->tableOffset ||
+            a.count > (h->tableOffset - a.offset)/a.elementSize)
+            return fail("array out of bounds");
+    }
+
+    m_size = h->fileSize;
+    m_header = h;
+    m_table = table;
+    return true;
+}
+
+const BlobArray* BlobReader::find(const char *name) const
+{
+    for (size_t i = 0; i < arrayCount(); i++)
+        if (strcmp(m_table[i].name, name) == 0)
+            return &m_table[i];
+    return NULL;
+}
+
+bool BlobReader::verify() const
+{
+    for (size_t i = 0; i < arrayCount(); i++) {
+        const BlobArray &a = m_table[i];
+        if (crc32(m_data + a.offset, a.count*a.elementSize) != a.checksum)
+            return fail("array checksum mismatch");
+    }
+    return true;
+}
+
+}; // namespace math
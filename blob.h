@@ -0,0 +1,211 @@
+#ifndef BLOB_H
+#define BLOB_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "vec.h"
+#include "matrix.h"
+#include "matrix3x4.h"
+#include "quaternion.h"
+#include "rect.h"
+
+namespace math {
+
+// Binary container for arrays of math types that can be mapped and used
+// in place. Layout, all little-endian:
+//
+//   BlobHeader          32 bytes, padded to BLOB_ALIGNMENT
+//   array data          each one starting on BLOB_ALIGNMENT
+//   BlobArray table     arrayCount entries
+//
+// The header checksum covers the header (with the checksum field zeroed)
+// and the table, each array has its own checksum checked by verify().
+
+static const uint16_t BLOB_VERSION = 1;
+static const size_t BLOB_ALIGNMENT = 64;
+
+typedef enum {
+    BLOB_FLOAT = 1,
+    BLOB_VEC2F,
+    BLOB_VEC3F,
+    BLOB_VEC4F,
+    BLOB_QUATERNION,
+    BLOB_MATRIX3F,
+    BLOB_MATRIX4F,
+    BLOB_MATRIX3X4F,
+    BLOB_RECT
+} blob_type_t;
+
+template <typename T> struct BlobType;
+template <> struct BlobType<float> { static const uint32_t value = BLOB_FLOAT; };
+template <> struct BlobType<vec2f> { static const uint32_t value = BLOB_VEC2F; };
+template <> struct BlobType<vec3f> { static const uint32_t value = BLOB_VEC3F; };
+template <> struct BlobType<vec4f> { static const uint32_t value = BLOB_VEC4F; };
+template <> struct BlobType<Quaternion> { static const uint32_t value = BLOB_QUATERNION; };
+template <> struct BlobType<Matrix3f> { static const uint32_t value = BLOB_MATRIX3F; };
+template <> struct BlobType<Matrix4f> { static const uint32_t value = BLOB_MATRIX4F; };
+template <> struct BlobType<Matrix3x4f> { static const uint32_t value = BLOB_MATRIX3X4F; };
+template <> struct BlobType<Rect> { static const uint32_t value = BLOB_RECT; };
+
+struct BlobHeader {
+    char magic[4];          // "GFXM"
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t arrayCount;
+    uint32_t checksum;
+    uint64_t tableOffset;
+    uint64_t fileSize;
+};
+
+struct BlobArray {
+    char name[32];          // zero terminated
+    uint32_t type;          // blob_type_t
+    uint32_t elementSize;
+    uint64_t count;
+    uint64_t offset;        // from the start of the blob
+    uint32_t checksum;      // of the data
+    uint32_t reserved;
+};
+
+static_assert(sizeof(BlobHeader) == 32, "BlobHeader layout");
+static_assert(sizeof(BlobArray) == 64, "BlobArray layout");
+
+/// CRC-32 (IEEE), pass the previous result to continue a running checksum
+uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+/// Streaming writer, arrays are appended as they come so the whole scene
+/// never has to be in memory:
+///
+///   BlobWriter w;
+///   w.open("scene.bin");
+///   w.beginArray<Matrix4f>("transforms");
+///   w.write(chunk, n);   // any number of times
+///   w.endArray();
+///   w.close();
+///
+/// Functions return false on failure, see error().
+class BlobWriter {
+public:
+    BlobWriter();
+    ~BlobWriter();
+
+    bool open(const char *path);
+    bool close();
+
+    template <typename T>
+    bool beginArray(const char *name)
+    {
+        return beginArray(name, BlobType<T>::value, sizeof(T));
+    }
+
+    template <typename T>
+    bool write(const T *data, size_t count)
+    {
+        if (m_current.type != BlobType<T>::value)
+            return fail("element type differs from beginArray");
+        return writeData(data, count*sizeof(T));
+    }
+
+    bool endArray();
+
+    template <typename T>
+    bool writeArray(const char *name, const T *data, size_t count)
+    {
+        return beginArray<T>(name) && write(data, count) && endArray();
+    }
+
+    const char* error() const
+    {
+        return m_error;
+    }
+
+private:
+    BlobWriter(const BlobWriter &);
+    BlobWriter& operator = (const BlobWriter &);
+
+    bool beginArray(const char *name, uint32_t type, uint32_t elementSize);
+    bool writeData(const void *data, size_t size);
+    bool writeBytes(const void *data, size_t size);
+    bool pad();
+    bool fail(const char *error);
+
+    FILE *m_file;
+    std::vector<BlobArray> m_arrays;
+    BlobArray m_current;
+    bool m_inArray;
+    uint64_t m_offset;
+    const char *m_error;
+};
+
+/// Maps a blob and hands out pointers into it, nothing is copied or
+/// parsed. Big-endian hosts can't use the data in place and fail to open.
+class BlobReader {
+public:
+    BlobReader();
+    ~BlobReader();
+
+    /// Map a file read-only
+    bool open(const char *path);
+
+    /// Use a blob already in memory (not copied, must stay alive and be
+    /// 16-byte aligned)
+    bool openMemory(const void *data, size_t size);
+
+    void close();
+
+    size_t arrayCount() const
+    {
+        return m_header ? m_header->arrayCount : 0;
+    }
+
+    const BlobArray& arrayInfo(size_t i) const
+    {
+        return m_table[i];
+    }
+
+    /// Entry by name, NULL if missing
+    const BlobArray* find(const char *name) const;
+
+    /// Array by name, NULL if missing or of another type
+    template <typename T>
+    const T* array(const char *name, size_t &count) const
+    {
+        const BlobArray *a = find(name);
+        if (!a || a->type != BlobType<T>::value || a->elementSize != sizeof(T)) {
+            count = 0;
+            return NULL;
+        }
+        count = a->count;
+        return reinterpret_cast<const T*>(m_data + a->offset);
+    }
+
+    /// Check the data checksums, this touches every byte
+    bool verify() const;
+
+    const char* error() const
+    {
+        return m_error;
+    }
+
+private:
+    BlobReader(const BlobReader &);
+    BlobReader& operator = (const BlobReader &);
+
+    bool validate(size_t size);
+    bool fail(const char *error) const;
+
+    const uint8_t *m_data;
+    size_t m_size;
+    const BlobHeader *m_header;
+    const BlobArray *m_table;
+    void *m_mapping;
+    size_t m_mappingSize;
+    mutable const char *m_error;
+};
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,497 @@
+#include "bounds.h"
+#include "parallel.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace math {
+
+static_assert(sizeof(Sphere) == 4*sizeof(float), "Sphere must be packed like vec4f");
+
+void Sphere::add(const vec3f &p)
+{
+    if (empty()) {
+        center = p;
+        radius = 0.0f;
+        return;
+    }
+    vec3f d = p - center;
+    float dist2 = d.lengthSquared();
+    if (dist2 <= radius*radius)
+        return;
+    // Move the far side of the sphere to p, keeping the near side
+    float dist = sqrtf(dist2);
+    float r = (radius + dist)*0.5f;
+    center += d*((r - radius)/dist);
+    radius = r;
+}
+
+void Sphere::add(const Sphere &s)
+{
+    if (s.empty())
+        return;
+    if (empty()) {
+        *this = s;
+        return;
+    }
+    vec3f d = s.center - center;
+    float dist = d.length();
+    if (dist + s.radius <= radius)
+        return;
+    if (dist + radius <= s.radius) {
+        *this = s;
+        return;
+    }
+    float r = (dist + radius + s.radius)*0.5f;
+    center += d*((r - radius)/dist);
+    radius = r;
+}
+
+/////
+
+// Reduce f(begin, end) over the parts with merge, in part order
+template <typename T, typename F>
+static T reduceParts(size_t count, size_t threads, F f, void (*merge)(T &a, const T &b))
+{
+    size_t n = partCount(count, threads, BOUNDS_PARALLEL_MIN);
+    if (n == 1)
+        return f(size_t(0), count);
+    std::vector<T> parts(n);
+    forEachPart(count, n, [&](size_t begin, size_t end, size_t k) {
+        parts[k] = f(begin, end);
+    });
+    for (size_t k = 1; k < n; k++)
+        merge(parts[0], parts[k]);
+    return parts[0];
+}
+
+static AABB boxOf(const vec3f *points, size_t count)
+{
+    AABB box;
+    size_t i = 0;
+#ifdef __SSE__
+    // Four points are three registers of interleaved xyz, reduced per
+    // register and unscrambled at the end
+    if (count >= 4) {
+        const float *p = points[0].data();
+        __m128 lo0 = _mm_loadu_ps(p), lo1 = _mm_loadu_ps(p+4), lo2 = _mm_loadu_ps(p+8);
+        __m128 hi0 = lo0, hi1 = lo1, hi2 = lo2;
+        for (i = 4; i+4 <= count; i += 4) {
+            __m128 a = _mm_loadu_ps(p + i*3);       // x0 y0 z0 x1
+            __m128 b = _mm_loadu_ps(p + i*3 + 4);   // y1 z1 x2 y2
+            __m128 c = _mm_loadu_ps(p + i*3 + 8);   // z2 x3 y3 z3
+            lo0 = _mm_min_ps(lo0, a);
+            lo1 = _mm_min_ps(lo1, b);
+            lo2 = _mm_min_ps(lo2, c);
+            hi0 = _mm_max_ps(hi0, a);
+            hi1 = _mm_max_ps(hi1, b);
+            hi2 = _mm_max_ps(hi2, c);
+        }
+        float l[12], h[12];
+        _mm_storeu_ps(l, lo0); _mm_storeu_ps(l+4, lo1); _mm_storeu_ps(l+8, lo2);
+        _mm_storeu_ps(h, hi0); _mm_storeu_ps(h+4, hi1); _mm_storeu_ps(h+8, hi2);
+        for (int k = 0; k < 12; k += 3) {
+            box.add(vec3f(l[k], l[k+1], l[k+2]));
+            box.add(vec3f(h[k], h[k+1], h[k+2]));
+        }
+    }
+#endif
+    for (; i < count; i++)
+        box.add(points[i]);
+    return box;
+}
+
+static void mergeBoxes(AABB &a, const AABB &b)
+{
+    a.add(b);
+}
+
+AABB boundingBox(const vec3f *points, size_t count, size_t threads)
+{
+    return reduceParts<AABB>(count, threads, [&](size_t begin, size_t end) {
+        return boxOf(points + begin, end - begin);
+    }, mergeBoxes);
+}
+
+/////
+
+namespace {
+
+// Directions of EPOS-26: the axes, the box corners and the box edges.
+// With components of 0 and 1 the projections are sums and differences,
+// computed the same way by the scalar and SSE paths.
+const int EPOS_DIRS = 13;
+
+inline void project(float x, float y, float z, float s[EPOS_DIRS])
+{
+    float xy = x + y, xmy = x - y;
+    s[0] = x;
+    s[1] = y;
+    s[2] = z;
+    s[3] = xy + z;
+    s[4] = xy - z;
+    s[5] = xmy + z;
+    s[6] = xmy - z;
+    s[7] = xy;
+    s[8] = xmy;
+    s[9] = x + z;
+    s[10] = x - z;
+    s[11] = y + z;
+    s[12] = y - z;
+}
+
+#ifdef __SSE2__
+inline void project(__m128 x, __m128 y, __m128 z, __m128 s[EPOS_DIRS])
+{
+    __m128 xy = _mm_add_ps(x, y), xmy = _mm_sub_ps(x, y);
+    s[0] = x;
+    s[1] = y;
+    s[2] = z;
+    s[3] = _mm_add_ps(xy, z);
+    s[4] = _mm_sub_ps(xy, z);
+    s[5] = _mm_add_ps(xmy, z);
+    s[6] = _mm_sub_ps(xmy, z);
+    s[7] = xy;
+    s[8] = xmy;
+    s[9] = _mm_add_ps(x, z);
+    s[10] = _mm_sub_ps(x, z);
+    s[11] = _mm_add_ps(y, z);
+    s[12] = _mm_sub_ps(y, z);
+}
+
+inline __m128i select(__m128 mask, __m128i a, __m128i b)
+{
+    __m128i m = _mm_castps_si128(mask);
+    return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+#endif
+
+struct Extremes {
+    float lo[EPOS_DIRS], hi[EPOS_DIRS];
+    size_t ilo[EPOS_DIRS], ihi[EPOS_DIRS];
+
+    // Earlier points win ties, in every path
+    void add(size_t i, const float s[EPOS_DIRS])
+    {
+        for (int d = 0; d < EPOS_DIRS; d++) {
+            if (s[d] < lo[d] || (s[d] == lo[d] && i < ilo[d])) {
+                lo[d] = s[d];
+                ilo[d] = i;
+            }
+            if (s[d] > hi[d] || (s[d] == hi[d] && i < ihi[d])) {
+                hi[d] = s[d];
+                ihi[d] = i;
+            }
+        }
+    }
+
+    void find(const vec3f *points, size_t begin, size_t end)
+    {
+        for (int d = 0; d < EPOS_DIRS; d++) {
+            lo[d] = INFINITY;
+            hi[d] = -INFINITY;
+            ilo[d] = ihi[d] = begin;
+        }
+        size_t i = begin;
+#ifdef __SSE2__
+        // Points deinterleaved in blocks, then the extremes and their
+        // indices tracked per lane and reduced at the end
+        const size_t BLOCK = 256;
+        if (end - begin >= 4 && end - begin < 0x7FFFFFFF) {
+            __m128 vlo[EPOS_DIRS], vhi[EPOS_DIRS];
+            __m128i vilo[EPOS_DIRS], vihi[EPOS_DIRS];
+            for (int d = 0; d < EPOS_DIRS; d++) {
+                vlo[d] = _mm_set1_ps(INFINITY);
+                vhi[d] = _mm_set1_ps(-INFINITY);
+                vilo[d] = vihi[d] = _mm_setzero_si128();
+            }
+            __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+            alignas(16) float x[BLOCK], y[BLOCK], z[BLOCK];
+            float *lanes[3] = { x, y, z };
+            while (i+4 <= end) {
+                size_t n = std::min(BLOCK, (end - i) & ~size_t(3));
+                deinterleave(points[i].data(), 3, lanes, n);
+                for (size_t k = 0; k < n; k += 4) {
+                    __m128 s[EPOS_DIRS];
+                    project(_mm_load_ps(x+k), _mm_load_ps(y+k), _mm_load_ps(z+k), s);
+                    for (int d = 0; d < EPOS_DIRS; d++) {
+                        vilo[d] = select(_mm_cmplt_ps(s[d], vlo[d]), idx, vilo[d]);
+                        vlo[d] = _mm_min_ps(s[d], vlo[d]);
+                        vihi[d] = select(_mm_cmpgt_ps(s[d], vhi[d]), idx, vihi[d]);
+                        vhi[d] = _mm_max_ps(s[d], vhi[d]);
+                    }
+                    idx = _mm_add_epi32(idx, _mm_set1_epi32(4));
+                }
+                i += n;
+            }
+            for (int d = 0; d < EPOS_DIRS; d++) {
+                alignas(16) float l[4], h[4];
+                alignas(16) int32_t il[4], ih[4];
+                _mm_store_ps(l, vlo[d]);
+                _mm_store_ps(h, vhi[d]);
+                _mm_store_si128((__m128i*)il, vilo[d]);
+                _mm_store_si128((__m128i*)ih, vihi[d]);
+                for (int k = 0; k < 4; k++) {
+                    size_t a = begin + il[k], b = begin + ih[k];
+                    if (l[k] < lo[d] || (l[k] == lo[d] && a < ilo[d])) {
+                        lo[d] = l[k];
+                        ilo[d] = a;
+                    }
+                    if (h[k] > hi[d] || (h[k] == hi[d] && b < ihi[d])) {
+                        hi[d] = h[k];
+                        ihi[d] = b;
+                    }
+                }
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            float s[EPOS_DIRS];
+            project(points[i][0], points[i][1], points[i][2], s);
+            add(i, s);
+        }
+    }
+
+    void merge(const Extremes &e)
+    {
+        for (int d = 0; d < EPOS_DIRS; d++) {
+            if (e.lo[d] < lo[d] || (e.lo[d] == lo[d] && e.ilo[d] < ilo[d])) {
+                lo[d] = e.lo[d];
+                ilo[d] = e.ilo[d];
+            }
+            if (e.hi[d] > hi[d] || (e.hi[d] == hi[d] && e.ihi[d] < ihi[d])) {
+                hi[d] = e.hi[d];
+                ihi[d] = e.ihi[d];
+            }
+        }
+    }
+};
+
+struct Farthest {
+    float dist2;
+    size_t index;
+};
+
+Farthest farthestFrom(const vec3f &c, const vec3f *points, size_t begin, size_t end)
+{
+    Farthest f = { -1.0f, begin };
+    for (size_t i = begin; i < end; i++) {
+        float d = (points[i] - c).lengthSquared();
+        if (d > f.dist2) {
+            f.dist2 = d;
+            f.index = i;
+        }
+    }
+    return f;
+}
+
+}; // namespace
+
+static void mergeFarthest(Farthest &a, const Farthest &b)
+{
+    if (b.dist2 > a.dist2)
+        a = b;
+}
+
+static void mergeExtremes(Extremes &a, const Extremes &b)
+{
+    a.merge(b);
+}
+
+static void mergeSpheres(Sphere &a, const Sphere &b)
+{
+    a.add(b);
+}
+
+Sphere boundingSphere(const vec3f *points, size_t count,
+                      sphere_fit_t fit, size_t threads)
+{
+    if (count == 0)
+        return Sphere();
+
+    Sphere s;
+    if (fit == SPHERE_RITTER) {
+        // Diameter between the point farthest from an arbitrary one and
+        // the point farthest from that
+        size_t a = reduceParts<Farthest>(count, threads, [&](size_t begin, size_t end) {
+            return farthestFrom(points[0], points, begin, end);
+        }, mergeFarthest).index;
+        size_t b = reduceParts<Farthest>(count, threads, [&](size_t begin, size_t end) {
+            return farthestFrom(points[a], points, begin, end);
+        }, mergeFarthest).index;
+        s = Sphere((points[a] + points[b])*0.5f, distance(points[a], points[b])*0.5f);
+    } else {
+        // Diameter between the farthest apart pair of extremal points,
+        // grown over the other extremal points
+        Extremes e = reduceParts<Extremes>(count, threads, [&](size_t begin, size_t end) {
+            Extremes part;
+            part.find(points, begin, end);
+            return part;
+        }, mergeExtremes);
+        int best = 0;
+        float bestDist2 = -1.0f;
+        for (int d = 0; d < EPOS_DIRS; d++) {
+            float d2 = (points[e.ihi[d]] - points[e.ilo[d]]).lengthSquared();
+            if (d2 > bestDist2) {
+                bestDist2 = d2;
+                best = d;
+            }
+        }
+        const vec3f &a = points[e.ilo[best]], &b = points[e.ihi[best]];
+        s = Sphere((a + b)*0.5f, sqrtf(bestDist2)*0.5f);
+        for (int d = 0; d < EPOS_DIRS; d++) {
+            s.add(points[e.ilo[d]]);
+            s.add(points[e.ihi[d]]);
+        }
+    }
+
+    // Grow over all points, each part from the initial sphere
+    return reduceParts<Sphere>(count, threads, [&](size_t begin, size_t end) {
+        Sphere part = s;
+        for (size_t i = begin; i < end; i++)
+            part.add(points[i]);
+        return part;
+    }, mergeSpheres);
+}
+
+/////
+
+static void transformSphere(const Matrix4f &m, const Sphere &s,
+                            float &x, float &y, float &z, float &r)
+{
+    const vec3f &c = s.center;
+    x = m[0][0]*c[0] + m[1][0]*c[1] + m[2][0]*c[2] + m[3][0];
+    y = m[0][1]*c[0] + m[1][1]*c[1] + m[2][1]*c[2] + m[3][1];
+    z = m[0][2]*c[0] + m[1][2]*c[1] + m[2][2]*c[2] + m[3][2];
+    // Largest eigenvalue of A^T A for the upper 3x3 A by Gershgorin, the
+    // squared axis lengths plus the absolute dot products with the others
+    float s0 = m[0][0]*m[0][0] + m[0][1]*m[0][1] + m[0][2]*m[0][2];
+    float s1 = m[1][0]*m[1][0] + m[1][1]*m[1][1] + m[1][2]*m[1][2];
+    float s2 = m[2][0]*m[2][0] + m[2][1]*m[2][1] + m[2][2]*m[2][2];
+    float d01 = fabsf(m[0][0]*m[1][0] + m[0][1]*m[1][1] + m[0][2]*m[1][2]);
+    float d02 = fabsf(m[0][0]*m[2][0] + m[0][1]*m[2][1] + m[0][2]*m[2][2]);
+    float d12 = fabsf(m[1][0]*m[2][0] + m[1][1]*m[2][1] + m[1][2]*m[2][2]);
+    r = s.radius*sqrtf(std::max(s0 + d01 + d02, std::max(s1 + d01 + d12, s2 + d02 + d12)));
+}
+
+#ifdef __SSE__
+// Column j of four matrices as lanes, c[k] holds row k
+static inline void loadColumns(const Matrix4f *m, int j, __m128 c[4])
+{
+    c[0] = _mm_load_ps(m[0][j]);
+    c[1] = _mm_load_ps(m[1][j]);
+    c[2] = _mm_load_ps(m[2][j]);
+    c[3] = _mm_load_ps(m[3][j]);
+    _MM_TRANSPOSE4_PS(c[0], c[1], c[2], c[3]);
+}
+
+static inline __m128 madd(__m128 a, __m128 b, __m128 c)
+{
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+#endif
+
+void transformSpheres(const Matrix4f *world, const Sphere *local,
+                      size_t count, SoA<vec4f> &out)
+{
+    out.resize(count);
+    float *ox = out.x(), *oy = out.y(), *oz = out.z(), *orad = out.w();
+    size_t i = 0;
+#ifdef __SSE__
+    // Four objects at a time with matrix elements and spheres transposed
+    // into lanes, so the lane stores go straight to the SoA output
+    for (; i+4 <= count; i += 4) {
+        __m128 c0[4], c1[4], c2[4], c3[4];
+        loadColumns(world+i, 0, c0);
+        loadColumns(world+i, 1, c1);
+        loadColumns(world+i, 2, c2);
+        loadColumns(world+i, 3, c3);
+
+        const float *s = reinterpret_cast<const float*>(local + i);
+        __m128 sx = _mm_loadu_ps(s);
+        __m128 sy = _mm_loadu_ps(s+4);
+        __m128 sz = _mm_loadu_ps(s+8);
+        __m128 sr = _mm_loadu_ps(s+12);
+        _MM_TRANSPOSE4_PS(sx, sy, sz, sr);
+
+        for (int k = 0; k < 3; k++) {
+            __m128 v = madd(c0[k], sx, madd(c1[k], sy, madd(c2[k], sz, c3[k])));
+            _mm_store_ps((k == 0 ? ox : k == 1 ? oy : oz) + i, v);
+        }
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        __m128 n0 = madd(c0[0], c0[0], madd(c0[1], c0[1], _mm_mul_ps(c0[2], c0[2])));
+        __m128 n1 = madd(c1[0], c1[0], madd(c1[1], c1[1], _mm_mul_ps(c1[2], c1[2])));
+        __m128 n2 = madd(c2[0], c2[0], madd(c2[1], c2[1], _mm_mul_ps(c2[2], c2[2])));
+        __m128 d01 = madd(c0[0], c1[0], madd(c0[1], c1[1], _mm_mul_ps(c0[2], c1[2])));
+        __m128 d02 = madd(c0[0], c2[0], madd(c0[1], c2[1], _mm_mul_ps(c0[2], c2[2])));
+        __m128 d12 = madd(c1[0], c2[0], madd(c1[1], c2[1], _mm_mul_ps(c1[2], c2[2])));
+        d01 = _mm_andnot_ps(signMask, d01);
+        d02 = _mm_andnot_ps(signMask, d02);
+        d12 = _mm_andnot_ps(signMask, d12);
+        n0 = _mm_add_ps(n0, _mm_add_ps(d01, d02));
+        n1 = _mm_add_ps(n1, _mm_add_ps(d01, d12));
+        n2 = _mm_add_ps(n2, _mm_add_ps(d02, d12));
+        __m128 scale = _mm_sqrt_ps(_mm_max_ps(n0, _mm_max_ps(n1, n2)));
+        _mm_store_ps(orad+i, _mm_mul_ps(sr, scale));
+    }
+#endif
+    for (; i < count; i++)
+        transformSphere(world[i], local[i], ox[i], oy[i], oz[i], orad[i]);
+}
+
+void transformBoxes(const Matrix4f *world, const AABB *local, size_t count,
+                    SoA<vec3f> &centers, SoA<vec3f> &extents)
+{
+    centers.resize(count);
+    extents.resize(count);
+    float *cx = centers.x(), *cy = centers.y(), *cz = centers.z();
+    float *ex = extents.x(), *ey = extents.y(), *ez = extents.z();
+    size_t i = 0;
+#ifdef __SSE__
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (; i+4 <= count; i += 4) {
+        __m128 c0[4], c1[4], c2[4], c3[4];
+        loadColumns(world+i, 0, c0);
+        loadColumns(world+i, 1, c1);
+        loadColumns(world+i, 2, c2);
+        loadColumns(world+i, 3, c3);
+
+        const AABB *b = local+i;
+        __m128 lo[3], hi[3];
+        for (int k = 0; k < 3; k++) {
+            lo[k] = _mm_setr_ps(b[0].min[k], b[1].min[k], b[2].min[k], b[3].min[k]);
+            hi[k] = _mm_setr_ps(b[0].max[k], b[1].max[k], b[2].max[k], b[3].max[k]);
+        }
+        const __m128 half = _mm_set1_ps(0.5f);
+        __m128 lc[3], le[3];
+        for (int k = 0; k < 3; k++) {
+            lc[k] = _mm_mul_ps(_mm_add_ps(lo[k], hi[k]), half);
+            le[k] = _mm_mul_ps(_mm_sub_ps(hi[k], lo[k]), half);
+        }
+
+        float *oc[3] = { cx+i, cy+i, cz+i }, *oe[3] = { ex+i, ey+i, ez+i };
+        for (int k = 0; k < 3; k++) {
+            _mm_store_ps(oc[k], madd(c0[k], lc[0], madd(c1[k], lc[1], madd(c2[k], lc[2], c3[k]))));
+            __m128 e = _mm_mul_ps(_mm_andnot_ps(signMask, c0[k]), le[0]);
+            e = madd(_mm_andnot_ps(signMask, c1[k]), le[1], e);
+            e = madd(_mm_andnot_ps(signMask, c2[k]), le[2], e);
+            _mm_store_ps(oe[k], e);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        const Matrix4f &m = world[i];
+        vec3f c = local[i].center(), e = local[i].extents();
+        float *oc[3] = { cx+i, cy+i, cz+i }, *oe[3] = { ex+i, ey+i, ez+i };
+        for (int k = 0; k < 3; k++) {
+            *oc[k] = m[0][k]*c[0] + m[1][k]*c[1] + m[2][k]*c[2] + m[3][k];
+            *oe[k] = fabsf(m[0][k])*e[0] + fabsf(m[1][k])*e[1] + fabsf(m[2][k])*e[2];
+        }
+    }
+}
+
+}; // namespace math
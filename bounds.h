@@ -0,0 +1,123 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include "matrix.h"
+#include "soa.h"
+
+namespace math {
+
+/// Axis aligned box, empty when min > max
+struct AABB {
+    vec3f min, max;
+
+    AABB()
+        : min(INFINITY)
+        , max(-INFINITY)
+    {}
+
+    AABB(const vec3f &min, const vec3f &max)
+        : min(min)
+        , max(max)
+    {}
+
+    bool empty() const
+    {
+        return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+    }
+
+    vec3f center() const
+    {
+        return (min + max)*0.5f;
+    }
+
+    /// Half the size along each axis
+    vec3f extents() const
+    {
+        return (max - min)*0.5f;
+    }
+
+    void add(const vec3f &p)
+    {
+        min = math::min(min, p);
+        max = math::max(max, p);
+    }
+
+    void add(const AABB &b)
+    {
+        min = math::min(min, b.min);
+        max = math::max(max, b.max);
+    }
+
+    bool contains(const vec3f &p) const
+    {
+        return p[0] >= min[0] && p[1] >= min[1] && p[2] >= min[2] &&
+               p[0] <= max[0] && p[1] <= max[1] && p[2] <= max[2];
+    }
+};
+
+/// Packed like a vec4f (x, y, z, radius)
+struct Sphere {
+    vec3f center;
+    float radius;
+
+    Sphere()
+        : center(0.0f)
+        , radius(-1.0f)
+    {}
+
+    Sphere(const vec3f &center, float radius)
+        : center(center)
+        , radius(radius)
+    {}
+
+    bool empty() const
+    {
+        return radius < 0.0f;
+    }
+
+    bool contains(const vec3f &p) const
+    {
+        return (p - center).lengthSquared() <= radius*radius;
+    }
+
+    /// Grow just enough to contain p
+    void add(const vec3f &p);
+
+    /// Grow just enough to contain s
+    void add(const Sphere &s);
+};
+
+typedef enum {
+    SPHERE_RITTER,      // farthest point pairs, three passes
+    SPHERE_EPOS         // extremal points along 13 directions, two passes
+                        // and usually a tighter sphere
+} sphere_fit_t;
+
+/// Inputs at least this large are split over the threads asked for
+static const size_t BOUNDS_PARALLEL_MIN = 1 << 16;
+
+/// Bounding box of count points. threads > 1 splits large inputs over
+/// that many threads, 0 uses one per hardware thread.
+AABB boundingBox(const vec3f *points, size_t count, size_t threads = 1);
+
+/// Bounding sphere of count points, not minimal. threads as above,
+/// the result depends on the number of threads used but not on timing.
+Sphere boundingSphere(const vec3f *points, size_t count,
+                      sphere_fit_t fit = SPHERE_EPOS, size_t threads = 1);
+
+/// World bounding spheres from local ones, out[i] = world[i] * local[i]
+/// as (x, y, z, radius) lanes ready for Frustum::containsSpheres(). The
+/// radius is scaled by a bound on how far the matrix stretches, exact
+/// when its axes are orthogonal (rotation and scale) and conservative
+/// under shear.
+void transformSpheres(const Matrix4f *world, const Sphere *local,
+                      size_t count, SoA<vec4f> &out);
+
+/// World boxes from local ones as centers and extents (half sizes),
+/// the tight box around each transformed local box (Arvo)
+void transformBoxes(const Matrix4f *world, const AABB *local, size_t count,
+                    SoA<vec3f> &centers, SoA<vec3f> &extents);
+
+}; // namespace math
+
+#endif
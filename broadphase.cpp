@@ -0,0 +1,247 @@
+#include <algorithm>
+
+#include "broadphase.h"
+#include "parallel.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+// Boxes per thread below which the sweep isn't split
+static const size_t SWEEP_PARALLEL_MIN = 1 << 12;
+
+// Padding after the sorted bounds, so the four-wide sweep can read past
+// the last box. Lanes at or past n are masked out of the hits.
+static const size_t SWEEP_PAD = 4;
+
+const uint32_t SweepAndPrune::INVALID;
+
+SweepAndPrune::SweepAndPrune()
+{
+    clear();
+}
+
+void SweepAndPrune::clear()
+{
+    m_boxes.clear();
+    m_alive.clear();
+    m_listed.clear();
+    m_free.clear();
+    m_size = 0;
+    m_order.clear();
+    m_keys.clear();
+    m_axis = 0;
+    m_sorted.resize(0);
+}
+
+uint32_t SweepAndPrune::insert(const AABB &box)
+{
+    uint32_t h;
+    if (!m_free.empty()) {
+        h = m_free.back();
+        m_free.pop_back();
+    } else {
+        h = m_boxes.size();
+        m_boxes.push_back(box);
+        m_alive.push_back(0);
+        m_listed.push_back(0);
+    }
+    m_boxes[h] = box;
+    m_alive[h] = 1;
+    // A handle removed and reused before the next sort keeps its place
+    if (!m_listed[h]) {
+        m_listed[h] = 1;
+        m_order.push_back(h);
+        m_keys.push_back(box.min[m_axis]);
+    }
+    m_size++;
+    return h;
+}
+
+void SweepAndPrune::update(uint32_t handle, const AABB &box)
+{
+    assert(m_alive[handle]);
+    m_boxes[handle] = box;
+}
+
+void SweepAndPrune::update(const uint32_t *handles, const AABB *boxes, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        update(handles[i], boxes[i]);
+}
+
+void SweepAndPrune::update(const uint32_t *handles, const SoA<vec3f> &centers,
+                           const SoA<vec3f> &extents)
+{
+    assert(centers.size() == extents.size());
+    const float *cx = centers.x(), *cy = centers.y(), *cz = centers.z();
+    const float *ex = extents.x(), *ey = extents.y(), *ez = extents.z();
+    for (size_t i = 0; i < centers.size(); i++) {
+        AABB &b = m_boxes[handles[i]];
+        b.min = vec3f(cx[i] - ex[i], cy[i] - ey[i], cz[i] - ez[i]);
+        b.max = vec3f(cx[i] + ex[i], cy[i] + ey[i], cz[i] + ez[i]);
+    }
+}
+
+void SweepAndPrune::remove(uint32_t handle)
+{
+    assert(m_alive[handle]);
+    m_alive[handle] = 0;
+    m_free.push_back(handle);
+    m_size--;
+}
+
+void SweepAndPrune::sort()
+{
+    // Drop removed handles and pick the axis with the widest spread
+    size_t n = 0;
+    vec3f sum(0.0f), sum2(0.0f);
+    for (size_t k = 0; k < m_order.size(); k++) {
+        uint32_t h = m_order[k];
+        if (!m_alive[h]) {
+            m_listed[h] = 0;
+            continue;
+        }
+        m_order[n++] = h;
+        vec3f c = m_boxes[h].center();
+        sum += c;
+        sum2 += c*c;
+    }
+    m_order.resize(n);
+    m_keys.resize(n);
+
+    vec3f var = sum2 - sum*sum/float(std::max<size_t>(n, 1));
+    int axis = m_axis;
+    for (int a = 0; a < 3; a++) {
+        // Some hysteresis, switching axis costs a full sort
+        if (var[a] > var[axis]*1.25f)
+            axis = a;
+    }
+
+    size_t descents = 0;
+    for (size_t k = 0; k < n; k++) {
+        m_keys[k] = m_boxes[m_order[k]].min[axis];
+        descents += k > 0 && m_keys[k] < m_keys[k-1];
+    }
+
+    if (axis != m_axis || descents > n/8 + 16) {
+        m_axis = axis;
+        std::vector<std::pair<float, uint32_t> > sorted(n);
+        for (size_t k = 0; k < n; k++)
+            sorted[k] = std::make_pair(m_keys[k], m_order[k]);
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t k = 0; k < n; k++) {
+            m_keys[k] = sorted[k].first;
+            m_order[k] = sorted[k].second;
+        }
+    } else {
+        // Frame to frame, boxes only move a few places
+        for (size_t k = 1; k < n; k++) {
+            float key = m_keys[k];
+            uint32_t h = m_order[k];
+            size_t j = k;
+            for (; j > 0 && m_keys[j-1] > key; j--) {
+                m_keys[j] = m_keys[j-1];
+                m_order[j] = m_order[j-1];
+            }
+            m_keys[j] = key;
+            m_order[j] = h;
+        }
+    }
+
+    int b = (m_axis + 1) % 3, c = (m_axis + 2) % 3;
+    m_sorted.resize(n + SWEEP_PAD);
+    float *lanes[6];
+    for (int k = 0; k < 6; k++)
+        lanes[k] = m_sorted.lane(k);
+    for (size_t k = 0; k < n; k++) {
+        const AABB &box = m_boxes[m_order[k]];
+        lanes[0][k] = m_keys[k];
+        lanes[1][k] = box.max[m_axis];
+        lanes[2][k] = box.min[b];
+        lanes[3][k] = box.max[b];
+        lanes[4][k] = box.min[c];
+        lanes[5][k] = box.max[c];
+    }
+    for (size_t k = n; k < n + SWEEP_PAD; k++)
+        lanes[0][k] = INFINITY;
+}
+
+static inline BoxPair makePair(uint32_t a, uint32_t b)
+{
+    BoxPair p = { std::min(a, b), std::max(a, b) };
+    return p;
+}
+
+void SweepAndPrune::sweep(size_t begin, size_t end, std::vector<BoxPair> &pairs) const
+{
+    const float *minA = m_sorted.lane(0), *maxA = m_sorted.lane(1);
+    const float *minB = m_sorted.lane(2), *maxB = m_sorted.lane(3);
+    const float *minC = m_sorted.lane(4), *maxC = m_sorted.lane(5);
+    const uint32_t *order = m_order.data();
+    size_t n = m_order.size();
+
+    for (size_t i = begin; i < end; i++) {
+        size_t j = i+1;
+#ifdef __SSE__
+        __m128 hiA = _mm_set1_ps(maxA[i]);
+        __m128 loB = _mm_set1_ps(minB[i]), hiB = _mm_set1_ps(maxB[i]);
+        __m128 loC = _mm_set1_ps(minC[i]), hiC = _mm_set1_ps(maxC[i]);
+        for (; j < n; j += 4) {
+            // Lower bounds are sorted, so the run ends at the first one
+            // past the upper bound of box i or at the end of the list,
+            // an unbounded box runs into the padding
+            __m128 run = _mm_cmple_ps(_mm_loadu_ps(minA+j), hiA);
+            __m128 hit = _mm_and_ps(run, _mm_cmple_ps(_mm_loadu_ps(minB+j), hiB));
+            hit = _mm_and_ps(hit, _mm_cmpge_ps(_mm_loadu_ps(maxB+j), loB));
+            hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_loadu_ps(minC+j), hiC));
+            hit = _mm_and_ps(hit, _mm_cmpge_ps(_mm_loadu_ps(maxC+j), loC));
+            int mask = _mm_movemask_ps(hit);
+            if (n - j < 4)
+                mask &= (1 << (n - j)) - 1;
+            for (int k = 0; mask; k++, mask >>= 1) {
+                if (mask & 1)
+                    pairs.push_back(makePair(order[i], order[j+k]));
+            }
+            if (_mm_movemask_ps(run) != 0xF)
+                break;
+        }
+#else
+        for (; j < n && minA[j] <= maxA[i]; j++) {
+            if (minB[j] <= maxB[i] && maxB[j] >= minB[i] &&
+                minC[j] <= maxC[i] && maxC[j] >= minC[i])
+                pairs.push_back(makePair(order[i], order[j]));
+        }
+#endif
+    }
+}
+
+void SweepAndPrune::findPairs(std::vector<BoxPair> &pairs, size_t threads)
+{
+    sort();
+    pairs.clear();
+    size_t n = m_order.size();
+    size_t parts = partCount(n, threads, SWEEP_PARALLEL_MIN);
+    if (parts == 1) {
+        sweep(0, n, pairs);
+        return;
+    }
+
+    // Each part into its own buffer, kept for the next call
+    if (m_partPairs.size() < parts)
+        m_partPairs.resize(parts);
+    forEachPart(n, parts, [&](size_t begin, size_t end, size_t k) {
+        m_partPairs[k].clear();
+        sweep(begin, end, m_partPairs[k]);
+    });
+    size_t total = 0;
+    for (size_t k = 0; k < parts; k++)
+        total += m_partPairs[k].size();
+    pairs.reserve(total);
+    for (size_t k = 0; k < parts; k++)
+        pairs.insert(pairs.end(), m_partPairs[k].begin(), m_partPairs[k].end());
+}
+
+}; // namespace math
@@ -0,0 +1,93 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "bounds.h"
+
+namespace math {
+
+/// Handles of two overlapping boxes, a < b
+struct BoxPair {
+    uint32_t a, b;
+};
+
+/// Sweep and prune broad phase over moving boxes. Boxes are kept sorted
+/// by their lower bound along the axis with the widest spread of centers,
+/// and re-sorted with insertion sort each findPairs(), which is close to
+/// linear when boxes move little between frames. The sweep runs over the
+/// sorted bounds as structure of arrays, testing the other two axes of
+/// four candidates at a time.
+///
+/// Boxes are referred to by handles from insert(), valid until removed.
+class SweepAndPrune {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFF;
+
+    SweepAndPrune();
+
+    void clear();
+
+    uint32_t insert(const AABB &box);
+
+    void update(uint32_t handle, const AABB &box);
+
+    /// Set boxes[i] for handles[i]
+    void update(const uint32_t *handles, const AABB *boxes, size_t count);
+
+    /// Set boxes from centers and extents, as written by transformBoxes()
+    void update(const uint32_t *handles, const SoA<vec3f> &centers,
+                const SoA<vec3f> &extents);
+
+    void remove(uint32_t handle);
+
+    const AABB& box(uint32_t handle) const
+    {
+        return m_boxes[handle];
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    /// Sweep axis picked by the last findPairs()
+    int axis() const
+    {
+        return m_axis;
+    }
+
+    /// All overlapping pairs (touching counts), replacing the contents
+    /// of pairs, whose capacity is reused. Sorted by the sweep order of
+    /// the first box. threads > 1 splits the sweep over that many
+    /// threads for large sets, e.g. the first build, 0 uses one per
+    /// hardware thread. The pairs don't depend on the thread count.
+    void findPairs(std::vector<BoxPair> &pairs, size_t threads = 1);
+
+private:
+    void sort();
+    void sweep(size_t begin, size_t end, std::vector<BoxPair> &pairs) const;
+
+    std::vector<AABB> m_boxes;          // by handle
+    std::vector<uint8_t> m_alive;
+    std::vector<uint8_t> m_listed;      // in m_order
+    std::vector<uint32_t> m_free;
+    size_t m_size;
+
+    // Handles by lower bound along m_axis, with the keys they were last
+    // sorted by. Removed handles are dropped on the next sort.
+    std::vector<uint32_t> m_order;
+    std::vector<float> m_keys;
+    int m_axis;
+
+    // Bounds in sweep order: min and max along the sweep axis, then the
+    // two other axes
+    SoAStorage<6> m_sorted;
+
+    std::vector<std::vector<BoxPair> > m_partPairs;
+};
+
+}; // namespace math
+
+#endif
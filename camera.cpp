@@ -0,0 +1,215 @@
+#include "camera.h"
+
+#include <math.h>
+
+namespace math {
+
+Camera::Camera()
+    : m_type(PROJECTION_PERSPECTIVE)
+    , m_reverseZ(false)
+    , m_fov(60.0f)
+    , m_aspect(1.0f)
+    , m_znear(0.1f)
+    , m_zfar(1000.0f)
+    , m_position(0.0f)
+    , m_dirty(DIRTY_POSE | DIRTY_LENS)
+{
+}
+
+void Camera::setLens(projection_t type, float fov, float aspectRatio,
+                     float znear, float zfar)
+{
+    if (type == m_type && fov == m_fov && aspectRatio == m_aspect &&
+        znear == m_znear && zfar == m_zfar)
+        return;
+    m_type = type;
+    m_fov = fov;
+    m_aspect = aspectRatio;
+    m_znear = znear;
+    m_zfar = zfar;
+    m_dirty |= DIRTY_LENS;
+}
+
+void Camera::setPerspective(float fov, float aspectRatio, float znear, float zfar)
+{
+    setLens(PROJECTION_PERSPECTIVE, fov, aspectRatio, znear, zfar);
+}
+
+void Camera::setOrthographic(float width, float height, float znear, float zfar)
+{
+    setLens(PROJECTION_ORTHOGRAPHIC, height, width/height, znear, zfar);
+}
+
+void Camera::setReverseZ(bool reverseZ)
+{
+    if (reverseZ != m_reverseZ) {
+        m_reverseZ = reverseZ;
+        m_dirty |= DIRTY_LENS;
+    }
+}
+
+void Camera::setPosition(const vec3f &pos)
+{
+    if (pos != m_position) {
+        m_position = pos;
+        m_dirty |= DIRTY_POSE;
+    }
+}
+
+void Camera::setOrientation(const Quaternion &q)
+{
+    if (q != m_orientation) {
+        m_orientation = q;
+        m_dirty |= DIRTY_POSE;
+    }
+}
+
+const Matrix4f& Camera::view() const
+{
+    if (m_dirty & DIRTY_VIEW) {
+        // Inverse of the rigid camera transform, R^T and -R^T*pos
+        Matrix4f r = m_orientation.toMatrix();
+        const vec3f &p = m_position;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                m_view[j][i] = r[i][j];
+            m_view[i][3] = 0.0f;
+            m_view[3][i] = -(r[i][0]*p.x() + r[i][1]*p.y() + r[i][2]*p.z());
+        }
+        m_view[3][3] = 1.0f;
+        m_dirty &= ~DIRTY_VIEW;
+    }
+    return m_view;
+}
+
+const Matrix4f& Camera::inverseView() const
+{
+    if (m_dirty & DIRTY_INVERSE_VIEW) {
+        m_inverseView = m_orientation.toMatrix();
+        for (int i = 0; i < 3; i++)
+            m_inverseView[3][i] = m_position[i];
+        m_dirty &= ~DIRTY_INVERSE_VIEW;
+    }
+    return m_inverseView;
+}
+
+const Matrix4f& Camera::projection() const
+{
+    if (!(m_dirty & DIRTY_PROJECTION))
+        return m_projection;
+
+    Matrix4f &m = m_projection;
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            m[j][i] = 0.0f;
+
+    float n = m_znear, f = m_zfar;
+    bool infinite = isinf(f);
+    if (m_type == PROJECTION_PERSPECTIVE) {
+        float cot = 1.0f/tanf(m_fov*float(M_PI)/360.0f);
+        m[0][0] = cot/m_aspect;
+        m[1][1] = cot;
+        m[2][3] = -1.0f;
+        if (m_reverseZ) {
+            // depth = n/-z, 1 at the near plane and 0 at the far one
+            m[2][2] = infinite ? 0.0f : n/(f - n);
+            m[3][2] = infinite ? n : f*n/(f - n);
+        } else {
+            m[2][2] = infinite ? -1.0f : (f + n)/(n - f);
+            m[3][2] = infinite ? -2.0f*n : 2.0f*f*n/(n - f);
+        }
+    } else {
+        m[0][0] = 2.0f/(m_fov*m_aspect);
+        m[1][1] = 2.0f/m_fov;
+        if (m_reverseZ) {
+            m[2][2] = 1.0f/(f - n);
+            m[3][2] = f/(f - n);
+        } else {
+            m[2][2] = 2.0f/(n - f);
+            m[3][2] = (f + n)/(n - f);
+        }
+        m[3][3] = 1.0f;
+    }
+
+    m_dirty &= ~DIRTY_PROJECTION;
+    return m;
+}
+
+const Matrix4f& Camera::inverseProjection() const
+{
+    if (m_dirty & DIRTY_INVERSE_PROJECTION) {
+        m_inverseProjection = projection().inverse();
+        m_dirty &= ~DIRTY_INVERSE_PROJECTION;
+    }
+    return m_inverseProjection;
+}
+
+const Matrix4f& Camera::viewProjection() const
+{
+    if (m_dirty & DIRTY_VIEW_PROJECTION) {
+        m_viewProjection = projection()*view();
+        m_dirty &= ~DIRTY_VIEW_PROJECTION;
+    }
+    return m_viewProjection;
+}
+
+const Matrix4f& Camera::inverseViewProjection() const
+{
+    if (m_dirty & DIRTY_INVERSE_VIEW_PROJECTION) {
+        m_inverseViewProjection = inverseView()*inverseProjection();
+        m_dirty &= ~DIRTY_INVERSE_VIEW_PROJECTION;
+    }
+    return m_inverseViewProjection;
+}
+
+const Frustum& Camera::frustum() const
+{
+    if (!(m_dirty & DIRTY_FRUSTUM))
+        return m_frustum;
+
+    // Planes from the rows of the view-projection matrix (Gribb, Hartmann)
+    const Matrix4f &vp = viewProjection();
+    vec4f row[4];
+    for (int i = 0; i < 4; i++)
+        row[i] = vec4f(vp[0][i], vp[1][i], vp[2][i], vp[3][i]);
+
+    vec4f planes[6];
+    if (m_reverseZ) {
+        planes[0] = row[3] - row[2];
+        planes[1] = row[2];
+    } else {
+        planes[0] = row[3] + row[2];
+        planes[1] = row[3] - row[2];
+    }
+    planes[2] = row[3] - row[1];
+    planes[3] = row[3] + row[1];
+    planes[4] = row[3] + row[0];
+    planes[5] = row[3] - row[0];
+
+    // An infinite far plane degenerates to 0 = w, push it out of the way
+    if (isinf(m_zfar))
+        planes[1] = vec4f(-vec3(planes[0]), 1e30f);
+
+    m_frustum.setPlanes(planes);
+    m_dirty &= ~DIRTY_FRUSTUM;
+    return m_frustum;
+}
+
+ScreenScale Camera::screenScale(const Viewport &viewport) const
+{
+    ScreenScale s;
+    if (m_type == PROJECTION_ORTHOGRAPHIC) {
+        s.depthPlane = vec4f(0.0f, 0.0f, 0.0f, 1.0f);
+        s.pixels = viewport.height/m_fov;
+        s.minDepth = 1.0f;
+        return s;
+    }
+    vec3f dir = vec3(m_orientation.toMatrix() * vec4f(0.0f, 0.0f, -1.0f, 0.0f));
+    dir.normalize();
+    s.depthPlane = vec4f(dir, -dot(dir, m_position));
+    s.pixels = viewport.height*0.5f/tanf(m_fov*float(M_PI)/180.0f/2.0f);
+    s.minDepth = m_znear;
+    return s;
+}
+
+}; // namespace math
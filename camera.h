@@ -0,0 +1,130 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "frustum.h"
+
+namespace math {
+
+typedef enum {
+    PROJECTION_PERSPECTIVE,
+    PROJECTION_ORTHOGRAPHIC
+} projection_t;
+
+/// View and projection of a camera looking down -z in its local space,
+/// like Frustum. Matrices, their inverses and the frustum planes are
+/// computed on first read after a change and cached, and setters that
+/// don't change anything invalidate nothing, so cameras that rarely move
+/// cost nothing per frame.
+///
+/// Projections map depth to GL clip space, z in [-w, w], which is what
+/// project() expects. With reverse Z they map near to depth 1 and far to
+/// 0 with z in [0, w] instead, for D3D, Vulkan or GL with a zero to one
+/// clip control, and the far plane may be INFINITY.
+class Camera {
+public:
+    Camera();
+
+    /// Vertical fov in degrees
+    void setPerspective(float fov, float aspectRatio, float znear, float zfar);
+
+    /// View volume of width x height centered on the view direction
+    void setOrthographic(float width, float height, float znear, float zfar);
+
+    void setReverseZ(bool reverseZ);
+
+    void setPosition(const vec3f &pos);
+    void setOrientation(const Quaternion &q);
+
+    projection_t projectionType() const
+    {
+        return m_type;
+    }
+
+    bool reverseZ() const
+    {
+        return m_reverseZ;
+    }
+
+    /// Vertical fov in degrees for perspective, height for orthographic
+    float fov() const
+    {
+        return m_fov;
+    }
+
+    /// Width over height
+    float aspectRatio() const
+    {
+        return m_aspect;
+    }
+
+    float zNear() const
+    {
+        return m_znear;
+    }
+
+    float zFar() const
+    {
+        return m_zfar;
+    }
+
+    const vec3f& position() const
+    {
+        return m_position;
+    }
+
+    const Quaternion& orientation() const
+    {
+        return m_orientation;
+    }
+
+    const Matrix4f& view() const;
+    const Matrix4f& projection() const;
+    const Matrix4f& viewProjection() const;
+
+    const Matrix4f& inverseView() const;
+    const Matrix4f& inverseProjection() const;
+    const Matrix4f& inverseViewProjection() const;
+
+    const Frustum& frustum() const;
+
+    /// Radii to pixels of viewport for Frustum::containsSpheres() with
+    /// LOD, for either projection. Orthographic sizes don't change with
+    /// depth.
+    ScreenScale screenScale(const Viewport &viewport) const;
+
+private:
+    enum {
+        DIRTY_VIEW                  = 1 << 0,
+        DIRTY_PROJECTION            = 1 << 1,
+        DIRTY_VIEW_PROJECTION       = 1 << 2,
+        DIRTY_INVERSE_VIEW          = 1 << 3,
+        DIRTY_INVERSE_PROJECTION    = 1 << 4,
+        DIRTY_INVERSE_VIEW_PROJECTION = 1 << 5,
+        DIRTY_FRUSTUM               = 1 << 6,
+
+        // What a change of position or orientation invalidates
+        DIRTY_POSE = DIRTY_VIEW | DIRTY_INVERSE_VIEW | DIRTY_VIEW_PROJECTION |
+                     DIRTY_INVERSE_VIEW_PROJECTION | DIRTY_FRUSTUM,
+        DIRTY_LENS = DIRTY_PROJECTION | DIRTY_INVERSE_PROJECTION |
+                     DIRTY_VIEW_PROJECTION | DIRTY_INVERSE_VIEW_PROJECTION |
+                     DIRTY_FRUSTUM
+    };
+
+    void setLens(projection_t type, float fov, float aspectRatio,
+                 float znear, float zfar);
+
+    projection_t m_type;
+    bool m_reverseZ;
+    float m_fov, m_aspect, m_znear, m_zfar;
+    vec3f m_position;
+    Quaternion m_orientation;
+
+    mutable unsigned m_dirty;
+    mutable Matrix4f m_view, m_projection, m_viewProjection;
+    mutable Matrix4f m_inverseView, m_inverseProjection, m_inverseViewProjection;
+    mutable Frustum m_frustum;
+};
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,221 @@
+#include <algorithm>
+
+#include "cluster.h"
+#include "parallel.h"
+
+namespace math {
+
+ClusterGrid::ClusterGrid()
+    : m_fov(-1.0f)
+    , m_aspect(0.0f)
+    , m_znear(0.0f)
+    , m_zfar(0.0f)
+    , m_columns(0)
+    , m_rows(0)
+    , m_slices(0)
+    , m_logScale(0.0f)
+{
+    m_offsets.push_back(0);
+}
+
+// Unit normals (1, t*tanHalf) of the planes through the eye at tile
+// boundaries t = -1..1, as (y or x, z)
+static void tilePlanes(std::vector<vec2f> &planes, int count, float tanHalf)
+{
+    planes.resize(count + 1);
+    for (int j = 0; j <= count; j++) {
+        float t = (-1.0f + 2.0f*j/count)*tanHalf;
+        float len = sqrtf(1.0f + t*t);
+        planes[j] = vec2f(1.0f/len, t/len);
+    }
+}
+
+void ClusterGrid::set(float fov, float aspectRatio, float znear, float zfar,
+                      int columns, int rows, int slices)
+{
+    if (fov == m_fov && aspectRatio == m_aspect && znear == m_znear &&
+        zfar == m_zfar && columns == m_columns && rows == m_rows && slices == m_slices)
+        return;
+    assert(columns > 0 && rows > 0 && slices > 0 && znear > 0.0f && zfar > znear);
+    m_fov = fov;
+    m_aspect = aspectRatio;
+    m_znear = znear;
+    m_zfar = zfar;
+    m_columns = columns;
+    m_rows = rows;
+    m_slices = slices;
+    m_logScale = slices/logf(zfar/znear);
+
+    float tanH = tanf(fov*float(M_PI)/180.0f/2.0f), tanW = tanH*aspectRatio;
+    tilePlanes(m_rowPlanes, rows, tanH);
+    tilePlanes(m_columnPlanes, columns, tanW);
+
+    m_bounds.resize(size_t(columns)*rows*slices);
+    for (int z = 0; z < slices; z++) {
+        float d0 = sliceDepth(z), d1 = sliceDepth(z+1);
+        for (int y = 0; y < rows; y++) {
+            float y0 = (-1.0f + 2.0f*y/rows)*tanH, y1 = (-1.0f + 2.0f*(y+1)/rows)*tanH;
+            for (int x = 0; x < columns; x++) {
+                float x0 = (-1.0f + 2.0f*x/columns)*tanW;
+                float x1 = (-1.0f + 2.0f*(x+1)/columns)*tanW;
+                // The widest of the near and far faces on each side
+                m_bounds[index(x, y, z)] = AABB(
+                    vec3f(std::min(x0*d0, x0*d1), std::min(y0*d0, y0*d1), -d1),
+                    vec3f(std::max(x1*d0, x1*d1), std::max(y1*d0, y1*d1), -d0));
+            }
+        }
+    }
+    m_offsets.assign(size() + 1, 0);
+    m_indices.clear();
+}
+
+int ClusterGrid::slice(float depth) const
+{
+    if (depth <= m_znear)
+        return 0;
+    int z = int(logf(depth/m_znear)*m_logScale);
+    return std::min(z, m_slices - 1);
+}
+
+float ClusterGrid::sliceDepth(int z) const
+{
+    return z == m_slices ? m_zfar : m_znear*expf(z/m_logScale);
+}
+
+// First and last tile whose slab between planes j and j+1 the sphere
+// reaches, given its distances to the planes
+static inline void tileRange(const std::vector<vec2f> &planes, float u, float z, float r,
+                             int &first, int &last)
+{
+    int count = int(planes.size()) - 1;
+    first = count;
+    last = -1;
+    float below = u*planes[0][0] + z*planes[0][1];
+    for (int j = 0; j < count; j++) {
+        float above = u*planes[j+1][0] + z*planes[j+1][1];
+        if (below >= -r && above <= r) {
+            first = std::min(first, j);
+            last = j;
+        }
+        below = above;
+    }
+}
+
+void ClusterGrid::bound(const SoA<vec4f> &lights, size_t begin, size_t end)
+{
+    const float *lx = lights.x(), *ly = lights.y(), *lz = lights.z(), *lr = lights.w();
+    for (size_t i = begin; i < end; i++) {
+        LightRange &range = m_ranges[i];
+        float depth = -lz[i], r = lr[i];
+        range.z0 = 1;
+        range.z1 = 0;
+        if (depth + r < m_znear || depth - r > m_zfar)
+            continue;
+        tileRange(m_rowPlanes, ly[i], lz[i], r, range.y0, range.y1);
+        tileRange(m_columnPlanes, lx[i], lz[i], r, range.x0, range.x1);
+        if (range.y0 > range.y1 || range.x0 > range.x1)
+            continue;
+        // A slice either way for rounding in the logarithm, the boxes
+        // reject the extra clusters
+        range.z0 = std::max(slice(depth - r) - 1, 0);
+        range.z1 = std::min(slice(depth + r) + 1, m_slices - 1);
+    }
+}
+
+static inline bool overlaps(const AABB &b, float x, float y, float z, float r)
+{
+    float dx = std::max(std::max(b.min[0] - x, x - b.max[0]), 0.0f);
+    float dy = std::max(std::max(b.min[1] - y, y - b.max[1]), 0.0f);
+    float dz = std::max(std::max(b.min[2] - z, z - b.max[2]), 0.0f);
+    return dx*dx + dy*dy + dz*dz <= r*r;
+}
+
+void ClusterGrid::assignSlices(const SoA<vec4f> &lights, int z0, int z1, size_t part)
+{
+    const float *lx = lights.x(), *ly = lights.y(), *lz = lights.z(), *lr = lights.w();
+    std::vector<uint32_t> &pairs = m_partPairs[part];
+    pairs.clear();
+    uint32_t *counts = &m_offsets[1];
+
+    // (cluster, light) pairs in light order, counted per cluster
+    for (size_t i = 0; i < lights.size(); i++) {
+        const LightRange &range = m_ranges[i];
+        int za = std::max(range.z0, z0), zb = std::min(range.z1, z1 - 1);
+        for (int z = za; z <= zb; z++) {
+            for (int y = range.y0; y <= range.y1; y++) {
+                size_t c = index(range.x0, y, z);
+                for (int x = range.x0; x <= range.x1; x++, c++) {
+                    if (!overlaps(m_bounds[c], lx[i], ly[i], lz[i], lr[i]))
+                        continue;
+                    counts[c]++;
+                    pairs.push_back(c);
+                    pairs.push_back(i);
+                }
+            }
+        }
+    }
+
+    // Counting sort by cluster into the part's own list, offsets local to
+    // the part until assign() adds the ones before it
+    size_t first = index(0, 0, z0), last = index(0, 0, z1);
+    uint32_t total = 0;
+    for (size_t c = first; c < last; c++) {
+        total += counts[c];
+        counts[c] = total;
+    }
+    std::vector<uint32_t> &indices = m_partIndices[part];
+    indices.resize(total);
+    for (size_t k = pairs.size(); k > 0; k -= 2)
+        indices[--counts[pairs[k-2]]] = pairs[k-1];
+    // counts[c] is now the start of cluster c, the end is the next start
+    for (size_t c = first; c + 1 < last; c++)
+        counts[c] = counts[c+1];
+    counts[last-1] = total;
+}
+
+void ClusterGrid::assign(const SoA<vec4f> &lights, size_t threads)
+{
+    m_ranges.resize(lights.size());
+    m_offsets.assign(size() + 1, 0);
+    bound(lights, 0, lights.size());
+
+    size_t parts = partCount(m_slices, threads, 1);
+    if (m_partPairs.size() < parts) {
+        m_partPairs.resize(parts);
+        m_partIndices.resize(parts);
+    }
+    forEachPart(m_slices, parts, [&](size_t begin, size_t end, size_t k) {
+        assignSlices(lights, int(begin), int(end), k);
+    });
+
+    size_t total = 0;
+    for (size_t k = 0; k < parts; k++)
+        total += m_partIndices[k].size();
+    m_indices.resize(total);
+    uint32_t base = 0;
+    for (size_t k = 0; k < parts; k++) {
+        size_t first = index(0, 0, int(m_slices*k/parts));
+        size_t last = index(0, 0, int(m_slices*(k+1)/parts));
+        for (size_t c = first; c < last; c++)
+            m_offsets[c+1] += base;
+        std::copy(m_partIndices[k].begin(), m_partIndices[k].end(), m_indices.begin() + base);
+        base += m_partIndices[k].size();
+    }
+}
+
+Sphere spotLightBounds(const vec3f &pos, const vec3f &dir, float range, float angle)
+{
+    // Past 90 degrees the sector reaches behind the apex, and only the
+    // sphere around it holds the whole cap
+    if (angle >= float(M_PI)/2)
+        return Sphere(pos, range);
+    float c = cosf(angle);
+    // Wide cones are bound by the circle of the cap, narrow ones by the
+    // sphere through the apex and the rim
+    if (angle > float(M_PI)/4)
+        return Sphere(pos + dir*(range*c), range*sinf(angle));
+    float r = range/(2.0f*c);
+    return Sphere(pos + dir*r, r);
+}
+
+}; // namespace math
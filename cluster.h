@@ -0,0 +1,135 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "bounds.h"
+
+namespace math {
+
+/// View space grid of clusters (froxels) for clustered shading, tiles
+/// across the screen by slices in depth. Slices are spaced exponentially,
+/// each one is the same factor deeper than the one before, so clusters
+/// stay roughly cube shaped. Lights are assigned with assign() and read
+/// back as compact index lists per cluster.
+///
+/// View space as in Camera, looking down -z with y up. Depth is the
+/// distance in front of the camera, -z.
+class ClusterGrid {
+public:
+    ClusterGrid();
+
+    /// Parameters as for Frustum::set(), vertical fov in degrees, and
+    /// the number of clusters across, down and in depth. Does nothing if
+    /// they are unchanged.
+    void set(float fov, float aspectRatio, float znear, float zfar,
+             int columns, int rows, int slices);
+
+    int columns() const
+    {
+        return m_columns;
+    }
+
+    int rows() const
+    {
+        return m_rows;
+    }
+
+    int slices() const
+    {
+        return m_slices;
+    }
+
+    size_t size() const
+    {
+        return m_bounds.size();
+    }
+
+    /// Clusters are ordered by slice, then row from the bottom, then column
+    /// from the left
+    size_t index(int x, int y, int z) const
+    {
+        return (size_t(z)*m_rows + y)*m_columns + x;
+    }
+
+    /// Slice containing depth, clamped to the grid
+    int slice(float depth) const;
+
+    /// Near depth of slice z, sliceDepth(slices()) is zfar
+    float sliceDepth(int z) const;
+
+    /// View space box around the cluster
+    const AABB& bounds(size_t cluster) const
+    {
+        return m_bounds[cluster];
+    }
+
+    /// Assign lights given as view space spheres (x, y, z, radius), e.g.
+    /// from transformSpheres() with the view matrix. Each light is bound
+    /// to a range of slices, rows and columns with the tile planes, then
+    /// tested against the boxes of the clusters in it. threads > 1 splits
+    /// the slices over that many threads, 0 uses one per hardware thread.
+    /// The lists don't depend on the thread count.
+    void assign(const SoA<vec4f> &lights, size_t threads = 1);
+
+    /// Lights overlapping cluster, ascending
+    const uint32_t* lights(size_t cluster) const
+    {
+        return m_indices.data() + m_offsets[cluster];
+    }
+
+    size_t lightCount(size_t cluster) const
+    {
+        return m_offsets[cluster+1] - m_offsets[cluster];
+    }
+
+    /// Start of each cluster's list in indices(), size() + 1 entries, ready
+    /// for upload with indices()
+    const std::vector<uint32_t>& offsets() const
+    {
+        return m_offsets;
+    }
+
+    const std::vector<uint32_t>& indices() const
+    {
+        return m_indices;
+    }
+
+private:
+    // Clusters a light may touch, slices [z0, z1] and so on, z0 > z1 when
+    // it is outside the grid
+    struct LightRange {
+        int x0, x1, y0, y1, z0, z1;
+    };
+
+    void bound(const SoA<vec4f> &lights, size_t begin, size_t end);
+    void assignSlices(const SoA<vec4f> &lights, int z0, int z1, size_t part);
+
+    float m_fov, m_aspect, m_znear, m_zfar;
+    int m_columns, m_rows, m_slices;
+    float m_logScale;           // slices per unit of log depth
+
+    // Tile planes through the eye, (y or x, z) of the unit normals,
+    // pointing up or right, rows + 1 and columns + 1 of them
+    std::vector<vec2f> m_rowPlanes, m_columnPlanes;
+    std::vector<AABB> m_bounds;
+
+    std::vector<LightRange> m_ranges;
+    std::vector<uint32_t> m_offsets;
+    std::vector<uint32_t> m_indices;
+
+    // Per part (cluster, light) pairs and their sorted lights
+    std::vector<std::vector<uint32_t> > m_partPairs;
+    std::vector<std::vector<uint32_t> > m_partIndices;
+};
+
+/// Bounding sphere of a spot light with its apex at pos, unit direction
+/// dir, range and half angle in radians, lighting the spherical sector of
+/// radius range. Tighter than the sphere of radius range around pos for
+/// angles below 90 degrees, that sphere for wider ones.
+Sphere spotLightBounds(const vec3f &pos, const vec3f &dir, float range, float angle);
+
+}; // namespace math
+
+#endif
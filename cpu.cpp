@@ -0,0 +1,118 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GFXMATH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace math {
+
+#ifdef GFXMATH_X86
+static void cpuid(unsigned leaf, unsigned sub, unsigned regs[4])
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, sub);
+    for (int i = 0; i < 4; i++)
+        regs[i] = r[i];
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the OS saves on context switch (XCR0)
+static unsigned long long xgetbv()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif // GFXMATH_X86
+
+simd_level_t detectSimdLevel()
+{
+#ifdef GFXMATH_X86
+    unsigned r[4];
+    cpuid(0, 0, r);
+    unsigned maxLeaf = r[0];
+
+    cpuid(1, 0, r);
+    bool sse2 = r[3] & (1u << 26);
+    bool sse41 = r[2] & (1u << 19);
+    bool fma = r[2] & (1u << 12);
+    bool osxsave = r[2] & (1u << 27);
+    bool avx = r[2] & (1u << 28);
+
+    if (!sse2)
+        return SIMD_SCALAR;
+    if (!sse41)
+        return SIMD_SSE2;
+
+    unsigned long long xcr0 = osxsave ? xgetbv() : 0;
+    bool ymm = (xcr0 & 0x6) == 0x6;
+    bool zmm = (xcr0 & 0xe6) == 0xe6;
+
+    bool avx2 = false, avx512 = false;
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, r);
+        avx2 = r[1] & (1u << 5);
+        avx512 = r[1] & (1u << 16);
+    }
+
+    if (avx && avx2 && fma && ymm) {
+        if (avx512 && zmm)
+            return SIMD_AVX512;
+        return SIMD_AVX2;
+    }
+    return SIMD_SSE41;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+static const char *s_names[] = { "scalar", "sse2", "sse41", "avx2", "avx512" };
+
+const char* simdLevelName(simd_level_t level)
+{
+    return s_names[level];
+}
+
+bool parseSimdLevel(const char *name, simd_level_t &level)
+{
+    for (int i = SIMD_SCALAR; i <= SIMD_AVX512; i++) {
+        if (strcmp(name, s_names[i]) == 0) {
+            level = (simd_level_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static simd_level_t initSimdLevel()
+{
+    simd_level_t level = detectSimdLevel();
+    const char *env = getenv("GFXMATH_SIMD");
+    simd_level_t forced;
+    if (env && parseSimdLevel(env, forced) && forced < level)
+        level = forced;
+    return level;
+}
+
+simd_level_t simdLevel()
+{
+    static simd_level_t level = initSimdLevel();
+    return level;
+}
+
+}; // namespace math
@@ -0,0 +1,29 @@
+#ifndef CPU_H
+#define CPU_H
+
+namespace math {
+
+typedef enum {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2 = 1,
+    SIMD_SSE41 = 2,
+    SIMD_AVX2 = 3,              // AVX2 + FMA
+    SIMD_AVX512 = 4             // AVX-512F
+} simd_level_t;
+
+/// Highest instruction set supported by both the CPU and the OS
+simd_level_t detectSimdLevel();
+
+/// Level used by the batched kernels, detected once. Setting the
+/// GFXMATH_SIMD environment variable to scalar, sse2, sse41, avx2 or
+/// avx512 forces a lower level (it is capped by what the CPU supports).
+simd_level_t simdLevel();
+
+const char* simdLevelName(simd_level_t level);
+
+/// Parse a level name as accepted by GFXMATH_SIMD, returns false if unknown
+bool parseSimdLevel(const char *name, simd_level_t &level);
+
+}; // namespace math
+
+#endif
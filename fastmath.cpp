@@ -0,0 +1,109 @@
+#include "fastmath.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace math {
+
+#ifdef __SSE2__
+static inline __m128 rsqrt4(__m128 x)
+{
+    // One Newton-Raphson step on top of the 12-bit estimate
+    __m128 y = _mm_rsqrt_ps(x);
+    __m128 yyx = _mm_mul_ps(_mm_mul_ps(y, y), x);
+    return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y),
+                      _mm_sub_ps(_mm_set1_ps(3.0f), yyx));
+}
+
+static inline void sincos4(__m128 x, __m128 &s, __m128 &c)
+{
+    const __m128 signmask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    __m128 sign = _mm_and_ps(x, signmask);
+    x = _mm_andnot_ps(signmask, x);
+
+    __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(detail::FOPI)));
+    j = _mm_add_epi32(j, _mm_set1_epi32(1));
+    j = _mm_and_si128(j, _mm_set1_epi32(~1));
+    __m128 y = _mm_cvtepi32_ps(j);
+
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(detail::DP1)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(detail::DP2)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(detail::DP3)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(detail::DP4)));
+
+    __m128 z = _mm_mul_ps(x, x);
+
+    __m128 ps = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), z),
+                           _mm_set1_ps(8.3321608736e-3f));
+    ps = _mm_add_ps(_mm_mul_ps(ps, z), _mm_set1_ps(-1.6666654611e-1f));
+    ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, z), x), x);
+
+    __m128 pc = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), z),
+                           _mm_set1_ps(-1.388731625493765e-3f));
+    pc = _mm_add_ps(_mm_mul_ps(pc, z), _mm_set1_ps(4.166664568298827e-2f));
+    pc = _mm_mul_ps(_mm_mul_ps(pc, z), z);
+    pc = _mm_sub_ps(pc, _mm_mul_ps(_mm_set1_ps(0.5f), z));
+    pc = _mm_add_ps(pc, _mm_set1_ps(1.0f));
+
+    // Quadrant selection: bit 1 swaps sin/cos, bits 1^2 flip the sign
+    // of cos, bit 2 flips the sign of sin.
+    __m128 swap = _mm_castsi128_ps(
+        _mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+    __m128i ssign = _mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29);
+    __m128i csign = _mm_slli_epi32(
+        _mm_and_si128(_mm_xor_si128(j, _mm_srli_epi32(j, 1)), _mm_set1_epi32(2)), 30);
+
+    __m128 rs = _mm_or_ps(_mm_and_ps(swap, pc), _mm_andnot_ps(swap, ps));
+    __m128 rc = _mm_or_ps(_mm_and_ps(swap, ps), _mm_andnot_ps(swap, pc));
+
+    s = _mm_xor_ps(rs, _mm_xor_ps(sign, _mm_castsi128_ps(ssign)));
+    c = _mm_xor_ps(rc, _mm_castsi128_ps(csign));
+}
+#endif // __SSE2__
+
+float fastRsqrt(float x)
+{
+#ifdef __SSE2__
+    return _mm_cvtss_f32(rsqrt4(_mm_set_ss(x)));
+#else
+    return 1.0f/sqrtf(x);
+#endif
+}
+
+void fastSincos(const float *x, float *s, float *c, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 limit = _mm_set1_ps(detail::SINCOS_MAX);
+    const __m128 signmask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    for (; i+4 <= count; i += 4) {
+        __m128 vx = _mm_loadu_ps(x+i);
+        // Out of range or NaN, the scalar version hands it to libm
+        if (_mm_movemask_ps(_mm_cmpnle_ps(_mm_andnot_ps(signmask, vx), limit))) {
+            for (size_t k = i; k < i+4; k++)
+                fastSincos(x[k], s[k], c[k]);
+            continue;
+        }
+        __m128 vs, vc;
+        sincos4(vx, vs, vc);
+        _mm_storeu_ps(s+i, vs);
+        _mm_storeu_ps(c+i, vc);
+    }
+#endif
+    for (; i < count; i++)
+        fastSincos(x[i], s[i], c[i]);
+}
+
+void fastRsqrt(const float *x, float *r, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i+4 <= count; i += 4)
+        _mm_storeu_ps(r+i, rsqrt4(_mm_loadu_ps(x+i)));
+#endif
+    for (; i < count; i++)
+        r[i] = fastRsqrt(x[i]);
+}
+
+}; // namespace math
@@ -0,0 +1,244 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include "tmath.h"
+
+#include <cstddef>
+
+// Polynomial approximations of the transcendental functions used by the
+// rotation builders. Error bounds are measured against double precision
+// libm over the stated domain:
+//
+//   fastSin/fastCos/fastSincos  |x| <= pi       max 1.6 ulp
+//                               |x| <= 100      max 2.1 ulp
+//                               |x| <= 8192     max 2.5 ulp
+//                               larger, NaN     sinf/cosf
+//   fastAsin                    [-1, 1]         max 2.5 ulp
+//   fastAcos                    [-1, 1]         max 1.5 ulp
+//   fastAtan2                   finite y, x     max 3.2 ulp
+//   fastRsqrt                   normal floats   max 2.5e-7 relative
+//
+// The batched versions share the error bounds of the scalar ones.
+//
+// Precision is chosen either per call site with Trig<Fast>/Trig<Precise>
+// or globally by defining GFXMATH_FAST_TRIG, which switches Trig<> to
+// the approximations.
+
+namespace math {
+
+struct Precise {};
+struct Fast {};
+
+#ifdef GFXMATH_FAST_TRIG
+typedef Fast DefaultPrecision;
+#else
+typedef Precise DefaultPrecision;
+#endif
+
+namespace detail {
+
+// Cody-Waite split of pi/4, the first three parts have few enough bits
+// that their products with the quadrant are exact up to SINCOS_MAX
+const float DP1 = 0.78515625f;
+const float DP2 = 2.4175643920898438e-4f;
+const float DP3 = 1.5692785382270813e-7f;
+const float DP4 = 3.038550314138355e-11f;
+const float FOPI = 1.27323954473516f; // 4/pi
+const float PIO2 = 1.5707963267948966f;
+const float PIO4 = 0.7853981633974483f;
+
+// Largest argument reduced with the split above, the quadrant stays
+// below 2^14 so its products with DP1-DP3 are exact
+const float SINCOS_MAX = 8192.0f;
+
+inline float sinPoly(float x, float z)
+{
+    return ((-1.9515295891e-4f*z + 8.3321608736e-3f)*z - 1.6666654611e-1f)*z*x + x;
+}
+
+inline float cosPoly(float z)
+{
+    return ((2.443315711809948e-5f*z - 1.388731625493765e-3f)*z
+            + 4.166664568298827e-2f)*z*z - 0.5f*z + 1.0f;
+}
+
+inline float asinPoly(float x, float z)
+{
+    return ((((4.2163199048e-2f*z + 2.4181311049e-2f)*z + 4.5470025998e-2f)*z
+             + 7.4953002686e-2f)*z + 1.6666752422e-1f)*z*x + x;
+}
+
+inline float atanPoly(float x, float z)
+{
+    return (((8.05374449538e-2f*z - 1.38776856032e-1f)*z + 1.99777106478e-1f)*z
+            - 3.33329491539e-1f)*z*x + x;
+}
+
+}; // namespace detail
+
+/// Sine and cosine of x computed together, |x| > 8192 goes to libm
+inline void fastSincos(float x, float &s, float &c)
+{
+    float sign = 1.0f;
+    if (std::signbit(x)) {
+        x = -x;
+        sign = -1.0f;
+    }
+    if (!(x <= detail::SINCOS_MAX)) {
+        s = sinf(x)*sign;
+        c = cosf(x);
+        return;
+    }
+
+    int j = (int)(x*detail::FOPI);
+    j = (j+1) & ~1;
+    float y = (float)j;
+    x = (((x - y*detail::DP1) - y*detail::DP2) - y*detail::DP3) - y*detail::DP4;
+
+    float z = x*x;
+    float ps = detail::sinPoly(x, z);
+    float pc = detail::cosPoly(z);
+
+    if (j & 2) {
+        float t = ps;
+        ps = pc;
+        pc = -t;
+    }
+    if (j & 4) {
+        ps = -ps;
+        pc = -pc;
+    }
+    s = ps*sign;
+    c = pc;
+}
+
+inline float fastSin(float x)
+{
+    float s, c;
+    fastSincos(x, s, c);
+    return s;
+}
+
+inline float fastCos(float x)
+{
+    float s, c;
+    fastSincos(x, s, c);
+    return c;
+}
+
+inline float fastTan(float x)
+{
+    float s, c;
+    fastSincos(x, s, c);
+    return s/c;
+}
+
+inline float fastAsin(float x)
+{
+    float a = fabsf(x);
+    float r;
+    if (a > 0.5f) {
+        float z = 0.5f*(1.0f-a);
+        r = detail::PIO2 - 2.0f*detail::asinPoly(sqrtf(z), z);
+    } else {
+        r = detail::asinPoly(a, a*a);
+    }
+    return x < 0 ? -r : r;
+}
+
+inline float fastAcos(float x)
+{
+    if (x < -0.5f) {
+        float z = 0.5f*(1.0f+x);
+        return 2.0f*detail::PIO2 - 2.0f*detail::asinPoly(sqrtf(z), z);
+    }
+    if (x > 0.5f) {
+        float z = 0.5f*(1.0f-x);
+        return 2.0f*detail::asinPoly(sqrtf(z), z);
+    }
+    return detail::PIO2 - detail::asinPoly(x, x*x);
+}
+
+inline float fastAtan(float x)
+{
+    float a = fabsf(x);
+    float base = 0.0f;
+    if (a > 2.414213562373095f) {
+        base = detail::PIO2;
+        a = -1.0f/a;
+    } else if (a > 0.4142135623730950f) {
+        base = detail::PIO4;
+        a = (a-1.0f)/(a+1.0f);
+    }
+    float r = base + detail::atanPoly(a, a*a);
+    return copysignf(r, x);
+}
+
+inline float fastAtan2(float y, float x)
+{
+    if (x == 0.0f) {
+        if (y == 0.0f)
+            return copysignf(std::signbit(x) ? 2.0f*detail::PIO2 : 0.0f, y);
+        return copysignf(detail::PIO2, y);
+    }
+    float r = fastAtan(y/x);
+    if (x < 0)
+        r += copysignf(2.0f*detail::PIO2, y);
+    return r;
+}
+
+/// Reciprocal square root
+float fastRsqrt(float x);
+
+/// Batched sine and cosine, vectorized when SSE2 is available
+void fastSincos(const float *x, float *s, float *c, size_t count);
+
+/// Batched reciprocal square root
+void fastRsqrt(const float *x, float *r, size_t count);
+
+template <typename P = DefaultPrecision>
+struct Trig;
+
+template <>
+struct Trig<Precise> {
+    static void sincos(float x, float &s, float &c)
+    {
+        s = sinf(x);
+        c = cosf(x);
+    }
+
+    static float tan(float x) { return tanf(x); }
+    static float asin(float x) { return asinf(x); }
+    static float acos(float x) { return acosf(x); }
+    static float atan2(float y, float x) { return atan2f(y, x); }
+    static float rsqrt(float x) { return 1.0f/sqrtf(x); }
+
+    static void sincos(const float *x, float *s, float *c, size_t count)
+    {
+        for (size_t i = 0; i < count; i++)
+            sincos(x[i], s[i], c[i]);
+    }
+};
+
+template <>
+struct Trig<Fast> {
+    static void sincos(float x, float &s, float &c)
+    {
+        fastSincos(x, s, c);
+    }
+
+    static float tan(float x) { return fastTan(x); }
+    static float asin(float x) { return fastAsin(x); }
+    static float acos(float x) { return fastAcos(x); }
+    static float atan2(float y, float x) { return fastAtan2(y, x); }
+    static float rsqrt(float x) { return fastRsqrt(x); }
+
+    static void sincos(const float *x, float *s, float *c, size_t count)
+    {
+        fastSincos(x, s, c, count);
+    }
+};
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,158 @@
+#include "format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+#if defined(__cpp_lib_to_chars)
+#define GFXMATH_TO_CHARS
+#endif
+
+namespace math {
+
+static inline char* put(char *first, char *last, const char *s, size_t n)
+{
+    if (!first || (size_t)(last-first) < n)
+        return NULL;
+    memcpy(first, s, n);
+    return first+n;
+}
+
+static inline const char* skipSpace(const char *first, const char *last)
+{
+    while (first != last && (*first == ' ' || *first == '\t' ||
+                             *first == '\n' || *first == '\r'))
+        first++;
+    return first;
+}
+
+static inline const char* expect(const char *first, const char *last, char c)
+{
+    if (!first)
+        return NULL;
+    first = skipSpace(first, last);
+    return first != last && *first == c ? first+1 : NULL;
+}
+
+char* format(char *first, char *last, float v)
+{
+    if (!first)
+        return NULL;
+#ifdef GFXMATH_TO_CHARS
+    std::to_chars_result r = std::to_chars(first, last, v);
+    return r.ec == std::errc() ? r.ptr : NULL;
+#else
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%.9g", v);
+    return put(first, last, buf, n);
+#endif
+}
+
+const char* parse(const char *first, const char *last, float &v)
+{
+    if (!first)
+        return NULL;
+    first = skipSpace(first, last);
+#ifdef GFXMATH_TO_CHARS
+    std::from_chars_result r = std::from_chars(first, last, v);
+    return r.ec == std::errc() ? r.ptr : NULL;
+#else
+    // strtof needs a terminated string
+    char buf[64];
+    size_t n = 0;
+    while (first+n != last && n+1 < sizeof(buf) && first[n] != 0 &&
+           (strchr("0123456789+-.eEinfatyINFATY", first[n]) != NULL))
+        n++;
+    memcpy(buf, first, n);
+    buf[n] = 0;
+    char *end;
+    v = strtof(buf, &end);
+    return end != buf ? first + (end-buf) : NULL;
+#endif
+}
+
+template <size_t N>
+char* format(char *first, char *last, const vec<N, float> &v)
+{
+    first = put(first, last, "(", 1);
+    for (size_t i = 0; i < N; i++) {
+        first = format(first, last, v[i]);
+        if (i+1 != N)
+            first = put(first, last, ", ", 2);
+    }
+    return put(first, last, ")", 1);
+}
+
+template <size_t N>
+const char* parse(const char *first, const char *last, vec<N, float> &v)
+{
+    first = expect(first, last, '(');
+    for (size_t i = 0; i < N; i++) {
+        first = parse(first, last, v[i]);
+        if (i+1 != N)
+            first = expect(first, last, ',');
+    }
+    return expect(first, last, ')');
+}
+
+char* format(char *first, char *last, const Quaternion &q)
+{
+    first = put(first, last, "[", 1);
+    first = format(first, last, q.m_w);
+    first = put(first, last, ", ", 2);
+    first = format(first, last, q.m_v);
+    return put(first, last, "]", 1);
+}
+
+const char* parse(const char *first, const char *last, Quaternion &q)
+{
+    first = expect(first, last, '[');
+    first = parse(first, last, q.m_w);
+    first = expect(first, last, ',');
+    first = parse(first, last, q.m_v);
+    return expect(first, last, ']');
+}
+
+template <size_t N>
+char* format(char *first, char *last, const Matrix<N, float> &m)
+{
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            first = format(first, last, m[j][i]);
+            if (j+1 != N)
+                first = put(first, last, " ", 1);
+        }
+        if (i+1 != N)
+            first = put(first, last, "\n", 1);
+    }
+    return first;
+}
+
+template <size_t N>
+const char* parse(const char *first, const char *last, Matrix<N, float> &m)
+{
+    for (size_t i = 0; i < N; i++)
+        for (size_t j = 0; j < N; j++)
+            first = parse(first, last, m[j][i]);
+    return first;
+}
+
+template char* format<2>(char *first, char *last, const vec<2, float> &v);
+template char* format<3>(char *first, char *last, const vec<3, float> &v);
+template char* format<4>(char *first, char *last, const vec<4, float> &v);
+template const char* parse<2>(const char *first, const char *last, vec<2, float> &v);
+template const char* parse<3>(const char *first, const char *last, vec<3, float> &v);
+template const char* parse<4>(const char *first, const char *last, vec<4, float> &v);
+
+template char* format<2>(char *first, char *last, const Matrix<2, float> &m);
+template char* format<3>(char *first, char *last, const Matrix<3, float> &m);
+template char* format<4>(char *first, char *last, const Matrix<4, float> &m);
+template const char* parse<2>(const char *first, const char *last, Matrix<2, float> &m);
+template const char* parse<3>(const char *first, const char *last, Matrix<3, float> &m);
+template const char* parse<4>(const char *first, const char *last, Matrix<4, float> &m);
+
+}; // namespace math
@@ -0,0 +1,62 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include "vec.h"
+#include "matrix.h"
+#include "quaternion.h"
+
+namespace math {
+
+// Text formatting into caller buffers without iostreams. The text is the
+// same as operator<< prints: vec as "(x, y, z)", Quaternion as
+// "[w, (x, y, z)]" and Matrix as one line per row, but floats use the
+// shortest representation that parses back to the same value
+// (std::to_chars when the library has it, "%.9g" otherwise).
+//
+// format() writes into [first, last) and returns the end of the text,
+// NULL if it doesn't fit. Nothing is zero terminated.
+// parse() skips leading whitespace and returns the position past the
+// parsed text, NULL on malformed input.
+
+char* format(char *first, char *last, float v);
+const char* parse(const char *first, const char *last, float &v);
+
+template <size_t N>
+char* format(char *first, char *last, const vec<N, float> &v);
+template <size_t N>
+const char* parse(const char *first, const char *last, vec<N, float> &v);
+
+char* format(char *first, char *last, const Quaternion &q);
+const char* parse(const char *first, const char *last, Quaternion &q);
+
+template <size_t N>
+char* format(char *first, char *last, const Matrix<N, float> &m);
+template <size_t N>
+const char* parse(const char *first, const char *last, Matrix<N, float> &m);
+
+/// Items one per line
+template <typename T>
+char* formatArray(char *first, char *last, const T *items, size_t count)
+{
+    for (size_t i = 0; i < count && first; i++) {
+        first = format(first, last, items[i]);
+        if (first && first != last)
+            *first++ = '\n';
+        else
+            first = NULL;
+    }
+    return first;
+}
+
+/// Parse count items separated by whitespace, as written by formatArray
+template <typename T>
+const char* parseArray(const char *first, const char *last, T *items, size_t count)
+{
+    for (size_t i = 0; i < count && first; i++)
+        first = parse(first, last, items[i]);
+    return first;
+}
+
+}; // namespace math
+
+#endif
@@ -1,4 +1,7 @@
 #include "frustum.h"
+#include "fastmath.h"
+#include "kernels.h"
+#include "instrument.h"
 
 namespace math {
 
@@ -6,11 +9,18 @@ Frustum::Frustum()
     : m_up(0.0f, 1.0f, 0.0f)
     , m_dir(0.0f, 0.0f, -1.0f)
     , m_origin(0.0f)
+    , m_fov(-1.0f)
+    , m_aspect(0.0f)
+    , m_znear(0.0f)
+    , m_zfar(0.0f)
+    , m_nh(0.0f)
+    , m_nw(0.0f)
 {
 }
 
 void Frustum::reset()
 {
+    GFXMATH_COUNT(COUNT_FRUSTUM_RESET);
     // Camera axes
     vec3f z = -m_dir;
     vec3f x = cross(m_up, z).normalized();
@@ -50,9 +60,14 @@ void Frustum::reset()
 void Frustum::set(float fov, float aspectRatio,
                   float znear, float zfar)
 {
+    if (fov == m_fov && aspectRatio == m_aspect &&
+        znear == m_znear && zfar == m_zfar)
+        return;
+    m_fov = fov;
+    m_aspect = aspectRatio;
     m_znear = znear;
     m_zfar = zfar;
-    float tfov = tanf(fov*M_PI/180.0f/2.0f);
+    float tfov = Trig<>::tan(fov*M_PI/180.0f/2.0f);
     m_nh = tfov*znear;
     m_nw = m_nh*aspectRatio;
     reset();
@@ -68,6 +83,9 @@ void Frustum::setPosition(const vec3f &pos)
 
 void Frustum::setOrientation(const Quaternion &q)
 {
+    if (q == m_orientation)
+        return;
+    m_orientation = q;
     Matrix4f mat = q.toMatrix();
     m_up = vec3(mat * vec4f(0.0f, 1.0f, 0.0f, 1.0f));
     m_up.normalize();
@@ -76,8 +94,19 @@ void Frustum::setOrientation(const Quaternion &q)
     reset();
 }
 
+void Frustum::setPlanes(const vec4f planes[6])
+{
+    for (int i = 0; i < 6; i++) {
+        vec3f n = vec3(planes[i]);
+        float len = n.length();
+        n /= len;
+        m_planes[i].set(n*(-planes[i].w()/len), n);
+    }
+}
+
 bool Frustum::containsPoint(const vec3f &p) const
 {
+    GFXMATH_COUNT(COUNT_CONTAINS_POINT);
     for (int i = 0; i < 6; i++) {
         if (m_planes[i].distance(p) < 0)
             return false;
@@ -87,14 +116,125 @@ bool Frustum::containsPoint(const vec3f &p) const
 
 int Frustum::containsSphere(const vec3f &c, float r) const
 {
+    GFXMATH_COUNT(COUNT_CONTAINS_SPHERE);
     for (int i = 0; i < 6; i++) {
         float d = m_planes[i].distance(c);
-        if (d < -r)
+        if (d < -r) {
+            GFXMATH_CULL(i, OUTSIDE);
             return OUTSIDE;
-        if (fabs(d) < r)
+        }
+        if (fabs(d) < r) {
+            GFXMATH_CULL(i, INTERSECT);
             return INTERSECT;
+        }
     }
+    GFXMATH_CULL(5, INSIDE);
     return INSIDE;
 }
 
+void Frustum::containsSpheres(const float *x, const float *y, const float *z,
+                              const float *r, uint8_t *result, size_t count) const
+{
+    GFXMATH_TIME(TIMER_CULL_SPHERES, count);
+    vec4f planes[6];
+    getPlanes(planes);
+    kernels().cullSpheres(planes, x, y, z, r, result, count);
+    GFXMATH_CULL_BATCH(result, count);
+}
+
+void Frustum::containsSpheres(const SoA<vec4f> &spheres, uint8_t *result) const
+{
+    containsSpheres(spheres.x(), spheres.y(), spheres.z(), spheres.w(),
+                    result, spheres.size());
+}
+
+ScreenScale Frustum::screenScale(const Viewport &viewport) const
+{
+    // The near plane is znear in front of the eye along the view direction
+    ScreenScale s;
+    s.depthPlane = m_planes[0].equation();
+    s.depthPlane[3] += m_znear;
+    s.pixels = viewport.height*0.5f*m_znear/m_nh;
+    s.minDepth = m_znear;
+    return s;
+}
+
+void Frustum::containsSpheres(const SoA<vec4f> &spheres, const ScreenScale &scale,
+                              float minPixels, const float *const thresholds[],
+                              int levels, uint8_t *result, uint8_t *lod) const
+{
+    assert(levels >= 0 && levels <= LOD_LEVELS_MAX);
+    GFXMATH_TIME(TIMER_CULL_SPHERES_LOD, spheres.size());
+    vec4f planes[6];
+    getPlanes(planes);
+    kernels().cullSpheresLod(planes, scale, minPixels, spheres.x(), spheres.y(),
+                             spheres.z(), spheres.w(), thresholds, levels,
+                             result, lod, spheres.size());
+    GFXMATH_CULL_BATCH(result, spheres.size());
+}
+
+template <typename T>
+static int classify(const Plane planes[6], const T &volume)
+{
+    int result = INSIDE;
+    for (int i = 0; i < 6; i++) {
+        float lo, hi;
+        distanceRange(planes[i], volume, lo, hi);
+        if (hi < 0.0f)
+            return OUTSIDE;
+        if (lo < 0.0f)
+            result = INTERSECT;
+    }
+    return result;
+}
+
+int Frustum::containsCone(const Cone &c) const
+{
+    return classify(m_planes, c);
+}
+
+int Frustum::containsCapsule(const Capsule &c) const
+{
+    return classify(m_planes, c);
+}
+
+void Frustum::containsCones(const SoA<Cone> &cones, uint8_t *result) const
+{
+    GFXMATH_TIME(TIMER_CULL_CONES, cones.size());
+    vec4f planes[6];
+    getPlanes(planes);
+    const float *lanes[8];
+    cones.lanes(lanes);
+    kernels().cullCones(planes, lanes, result, cones.size());
+}
+
+void Frustum::containsCapsules(const SoA<Capsule> &capsules, uint8_t *result) const
+{
+    GFXMATH_TIME(TIMER_CULL_CAPSULES, capsules.size());
+    vec4f planes[6];
+    getPlanes(planes);
+    const float *lanes[7];
+    capsules.lanes(lanes);
+    kernels().cullCapsules(planes, lanes, result, capsules.size());
+}
+
+void Frustum::depthKeys(const float *x, const float *y, const float *z,
+                        uint32_t *keys, size_t count, sort_order_t order) const
+{
+    GFXMATH_TIME(TIMER_DEPTH_KEYS, count);
+    kernels().depthKeys(m_planes[0].equation(), x, y, z,
+                        order == SORT_BACK_TO_FRONT ? ~0u : 0u, keys, count);
+}
+
+void Frustum::depthKeys(const SoA<vec3f> &points, uint32_t *keys, sort_order_t order) const
+{
+    depthKeys(points.x(), points.y(), points.z(), keys, points.size(), order);
+}
+
+void Frustum::getPlanes(vec4f planes[6]) const
+{
+    for (int i = 0; i < 6; i++)
+        planes[i] = m_planes[i].equation();
+}
+
 }; // namespace mats
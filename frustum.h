@@ -3,27 +3,95 @@
 #include "plane.h"
 #include "matrix.h"
 #include "quaternion.h"
+#include "soa.h"
+#include "volumes.h"
+#include "radixsort.h"
+#include "viewport.h"
+
+#include <stdint.h>
 
 namespace math {
 
 typedef enum { OUTSIDE = 0, INSIDE = 1, INTERSECT = 2 } intersection_t;
 
+/// How radii project to pixels. A sphere of radius r at view depth z
+/// covers r*pixels/z pixels, z being the distance to depthPlane clamped
+/// to at least minDepth so spheres around the eye come out large. Get
+/// one from Frustum::screenScale() or Camera::screenScale().
+struct ScreenScale {
+    vec4f depthPlane;
+    float pixels;
+    float minDepth;
+};
+
+/// Most thresholds the LOD variant of containsSpheres() takes
+static const int LOD_LEVELS_MAX = 8;
+
 class Frustum {
 public:
     Frustum();
 
+    /// Does nothing if the parameters are unchanged, like the setters below
     void set(float fov, float aspectRatio,
              float znear, float zfar);
 
     void setPosition(const vec3f &tr);
     void setOrientation(const Quaternion &q);
 
+    /// Set the plane equations (nx, ny, nz, d) of near, far, top, bottom,
+    /// left, right directly, normals pointing inside. They needn't be
+    /// normalized. Replaced by the next change through the setters above.
+    void setPlanes(const vec4f planes[6]);
+
     bool containsPoint(const vec3f &p) const;
     int containsSphere(const vec3f &c, float r) const;
 
+    /// Classify spheres given as structure of arrays, result[i] is an
+    /// intersection_t. Unlike containsSphere, every plane is tested so a
+    /// sphere crossing one plane but outside another is OUTSIDE.
+    void containsSpheres(const float *x, const float *y, const float *z,
+                         const float *r, uint8_t *result, size_t count) const;
+
+    /// Same with spheres as (x, y, z, radius) lanes
+    void containsSpheres(const SoA<vec4f> &spheres, uint8_t *result) const;
+
+    /// Radii to pixels of viewport for the perspective given to set()
+    ScreenScale screenScale(const Viewport &viewport) const;
+
+    /// containsSpheres() choosing levels of detail and culling small
+    /// objects by projected radius in the same pass. Spheres under
+    /// minPixels are OUTSIDE. lod[i] is the number of thresholds[k][i],
+    /// k < levels, above the radius of sphere i, so with each object's
+    /// thresholds in descending pixels 0 is full detail. Thresholds are
+    /// lanes, e.g. of a SoA<vec3f> for four levels.
+    void containsSpheres(const SoA<vec4f> &spheres, const ScreenScale &scale,
+                         float minPixels, const float *const thresholds[],
+                         int levels, uint8_t *result, uint8_t *lod) const;
+
+    /// Classify a cone or capsule, testing every plane like containsSpheres.
+    /// Exact per plane, so only conservative near the frustum's edges.
+    int containsCone(const Cone &c) const;
+    int containsCapsule(const Capsule &c) const;
+
+    void containsCones(const SoA<Cone> &cones, uint8_t *result) const;
+    void containsCapsules(const SoA<Capsule> &capsules, uint8_t *result) const;
+
+    /// Sort keys for radixSort() of the points' distance from the near
+    /// plane, which orders like view depth and is one dot product each.
+    /// Works for planes from setPlanes() too, e.g. Camera::frustum().
+    void depthKeys(const float *x, const float *y, const float *z,
+                   uint32_t *keys, size_t count, sort_order_t order) const;
+
+    void depthKeys(const SoA<vec3f> &points, uint32_t *keys, sort_order_t order) const;
+
+    /// Plane equations (nx, ny, nz, d) of near, far, top, bottom, left, right
+    void getPlanes(vec4f planes[6]) const;
+
 private:
     vec3f m_up, m_dir, m_origin;
+    Quaternion m_orientation;
     Plane m_planes[6];
+    float m_fov, m_aspect;
     float m_znear, m_zfar, m_nh, m_nw;
 
     void reset();
@@ -0,0 +1,580 @@
+#include <algorithm>
+
+#include "gjk.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+static const int GJK_MAX_ITERATIONS = 64;
+// Relative progress below which GJK stops
+static const float GJK_TOLERANCE = 1e-5f;
+
+static const int EPA_MAX_ITERATIONS = 64;
+static const int EPA_MAX_VERTICES = EPA_MAX_ITERATIONS + 4;
+static const int EPA_MAX_FACES = 256;
+static const int EPA_MAX_EDGES = 128;
+// Relative to the size of the polytope
+static const float EPA_TOLERANCE = 1e-4f;
+
+ConvexShape ConvexShape::sphere(const vec3f &center, float radius)
+{
+    ConvexShape s;
+    s.type = SHAPE_SPHERE;
+    s.radius = radius;
+    s.center = center;
+    s.extents = vec3f(0.0f);
+    s.rotation.loadIdentity();
+    s.points = NULL;
+    s.count = 0;
+    return s;
+}
+
+ConvexShape ConvexShape::capsule(const vec3f &a, const vec3f &b, float radius)
+{
+    ConvexShape s = sphere((a + b)*0.5f, radius);
+    s.type = SHAPE_CAPSULE;
+    s.extents = (b - a)*0.5f;
+    return s;
+}
+
+ConvexShape ConvexShape::box(const vec3f &center, const vec3f &extents,
+                             const Matrix3f &rotation)
+{
+    ConvexShape s = sphere(center, 0.0f);
+    s.type = SHAPE_BOX;
+    s.extents = extents;
+    s.rotation = rotation;
+    return s;
+}
+
+ConvexShape ConvexShape::hull(const vec3f *points, size_t count,
+                              const vec3f &center, const Matrix3f &rotation)
+{
+    assert(count > 0);
+    ConvexShape s = sphere(center, 0.0f);
+    s.type = SHAPE_HULL;
+    s.rotation = rotation;
+    s.points = points;
+    s.count = count;
+    return s;
+}
+
+vec3f ConvexShape::coreSupport(const vec3f &d) const
+{
+    switch (type) {
+    case SHAPE_SPHERE:
+        return center;
+    case SHAPE_CAPSULE:
+        return dot(extents, d) >= 0.0f ? center + extents : center - extents;
+    default:
+        break;
+    }
+
+    // Direction in local space, columns of the rotation are the axes
+    const Matrix3f &r = rotation;
+    vec3f l(r[0][0]*d[0] + r[0][1]*d[1] + r[0][2]*d[2],
+            r[1][0]*d[0] + r[1][1]*d[1] + r[1][2]*d[2],
+            r[2][0]*d[0] + r[2][1]*d[1] + r[2][2]*d[2]);
+    vec3f p;
+    if (type == SHAPE_BOX) {
+        p = vec3f(l[0] >= 0.0f ? extents[0] : -extents[0],
+                  l[1] >= 0.0f ? extents[1] : -extents[1],
+                  l[2] >= 0.0f ? extents[2] : -extents[2]);
+    } else {
+        size_t best = 0;
+        float bestDot = dot(points[0], l);
+        for (size_t i = 1; i < count; i++) {
+            float t = dot(points[i], l);
+            if (t > bestDot) {
+                bestDot = t;
+                best = i;
+            }
+        }
+        p = points[best];
+    }
+    return center + r*p;
+}
+
+vec3f ConvexShape::support(const vec3f &d) const
+{
+    vec3f p = coreSupport(d);
+    float len2 = d.lengthSquared();
+    if (radius > 0.0f && len2 > 0.0f)
+        p += d*(radius/sqrtf(len2));
+    return p;
+}
+
+/////
+
+namespace {
+
+// Point of the Minkowski difference of the cores of a and b, with the
+// points it came from and the direction it was found along
+struct SupportPoint {
+    vec3f w, a, b, d;
+};
+
+struct Simplex {
+    SupportPoint p[4];
+    float weight[4];
+    int count;
+};
+
+};
+
+static inline SupportPoint supportPoint(const ConvexShape &a, const ConvexShape &b,
+                                        const vec3f &d)
+{
+    SupportPoint s;
+    s.a = a.coreSupport(d);
+    s.b = b.coreSupport(-d);
+    s.w = s.a - s.b;
+    s.d = d;
+    return s;
+}
+
+// Weights of the point on segment ab closest to the origin
+static void closestOnSegment(const vec3f &a, const vec3f &b, float w[2])
+{
+    vec3f ab = b - a;
+    float len2 = ab.lengthSquared();
+    float t = len2 > 0.0f ? -dot(a, ab)/len2 : 0.0f;
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    w[0] = 1.0f - t;
+    w[1] = t;
+}
+
+// Weights of the point on triangle abc closest to the origin, by Voronoi
+// regions (Ericson, Real-Time Collision Detection, 5.1.5)
+static void closestOnTriangle(const vec3f &a, const vec3f &b, const vec3f &c, float w[3])
+{
+    vec3f ab = b - a, ac = c - a;
+    float d1 = -dot(ab, a), d2 = -dot(ac, a);
+    if (d1 <= 0.0f && d2 <= 0.0f) {
+        w[0] = 1.0f; w[1] = 0.0f; w[2] = 0.0f;
+        return;
+    }
+    float d3 = -dot(ab, b), d4 = -dot(ac, b);
+    if (d3 >= 0.0f && d4 <= d3) {
+        w[0] = 0.0f; w[1] = 1.0f; w[2] = 0.0f;
+        return;
+    }
+    float vc = d1*d4 - d3*d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+        float t = d1/(d1 - d3);
+        w[0] = 1.0f - t; w[1] = t; w[2] = 0.0f;
+        return;
+    }
+    float d5 = -dot(ab, c), d6 = -dot(ac, c);
+    if (d6 >= 0.0f && d5 <= d6) {
+        w[0] = 0.0f; w[1] = 0.0f; w[2] = 1.0f;
+        return;
+    }
+    float vb = d5*d2 - d1*d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+        float t = d2/(d2 - d6);
+        w[0] = 1.0f - t; w[1] = 0.0f; w[2] = t;
+        return;
+    }
+    float va = d3*d6 - d5*d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+        float t = (d4 - d3)/((d4 - d3) + (d5 - d6));
+        w[0] = 0.0f; w[1] = 1.0f - t; w[2] = t;
+        return;
+    }
+    float sum = va + vb + vc;
+    if (sum > 0.0f) {
+        w[0] = va/sum; w[1] = vb/sum; w[2] = vc/sum;
+        return;
+    }
+
+    // Degenerate, the closest of the edges
+    const vec3f *v[3] = { &a, &b, &c };
+    float best = INFINITY;
+    for (int e = 0; e < 3; e++) {
+        int i = e, j = (e + 1) % 3;
+        float s[2];
+        closestOnSegment(*v[i], *v[j], s);
+        float dist = (*v[i]*s[0] + *v[j]*s[1]).lengthSquared();
+        if (dist < best) {
+            best = dist;
+            w[i] = s[0]; w[j] = s[1]; w[3 - i - j] = 0.0f;
+        }
+    }
+}
+
+// Point of s closest to the origin, dropping the vertices it doesn't
+// depend on. Returns true if the origin is inside the tetrahedron.
+static bool closest(Simplex &s, vec3f &v)
+{
+    const SupportPoint *p = s.p;
+    float *w = s.weight;
+    switch (s.count) {
+    case 1:
+        w[0] = 1.0f;
+        break;
+    case 2:
+        closestOnSegment(p[0].w, p[1].w, w);
+        break;
+    case 3:
+        closestOnTriangle(p[0].w, p[1].w, p[2].w, w);
+        break;
+    default: {
+        static const int faces[4][4] = {
+            { 0, 1, 2, 3 }, { 0, 3, 1, 2 }, { 0, 2, 3, 1 }, { 1, 3, 2, 0 }
+        };
+        float best = INFINITY;
+        bool inside = true;
+        for (int f = 0; f < 4; f++) {
+            const vec3f &a = p[faces[f][0]].w, &b = p[faces[f][1]].w;
+            const vec3f &c = p[faces[f][2]].w, &d = p[faces[f][3]].w;
+            vec3f n = cross(b - a, c - a);
+            // Outside the face when on the other side than d, flat
+            // tetrahedra have every face as a candidate
+            if (dot(n, a)*dot(n, d - a) < 0.0f)
+                continue;
+            inside = false;
+            float fw[3];
+            closestOnTriangle(a, b, c, fw);
+            float dist = (a*fw[0] + b*fw[1] + c*fw[2]).lengthSquared();
+            if (dist < best) {
+                best = dist;
+                for (int k = 0; k < 3; k++)
+                    w[faces[f][k]] = fw[k];
+                w[faces[f][3]] = 0.0f;
+            }
+        }
+        if (inside)
+            return true;
+    }
+    }
+
+    int n = 0;
+    v = vec3f(0.0f);
+    for (int k = 0; k < s.count; k++) {
+        if (w[k] <= 0.0f)
+            continue;
+        v += p[k].w*w[k];
+        s.p[n] = s.p[k];
+        s.weight[n] = w[k];
+        n++;
+    }
+    s.count = n;
+    return false;
+}
+
+// GJK on the cores of a and b. Returns true if they overlap, otherwise
+// v is the closest point of a - b to the origin.
+static bool gjk(const ConvexShape &a, const ConvexShape &b, Simplex &s, vec3f &v,
+                GjkCache *cache)
+{
+    s.count = 0;
+    if (cache && cache->count > 0) {
+        for (int k = 0; k < cache->count; k++)
+            s.p[s.count++] = supportPoint(a, b, cache->dirs[k]);
+    } else {
+        vec3f d = b.center - a.center;
+        if (d.lengthSquared() == 0.0f)
+            d = vec3f(1.0f, 0.0f, 0.0f);
+        s.p[s.count++] = supportPoint(a, b, d);
+    }
+
+    bool overlap = closest(s, v);
+    for (int iter = 0; !overlap && iter < GJK_MAX_ITERATIONS; iter++) {
+        float vv = v.lengthSquared();
+        if (vv <= 1e-12f) {
+            overlap = true;
+            break;
+        }
+        SupportPoint p = supportPoint(a, b, -v);
+        // No closer than the current point by more than the tolerance
+        if (vv - dot(v, p.w) <= GJK_TOLERANCE*vv)
+            break;
+        bool repeated = false;
+        for (int k = 0; k < s.count; k++)
+            repeated |= s.p[k].w == p.w;
+        if (repeated)
+            break;
+        s.p[s.count++] = p;
+        overlap = closest(s, v);
+    }
+
+    if (cache) {
+        cache->count = s.count;
+        for (int k = 0; k < s.count; k++)
+            cache->dirs[k] = s.p[k].d;
+    }
+    return overlap;
+}
+
+// Contact from separated cores, exact with the radii added
+static bool separated(const ConvexShape &a, const ConvexShape &b, const Simplex &s,
+                      const vec3f &v, Contact &out)
+{
+    vec3f pa(0.0f), pb(0.0f);
+    for (int k = 0; k < s.count; k++) {
+        pa += s.p[k].a*s.weight[k];
+        pb += s.p[k].b*s.weight[k];
+    }
+    float dist = v.length();
+    vec3f n = -v/dist;
+    out.normal = n;
+    out.pointA = pa + n*a.radius;
+    out.pointB = pb - n*b.radius;
+    out.distance = dist - a.radius - b.radius;
+    return out.distance <= 0.0f;
+}
+
+bool closestPoints(const ConvexShape &a, const ConvexShape &b, Contact &out,
+                   GjkCache *cache)
+{
+    Simplex s;
+    vec3f v;
+    if (!gjk(a, b, s, v, cache))
+        return separated(a, b, s, v, out);
+
+    vec3f p(0.0f);
+    for (int k = 0; k < s.count; k++)
+        p += s.p[k].a;
+    out.pointA = out.pointB = p/float(s.count);
+    out.normal = vec3f(0.0f);
+    out.distance = 0.0f;
+    return true;
+}
+
+/////
+
+namespace {
+
+struct EpaFace {
+    int v[3];
+    vec3f n;
+    float d;
+};
+
+};
+
+static inline void makeFace(EpaFace &f, const SupportPoint *verts, int i, int j, int k)
+{
+    f.v[0] = i;
+    f.v[1] = j;
+    f.v[2] = k;
+    vec3f n = cross(verts[j].w - verts[i].w, verts[k].w - verts[i].w);
+    float len = n.length();
+    if (len > 0.0f) {
+        f.n = n/len;
+        f.d = dot(f.n, verts[i].w);
+    } else {
+        // Never closest nor visible
+        f.n = vec3f(0.0f);
+        f.d = INFINITY;
+    }
+}
+
+// Grow the simplex GJK stopped with into a tetrahedron around the origin,
+// false if the difference of the cores is flat there
+static bool blowUp(const ConvexShape &a, const ConvexShape &b, Simplex &s, float eps)
+{
+    static const vec3f axes[3] = {
+        vec3f(1.0f, 0.0f, 0.0f), vec3f(0.0f, 1.0f, 0.0f), vec3f(0.0f, 0.0f, 1.0f)
+    };
+
+    if (s.count == 1) {
+        for (int k = 0; k < 6 && s.count == 1; k++) {
+            SupportPoint p = supportPoint(a, b, k < 3 ? axes[k] : -axes[k-3]);
+            if ((p.w - s.p[0].w).lengthSquared() > eps*eps)
+                s.p[s.count++] = p;
+        }
+    }
+    if (s.count == 2) {
+        vec3f line = s.p[1].w - s.p[0].w;
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (fabsf(line[k]) < fabsf(line[axis]))
+                axis = k;
+        }
+        vec3f d1 = cross(line, axes[axis]), d2 = cross(line, d1);
+        vec3f dirs[4] = { d1, -d1, d2, -d2 };
+        float len2 = line.lengthSquared();
+        for (int k = 0; k < 4 && s.count == 2; k++) {
+            SupportPoint p = supportPoint(a, b, dirs[k]);
+            vec3f off = cross(p.w - s.p[0].w, line);
+            if (off.lengthSquared() > eps*eps*len2)
+                s.p[s.count++] = p;
+        }
+    }
+    if (s.count == 3) {
+        vec3f n = cross(s.p[1].w - s.p[0].w, s.p[2].w - s.p[0].w);
+        float len = n.length();
+        if (len == 0.0f)
+            return false;
+        n /= len;
+        SupportPoint p = supportPoint(a, b, n);
+        if (dot(p.w - s.p[0].w, n) <= eps)
+            p = supportPoint(a, b, -n);
+        if (fabsf(dot(p.w - s.p[0].w, n)) <= eps)
+            return false;
+        s.p[s.count++] = p;
+    }
+    return s.count == 4;
+}
+
+// Contact of overlapping cores whose difference is flat around the origin,
+// the cores only touch and the radii give all the depth
+static void flatContact(const ConvexShape &a, const ConvexShape &b, const Simplex &s,
+                        Contact &out)
+{
+    vec3f n(1.0f, 0.0f, 0.0f);
+    if (s.count == 2) {
+        vec3f line = s.p[1].w - s.p[0].w;
+        n = cross(line, fabsf(line[0]) < fabsf(line[1]) ? vec3f(1.0f, 0.0f, 0.0f)
+                                                        : vec3f(0.0f, 1.0f, 0.0f));
+    } else if (s.count >= 3) {
+        n = cross(s.p[1].w - s.p[0].w, s.p[2].w - s.p[0].w);
+    }
+    float len = n.length();
+    if (len > 0.0f)
+        n /= len;
+    else
+        n = vec3f(1.0f, 0.0f, 0.0f);
+    out.normal = n;
+    out.pointA = s.p[0].a + n*a.radius;
+    out.pointB = s.p[0].b - n*b.radius;
+    out.distance = -(a.radius + b.radius);
+}
+
+// EPA from the overlapping simplex GJK stopped with. Runs on the cores,
+// growing both shapes by their radius adds the sum to the depth, which
+// keeps curved shapes exact.
+static void epa(const ConvexShape &a, const ConvexShape &b, Simplex &s, Contact &out)
+{
+    float scale = 0.0f;
+    for (int k = 0; k < s.count; k++)
+        scale = std::max(scale, s.p[k].w.length());
+    float eps = std::max(scale, 1e-6f)*EPA_TOLERANCE;
+    if (!blowUp(a, b, s, eps)) {
+        flatContact(a, b, s, out);
+        return;
+    }
+
+    SupportPoint verts[EPA_MAX_VERTICES];
+    EpaFace faces[EPA_MAX_FACES];
+    int edges[EPA_MAX_EDGES][2];
+    int nverts = 4, nfaces = 4;
+    for (int k = 0; k < 4; k++)
+        verts[k] = s.p[k];
+    // Wind the faces outwards
+    if (dot(cross(verts[1].w - verts[0].w, verts[2].w - verts[0].w),
+            verts[3].w - verts[0].w) > 0.0f)
+        std::swap(verts[1], verts[2]);
+    makeFace(faces[0], verts, 0, 1, 2);
+    makeFace(faces[1], verts, 0, 3, 1);
+    makeFace(faces[2], verts, 0, 2, 3);
+    makeFace(faces[3], verts, 1, 3, 2);
+
+    EpaFace f;
+    for (int iter = 0; ; iter++) {
+        int best = 0;
+        for (int k = 1; k < nfaces; k++) {
+            if (faces[k].d < faces[best].d)
+                best = k;
+        }
+        f = faces[best];
+        if (iter == EPA_MAX_ITERATIONS || nverts == EPA_MAX_VERTICES)
+            break;
+        SupportPoint p = supportPoint(a, b, f.n);
+        if (dot(p.w, f.n) - f.d <= eps)
+            break;
+
+        // Remove the faces p sees, the edges left open once are the horizon
+        int nedges = 0;
+        bool full = false;
+        for (int k = 0; k < nfaces; ) {
+            const EpaFace &face = faces[k];
+            if (dot(face.n, p.w - verts[face.v[0]].w) <= 0.0f) {
+                k++;
+                continue;
+            }
+            for (int e = 0; e < 3; e++) {
+                int i = face.v[e], j = face.v[(e + 1) % 3];
+                int m = 0;
+                while (m < nedges && !(edges[m][0] == j && edges[m][1] == i))
+                    m++;
+                if (m < nedges) {
+                    edges[m][0] = edges[nedges-1][0];
+                    edges[m][1] = edges[nedges-1][1];
+                    nedges--;
+                } else if (nedges < EPA_MAX_EDGES) {
+                    edges[nedges][0] = i;
+                    edges[nedges][1] = j;
+                    nedges++;
+                } else {
+                    full = true;
+                }
+            }
+            faces[k] = faces[--nfaces];
+        }
+        // Out of room, answer with the closest face so far, whose
+        // vertices are still there
+        if (full || nfaces + nedges > EPA_MAX_FACES)
+            break;
+
+        verts[nverts] = p;
+        for (int e = 0; e < nedges; e++)
+            makeFace(faces[nfaces++], verts, edges[e][0], edges[e][1], nverts);
+        nverts++;
+    }
+
+    // Barycentric weights of the origin projected onto the closest face
+    const SupportPoint &va = verts[f.v[0]], &vb = verts[f.v[1]], &vc = verts[f.v[2]];
+    float depth = std::max(f.d, 0.0f);
+    vec3f e0 = vb.w - va.w, e1 = vc.w - va.w, e2 = f.n*f.d - va.w;
+    float d00 = dot(e0, e0), d01 = dot(e0, e1), d11 = dot(e1, e1);
+    float d20 = dot(e2, e0), d21 = dot(e2, e1);
+    float denom = d00*d11 - d01*d01;
+    float u = 1.0f, v = 0.0f, w = 0.0f;
+    if (denom > 0.0f) {
+        v = (d11*d20 - d01*d21)/denom;
+        w = (d00*d21 - d01*d20)/denom;
+        u = 1.0f - v - w;
+    }
+    out.normal = f.n;
+    out.pointA = va.a*u + vb.a*v + vc.a*w + f.n*a.radius;
+    out.pointB = va.b*u + vb.b*v + vc.b*w - f.n*b.radius;
+    out.distance = -(depth + a.radius + b.radius);
+}
+
+bool penetration(const ConvexShape &a, const ConvexShape &b, Contact &out,
+                 GjkCache *cache)
+{
+    Simplex s;
+    vec3f v;
+    if (!gjk(a, b, s, v, cache))
+        return separated(a, b, s, v, out);
+    epa(a, b, s, out);
+    return true;
+}
+
+size_t penetration(const ConvexShape *a, const ConvexShape *b, Contact *out,
+                   GjkCache *caches, size_t count)
+{
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++) {
+#ifdef __SSE__
+        // Hull points are the only data not in the arrays
+        if (i + 1 < count) {
+            if (a[i+1].points)
+                _mm_prefetch((const char*)a[i+1].points, _MM_HINT_T0);
+            if (b[i+1].points)
+                _mm_prefetch((const char*)b[i+1].points, _MM_HINT_T0);
+        }
+#endif
+        hits += penetration(a[i], b[i], out[i], caches ? caches + i : NULL);
+    }
+    return hits;
+}
+
+}; // namespace math
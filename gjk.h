@@ -0,0 +1,87 @@
+#ifndef GJK_H
+#define GJK_H
+
+#include "matrix.h"
+
+namespace math {
+
+typedef enum {
+    SHAPE_SPHERE,       // point core
+    SHAPE_CAPSULE,      // segment core
+    SHAPE_BOX,
+    SHAPE_HULL
+} shape_t;
+
+/// Convex shape in world space for the GJK and EPA queries below. Each
+/// shape is a core (point, segment, box or point cloud) grown by radius,
+/// GJK runs on the cores and adds the radii afterwards, so spheres and
+/// capsules are exact and don't need EPA unless their cores overlap.
+///
+/// Build with the named constructors. Hull points are in local space
+/// and referenced, not copied.
+struct ConvexShape {
+    shape_t type;
+    float radius;
+    vec3f center;           // capsule segment midpoint
+    vec3f extents;          // box half sizes, capsule half segment
+    Matrix3f rotation;      // box and hull, columns are the local axes
+    const vec3f *points;
+    size_t count;
+
+    static ConvexShape sphere(const vec3f &center, float radius);
+    static ConvexShape capsule(const vec3f &a, const vec3f &b, float radius);
+    static ConvexShape box(const vec3f &center, const vec3f &extents,
+                           const Matrix3f &rotation);
+    static ConvexShape hull(const vec3f *points, size_t count,
+                            const vec3f &center, const Matrix3f &rotation);
+
+    /// Farthest point of the core along d, d needn't be normalized
+    vec3f coreSupport(const vec3f &d) const;
+
+    /// Farthest point of the shape along d
+    vec3f support(const vec3f &d) const;
+};
+
+/// Result of a query between shapes a and b
+struct Contact {
+    vec3f pointA, pointB;       // closest or deepest points on each shape
+    vec3f normal;               // unit, from a to b
+    float distance;             // negative penetration depth on overlap
+};
+
+/// GJK state kept between frames for one pair. Holds the directions the
+/// last simplex was found along, the next query starts from the simplex
+/// they give on the moved shapes, which usually ends GJK in an iteration
+/// or two. Zero initialized is empty.
+struct GjkCache {
+    vec3f dirs[4];
+    int count;
+
+    GjkCache()
+        : count(0)
+    {}
+};
+
+/// Distance and closest points of a and b with GJK. Returns true if the
+/// shapes overlap, then distance and normal are only filled in when the
+/// overlap is within the radii, otherwise distance is 0 and the normal
+/// is meaningless; use penetration() for those. cache may be NULL.
+bool closestPoints(const ConvexShape &a, const ConvexShape &b, Contact &out,
+                   GjkCache *cache = NULL);
+
+/// closestPoints(), with EPA to find the depth, normal and deepest
+/// points when the cores overlap. EPA runs on the cores too and adds
+/// the radii, so the rounded shapes don't need a finely tessellated
+/// polytope.
+bool penetration(const ConvexShape &a, const ConvexShape &b, Contact &out,
+                 GjkCache *cache = NULL);
+
+/// penetration() for pairs (a[i], b[i]) laid out contiguously, e.g. as
+/// gathered from the broad phase. caches is NULL or count entries.
+/// Returns the number of overlapping pairs.
+size_t penetration(const ConvexShape *a, const ConvexShape *b, Contact *out,
+                   GjkCache *caches, size_t count);
+
+}; // namespace math
+
+#endif
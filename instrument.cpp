@@ -0,0 +1,263 @@
+#include "instrument.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GFXMATH_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define GFXMATH_RDTSC
+#endif
+
+namespace math {
+
+namespace {
+
+// Only the owning thread writes, so a relaxed load and store is enough
+// and compiles to a plain add, readers on other threads see whole values.
+// Resets never write them, see ThreadStats::baseline.
+typedef std::atomic<uint64_t> Counter;
+
+inline void add(Counter &c, uint64_t n)
+{
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct ThreadStats {
+    Counter counters[COUNTER_COUNT];
+    Counter timers[TIMER_COUNT][3];
+    Counter cullPlanes[6][3];
+    Counter cullBatch[3];
+
+    // Counts at the last reset, which readers subtract. Zeroing the
+    // counters from the resetting thread would race the owner's load and
+    // store and lose the reset. Guarded by the registry mutex.
+    InstrumentStats baseline;
+
+    ThreadStats();
+    ~ThreadStats();
+
+    void reset();
+    void snapshot(InstrumentStats &stats) const;
+    void addTo(InstrumentStats &stats) const;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadStats*> threads;
+    InstrumentStats retired;    // from threads that exited
+
+    Registry()
+    {
+        memset(&retired, 0, sizeof(retired));
+    }
+};
+
+Registry& registry()
+{
+    static Registry r;
+    return r;
+}
+
+// Only made by threadStats(), for the macros
+#ifdef GFXMATH_INSTRUMENT
+ThreadStats::ThreadStats()
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        counters[i].store(0, std::memory_order_relaxed);
+    for (int i = 0; i < TIMER_COUNT; i++)
+        for (int k = 0; k < 3; k++)
+            timers[i][k].store(0, std::memory_order_relaxed);
+    for (int p = 0; p < 6; p++)
+        for (int k = 0; k < 3; k++)
+            cullPlanes[p][k].store(0, std::memory_order_relaxed);
+    for (int k = 0; k < 3; k++)
+        cullBatch[k].store(0, std::memory_order_relaxed);
+    memset(&baseline, 0, sizeof(baseline));
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.push_back(this);
+}
+
+ThreadStats::~ThreadStats()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    addTo(r.retired);
+    for (size_t i = 0; i < r.threads.size(); i++) {
+        if (r.threads[i] == this) {
+            r.threads.erase(r.threads.begin() + i);
+            break;
+        }
+    }
+}
+#endif
+
+void ThreadStats::reset()
+{
+    snapshot(baseline);
+}
+
+void ThreadStats::snapshot(InstrumentStats &stats) const
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    for (int i = 0; i < COUNTER_COUNT; i++)
+        stats.counters[i] = counters[i].load(relaxed);
+    for (int i = 0; i < TIMER_COUNT; i++) {
+        stats.timers[i].calls = timers[i][0].load(relaxed);
+        stats.timers[i].items = timers[i][1].load(relaxed);
+        stats.timers[i].ticks = timers[i][2].load(relaxed);
+    }
+    for (int p = 0; p < 6; p++)
+        for (int k = 0; k < 3; k++)
+            stats.cullPlanes[p][k] = cullPlanes[p][k].load(relaxed);
+    for (int k = 0; k < 3; k++)
+        stats.cullBatch[k] = cullBatch[k].load(relaxed);
+}
+
+void ThreadStats::addTo(InstrumentStats &stats) const
+{
+    // Every field is a count, added word by word
+    static_assert(sizeof(InstrumentStats) % sizeof(uint64_t) == 0, "InstrumentStats has padding");
+    InstrumentStats now;
+    snapshot(now);
+    uint64_t *out = reinterpret_cast<uint64_t*>(&stats);
+    const uint64_t *n = reinterpret_cast<const uint64_t*>(&now);
+    const uint64_t *b = reinterpret_cast<const uint64_t*>(&baseline);
+    for (size_t k = 0; k < sizeof(InstrumentStats)/sizeof(uint64_t); k++)
+        out[k] += n[k] - b[k];
+}
+
+#ifdef GFXMATH_INSTRUMENT
+ThreadStats& threadStats()
+{
+    static thread_local ThreadStats stats;
+    return stats;
+}
+#endif
+
+// Hook and user pointer published together, so a timer never pairs the
+// new hook with the old pointer. Replaced ones are never freed, a timer
+// may still be calling through them, and hooks change rarely.
+struct Hook {
+    instr_hook_t hook;
+    void *user;
+};
+
+std::atomic<const Hook*> g_hook(NULL);
+
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "Frustum::reset",
+    "Matrix::operator*",
+    "Quaternion::toMatrix",
+    "Frustum::containsPoint",
+    "Frustum::containsSphere"
+};
+
+const char* const TIMER_NAMES[TIMER_COUNT] = {
+    "multiply",
+    "transformPoints",
+    "cullSpheres",
+    "toMatrices",
+    "fromMatrices",
+    "project",
+    "Animation::sample",
+    "cullCones",
+    "cullCapsules",
+    "depthKeys",
+    "radixSort",
+    "cullSpheresLod"
+};
+
+}; // namespace
+
+InstrumentStats instrumentStats()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    InstrumentStats stats = r.retired;
+    for (size_t i = 0; i < r.threads.size(); i++)
+        r.threads[i]->addTo(stats);
+    return stats;
+}
+
+void resetInstrumentStats()
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    memset(&r.retired, 0, sizeof(r.retired));
+    for (size_t i = 0; i < r.threads.size(); i++)
+        r.threads[i]->reset();
+}
+
+const char* counterName(instr_counter_t counter)
+{
+    return counter < COUNTER_COUNT ? COUNTER_NAMES[counter] : "unknown";
+}
+
+const char* timerName(instr_timer_t timer)
+{
+    return timer < TIMER_COUNT ? TIMER_NAMES[timer] : "unknown";
+}
+
+void setInstrumentHook(instr_hook_t hook, void *user)
+{
+    g_hook.store(hook ? new Hook{hook, user} : NULL, std::memory_order_release);
+}
+
+namespace instr {
+
+uint64_t ticks()
+{
+#ifdef GFXMATH_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// The macros' entry points only exist in an instrumented library, so
+// instrumented clients don't link against one built without
+#ifdef GFXMATH_INSTRUMENT
+void count(instr_counter_t counter)
+{
+    add(threadStats().counters[counter], 1);
+}
+
+void cull(int plane, int outcome)
+{
+    add(threadStats().cullPlanes[plane][outcome], 1);
+}
+
+void cullBatch(const uint8_t *results, size_t count)
+{
+    uint64_t n[3] = { 0, 0, 0 };
+    for (size_t i = 0; i < count; i++)
+        n[results[i]]++;
+    ThreadStats &stats = threadStats();
+    for (int k = 0; k < 3; k++)
+        add(stats.cullBatch[k], n[k]);
+}
+
+void timed(instr_timer_t timer, uint64_t ticks, size_t items)
+{
+    ThreadStats &stats = threadStats();
+    add(stats.timers[timer][0], 1);
+    add(stats.timers[timer][1], items);
+    add(stats.timers[timer][2], ticks);
+
+    const Hook *hook = g_hook.load(std::memory_order_acquire);
+    if (hook)
+        hook->hook(timer, ticks, items, hook->user);
+}
+#endif // GFXMATH_INSTRUMENT
+
+}; // namespace instr
+
+}; // namespace math
@@ -0,0 +1,124 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Opt-in instrumentation of the hot paths. Build with GFXMATH_INSTRUMENT
+// defined to enable the GFXMATH_* macros below, otherwise they expand to
+// nothing. The query and hook API is always there and reports zeros when
+// disabled. Counters are per thread and summed by instrumentStats().
+//
+// Inline code in the headers is instrumented too (Matrix::operator*), so
+// GFXMATH_INSTRUMENT must be defined the same way for the library and
+// every file including its headers. Otherwise those functions differ
+// between files, which breaks the one definition rule, and counts go
+// missing. Instrumented clients fail to link against a library built
+// without it.
+
+namespace math {
+
+typedef enum {
+    COUNT_FRUSTUM_RESET,
+    COUNT_MATRIX_MULTIPLY,
+    COUNT_QUATERNION_TO_MATRIX,
+    COUNT_CONTAINS_POINT,
+    COUNT_CONTAINS_SPHERE,
+    COUNTER_COUNT
+} instr_counter_t;
+
+/// Batched kernels timed with the cycle counter
+typedef enum {
+    TIMER_MULTIPLY,
+    TIMER_TRANSFORM_POINTS,
+    TIMER_CULL_SPHERES,
+    TIMER_TO_MATRICES,
+    TIMER_FROM_MATRICES,
+    TIMER_PROJECT,
+    TIMER_ANIMATION_SAMPLE,
+    TIMER_CULL_CONES,
+    TIMER_CULL_CAPSULES,
+    TIMER_DEPTH_KEYS,
+    TIMER_RADIX_SORT,
+    TIMER_CULL_SPHERES_LOD,
+    TIMER_COUNT
+} instr_timer_t;
+
+struct TimerStats {
+    uint64_t calls;
+    uint64_t items;
+    uint64_t ticks;     // rdtsc cycles on x86, nanoseconds elsewhere
+};
+
+struct InstrumentStats {
+    uint64_t counters[COUNTER_COUNT];
+    TimerStats timers[TIMER_COUNT];
+
+    /// Frustum::containsSphere outcomes by the plane (near, far, top,
+    /// bottom, left, right) it returned at, indexed by intersection_t.
+    /// INSIDE is counted at the last plane.
+    uint64_t cullPlanes[6][3];
+
+    /// Frustum::containsSpheres results, indexed by intersection_t
+    uint64_t cullBatch[3];
+};
+
+/// Sum of all threads since the last reset
+InstrumentStats instrumentStats();
+
+void resetInstrumentStats();
+
+const char* counterName(instr_counter_t counter);
+const char* timerName(instr_timer_t timer);
+
+/// Called after every timed kernel on the thread that ran it, NULL to
+/// remove. Use it to forward spans to an external tracer.
+typedef void (*instr_hook_t)(instr_timer_t timer, uint64_t ticks,
+                             size_t items, void *user);
+void setInstrumentHook(instr_hook_t hook, void *user);
+
+namespace instr {
+
+// Implementation details used by the macros
+
+void count(instr_counter_t counter);
+void cull(int plane, int outcome);
+void cullBatch(const uint8_t *results, size_t count);
+uint64_t ticks();
+void timed(instr_timer_t timer, uint64_t ticks, size_t items);
+
+class ScopedTimer {
+public:
+    ScopedTimer(instr_timer_t timer, size_t items)
+        : m_timer(timer), m_items(items), m_start(ticks())
+    {}
+
+    ~ScopedTimer()
+    {
+        timed(m_timer, ticks() - m_start, m_items);
+    }
+
+private:
+    instr_timer_t m_timer;
+    size_t m_items;
+    uint64_t m_start;
+};
+
+}; // namespace instr
+
+}; // namespace math
+
+#ifdef GFXMATH_INSTRUMENT
+#define GFXMATH_COUNT(counter) ::math::instr::count(counter)
+#define GFXMATH_CULL(plane, outcome) ::math::instr::cull(plane, outcome)
+#define GFXMATH_CULL_BATCH(results, count) ::math::instr::cullBatch(results, count)
+#define GFXMATH_TIME(timer, items) \
+    ::math::instr::ScopedTimer gfxmath_scoped_timer(timer, items)
+#else
+#define GFXMATH_COUNT(counter) ((void)0)
+#define GFXMATH_CULL(plane, outcome) ((void)0)
+#define GFXMATH_CULL_BATCH(results, count) ((void)0)
+#define GFXMATH_TIME(timer, items) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,837 @@
+#include <algorithm>
+#include <string.h>
+
+#include "kernels.h"
+#include "frustum.h"
+#include "radixsort.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GFXMATH_X86
+#define TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define GFXMATH_X86
+#define TARGET(isa)
+#endif
+
+#ifdef GFXMATH_X86
+#include <immintrin.h>
+#endif
+
+namespace math {
+
+static inline void writeClasses(uint8_t *result, unsigned outside,
+                                unsigned intersect, int n)
+{
+    for (int k = 0; k < n; k++) {
+        if ((outside >> k) & 1)
+            result[k] = OUTSIDE;
+        else
+            result[k] = (intersect >> k) & 1 ? INTERSECT : INSIDE;
+    }
+}
+
+/////
+
+static void multiplyScalar(const Matrix4f *a, const Matrix4f *b,
+                           Matrix4f *out, size_t count)
+{
+    for (size_t n = 0; n < count; n++) {
+        float r[4][4];
+        for (int j = 0; j < 4; j++)
+            for (int i = 0; i < 4; i++)
+                r[j][i] = a[n][0][i]*b[n][j][0] + a[n][1][i]*b[n][j][1]
+                        + a[n][2][i]*b[n][j][2] + a[n][3][i]*b[n][j][3];
+        out[n] = Matrix4f(r[0]);
+    }
+}
+
+static void transformPointsScalar(const Matrix4f &m,
+                                  const float *x, const float *y, const float *z,
+                                  float *ox, float *oy, float *oz, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        float px = x[i], py = y[i], pz = z[i];
+        ox[i] = m[0][0]*px + m[1][0]*py + m[2][0]*pz + m[3][0];
+        oy[i] = m[0][1]*px + m[1][1]*py + m[2][1]*pz + m[3][1];
+        oz[i] = m[0][2]*px + m[1][2]*py + m[2][2]*pz + m[3][2];
+    }
+}
+
+static void cullSpheresScalar(const vec4f planes[6],
+                              const float *x, const float *y, const float *z,
+                              const float *r, uint8_t *result, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        unsigned outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            float d = pl[0]*x[i] + pl[1]*y[i] + pl[2]*z[i] + pl[3];
+            outside |= d < -r[i];
+            intersect |= d < r[i];
+        }
+        writeClasses(result+i, outside, intersect, 1);
+    }
+}
+
+// Lane pointers advanced past the first i elements, for the tails. The
+// first n of at most Lanes for a varying number of lanes.
+template <size_t Lanes>
+struct LanesFrom {
+    const float *p[Lanes];
+
+    LanesFrom(const float *const *lanes, size_t i, size_t n = Lanes)
+    {
+        for (size_t k = 0; k < n; k++)
+            p[k] = lanes[k] + i;
+    }
+};
+
+// Sizes compare as pixels*depth, r*pixels < t*depth, to stay clear of
+// dividing by depth
+static void cullSpheresLodScalar(const vec4f planes[6], const ScreenScale &scale,
+                                 float minPixels, const float *x, const float *y,
+                                 const float *z, const float *r,
+                                 const float *const thresholds[], int levels,
+                                 uint8_t *result, uint8_t *lod, size_t count)
+{
+    const vec4f &dp = scale.depthPlane;
+    for (size_t i = 0; i < count; i++) {
+        unsigned outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            float d = pl[0]*x[i] + pl[1]*y[i] + pl[2]*z[i] + pl[3];
+            outside |= d < -r[i];
+            intersect |= d < r[i];
+        }
+        float depth = std::max(dp[0]*x[i] + dp[1]*y[i] + dp[2]*z[i] + dp[3], scale.minDepth);
+        float size = r[i]*scale.pixels;
+        outside |= size < minPixels*depth;
+        int level = 0;
+        for (int k = 0; k < levels; k++)
+            level += size < thresholds[k][i]*depth;
+        lod[i] = uint8_t(level);
+        writeClasses(result+i, outside, intersect, 1);
+    }
+}
+
+// Nearest and farthest point of a cone from a plane: the apex, or the
+// base disc reaching out radius*sin(angle to the normal) from its center
+static void cullConesScalar(const vec4f planes[6], const float *const c[8],
+                            uint8_t *result, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        unsigned outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            float da = pl[0]*c[0][i] + pl[1]*c[1][i] + pl[2]*c[2][i] + pl[3];
+            float na = pl[0]*c[4][i] + pl[1]*c[5][i] + pl[2]*c[6][i];
+            float db = da + c[3][i]*na;
+            float k = c[7][i]*sqrtf(std::max(1.0f - na*na, 0.0f));
+            outside |= std::max(da, db + k) < 0.0f;
+            intersect |= std::min(da, db - k) < 0.0f;
+        }
+        writeClasses(result+i, outside, intersect, 1);
+    }
+}
+
+static void cullCapsulesScalar(const vec4f planes[6], const float *const c[7],
+                               uint8_t *result, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        unsigned outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            float da = pl[0]*c[0][i] + pl[1]*c[1][i] + pl[2]*c[2][i] + pl[3];
+            float db = pl[0]*c[3][i] + pl[1]*c[4][i] + pl[2]*c[5][i] + pl[3];
+            outside |= std::max(da, db) < -c[6][i];
+            intersect |= std::min(da, db) < c[6][i];
+        }
+        writeClasses(result+i, outside, intersect, 1);
+    }
+}
+
+static void depthKeysScalar(const vec4f &plane, const float *x, const float *y,
+                            const float *z, uint32_t flip, uint32_t *keys, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        float d = plane[0]*x[i] + plane[1]*y[i] + plane[2]*z[i] + plane[3];
+        keys[i] = floatKey(d) ^ flip;
+    }
+}
+
+#ifdef GFXMATH_X86
+
+/////
+
+TARGET("sse2")
+static void multiplySSE2(const Matrix4f *a, const Matrix4f *b,
+                         Matrix4f *out, size_t count)
+{
+    for (size_t n = 0; n < count; n++) {
+        __m128 a0 = _mm_load_ps(a[n][0]);
+        __m128 a1 = _mm_load_ps(a[n][1]);
+        __m128 a2 = _mm_load_ps(a[n][2]);
+        __m128 a3 = _mm_load_ps(a[n][3]);
+        __m128 r[4];
+        for (int j = 0; j < 4; j++) {
+            const float *c = b[n][j];
+            r[j] = _mm_mul_ps(a0, _mm_set1_ps(c[0]));
+            r[j] = _mm_add_ps(r[j], _mm_mul_ps(a1, _mm_set1_ps(c[1])));
+            r[j] = _mm_add_ps(r[j], _mm_mul_ps(a2, _mm_set1_ps(c[2])));
+            r[j] = _mm_add_ps(r[j], _mm_mul_ps(a3, _mm_set1_ps(c[3])));
+        }
+        for (int j = 0; j < 4; j++)
+            _mm_store_ps(out[n][j], r[j]);
+    }
+}
+
+TARGET("sse2")
+static void transformPointsSSE2(const Matrix4f &m,
+                                const float *x, const float *y, const float *z,
+                                float *ox, float *oy, float *oz, size_t count)
+{
+    size_t i = 0;
+    for (; i+4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x+i);
+        __m128 py = _mm_loadu_ps(y+i);
+        __m128 pz = _mm_loadu_ps(z+i);
+        __m128 r[3];
+        for (int k = 0; k < 3; k++) {
+            r[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][k]), px), _mm_set1_ps(m[3][k]));
+            r[k] = _mm_add_ps(r[k], _mm_mul_ps(_mm_set1_ps(m[1][k]), py));
+            r[k] = _mm_add_ps(r[k], _mm_mul_ps(_mm_set1_ps(m[2][k]), pz));
+        }
+        _mm_storeu_ps(ox+i, r[0]);
+        _mm_storeu_ps(oy+i, r[1]);
+        _mm_storeu_ps(oz+i, r[2]);
+    }
+    transformPointsScalar(m, x+i, y+i, z+i, ox+i, oy+i, oz+i, count-i);
+}
+
+TARGET("sse2")
+static void cullSpheresSSE2(const vec4f planes[6],
+                            const float *x, const float *y, const float *z,
+                            const float *r, uint8_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i+4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x+i);
+        __m128 py = _mm_loadu_ps(y+i);
+        __m128 pz = _mm_loadu_ps(z+i);
+        __m128 pr = _mm_loadu_ps(r+i);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), pr);
+        __m128 outside = _mm_setzero_ps();
+        __m128 intersect = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl[0]), px), _mm_set1_ps(pl[3]));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl[1]), py));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl[2]), pz));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, nr));
+            intersect = _mm_or_ps(intersect, _mm_cmplt_ps(d, pr));
+        }
+        writeClasses(result+i, _mm_movemask_ps(outside), _mm_movemask_ps(intersect), 4);
+    }
+    cullSpheresScalar(planes, x+i, y+i, z+i, r+i, result+i, count-i);
+}
+
+TARGET("sse2")
+static void cullSpheresLodSSE2(const vec4f planes[6], const ScreenScale &scale,
+                               float minPixels, const float *x, const float *y,
+                               const float *z, const float *r,
+                               const float *const thresholds[], int levels,
+                               uint8_t *result, uint8_t *lod, size_t count)
+{
+    const vec4f &dp = scale.depthPlane;
+    size_t i = 0;
+    for (; i+4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x+i);
+        __m128 py = _mm_loadu_ps(y+i);
+        __m128 pz = _mm_loadu_ps(z+i);
+        __m128 pr = _mm_loadu_ps(r+i);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), pr);
+        __m128 outside = _mm_setzero_ps();
+        __m128 intersect = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(pl[0]), px), _mm_set1_ps(pl[3]));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl[1]), py));
+            d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(pl[2]), pz));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, nr));
+            intersect = _mm_or_ps(intersect, _mm_cmplt_ps(d, pr));
+        }
+        __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dp[0]), px), _mm_set1_ps(dp[3]));
+        depth = _mm_add_ps(depth, _mm_mul_ps(_mm_set1_ps(dp[1]), py));
+        depth = _mm_add_ps(depth, _mm_mul_ps(_mm_set1_ps(dp[2]), pz));
+        depth = _mm_max_ps(depth, _mm_set1_ps(scale.minDepth));
+        __m128 size = _mm_mul_ps(pr, _mm_set1_ps(scale.pixels));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(size, _mm_mul_ps(_mm_set1_ps(minPixels), depth)));
+        __m128i level = _mm_setzero_si128();
+        for (int k = 0; k < levels; k++) {
+            __m128 t = _mm_mul_ps(_mm_loadu_ps(thresholds[k]+i), depth);
+            level = _mm_sub_epi32(level, _mm_castps_si128(_mm_cmplt_ps(size, t)));
+        }
+        level = _mm_packs_epi32(level, level);
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(level, level));
+        memcpy(lod+i, &bytes, 4);
+        writeClasses(result+i, _mm_movemask_ps(outside), _mm_movemask_ps(intersect), 4);
+    }
+    cullSpheresLodScalar(planes, scale, minPixels, x+i, y+i, z+i, r+i,
+                         LanesFrom<LOD_LEVELS_MAX>(thresholds, i, levels).p, levels,
+                         result+i, lod+i, count-i);
+}
+
+TARGET("sse2")
+static void cullConesSSE2(const vec4f planes[6], const float *const c[8],
+                          uint8_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i+4 <= count; i += 4) {
+        __m128 ax = _mm_loadu_ps(c[0]+i), ay = _mm_loadu_ps(c[1]+i), az = _mm_loadu_ps(c[2]+i);
+        __m128 h = _mm_loadu_ps(c[3]+i);
+        __m128 dx = _mm_loadu_ps(c[4]+i), dy = _mm_loadu_ps(c[5]+i), dz = _mm_loadu_ps(c[6]+i);
+        __m128 r = _mm_loadu_ps(c[7]+i);
+        __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        __m128 outside = zero, intersect = zero;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m128 nx = _mm_set1_ps(pl[0]), ny = _mm_set1_ps(pl[1]), nz = _mm_set1_ps(pl[2]);
+            __m128 da = _mm_add_ps(_mm_mul_ps(nx, ax), _mm_set1_ps(pl[3]));
+            da = _mm_add_ps(da, _mm_mul_ps(ny, ay));
+            da = _mm_add_ps(da, _mm_mul_ps(nz, az));
+            __m128 na = _mm_mul_ps(nx, dx);
+            na = _mm_add_ps(na, _mm_mul_ps(ny, dy));
+            na = _mm_add_ps(na, _mm_mul_ps(nz, dz));
+            __m128 db = _mm_add_ps(da, _mm_mul_ps(h, na));
+            __m128 k = _mm_sub_ps(one, _mm_mul_ps(na, na));
+            k = _mm_mul_ps(r, _mm_sqrt_ps(_mm_max_ps(k, zero)));
+            __m128 hi = _mm_max_ps(da, _mm_add_ps(db, k));
+            __m128 lo = _mm_min_ps(da, _mm_sub_ps(db, k));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(hi, zero));
+            intersect = _mm_or_ps(intersect, _mm_cmplt_ps(lo, zero));
+        }
+        writeClasses(result+i, _mm_movemask_ps(outside), _mm_movemask_ps(intersect), 4);
+    }
+    cullConesScalar(planes, LanesFrom<8>(c, i).p, result+i, count-i);
+}
+
+TARGET("sse2")
+static void cullCapsulesSSE2(const vec4f planes[6], const float *const c[7],
+                             uint8_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i+4 <= count; i += 4) {
+        __m128 ax = _mm_loadu_ps(c[0]+i), ay = _mm_loadu_ps(c[1]+i), az = _mm_loadu_ps(c[2]+i);
+        __m128 bx = _mm_loadu_ps(c[3]+i), by = _mm_loadu_ps(c[4]+i), bz = _mm_loadu_ps(c[5]+i);
+        __m128 r = _mm_loadu_ps(c[6]+i);
+        __m128 nr = _mm_sub_ps(_mm_setzero_ps(), r);
+        __m128 outside = _mm_setzero_ps(), intersect = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m128 nx = _mm_set1_ps(pl[0]), ny = _mm_set1_ps(pl[1]), nz = _mm_set1_ps(pl[2]);
+            __m128 d = _mm_set1_ps(pl[3]);
+            __m128 da = _mm_add_ps(_mm_mul_ps(nx, ax), d);
+            da = _mm_add_ps(da, _mm_mul_ps(ny, ay));
+            da = _mm_add_ps(da, _mm_mul_ps(nz, az));
+            __m128 db = _mm_add_ps(_mm_mul_ps(nx, bx), d);
+            db = _mm_add_ps(db, _mm_mul_ps(ny, by));
+            db = _mm_add_ps(db, _mm_mul_ps(nz, bz));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_max_ps(da, db), nr));
+            intersect = _mm_or_ps(intersect, _mm_cmplt_ps(_mm_min_ps(da, db), r));
+        }
+        writeClasses(result+i, _mm_movemask_ps(outside), _mm_movemask_ps(intersect), 4);
+    }
+    cullCapsulesScalar(planes, LanesFrom<7>(c, i).p, result+i, count-i);
+}
+
+TARGET("sse2")
+static void depthKeysSSE2(const vec4f &plane, const float *x, const float *y,
+                          const float *z, uint32_t flip, uint32_t *keys, size_t count)
+{
+    __m128 nx = _mm_set1_ps(plane[0]), ny = _mm_set1_ps(plane[1]);
+    __m128 nz = _mm_set1_ps(plane[2]), nd = _mm_set1_ps(plane[3]);
+    __m128i sign = _mm_set1_epi32(int(0x80000000u)), f = _mm_set1_epi32(int(flip));
+    size_t i = 0;
+    for (; i+4 <= count; i += 4) {
+        __m128 d = _mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(x+i)), nd);
+        d = _mm_add_ps(d, _mm_mul_ps(ny, _mm_loadu_ps(y+i)));
+        d = _mm_add_ps(d, _mm_mul_ps(nz, _mm_loadu_ps(z+i)));
+        __m128i u = _mm_castps_si128(d);
+        __m128i mask = _mm_or_si128(_mm_srai_epi32(u, 31), sign);
+        _mm_storeu_si128((__m128i*)(keys+i), _mm_xor_si128(u, _mm_xor_si128(mask, f)));
+    }
+    depthKeysScalar(plane, x+i, y+i, z+i, flip, keys+i, count-i);
+}
+
+/////
+
+// Two columns per register: in-lane permutes broadcast b[j][k] and
+// b[j+1][k] to the low and high halves
+TARGET("avx2,fma")
+static void multiplyAVX2(const Matrix4f *a, const Matrix4f *b,
+                         Matrix4f *out, size_t count)
+{
+    for (size_t n = 0; n < count; n++) {
+        __m256 a0 = _mm256_broadcast_ps((const __m128*)a[n][0]);
+        __m256 a1 = _mm256_broadcast_ps((const __m128*)a[n][1]);
+        __m256 a2 = _mm256_broadcast_ps((const __m128*)a[n][2]);
+        __m256 a3 = _mm256_broadcast_ps((const __m128*)a[n][3]);
+        __m256 b01 = _mm256_loadu_ps(b[n][0]);
+        __m256 b23 = _mm256_loadu_ps(b[n][2]);
+
+        __m256 r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00));
+        r01 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b01, 0x55), r01);
+        r01 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b01, 0xaa), r01);
+        r01 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b01, 0xff), r01);
+
+        __m256 r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00));
+        r23 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b23, 0x55), r23);
+        r23 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b23, 0xaa), r23);
+        r23 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b23, 0xff), r23);
+
+        _mm256_storeu_ps(out[n][0], r01);
+        _mm256_storeu_ps(out[n][2], r23);
+    }
+}
+
+TARGET("avx2,fma")
+static void transformPointsAVX2(const Matrix4f &m,
+                                const float *x, const float *y, const float *z,
+                                float *ox, float *oy, float *oz, size_t count)
+{
+    size_t i = 0;
+    for (; i+8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x+i);
+        __m256 py = _mm256_loadu_ps(y+i);
+        __m256 pz = _mm256_loadu_ps(z+i);
+        __m256 r[3];
+        for (int k = 0; k < 3; k++) {
+            r[k] = _mm256_fmadd_ps(_mm256_set1_ps(m[0][k]), px, _mm256_set1_ps(m[3][k]));
+            r[k] = _mm256_fmadd_ps(_mm256_set1_ps(m[1][k]), py, r[k]);
+            r[k] = _mm256_fmadd_ps(_mm256_set1_ps(m[2][k]), pz, r[k]);
+        }
+        _mm256_storeu_ps(ox+i, r[0]);
+        _mm256_storeu_ps(oy+i, r[1]);
+        _mm256_storeu_ps(oz+i, r[2]);
+    }
+    transformPointsSSE2(m, x+i, y+i, z+i, ox+i, oy+i, oz+i, count-i);
+}
+
+TARGET("avx2,fma")
+static void cullSpheresAVX2(const vec4f planes[6],
+                            const float *x, const float *y, const float *z,
+                            const float *r, uint8_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i+8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x+i);
+        __m256 py = _mm256_loadu_ps(y+i);
+        __m256 pz = _mm256_loadu_ps(z+i);
+        __m256 pr = _mm256_loadu_ps(r+i);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), pr);
+        __m256 outside = _mm256_setzero_ps();
+        __m256 intersect = _mm256_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m256 d = _mm256_fmadd_ps(_mm256_set1_ps(pl[0]), px, _mm256_set1_ps(pl[3]));
+            d = _mm256_fmadd_ps(_mm256_set1_ps(pl[1]), py, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(pl[2]), pz, d);
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, nr, _CMP_LT_OQ));
+            intersect = _mm256_or_ps(intersect, _mm256_cmp_ps(d, pr, _CMP_LT_OQ));
+        }
+        writeClasses(result+i, _mm256_movemask_ps(outside),
+                     _mm256_movemask_ps(intersect), 8);
+    }
+    cullSpheresSSE2(planes, x+i, y+i, z+i, r+i, result+i, count-i);
+}
+
+TARGET("avx2,fma")
+static void cullSpheresLodAVX2(const vec4f planes[6], const ScreenScale &scale,
+                               float minPixels, const float *x, const float *y,
+                               const float *z, const float *r,
+                               const float *const thresholds[], int levels,
+                               uint8_t *result, uint8_t *lod, size_t count)
+{
+    const vec4f &dp = scale.depthPlane;
+    size_t i = 0;
+    for (; i+8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x+i);
+        __m256 py = _mm256_loadu_ps(y+i);
+        __m256 pz = _mm256_loadu_ps(z+i);
+        __m256 pr = _mm256_loadu_ps(r+i);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), pr);
+        __m256 outside = _mm256_setzero_ps();
+        __m256 intersect = _mm256_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m256 d = _mm256_fmadd_ps(_mm256_set1_ps(pl[0]), px, _mm256_set1_ps(pl[3]));
+            d = _mm256_fmadd_ps(_mm256_set1_ps(pl[1]), py, d);
+            d = _mm256_fmadd_ps(_mm256_set1_ps(pl[2]), pz, d);
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, nr, _CMP_LT_OQ));
+            intersect = _mm256_or_ps(intersect, _mm256_cmp_ps(d, pr, _CMP_LT_OQ));
+        }
+        __m256 depth = _mm256_fmadd_ps(_mm256_set1_ps(dp[0]), px, _mm256_set1_ps(dp[3]));
+        depth = _mm256_fmadd_ps(_mm256_set1_ps(dp[1]), py, depth);
+        depth = _mm256_fmadd_ps(_mm256_set1_ps(dp[2]), pz, depth);
+        depth = _mm256_max_ps(depth, _mm256_set1_ps(scale.minDepth));
+        __m256 size = _mm256_mul_ps(pr, _mm256_set1_ps(scale.pixels));
+        __m256 small = _mm256_cmp_ps(size, _mm256_mul_ps(_mm256_set1_ps(minPixels), depth), _CMP_LT_OQ);
+        outside = _mm256_or_ps(outside, small);
+        __m256i level = _mm256_setzero_si256();
+        for (int k = 0; k < levels; k++) {
+            __m256 t = _mm256_mul_ps(_mm256_loadu_ps(thresholds[k]+i), depth);
+            level = _mm256_sub_epi32(level, _mm256_castps_si256(_mm256_cmp_ps(size, t, _CMP_LT_OQ)));
+        }
+        __m128i level16 = _mm_packs_epi32(_mm256_castsi256_si128(level),
+                                          _mm256_extracti128_si256(level, 1));
+        _mm_storel_epi64((__m128i*)(lod+i), _mm_packus_epi16(level16, level16));
+        writeClasses(result+i, _mm256_movemask_ps(outside),
+                     _mm256_movemask_ps(intersect), 8);
+    }
+    cullSpheresLodSSE2(planes, scale, minPixels, x+i, y+i, z+i, r+i,
+                       LanesFrom<LOD_LEVELS_MAX>(thresholds, i, levels).p, levels,
+                       result+i, lod+i, count-i);
+}
+
+TARGET("avx2,fma")
+static void cullConesAVX2(const vec4f planes[6], const float *const c[8],
+                          uint8_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i+8 <= count; i += 8) {
+        __m256 ax = _mm256_loadu_ps(c[0]+i), ay = _mm256_loadu_ps(c[1]+i);
+        __m256 az = _mm256_loadu_ps(c[2]+i), h = _mm256_loadu_ps(c[3]+i);
+        __m256 dx = _mm256_loadu_ps(c[4]+i), dy = _mm256_loadu_ps(c[5]+i);
+        __m256 dz = _mm256_loadu_ps(c[6]+i), r = _mm256_loadu_ps(c[7]+i);
+        __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+        __m256 outside = zero, intersect = zero;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m256 nx = _mm256_set1_ps(pl[0]), ny = _mm256_set1_ps(pl[1]), nz = _mm256_set1_ps(pl[2]);
+            __m256 da = _mm256_fmadd_ps(nx, ax, _mm256_set1_ps(pl[3]));
+            da = _mm256_fmadd_ps(ny, ay, da);
+            da = _mm256_fmadd_ps(nz, az, da);
+            __m256 na = _mm256_mul_ps(nx, dx);
+            na = _mm256_fmadd_ps(ny, dy, na);
+            na = _mm256_fmadd_ps(nz, dz, na);
+            __m256 db = _mm256_fmadd_ps(h, na, da);
+            __m256 k = _mm256_fnmadd_ps(na, na, one);
+            k = _mm256_mul_ps(r, _mm256_sqrt_ps(_mm256_max_ps(k, zero)));
+            __m256 hi = _mm256_max_ps(da, _mm256_add_ps(db, k));
+            __m256 lo = _mm256_min_ps(da, _mm256_sub_ps(db, k));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(hi, zero, _CMP_LT_OQ));
+            intersect = _mm256_or_ps(intersect, _mm256_cmp_ps(lo, zero, _CMP_LT_OQ));
+        }
+        writeClasses(result+i, _mm256_movemask_ps(outside),
+                     _mm256_movemask_ps(intersect), 8);
+    }
+    cullConesSSE2(planes, LanesFrom<8>(c, i).p, result+i, count-i);
+}
+
+TARGET("avx2,fma")
+static void cullCapsulesAVX2(const vec4f planes[6], const float *const c[7],
+                             uint8_t *result, size_t count)
+{
+    size_t i = 0;
+    for (; i+8 <= count; i += 8) {
+        __m256 ax = _mm256_loadu_ps(c[0]+i), ay = _mm256_loadu_ps(c[1]+i);
+        __m256 az = _mm256_loadu_ps(c[2]+i), bx = _mm256_loadu_ps(c[3]+i);
+        __m256 by = _mm256_loadu_ps(c[4]+i), bz = _mm256_loadu_ps(c[5]+i);
+        __m256 r = _mm256_loadu_ps(c[6]+i);
+        __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), r);
+        __m256 outside = _mm256_setzero_ps(), intersect = _mm256_setzero_ps();
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m256 nx = _mm256_set1_ps(pl[0]), ny = _mm256_set1_ps(pl[1]), nz = _mm256_set1_ps(pl[2]);
+            __m256 d = _mm256_set1_ps(pl[3]);
+            __m256 da = _mm256_fmadd_ps(nz, az, _mm256_fmadd_ps(ny, ay, _mm256_fmadd_ps(nx, ax, d)));
+            __m256 db = _mm256_fmadd_ps(nz, bz, _mm256_fmadd_ps(ny, by, _mm256_fmadd_ps(nx, bx, d)));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_max_ps(da, db), nr, _CMP_LT_OQ));
+            intersect = _mm256_or_ps(intersect, _mm256_cmp_ps(_mm256_min_ps(da, db), r, _CMP_LT_OQ));
+        }
+        writeClasses(result+i, _mm256_movemask_ps(outside),
+                     _mm256_movemask_ps(intersect), 8);
+    }
+    cullCapsulesSSE2(planes, LanesFrom<7>(c, i).p, result+i, count-i);
+}
+
+TARGET("avx2,fma")
+static void depthKeysAVX2(const vec4f &plane, const float *x, const float *y,
+                          const float *z, uint32_t flip, uint32_t *keys, size_t count)
+{
+    __m256 nx = _mm256_set1_ps(plane[0]), ny = _mm256_set1_ps(plane[1]);
+    __m256 nz = _mm256_set1_ps(plane[2]), nd = _mm256_set1_ps(plane[3]);
+    __m256i sign = _mm256_set1_epi32(int(0x80000000u)), f = _mm256_set1_epi32(int(flip));
+    size_t i = 0;
+    for (; i+8 <= count; i += 8) {
+        __m256 d = _mm256_fmadd_ps(nx, _mm256_loadu_ps(x+i), nd);
+        d = _mm256_fmadd_ps(ny, _mm256_loadu_ps(y+i), d);
+        d = _mm256_fmadd_ps(nz, _mm256_loadu_ps(z+i), d);
+        __m256i u = _mm256_castps_si256(d);
+        __m256i mask = _mm256_or_si256(_mm256_srai_epi32(u, 31), sign);
+        _mm256_storeu_si256((__m256i*)(keys+i), _mm256_xor_si256(u, _mm256_xor_si256(mask, f)));
+    }
+    depthKeysSSE2(plane, x+i, y+i, z+i, flip, keys+i, count-i);
+}
+
+/////
+
+// The whole matrix fits one register, columns of a are broadcast to all
+// four 128-bit lanes
+TARGET("avx512f")
+static void multiplyAVX512(const Matrix4f *a, const Matrix4f *b,
+                           Matrix4f *out, size_t count)
+{
+    for (size_t n = 0; n < count; n++) {
+        __m512 a0 = _mm512_maskz_broadcast_f32x4(0xffff, _mm_load_ps(a[n][0]));
+        __m512 a1 = _mm512_maskz_broadcast_f32x4(0xffff, _mm_load_ps(a[n][1]));
+        __m512 a2 = _mm512_maskz_broadcast_f32x4(0xffff, _mm_load_ps(a[n][2]));
+        __m512 a3 = _mm512_maskz_broadcast_f32x4(0xffff, _mm_load_ps(a[n][3]));
+        __m512 bb = _mm512_loadu_ps(b[n][0]);
+
+        __m512 r = _mm512_mul_ps(a0, _mm512_shuffle_ps(bb, bb, 0x00));
+        r = _mm512_fmadd_ps(a1, _mm512_shuffle_ps(bb, bb, 0x55), r);
+        r = _mm512_fmadd_ps(a2, _mm512_shuffle_ps(bb, bb, 0xaa), r);
+        r = _mm512_fmadd_ps(a3, _mm512_shuffle_ps(bb, bb, 0xff), r);
+
+        _mm512_storeu_ps(out[n][0], r);
+    }
+}
+
+TARGET("avx512f")
+static void transformPointsAVX512(const Matrix4f &m,
+                                  const float *x, const float *y, const float *z,
+                                  float *ox, float *oy, float *oz, size_t count)
+{
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count-i < 16 ? count-i : 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+        __m512 px = _mm512_maskz_loadu_ps(mask, x+i);
+        __m512 py = _mm512_maskz_loadu_ps(mask, y+i);
+        __m512 pz = _mm512_maskz_loadu_ps(mask, z+i);
+        __m512 r[3];
+        for (int k = 0; k < 3; k++) {
+            r[k] = _mm512_fmadd_ps(_mm512_set1_ps(m[0][k]), px, _mm512_set1_ps(m[3][k]));
+            r[k] = _mm512_fmadd_ps(_mm512_set1_ps(m[1][k]), py, r[k]);
+            r[k] = _mm512_fmadd_ps(_mm512_set1_ps(m[2][k]), pz, r[k]);
+        }
+        _mm512_mask_storeu_ps(ox+i, mask, r[0]);
+        _mm512_mask_storeu_ps(oy+i, mask, r[1]);
+        _mm512_mask_storeu_ps(oz+i, mask, r[2]);
+    }
+}
+
+TARGET("avx512f")
+static void cullSpheresAVX512(const vec4f planes[6],
+                              const float *x, const float *y, const float *z,
+                              const float *r, uint8_t *result, size_t count)
+{
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count-i < 16 ? count-i : 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+        __m512 px = _mm512_maskz_loadu_ps(mask, x+i);
+        __m512 py = _mm512_maskz_loadu_ps(mask, y+i);
+        __m512 pz = _mm512_maskz_loadu_ps(mask, z+i);
+        __m512 pr = _mm512_maskz_loadu_ps(mask, r+i);
+        __m512 nr = _mm512_sub_ps(_mm512_setzero_ps(), pr);
+        __mmask16 outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m512 d = _mm512_fmadd_ps(_mm512_set1_ps(pl[0]), px, _mm512_set1_ps(pl[3]));
+            d = _mm512_fmadd_ps(_mm512_set1_ps(pl[1]), py, d);
+            d = _mm512_fmadd_ps(_mm512_set1_ps(pl[2]), pz, d);
+            outside |= _mm512_cmp_ps_mask(d, nr, _CMP_LT_OQ);
+            intersect |= _mm512_cmp_ps_mask(d, pr, _CMP_LT_OQ);
+        }
+        writeClasses(result+i, outside, intersect, (int)n);
+    }
+}
+
+TARGET("avx512f")
+static void cullSpheresLodAVX512(const vec4f planes[6], const ScreenScale &scale,
+                                 float minPixels, const float *x, const float *y,
+                                 const float *z, const float *r,
+                                 const float *const thresholds[], int levels,
+                                 uint8_t *result, uint8_t *lod, size_t count)
+{
+    const vec4f &dp = scale.depthPlane;
+    __m512 minDepth = _mm512_set1_ps(scale.minDepth);
+    __m512i one = _mm512_set1_epi32(1);
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count-i < 16 ? count-i : 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+        __m512 px = _mm512_maskz_loadu_ps(mask, x+i);
+        __m512 py = _mm512_maskz_loadu_ps(mask, y+i);
+        __m512 pz = _mm512_maskz_loadu_ps(mask, z+i);
+        __m512 pr = _mm512_maskz_loadu_ps(mask, r+i);
+        __m512 nr = _mm512_sub_ps(_mm512_setzero_ps(), pr);
+        __mmask16 outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m512 d = _mm512_fmadd_ps(_mm512_set1_ps(pl[0]), px, _mm512_set1_ps(pl[3]));
+            d = _mm512_fmadd_ps(_mm512_set1_ps(pl[1]), py, d);
+            d = _mm512_fmadd_ps(_mm512_set1_ps(pl[2]), pz, d);
+            outside |= _mm512_cmp_ps_mask(d, nr, _CMP_LT_OQ);
+            intersect |= _mm512_cmp_ps_mask(d, pr, _CMP_LT_OQ);
+        }
+        __m512 depth = _mm512_fmadd_ps(_mm512_set1_ps(dp[0]), px, _mm512_set1_ps(dp[3]));
+        depth = _mm512_fmadd_ps(_mm512_set1_ps(dp[1]), py, depth);
+        depth = _mm512_fmadd_ps(_mm512_set1_ps(dp[2]), pz, depth);
+        depth = _mm512_mask_mov_ps(depth, _mm512_cmp_ps_mask(depth, minDepth, _CMP_LT_OQ), minDepth);
+        __m512 size = _mm512_mul_ps(pr, _mm512_set1_ps(scale.pixels));
+        outside |= _mm512_cmp_ps_mask(size, _mm512_mul_ps(_mm512_set1_ps(minPixels), depth), _CMP_LT_OQ);
+        __m512i level = _mm512_setzero_si512();
+        for (int k = 0; k < levels; k++) {
+            __m512 t = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, thresholds[k]+i), depth);
+            level = _mm512_mask_add_epi32(level, _mm512_cmp_ps_mask(size, t, _CMP_LT_OQ), level, one);
+        }
+        _mm512_mask_cvtepi32_storeu_epi8(lod+i, mask, level);
+        writeClasses(result+i, outside, intersect, (int)n);
+    }
+}
+
+TARGET("avx512f")
+static void cullConesAVX512(const vec4f planes[6], const float *const c[8],
+                            uint8_t *result, size_t count)
+{
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count-i < 16 ? count-i : 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+        __m512 ax = _mm512_maskz_loadu_ps(mask, c[0]+i), ay = _mm512_maskz_loadu_ps(mask, c[1]+i);
+        __m512 az = _mm512_maskz_loadu_ps(mask, c[2]+i), h = _mm512_maskz_loadu_ps(mask, c[3]+i);
+        __m512 dx = _mm512_maskz_loadu_ps(mask, c[4]+i), dy = _mm512_maskz_loadu_ps(mask, c[5]+i);
+        __m512 dz = _mm512_maskz_loadu_ps(mask, c[6]+i), r = _mm512_maskz_loadu_ps(mask, c[7]+i);
+        __m512 zero = _mm512_setzero_ps(), one = _mm512_set1_ps(1.0f);
+        __mmask16 outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m512 nx = _mm512_set1_ps(pl[0]), ny = _mm512_set1_ps(pl[1]), nz = _mm512_set1_ps(pl[2]);
+            __m512 da = _mm512_fmadd_ps(nx, ax, _mm512_set1_ps(pl[3]));
+            da = _mm512_fmadd_ps(ny, ay, da);
+            da = _mm512_fmadd_ps(nz, az, da);
+            __m512 na = _mm512_mul_ps(nx, dx);
+            na = _mm512_fmadd_ps(ny, dy, na);
+            na = _mm512_fmadd_ps(nz, dz, na);
+            __m512 db = _mm512_fmadd_ps(h, na, da);
+            __m512 k = _mm512_fnmadd_ps(na, na, one);
+            k = _mm512_mul_ps(r, _mm512_maskz_sqrt_ps(_mm512_cmp_ps_mask(k, zero, _CMP_GT_OQ), k));
+            // Apex and base both behind for outside, either for intersect
+            __mmask16 apex = _mm512_cmp_ps_mask(da, zero, _CMP_LT_OQ);
+            outside |= apex & _mm512_cmp_ps_mask(_mm512_add_ps(db, k), zero, _CMP_LT_OQ);
+            intersect |= apex | _mm512_cmp_ps_mask(_mm512_sub_ps(db, k), zero, _CMP_LT_OQ);
+        }
+        writeClasses(result+i, outside, intersect, (int)n);
+    }
+}
+
+TARGET("avx512f")
+static void cullCapsulesAVX512(const vec4f planes[6], const float *const c[7],
+                               uint8_t *result, size_t count)
+{
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count-i < 16 ? count-i : 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+        __m512 ax = _mm512_maskz_loadu_ps(mask, c[0]+i), ay = _mm512_maskz_loadu_ps(mask, c[1]+i);
+        __m512 az = _mm512_maskz_loadu_ps(mask, c[2]+i), bx = _mm512_maskz_loadu_ps(mask, c[3]+i);
+        __m512 by = _mm512_maskz_loadu_ps(mask, c[4]+i), bz = _mm512_maskz_loadu_ps(mask, c[5]+i);
+        __m512 r = _mm512_maskz_loadu_ps(mask, c[6]+i);
+        __m512 nr = _mm512_sub_ps(_mm512_setzero_ps(), r);
+        __mmask16 outside = 0, intersect = 0;
+        for (int p = 0; p < 6; p++) {
+            const vec4f &pl = planes[p];
+            __m512 nx = _mm512_set1_ps(pl[0]), ny = _mm512_set1_ps(pl[1]), nz = _mm512_set1_ps(pl[2]);
+            __m512 d = _mm512_set1_ps(pl[3]);
+            __m512 da = _mm512_fmadd_ps(nz, az, _mm512_fmadd_ps(ny, ay, _mm512_fmadd_ps(nx, ax, d)));
+            __m512 db = _mm512_fmadd_ps(nz, bz, _mm512_fmadd_ps(ny, by, _mm512_fmadd_ps(nx, bx, d)));
+            outside |= _mm512_cmp_ps_mask(da, nr, _CMP_LT_OQ) & _mm512_cmp_ps_mask(db, nr, _CMP_LT_OQ);
+            intersect |= _mm512_cmp_ps_mask(da, r, _CMP_LT_OQ) | _mm512_cmp_ps_mask(db, r, _CMP_LT_OQ);
+        }
+        writeClasses(result+i, outside, intersect, (int)n);
+    }
+}
+
+TARGET("avx512f")
+static void depthKeysAVX512(const vec4f &plane, const float *x, const float *y,
+                            const float *z, uint32_t flip, uint32_t *keys, size_t count)
+{
+    __m512 nx = _mm512_set1_ps(plane[0]), ny = _mm512_set1_ps(plane[1]);
+    __m512 nz = _mm512_set1_ps(plane[2]), nd = _mm512_set1_ps(plane[3]);
+    __m512i sign = _mm512_set1_epi32(int(0x80000000u)), f = _mm512_set1_epi32(int(flip));
+    for (size_t i = 0; i < count; i += 16) {
+        size_t n = count-i < 16 ? count-i : 16;
+        __mmask16 mask = (__mmask16)((1u << n) - 1);
+        __m512 d = _mm512_fmadd_ps(nx, _mm512_maskz_loadu_ps(mask, x+i), nd);
+        d = _mm512_fmadd_ps(ny, _mm512_maskz_loadu_ps(mask, y+i), d);
+        d = _mm512_fmadd_ps(nz, _mm512_maskz_loadu_ps(mask, z+i), d);
+        __m512i u = _mm512_castps_si512(d);
+        __m512i m = _mm512_or_si512(_mm512_maskz_srai_epi32(0xffff, u, 31), sign);
+        _mm512_mask_storeu_epi32(keys+i, mask, _mm512_xor_si512(u, _mm512_xor_si512(m, f)));
+    }
+}
+
+#endif // GFXMATH_X86
+
+static Kernels makeKernels(simd_level_t level)
+{
+    Kernels k;
+    k.level = SIMD_SCALAR;
+    k.multiply = multiplyScalar;
+    k.transformPoints = transformPointsScalar;
+    k.cullSpheres = cullSpheresScalar;
+    k.cullSpheresLod = cullSpheresLodScalar;
+    k.cullCones = cullConesScalar;
+    k.cullCapsules = cullCapsulesScalar;
+    k.depthKeys = depthKeysScalar;
+
+#ifdef GFXMATH_X86
+    if (level >= SIMD_SSE2) {
+        k.level = SIMD_SSE2;
+        k.multiply = multiplySSE2;
+        k.transformPoints = transformPointsSSE2;
+        k.cullSpheres = cullSpheresSSE2;
+        k.cullSpheresLod = cullSpheresLodSSE2;
+        k.cullCones = cullConesSSE2;
+        k.cullCapsules = cullCapsulesSSE2;
+        k.depthKeys = depthKeysSSE2;
+    }
+    // Nothing in SSE4.1 helps these kernels, the SSE2 variants are kept
+    if (level >= SIMD_SSE41)
+        k.level = SIMD_SSE41;
+    if (level >= SIMD_AVX2) {
+        k.level = SIMD_AVX2;
+        k.multiply = multiplyAVX2;
+        k.transformPoints = transformPointsAVX2;
+        k.cullSpheres = cullSpheresAVX2;
+        k.cullSpheresLod = cullSpheresLodAVX2;
+        k.cullCones = cullConesAVX2;
+        k.cullCapsules = cullCapsulesAVX2;
+        k.depthKeys = depthKeysAVX2;
+    }
+    if (level >= SIMD_AVX512) {
+        k.level = SIMD_AVX512;
+        k.multiply = multiplyAVX512;
+        k.transformPoints = transformPointsAVX512;
+        k.cullSpheres = cullSpheresAVX512;
+        k.cullSpheresLod = cullSpheresLodAVX512;
+        k.cullCones = cullConesAVX512;
+        k.cullCapsules = cullCapsulesAVX512;
+        k.depthKeys = depthKeysAVX512;
+    }
+#endif
+
+    return k;
+}
+
+const Kernels& kernels()
+{
+    static Kernels k = makeKernels(simdLevel());
+    return k;
+}
+
+Kernels kernels(simd_level_t level)
+{
+    simd_level_t supported = detectSimdLevel();
+    return makeKernels(level < supported ? level : supported);
+}
+
+}; // namespace math
@@ -0,0 +1,68 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "cpu.h"
+#include "matrix.h"
+
+#include <stdint.h>
+
+namespace math {
+
+struct ScreenScale;     // frustum.h
+
+/// Batched kernels with one implementation per SIMD level, bound to
+/// function pointers at startup. Arrays may be unaligned.
+struct Kernels {
+    simd_level_t level;
+
+    /// out[i] = a[i]*b[i], out may alias a or b
+    void (*multiply)(const Matrix4f *a, const Matrix4f *b,
+                     Matrix4f *out, size_t count);
+
+    /// Transform points (w = 1) given as structure of arrays, the result is
+    /// not divided by w. Output arrays may alias the input ones.
+    void (*transformPoints)(const Matrix4f &m,
+                            const float *x, const float *y, const float *z,
+                            float *ox, float *oy, float *oz, size_t count);
+
+    /// Classify spheres against plane equations (n, d) as intersection_t:
+    /// OUTSIDE if behind any plane, INTERSECT if crossing any, else INSIDE
+    void (*cullSpheres)(const vec4f planes[6],
+                        const float *x, const float *y, const float *z,
+                        const float *r, uint8_t *result, size_t count);
+
+    /// cullSpheres fused with the spheres' size on screen (ScreenScale).
+    /// Spheres under minPixels in projected radius are OUTSIDE, lod[i] is
+    /// the number of thresholds[k][i], k < levels, above the projected
+    /// radius, levels at most LOD_LEVELS_MAX
+    void (*cullSpheresLod)(const vec4f planes[6], const ScreenScale &scale,
+                           float minPixels, const float *x, const float *y,
+                           const float *z, const float *r,
+                           const float *const thresholds[], int levels,
+                           uint8_t *result, uint8_t *lod, size_t count);
+
+    /// Same for cones given as the 8 lanes of SoA<Cone> (volumes.h),
+    /// plane normals must be unit length
+    void (*cullCones)(const vec4f planes[6], const float *const cones[8],
+                      uint8_t *result, size_t count);
+
+    /// Same for capsules given as the 7 lanes of SoA<Capsule>
+    void (*cullCapsules)(const vec4f planes[6], const float *const capsules[7],
+                         uint8_t *result, size_t count);
+
+    /// keys[i] = floatKey() (radixsort.h) of the signed distance of
+    /// point i to the plane (n, d), xor flip (0, or ~0 for descending)
+    void (*depthKeys)(const vec4f &plane, const float *x, const float *y,
+                      const float *z, uint32_t flip, uint32_t *keys, size_t count);
+};
+
+/// Kernels for simdLevel()
+const Kernels& kernels();
+
+/// Kernels for a given level (capped by what the CPU supports),
+/// for tests and benchmarks comparing variants
+Kernels kernels(simd_level_t level);
+
+}; // namespace math
+
+#endif
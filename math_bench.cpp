@@ -0,0 +1,856 @@
+#include "vec.h"
+#include "matrix.h"
+#include "aalloc.h"
+#include "quaternion.h"
+#include "frustum.h"
+#include "kernels.h"
+#include "projection.h"
+#include "soa.h"
+#include "format.h"
+#include "solve.h"
+#include "spatialhash.h"
+#include "camera.h"
+#include "rotation.h"
+#include "transform.h"
+#include "bounds.h"
+#include "broadphase.h"
+#include "gjk.h"
+#include "cluster.h"
+#include "volumes.h"
+#include "radixsort.h"
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <vector>
+
+using namespace math;
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Keeps results alive so the optimizer can't drop the measured work
+static volatile float g_sink;
+
+template <typename F>
+static void bench(const char *name, size_t ops, F func)
+{
+    func(); // warm up
+    const int runs = 5;
+    double best = 1e30;
+    for (int r = 0; r < runs; r++) {
+        Clock::time_point start = Clock::now();
+        func();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now()-start).count();
+        if (ns < best)
+            best = ns;
+    }
+    printf("%-40s %10.2f ns/op\n", name, best/ops);
+}
+
+static Matrix4f randomMatrix(int seed)
+{
+    Matrix4f m;
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            m[j][i] = (float)((seed*31 + j*7 + i*3) % 17) / 17.0f;
+    return m;
+}
+
+static void benchMatrixMultiply()
+{
+    const size_t count = 4096;
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > a(count), b(count), out(count);
+    for (size_t i = 0; i < count; i++) {
+        a[i] = randomMatrix(i);
+        b[i] = randomMatrix(i+1);
+    }
+
+    // Same data shifted by one float so no column is 16-byte aligned
+    std::vector<float> raw(count*16*3 + 1);
+    float *ua = &raw[1];
+    float *ub = ua + count*16;
+    float *uout = ub + count*16;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(ua+i*16, a[i].data(), sizeof(float)*16);
+        memcpy(ub+i*16, b[i].data(), sizeof(float)*16);
+    }
+
+    bench("Matrix4f operator*", count, [&] {
+        for (size_t i = 0; i < count; i++)
+            out[i] = a[i]*b[i];
+        g_sink = out[count-1][3][3];
+    });
+
+    bench("Matrix4f operator*= (in place)", count, [&] {
+        for (size_t i = 0; i < count; i++)
+            out[i] *= a[i];
+        g_sink = out[count-1][3][3];
+    });
+
+    bench("multiply (aligned)", count, [&] {
+        multiply(&a[0], &b[0], &out[0], count);
+        g_sink = out[count-1][3][3];
+    });
+
+    bench("multiplyUnaligned", count, [&] {
+        multiplyUnaligned(ua, ub, uout, count);
+        g_sink = uout[count*16-1];
+    });
+
+    SoA<Matrix4f> sa(&a[0], count), sb(&b[0], count), sout;
+    bench("multiply (SoA)", count, [&] {
+        multiply(sa, sb, sout);
+        g_sink = sout.lane(15)[count-1];
+    });
+
+    bench("SoA<Matrix4f>::assign (transpose)", count, [&] {
+        sout.assign(&a[0], count);
+        g_sink = sout.lane(15)[count-1];
+    });
+}
+
+// Small Matrix calls in loops, where inlining decides the cost
+static void benchMatrixCalls()
+{
+    const size_t count = 4096;
+    std::vector<vec4f> v(count), out4(count);
+    std::vector<vec3f> p(count), out3(count);
+    for (size_t i = 0; i < count; i++) {
+        v[i] = vec4f((float)i, 1.0f, 2.0f, 1.0f);
+        p[i] = vec3f((float)i, 1.0f, 2.0f);
+    }
+    Matrix4f m = randomMatrix(3);
+    Matrix3f m3(m);
+
+    bench("Matrix4f * vec4f", count, [&] {
+        for (size_t i = 0; i < count; i++)
+            out4[i] = m*v[i];
+        g_sink = out4[count-1][3];
+    });
+
+    bench("Matrix3f * vec3f", count, [&] {
+        for (size_t i = 0; i < count; i++)
+            out3[i] = m3*p[i];
+        g_sink = out3[count-1][2];
+    });
+
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > mats(count);
+    bench("translate(p)*scale(s)", count, [&] {
+        for (size_t i = 0; i < count; i++)
+            mats[i] = translate(p[i])*scale(2.0f, 2.0f, 2.0f);
+        g_sink = mats[count-1][3][0];
+    });
+
+    bench("Matrix4f transposed + isScale", count, [&] {
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++)
+            n += mats[i].transposed().isScale();
+        g_sink = n;
+    });
+}
+
+static void benchQuaternionToMatrix()
+{
+    const size_t count = 4096;
+    std::vector<float> x(count), y(count), z(count), w(count);
+    std::vector<Quaternion> q(count);
+    for (size_t i = 0; i < count; i++) {
+        q[i] = Quaternion::fromAngleAxis(i*0.01f, vec3f(1.0f, 2.0f, 3.0f));
+        x[i] = q[i].m_v.x(); y[i] = q[i].m_v.y(); z[i] = q[i].m_v.z(); w[i] = q[i].m_w;
+    }
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > out(count);
+    std::vector<Matrix3x4f, AlignedAllocator<Matrix3x4f> > out34(count);
+
+    bench("Quaternion::toMatrix", count, [&] {
+        for (size_t i = 0; i < count; i++)
+            out[i] = q[i].toMatrix();
+        g_sink = out[count-1][0][0];
+    });
+
+    bench("toMatrices (Matrix4f)", count, [&] {
+        toMatrices(&x[0], &y[0], &z[0], &w[0], &out[0], count);
+        g_sink = out[count-1][0][0];
+    });
+
+    bench("toMatrices (Matrix3x4f)", count, [&] {
+        toMatrices(&x[0], &y[0], &z[0], &w[0], &out34[0], count);
+        g_sink = out34[count-1][0][0];
+    });
+
+    bench("fromMatrices (Matrix4f)", count, [&] {
+        fromMatrices(&out[0], &x[0], &y[0], &z[0], &w[0], count);
+        g_sink = w[count-1];
+    });
+}
+
+static void benchProject()
+{
+    const size_t count = 100000;
+    std::vector<vec3f> points(count), screen(count);
+    std::vector<uint8_t> clip(count);
+    for (size_t i = 0; i < count; i++)
+        points[i] = vec3f((i%100)*0.1f - 5.0f, (i%37)*0.1f, -(i%50)*1.0f);
+    Matrix4f viewProj = randomMatrix(7);
+    Viewport viewport;
+
+    bench("project (per point, Matrix4f*vec4f)", count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            vec4f c = viewProj * vec4f(points[i], 1.0f);
+            float xs, ys;
+            viewport.fromClipSpace(c[0]/c[3], c[1]/c[3], xs, ys);
+            screen[i] = vec3f(xs, ys, c[2]/c[3]*0.5f + 0.5f);
+        }
+        g_sink = screen[count-1][0];
+    });
+
+    bench("project (batched, clip flags)", count, [&] {
+        project(viewProj, viewport, &points[0], &screen[0], &clip[0], count);
+        g_sink = screen[count-1][0];
+    });
+}
+
+static void benchFormat()
+{
+    const size_t count = 20000;
+    std::vector<vec3f> v(count), pv(count);
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > m(count), pm(count);
+    for (size_t i = 0; i < count; i++) {
+        v[i] = vec3f(i*0.37f, -1.0f/(i+1), i*1e3f);
+        m[i] = randomMatrix(i);
+    }
+    std::vector<char> buf(count*256);
+    char *first = &buf[0], *last = first + buf.size();
+    size_t vlen = formatArray(first, last, &v[0], count) - first;
+
+    bench("vec3f operator<< (ostringstream)", count, [&] {
+        std::ostringstream ss;
+        for (size_t i = 0; i < count; i++)
+            ss << v[i] << '\n';
+        g_sink = ss.str().size();
+    });
+
+    bench("vec3f formatArray", count, [&] {
+        g_sink = formatArray(first, last, &v[0], count) - first;
+    });
+
+    bench("vec3f istringstream >> float", count, [&] {
+        std::istringstream ss(std::string(first, vlen));
+        char c;
+        for (size_t i = 0; i < count; i++)
+            ss >> c >> pv[i][0] >> c >> pv[i][1] >> c >> pv[i][2] >> c;
+        g_sink = pv[count-1][2];
+    });
+
+    bench("vec3f parseArray", count, [&] {
+        parseArray(first, first + vlen, &pv[0], count);
+        g_sink = pv[count-1][2];
+    });
+
+    bench("Matrix4f operator<< (ostringstream)", count, [&] {
+        std::ostringstream ss;
+        for (size_t i = 0; i < count; i++)
+            ss << m[i];
+        g_sink = ss.str().size();
+    });
+
+    bench("Matrix4f formatArray", count, [&] {
+        g_sink = formatArray(first, last, &m[0], count) - first;
+    });
+
+    size_t mlen = formatArray(first, last, &m[0], count) - first;
+    bench("Matrix4f parseArray", count, [&] {
+        parseArray(first, first + mlen, &pm[0], count);
+        g_sink = pm[count-1][3][3];
+    });
+}
+
+// Every kernel variant the CPU supports, the one bound at startup is marked
+static void benchKernels()
+{
+    const size_t count = 1 << 16;
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > a(count/16), b(count/16), m(count/16);
+    std::vector<float> x(count), y(count), z(count), r(count);
+    std::vector<float> ox(count), oy(count), oz(count);
+    std::vector<uint8_t> classes(count);
+    for (size_t i = 0; i < count/16; i++) {
+        a[i] = randomMatrix(i);
+        b[i] = randomMatrix(i+3);
+    }
+    for (size_t i = 0; i < count; i++) {
+        x[i] = (i%97)*0.5f - 24.0f;
+        y[i] = (i%13)*0.5f - 3.0f;
+        z[i] = -(float)(i%200);
+        r[i] = (i%7)*0.3f;
+    }
+
+    Frustum frustum;
+    frustum.set(60.0f, 1.5f, 0.5f, 150.0f);
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+
+    // Long narrow spot lights, and capsules along them
+    SoA<Cone> cones;
+    SoA<Capsule> capsules;
+    SoA<vec4f> coneSpheres;
+    for (size_t i = 0; i < count; i++) {
+        vec3f p(x[i]*2.0f, y[i] - 8.0f, z[i]);
+        vec3f d = vec3f((i%5)*0.4f - 0.8f, 1.0f, (i%3)*0.5f - 0.5f).normalized();
+        Cone c = Cone::spot(p, d, 20.0f + (i%11), 0.15f + (i%4)*0.05f);
+        cones.push_back(c);
+        capsules.push_back(Capsule(p, p + d*c.height, 0.5f + r[i]));
+        Sphere s = spotLightBounds(c.apex, c.axis, c.height, atanf(c.radius/c.height));
+        coneSpheres.push_back(vec4f(s.center, s.radius));
+    }
+    const float *coneLanes[8], *capsuleLanes[7];
+    cones.lanes(coneLanes);
+    capsules.lanes(capsuleLanes);
+    size_t sphereVisible = 0, coneVisible = 0;
+    frustum.containsSpheres(coneSpheres, &classes[0]);
+    for (size_t i = 0; i < count; i++)
+        sphereVisible += classes[i] != OUTSIDE;
+    frustum.containsCones(cones, &classes[0]);
+    for (size_t i = 0; i < count; i++)
+        coneVisible += classes[i] != OUTSIDE;
+    printf("spot lights visible: %zu of %zu by bounding sphere, %zu by cone\n",
+           sphereVisible, count, coneVisible);
+
+    // Three LOD thresholds per object, and the same split into a cull
+    // pass and a second pass over the visible spheres
+    std::vector<float> t0(count), t1(count), t2(count);
+    for (size_t i = 0; i < count; i++) {
+        t0[i] = 40.0f + (i%5)*10.0f;
+        t1[i] = t0[i]*0.5f;
+        t2[i] = t0[i]*0.25f;
+    }
+    const float *thresholds[3] = {&t0[0], &t1[0], &t2[0]};
+    ScreenScale scale = frustum.screenScale(Viewport(0, 0, 1920, 1080));
+    std::vector<uint8_t> lod(count);
+    bench("cullSpheres, then LOD pass", count, [&] {
+        kernels().cullSpheres(planes, &x[0], &y[0], &z[0], &r[0], &classes[0], count);
+        const vec4f &dp = scale.depthPlane;
+        for (size_t i = 0; i < count; i++) {
+            if (classes[i] == OUTSIDE)
+                continue;
+            float depth = std::max(dp[0]*x[i] + dp[1]*y[i] + dp[2]*z[i] + dp[3], scale.minDepth);
+            float px = r[i]*scale.pixels/depth;
+            if (px < 1.0f)
+                classes[i] = OUTSIDE;
+            lod[i] = (px < t0[i]) + (px < t1[i]) + (px < t2[i]);
+        }
+        g_sink = lod[count-1];
+    });
+
+    printf("simd level: %s (detected %s)\n",
+           simdLevelName(simdLevel()), simdLevelName(detectSimdLevel()));
+
+    char name[64];
+    for (int l = SIMD_SCALAR; l <= detectSimdLevel(); l++) {
+        Kernels k = kernels((simd_level_t)l);
+        if (k.level != l)
+            continue;
+        const char *mark = k.level == kernels().level ? "*" : "";
+
+        snprintf(name, sizeof(name), "multiply [%s]%s", simdLevelName(k.level), mark);
+        bench(name, count/16, [&] {
+            k.multiply(&a[0], &b[0], &m[0], count/16);
+            g_sink = m[0][0][0];
+        });
+
+        snprintf(name, sizeof(name), "transformPoints [%s]%s", simdLevelName(k.level), mark);
+        bench(name, count, [&] {
+            k.transformPoints(a[0], &x[0], &y[0], &z[0], &ox[0], &oy[0], &oz[0], count);
+            g_sink = ox[count-1];
+        });
+
+        snprintf(name, sizeof(name), "cullSpheres [%s]%s", simdLevelName(k.level), mark);
+        bench(name, count, [&] {
+            k.cullSpheres(planes, &x[0], &y[0], &z[0], &r[0], &classes[0], count);
+            g_sink = classes[count-1];
+        });
+
+        snprintf(name, sizeof(name), "cullSpheresLod [%s]%s", simdLevelName(k.level), mark);
+        bench(name, count, [&] {
+            k.cullSpheresLod(planes, scale, 1.0f, &x[0], &y[0], &z[0], &r[0], thresholds, 3,
+                             &classes[0], &lod[0], count);
+            g_sink = lod[count-1];
+        });
+
+        snprintf(name, sizeof(name), "cullCones [%s]%s", simdLevelName(k.level), mark);
+        bench(name, count, [&] {
+            k.cullCones(planes, coneLanes, &classes[0], count);
+            g_sink = classes[count-1];
+        });
+
+        snprintf(name, sizeof(name), "cullCapsules [%s]%s", simdLevelName(k.level), mark);
+        bench(name, count, [&] {
+            k.cullCapsules(planes, capsuleLanes, &classes[0], count);
+            g_sink = classes[count-1];
+        });
+    }
+}
+
+static void benchSolve()
+{
+    typedef Matrix<6, float> Matrix6f;
+    typedef vec<6, float> vec6f;
+    const size_t count = 4096;
+    std::vector<Matrix6f> a(count), spd(count);
+    std::vector<vec6f> b(count), x(count);
+    for (size_t k = 0; k < count; k++) {
+        for (int j = 0; j < 6; j++)
+            for (int i = 0; i < 6; i++)
+                a[k][j][i] = (float)((k*31 + j*7 + i*13) % 17) / 17.0f + (i == j ? 2.0f : 0.0f);
+        spd[k] = a[k].transposed()*a[k];
+        for (int i = 0; i < 6; i++)
+            b[k][i] = (float)i;
+    }
+
+    bench("LU<6, float>::solve", count, [&] {
+        for (size_t k = 0; k < count; k++)
+            x[k] = LU<6, float>(a[k]).solve(b[k]);
+        g_sink = x[count-1][5];
+    });
+
+    bench("solveLU 6x6 (batched)", count, [&] {
+        solveLU(&a[0], &b[0], &x[0], count);
+        g_sink = x[count-1][5];
+    });
+
+    bench("Cholesky<6, float>::solve", count, [&] {
+        for (size_t k = 0; k < count; k++)
+            x[k] = Cholesky<6, float>(spd[k]).solve(b[k]);
+        g_sink = x[count-1][5];
+    });
+
+    bench("solveCholesky 6x6 (batched)", count, [&] {
+        solveCholesky(&spd[0], &b[0], &x[0], count);
+        g_sink = x[count-1][5];
+    });
+
+    Matrix<12, float> m12, r12;
+    for (int j = 0; j < 12; j++)
+        for (int i = 0; i < 12; i++)
+            m12[j][i] = (float)((j*7 + i*3) % 17) / 17.0f;
+    r12.loadIdentity();
+    bench("Matrix<12, float> operator*", 1024, [&] {
+        for (int n = 0; n < 1024; n++)
+            r12 = r12*m12*0.25f;
+        g_sink = r12[11][11];
+    });
+}
+
+static void benchSpatialHash()
+{
+    const size_t count = 10000;
+    std::vector<vec3f> pos(count);
+    for (size_t i = 0; i < count; i++)
+        pos[i] = vec3f((float)(i*7919 % 1000), (float)(i*104729 % 1000), (float)(i*1299709 % 100))*0.1f;
+
+    SpatialHash index(2.0f);
+    std::vector<uint32_t> handles(count), result;
+    index.insert(&pos[0], NULL, count, &handles[0]);
+
+    const size_t queries = 1000;
+    bench("radius query, brute force", queries, [&] {
+        size_t found = 0;
+        for (size_t q = 0; q < queries; q++)
+            for (size_t i = 0; i < count; i++)
+                found += distance(pos[i], pos[q]) <= 2.0f;
+        g_sink = found;
+    });
+
+    bench("SpatialHash::queryRadius", queries, [&] {
+        size_t found = 0;
+        for (size_t q = 0; q < queries; q++) {
+            index.queryRadius(pos[q], 2.0f, result);
+            found += result.size();
+        }
+        g_sink = found;
+    });
+
+    bench("SpatialHash::queryNearest (k = 8)", queries, [&] {
+        for (size_t q = 0; q < queries; q++)
+            index.queryNearest(pos[q], 8, result);
+        g_sink = result[0];
+    });
+
+    std::vector<vec3f> moved(count);
+    for (size_t i = 0; i < count; i++)
+        moved[i] = pos[i] + vec3f(0.05f, 0.0f, 0.0f)*(float)(i % 3);
+    bench("SpatialHash::move (batched)", count, [&] {
+        index.move(&handles[0], &moved[0], NULL, count);
+        index.move(&handles[0], &pos[0], NULL, count);
+    });
+}
+
+static void benchCamera()
+{
+    const size_t count = 256;
+    std::vector<Camera> cameras(count);
+    std::vector<vec3f> pos(count);
+    std::vector<Quaternion> rot(count);
+    for (size_t i = 0; i < count; i++) {
+        pos[i] = vec3f((float)(i % 16), 0.0f, (float)(i / 16));
+        rot[i] = Quaternion::fromMatrix(rotateY(0.01f*i));
+        cameras[i].setPerspective(90.0f, 1.0f, 0.1f, 100.0f);
+    }
+
+    // What a frame did before Camera, rebuilding the planes every time
+    bench("probe frustum, rebuilt every frame", count, [&] {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            Frustum f;
+            f.set(90.0f, 1.0f, 0.1f, 100.0f);
+            f.setPosition(pos[i]);
+            f.setOrientation(rot[i]);
+            vec4f planes[6];
+            f.getPlanes(planes);
+            sum += planes[0].w();
+        }
+        g_sink = sum;
+    });
+
+    bench("probe camera, unchanged", count, [&] {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            cameras[i].setPosition(pos[i]);
+            cameras[i].setOrientation(rot[i]);
+            sum += cameras[i].viewProjection()[3][3];
+            sum += cameras[i].frustum().containsPoint(vec3f(0.0f));
+        }
+        g_sink = sum;
+    });
+
+    bench("probe camera, moved", count, [&] {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            pos[i][1] += 0.01f;
+            cameras[i].setPosition(pos[i]);
+            sum += cameras[i].viewProjection()[3][3];
+            sum += cameras[i].frustum().containsPoint(vec3f(0.0f));
+        }
+        g_sink = sum;
+    });
+}
+
+// Scene graph style chains, mostly translations and rotations
+static void benchTransform()
+{
+    const size_t count = 4096;
+    std::vector<Transform> local(count), world(count);
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > localm(count), worldm(count);
+    for (size_t i = 0; i < count; i++) {
+        vec3f t((float)(i % 7), 1.0f, (float)(i % 5));
+        local[i] = i % 4 == 0 ? Transform::translation(t)*Transform::rotationY(0.001f*i)
+                              : Transform::translation(t);
+        localm[i] = local[i].matrix();
+    }
+
+    bench("Matrix4f world = parent*local", count, [&] {
+        worldm[0] = localm[0];
+        for (size_t i = 1; i < count; i++)
+            worldm[i] = worldm[(i-1)/2]*localm[i];
+        g_sink = worldm[count-1][3][0];
+    });
+
+    bench("Transform world = parent*local", count, [&] {
+        world[0] = local[0];
+        for (size_t i = 1; i < count; i++)
+            world[i] = world[(i-1)/2]*local[i];
+        g_sink = world[count-1].matrix()[3][0];
+    });
+
+    bench("Matrix4f::inverse (rigid)", count, [&] {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++)
+            sum += worldm[i].inverse()[3][0];
+        g_sink = sum;
+    });
+
+    bench("Transform::inverse (rigid)", count, [&] {
+        float sum = 0.0f;
+        for (size_t i = 0; i < count; i++)
+            sum += world[i].inverse().matrix()[3][0];
+        g_sink = sum;
+    });
+
+    bench("Matrix4f * point (translation)", count, [&] {
+        vec3f p(0.0f);
+        for (size_t i = 0; i < count; i++)
+            p = vec3(localm[i]*vec4f(p, 1.0f));
+        g_sink = p[0];
+    });
+
+    bench("Transform::transformPoint (translation)", count, [&] {
+        vec3f p(0.0f);
+        for (size_t i = 0; i < count; i++)
+            p = local[i].transformPoint(p);
+        g_sink = p[0];
+    });
+}
+
+static void benchBounds()
+{
+    const size_t count = 1 << 20;
+    std::vector<vec3f> points(count);
+    for (size_t i = 0; i < count; i++)
+        points[i] = vec3f((float)(i*7919 % 1000), (float)(i*104729 % 997), (float)(i*1299709 % 991))*0.01f;
+
+    bench("AABB, scalar loop", count, [&] {
+        AABB box;
+        for (size_t i = 0; i < count; i++)
+            box.add(points[i]);
+        g_sink = box.max[0];
+    });
+    bench("boundingBox", count, [&] {
+        g_sink = boundingBox(&points[0], count).max[0];
+    });
+    bench("boundingBox, all threads", count, [&] {
+        g_sink = boundingBox(&points[0], count, 0).max[0];
+    });
+    bench("boundingSphere, Ritter", count, [&] {
+        g_sink = boundingSphere(&points[0], count, SPHERE_RITTER).radius;
+    });
+    bench("boundingSphere, EPOS", count, [&] {
+        g_sink = boundingSphere(&points[0], count, SPHERE_EPOS).radius;
+    });
+    bench("boundingSphere, EPOS, all threads", count, [&] {
+        g_sink = boundingSphere(&points[0], count, SPHERE_EPOS, 0).radius;
+    });
+    printf("sphere radius: Ritter %.3f, EPOS %.3f\n",
+           boundingSphere(&points[0], count, SPHERE_RITTER).radius,
+           boundingSphere(&points[0], count, SPHERE_EPOS).radius);
+
+    // World spheres for the culler
+    const size_t objects = 200000;
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > world(objects);
+    std::vector<Sphere> local(objects);
+    for (size_t i = 0; i < objects; i++) {
+        world[i] = randomMatrix(i);
+        local[i] = Sphere(points[i], 1.0f);
+    }
+    SoA<vec4f> spheres;
+    bench("world spheres, Matrix4f*vec4f + scale", objects, [&] {
+        spheres.resize(objects);
+        float *x = spheres.x(), *y = spheres.y(), *z = spheres.z(), *r = spheres.w();
+        for (size_t i = 0; i < objects; i++) {
+            const Matrix4f &m = world[i];
+            vec4f c = m*vec4f(local[i].center, 1.0f);
+            float s = std::max(vec3(vec4f(m[0])).lengthSquared(),
+                               std::max(vec3(vec4f(m[1])).lengthSquared(),
+                                        vec3(vec4f(m[2])).lengthSquared()));
+            x[i] = c[0];
+            y[i] = c[1];
+            z[i] = c[2];
+            r[i] = local[i].radius*sqrtf(s);
+        }
+        g_sink = r[objects-1];
+    });
+    bench("transformSpheres", objects, [&] {
+        transformSpheres(&world[0], &local[0], objects, spheres);
+        g_sink = spheres.w()[objects-1];
+    });
+    std::vector<AABB> boxes(objects, AABB(vec3f(-1.0f), vec3f(1.0f)));
+    SoA<vec3f> centers, extents;
+    bench("transformBoxes", objects, [&] {
+        transformBoxes(&world[0], &boxes[0], objects, centers, extents);
+        g_sink = extents.x()[objects-1];
+    });
+}
+
+static void benchBroadPhase()
+{
+    const size_t count = 10000;
+    std::vector<AABB> boxes(count);
+    for (size_t i = 0; i < count; i++) {
+        vec3f c((float)(i*7919 % 1000), (float)(i*104729 % 1000), (float)(i*1299709 % 100));
+        boxes[i] = AABB(c*0.1f - vec3f(0.5f), c*0.1f + vec3f(0.5f));
+    }
+    std::vector<BoxPair> pairs;
+
+    bench("pairs, brute force", count, [&] {
+        pairs.clear();
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = i+1; j < count; j++) {
+                const AABB &a = boxes[i], &b = boxes[j];
+                if (a.min[0] <= b.max[0] && b.min[0] <= a.max[0] &&
+                    a.min[1] <= b.max[1] && b.min[1] <= a.max[1] &&
+                    a.min[2] <= b.max[2] && b.min[2] <= a.max[2]) {
+                    BoxPair p = { (uint32_t)i, (uint32_t)j };
+                    pairs.push_back(p);
+                }
+            }
+        }
+        g_sink = pairs.size();
+    });
+
+    std::vector<uint32_t> handles(count);
+    bench("SweepAndPrune, first build", count, [&] {
+        SweepAndPrune sap;
+        for (size_t i = 0; i < count; i++)
+            handles[i] = sap.insert(boxes[i]);
+        sap.findPairs(pairs);
+        g_sink = pairs.size();
+    });
+
+    SweepAndPrune sap;
+    for (size_t i = 0; i < count; i++)
+        handles[i] = sap.insert(boxes[i]);
+    sap.findPairs(pairs);
+    size_t frame = 0;
+    bench("SweepAndPrune, moving frame", count, [&] {
+        float d = frame++ % 2 ? 0.05f : -0.05f;
+        for (size_t i = 0; i < count; i++) {
+            AABB &b = boxes[i];
+            vec3f step(i % 3 ? d : -d, 0.0f, d);
+            b = AABB(b.min + step, b.max + step);
+            sap.update(handles[i], b);
+        }
+        sap.findPairs(pairs);
+        g_sink = pairs.size();
+    });
+}
+
+static void benchGJK()
+{
+    const size_t count = 4096;
+    vec3f corners[12];
+    for (int i = 0; i < 12; i++) {
+        float a = float(i)*float(M_PI)/3.0f;
+        corners[i] = vec3f(cosf(a)*0.5f, i < 6 ? -0.4f : 0.4f, sinf(a)*0.5f);
+    }
+    std::vector<ConvexShape> as, bs;
+    for (size_t i = 0; i < count; i++) {
+        Matrix3f r(Quaternion::fromAngleAxis(i*0.37f, vec3f(1.0f, 2.0f, 3.0f).normalized()).toMatrix());
+        vec3f p(float(i % 64), float(i/64), 0.0f);
+        as.push_back(ConvexShape::box(p, vec3f(0.5f, 0.3f, 0.4f), r));
+        vec3f q = p + vec3f(0.6f + (i % 5)*0.1f, 0.2f, 0.1f*(i % 3));
+        if (i % 2)
+            bs.push_back(ConvexShape::hull(corners, 12, q, r));
+        else
+            bs.push_back(ConvexShape::capsule(q, q + vec3f(0.0f, 0.5f, 0.0f), 0.25f));
+    }
+    std::vector<Contact> contacts(count);
+    std::vector<GjkCache> caches(count);
+
+    size_t frame = 0;
+    auto move = [&] {
+        vec3f d(frame++ % 2 ? 0.01f : -0.01f, 0.0f, 0.005f);
+        for (size_t i = 0; i < count; i++)
+            bs[i].center += d;
+    };
+    bench("penetration, cold", count, [&] {
+        move();
+        g_sink = penetration(&as[0], &bs[0], &contacts[0], NULL, count);
+    });
+    bench("penetration, warm started", count, [&] {
+        move();
+        g_sink = penetration(&as[0], &bs[0], &contacts[0], &caches[0], count);
+    });
+}
+
+static void benchClusters()
+{
+    const size_t count = 4096;
+    ClusterGrid grid;
+    grid.set(60.0f, 16.0f/9.0f, 0.1f, 200.0f, 32, 16, 32);
+    SoA<vec4f> lights;
+    for (size_t i = 0; i < count; i++) {
+        vec3f p((float)(i*7919 % 2000)*0.05f - 50.0f, (float)(i*104729 % 1000)*0.05f - 25.0f,
+                -(float)(i*1299709 % 1900)*0.1f);
+        lights.push_back(vec4f(p, 0.5f + (i % 7)*0.5f));
+    }
+
+    std::vector<uint32_t> counts(grid.size());
+    bench("lights x clusters, brute force", count, [&] {
+        const float *x = lights.x(), *y = lights.y(), *z = lights.z(), *r = lights.w();
+        for (size_t c = 0; c < grid.size(); c++) {
+            const AABB &b = grid.bounds(c);
+            uint32_t n = 0;
+            for (size_t i = 0; i < count; i++) {
+                float dx = std::max(std::max(b.min[0] - x[i], x[i] - b.max[0]), 0.0f);
+                float dy = std::max(std::max(b.min[1] - y[i], y[i] - b.max[1]), 0.0f);
+                float dz = std::max(std::max(b.min[2] - z[i], z[i] - b.max[2]), 0.0f);
+                n += dx*dx + dy*dy + dz*dz <= r[i]*r[i];
+            }
+            counts[c] = n;
+        }
+        g_sink = counts[grid.size()/2];
+    });
+    bench("ClusterGrid::assign", count, [&] {
+        grid.assign(lights);
+        g_sink = grid.indices().size();
+    });
+    bench("ClusterGrid::assign, all threads", count, [&] {
+        grid.assign(lights, 0);
+        g_sink = grid.indices().size();
+    });
+}
+
+static void benchDepthSort()
+{
+    const size_t count = 200000;
+    Frustum frustum;
+    frustum.set(60.0f, 1.5f, 0.5f, 500.0f);
+    frustum.setPosition(vec3f(3.0f, 1.0f, 2.0f));
+    SoA<vec3f> points;
+    for (size_t i = 0; i < count; i++)
+        points.push_back(vec3f((float)(i*7919 % 2000)*0.1f - 100.0f, (float)(i*104729 % 500)*0.1f - 25.0f,
+                               -(float)(i*1299709 % 4000)*0.1f));
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+
+    std::vector<float> depths(count);
+    std::vector<uint32_t> order(count);
+    bench("std::sort by depth", count, [&] {
+        for (size_t i = 0; i < count; i++) {
+            depths[i] = planes[0][0]*points.x()[i] + planes[0][1]*points.y()[i] +
+                planes[0][2]*points.z()[i] + planes[0][3];
+            order[i] = uint32_t(i);
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return depths[a] < depths[b];
+        });
+        g_sink = order[count/2];
+    });
+
+    std::vector<uint32_t> keys(count), tmpKeys(count), tmpValues(count);
+    bench("Frustum::depthKeys", count, [&] {
+        frustum.depthKeys(points, keys.data(), SORT_FRONT_TO_BACK);
+        g_sink = keys[count/2];
+    });
+    bench("depthKeys + radixSort", count, [&] {
+        frustum.depthKeys(points, keys.data(), SORT_FRONT_TO_BACK);
+        for (size_t i = 0; i < count; i++)
+            order[i] = uint32_t(i);
+        radixSort(keys.data(), order.data(), tmpKeys.data(), tmpValues.data(), count);
+        g_sink = order[count/2];
+    });
+    bench("depthKeys + radixSort, all threads", count, [&] {
+        frustum.depthKeys(points, keys.data(), SORT_FRONT_TO_BACK);
+        for (size_t i = 0; i < count; i++)
+            order[i] = uint32_t(i);
+        radixSort(keys.data(), order.data(), tmpKeys.data(), tmpValues.data(), count, 0);
+        g_sink = order[count/2];
+    });
+}
+
+int main()
+{
+    benchMatrixMultiply();
+    benchMatrixCalls();
+    benchQuaternionToMatrix();
+    benchKernels();
+    benchProject();
+    benchFormat();
+    benchSolve();
+    benchSpatialHash();
+    benchCamera();
+    benchTransform();
+    benchBounds();
+    benchBroadPhase();
+    benchGJK();
+    benchClusters();
+    benchDepthSort();
+    return 0;
+}
@@ -3,6 +3,31 @@
 #include "quaternion.h"
 #include "plane.h"
 #include "frustum.h"
+#include "rotation.h"
+#include "fastmath.h"
+#include "matrix3x4.h"
+#include "animation.h"
+#include "kernels.h"
+#include "matrix2x3.h"
+#include "sprite.h"
+#include "rectgrid.h"
+#include "projection.h"
+#include "soa.h"
+#include "blob.h"
+#include "format.h"
+#include "instrument.h"
+#include "solve.h"
+#include "spatialhash.h"
+#include "camera.h"
+#include "transform.h"
+#include "bounds.h"
+#include "broadphase.h"
+#include "gjk.h"
+#include "cluster.h"
+#include "volumes.h"
+#include "radixsort.h"
+
+#include <sstream>
 
 #define BOOST_TEST_MODULE MathTest
 #ifdef ANDROID
@@ -200,6 +225,37 @@ BOOST_AUTO_TEST_CASE(Matrix3)
     for (int j = 0; j < 3; j++)
         for (int i = 0; i < 3; i++)
             BOOST_CHECK_EQUAL(id[j][i], identity[j][i]);
+
+    // Off the diagonal, against LU
+    float skew[] = {
+        2, 0, 1,
+        1, 3, 0,
+        0, 1, 4
+    };
+    Matrix3f mskew(skew);
+    BOOST_CHECK_CLOSE(mskew.det(), 25.0f, 1e-4f);
+    srand(5);
+    for (int n = 0; n < 20; n++) {
+        Matrix3f m = mskew;
+        if (n > 0) {
+            for (int j = 0; j < 3; j++)
+                for (int i = 0; i < 3; i++)
+                    m[j][i] = float(rand() % 19 - 9);
+        }
+        LU<3, float> lu(m);
+        if (lu.singular())
+            continue;
+        BOOST_CHECK_CLOSE(m.det(), lu.det(), 1e-3f);
+        Matrix3f ref = lu.inverse();
+        inv = m.inverse();
+        id = m*inv;
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++) {
+                BOOST_CHECK_SMALL(inv[j][i] - ref[j][i], 1e-5f);
+                BOOST_CHECK_SMALL(id[j][i] - identity[j][i], 1e-5f);
+            }
+        }
+    }
 }
 
 BOOST_AUTO_TEST_CASE(Matrix2)
@@ -226,3 +282,2044 @@ BOOST_AUTO_TEST_CASE(Matrix2)
     float det = mat3[0][0]*mat3[1][1] - mat3[1][0]*mat3[0][1];
     BOOST_CHECK_EQUAL(mat3.det(), det);
 }
+
+static double ulpError(float v, double ref)
+{
+    float r = fabsf(float(ref));
+    return fabs(v - ref)/(nextafterf(r, INFINITY) - r);
+}
+
+BOOST_AUTO_TEST_CASE(FastTrig)
+{
+    for (float x = -10.0f; x < 10.0f; x += 0.01f) {
+        float s, c;
+        fastSincos(x, s, c);
+        BOOST_CHECK_SMALL(s - sinf(x), 1e-6f);
+        BOOST_CHECK_SMALL(c - cosf(x), 1e-6f);
+        BOOST_CHECK_SMALL(fastAtan2(s, c) - atan2f(s, c), 1e-6f);
+    }
+
+    for (float x = -1.0f; x <= 1.0f; x += 0.01f) {
+        BOOST_CHECK_SMALL(fastAcos(x) - acosf(x), 1e-6f);
+        BOOST_CHECK_SMALL(fastAsin(x) - asinf(x), 1e-6f);
+    }
+
+    // Densest error near the zeros, around every multiple of pi/2 and on
+    // a fine grid in between, against the bounds in fastmath.h
+    std::vector<float> xs;
+    for (int k = 0; k*M_PI/2 <= 100.0; k++) {
+        float x = float(k*M_PI/2);
+        for (int i = 0; i < 256; i++)
+            x = nextafterf(x, 0.0f);
+        for (int i = 0; i < 512 && x <= 100.0f; i++, x = nextafterf(x, INFINITY))
+            xs.push_back(x);
+    }
+    for (float x = 0.0f; x <= 100.0f; x += 1e-3f)
+        xs.push_back(x);
+    size_t positive = xs.size();
+    for (size_t i = 0; i < positive; i++)
+        xs.push_back(-xs[i]);
+    std::vector<float> bs(xs.size()), bc(xs.size());
+    fastSincos(&xs[0], &bs[0], &bc[0], xs.size());
+    double worst[2] = {0.0, 0.0};
+    for (size_t i = 0; i < xs.size(); i++) {
+        float s, c;
+        fastSincos(xs[i], s, c);
+        int range = fabsf(xs[i]) <= float(M_PI) ? 0 : 1;
+        double rs = sin(double(xs[i])), rc = cos(double(xs[i]));
+        worst[range] = std::max(worst[range], std::max(ulpError(s, rs), ulpError(c, rc)));
+        worst[range] = std::max(worst[range], std::max(ulpError(bs[i], rs), ulpError(bc[i], rc)));
+    }
+    BOOST_CHECK_LE(worst[0], 1.6);
+    BOOST_CHECK_LE(worst[1], 2.1);
+
+    // Signed zero, and libm past the reduced range
+    float s, c;
+    fastSincos(-0.0f, s, c);
+    BOOST_CHECK(std::signbit(s) && c == 1.0f);
+    BOOST_CHECK(std::signbit(fastSin(-0.0f)));
+    float big[] = {-0.0f, 1e10f, -3e38f, NAN, 8193.0f, 1.0f, -1.0f, 2.0f};
+    float bigs[8], bigc[8];
+    fastSincos(big, bigs, bigc, 8);
+    BOOST_CHECK(std::signbit(bigs[0]));
+    BOOST_CHECK_EQUAL(bigs[1], sinf(1e10f));
+    BOOST_CHECK_EQUAL(bigc[2], cosf(-3e38f));
+    BOOST_CHECK(std::isnan(bigs[3]) && std::isnan(bigc[3]));
+    BOOST_CHECK_EQUAL(fastCos(8193.0f), cosf(8193.0f));
+    BOOST_CHECK_EQUAL(fastSin(-1e30f), sinf(-1e30f));
+
+    for (float y : {0.0f, -0.0f}) {
+        for (float x : {0.0f, -0.0f, 1.0f, -1.0f}) {
+            BOOST_CHECK_EQUAL(fastAtan2(y, x), atan2f(y, x));
+            BOOST_CHECK_EQUAL(std::signbit(fastAtan2(y, x)),
+                              std::signbit(atan2f(y, x)));
+        }
+    }
+
+    BOOST_CHECK_CLOSE(fastRsqrt(4.0f), 0.5f, 0.0001);
+    BOOST_CHECK_CLOSE(fastRsqrt(1e-4f), 100.0f, 0.0001);
+}
+
+BOOST_AUTO_TEST_CASE(BatchedRotations)
+{
+    const size_t count = 37;
+    float angles[count];
+    vec3f euler[count];
+    for (size_t i = 0; i < count; i++) {
+        angles[i] = rad(i*10.0f - 180.0f);
+        euler[i] = vec3f(angles[i], angles[i]*0.5f, -angles[i]);
+    }
+
+    Matrix4f rx[count];
+    Quaternion qe[count];
+    rotateX(angles, rx, count);
+    Quaternion::fromEuler(euler, qe, count);
+
+    for (size_t i = 0; i < count; i++) {
+        Matrix4f m = rotateX(angles[i]);
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                BOOST_CHECK_SMALL(rx[i][j][k] - m[j][k], 1e-6f);
+
+        Quaternion q = Quaternion::fromEuler(euler[i]);
+        BOOST_CHECK_SMALL(qe[i].m_w - q.m_w, 1e-6f);
+        BOOST_CHECK_SMALL(distance(qe[i].m_v, q.m_v), 1e-6f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Affine3x4)
+{
+    Matrix4f m1 = translate(1.0f, 2.0f, 3.0f) * rotateY(0.3f) * scale(2.0f, 3.0f, 4.0f);
+    Matrix4f m2 = rotateX(-0.7f) * translate(-4.0f, 5.0f, 0.5f);
+    Matrix3x4f a1(m1), a2(m2);
+
+    BOOST_CHECK_EQUAL(a1.toMatrix4(), m1);
+
+    Matrix4f m12 = m1 * m2;
+    Matrix3x4f a12 = a1 * a2;
+    vec3f p(1.0f, -2.0f, 3.0f);
+    vec4f p4 = m12 * vec4f(p, 1.0f);
+    vec3f pa = a12.transformPoint(p);
+    BOOST_CHECK_SMALL(distance(vec3(p4), pa), 1e-5f);
+
+    vec3f pts[3] = { p, vec3f(0.0f), vec3f(-1.0f, 0.5f, 2.0f) };
+    vec3f out[3];
+    transformPoints(a12, pts, out, 3);
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK_SMALL(distance(out[i], a12.transformPoint(pts[i])), 1e-5f);
+
+    Matrix3x4f id = a1.inverse() * a1;
+    Matrix3x4f ref;
+    ref.loadIdentity();
+    for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 4; i++)
+            BOOST_CHECK_SMALL(id[j][i] - ref[j][i], 1e-5f);
+}
+
+BOOST_AUTO_TEST_CASE(MatrixInPlace)
+{
+    Matrix4f a = translate(1.0f, 2.0f, 3.0f) * rotateZ(0.5f);
+    Matrix4f b = scale(2.0f, 3.0f, 4.0f) * rotateX(0.25f);
+
+    Matrix4f ref = a * b;
+    Matrix4f m = b;
+    m *= a;
+    BOOST_CHECK_EQUAL(m, ref);
+
+    Matrix4f sq = a * a;
+    m = a;
+    m *= m;
+    BOOST_CHECK_EQUAL(m, sq);
+
+    Matrix4f batch[2] = { a, b };
+    multiply(batch, batch, batch, 2);
+    BOOST_CHECK_EQUAL(batch[0], sq);
+    BOOST_CHECK_EQUAL(batch[1], b * b);
+
+    float raw[16*3+1];
+    memcpy(raw+1, a.data(), sizeof(float)*16);
+    memcpy(raw+17, b.data(), sizeof(float)*16);
+    multiplyUnaligned(raw+1, raw+17, raw+33, 1);
+    BOOST_CHECK_EQUAL(Matrix4f(raw+33), ref);
+    BOOST_CHECK_EQUAL((size_t)batch[1].data() % 16, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(QuaternionMatrixBatch)
+{
+    const size_t count = 11;
+    float x[count], y[count], z[count], w[count];
+    for (size_t i = 0; i < count; i++) {
+        // Angles up to ~2pi so every branch of Shepperd's method is taken
+        vec3f axis(i%3 == 0, i%3 == 1, 0.5f + (i%3 == 2));
+        Quaternion q = Quaternion::fromAngleAxis(i*0.6f, axis);
+        x[i] = q.m_v.x(); y[i] = q.m_v.y(); z[i] = q.m_v.z(); w[i] = q.m_w;
+    }
+
+    Matrix3f m3[count];
+    Matrix3x4f m34[count];
+    Matrix4f m4[count];
+    toMatrices(x, y, z, w, m3, count);
+    toMatrices(x, y, z, w, m34, count);
+    toMatrices(x, y, z, w, m4, count);
+
+    float rx[count], ry[count], rz[count], rw[count];
+    fromMatrices(m4, rx, ry, rz, rw, count);
+    float sx[count], sy[count], sz[count], sw[count];
+    fromMatrices(m34, sx, sy, sz, sw, count);
+
+    for (size_t i = 0; i < count; i++) {
+        Quaternion q(w[i], vec3f(x[i], y[i], z[i]));
+        Matrix4f ref = q.toMatrix();
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++) {
+                BOOST_CHECK_SMALL(m4[i][j][k] - ref[j][k], 1e-6f);
+                if (j < 3 && k < 3)
+                    BOOST_CHECK_SMALL(m3[i][j][k] - ref[j][k], 1e-6f);
+            }
+        BOOST_CHECK_EQUAL(m34[i].toMatrix4(), m4[i]);
+
+        // q and -q are the same rotation
+        float sign = (q.m_w*rw[i] + dot(q.m_v, vec3f(rx[i], ry[i], rz[i]))) < 0 ? -1.0f : 1.0f;
+        BOOST_CHECK_SMALL(rw[i]*sign - q.m_w, 1e-5f);
+        BOOST_CHECK_SMALL(distance(vec3f(rx[i], ry[i], rz[i])*sign, q.m_v), 1e-5f);
+        BOOST_CHECK_EQUAL(rx[i], sx[i]);
+        BOOST_CHECK_EQUAL(rw[i], sw[i]);
+
+        Quaternion qs = Quaternion::fromMatrix(ref);
+        BOOST_CHECK_SMALL(fabsf(qs.m_w) - fabsf(q.m_w), 1e-5f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(AnimationTracks)
+{
+    Quaternion q = Quaternion::fromEuler(rad(10.0f), rad(-70.0f), rad(130.0f));
+    Quaternion p = PackedQuaternion::pack(q).unpack();
+    Quaternion pn = PackedQuaternion::pack(q*-1.0f).unpack();
+    BOOST_CHECK_SMALL(fabsf(p.m_w*q.m_w + dot(p.m_v, q.m_v)) - 1.0f, 1e-4f);
+    BOOST_CHECK_EQUAL(p, pn);
+
+    float times[] = { 0.0f, 1.0f, 2.0f, 4.0f };
+    Quaternion rotations[] = {
+        Quaternion(),
+        Quaternion::fromAngleAxis(rad(90.0f), vec3f(0.0f, 1.0f, 0.0f)),
+        Quaternion::fromAngleAxis(rad(180.0f), vec3f(0.0f, 1.0f, 0.0f)),
+        Quaternion::fromAngleAxis(rad(90.0f), vec3f(1.0f, 0.0f, 0.0f)),
+    };
+    vec3f positions[] = {
+        vec3f(0.0f), vec3f(1.0f, 0.0f, 0.0f),
+        vec3f(1.0f, 2.0f, 0.0f), vec3f(-3.0f, 2.0f, 5.0f),
+    };
+
+    Animation anim(2);
+    anim.track(0).rotation.set(times, rotations, 4);
+    anim.track(0).translation.set(times, positions, 4);
+    anim.track(1).translation.set(times, positions, 2);
+
+    TrackCursor cursor;
+    BOOST_CHECK_EQUAL(seekKey(times, 4, 0.5f, cursor), 0u);
+    BOOST_CHECK_EQUAL(seekKey(times, 4, 1.5f, cursor), 1u);
+    BOOST_CHECK_EQUAL(cursor.key, 1u);
+    BOOST_CHECK_EQUAL(seekKey(times, 4, 3.0f, cursor), 2u);
+    BOOST_CHECK_EQUAL(seekKey(times, 4, 10.0f, cursor), 2u);
+    BOOST_CHECK_EQUAL(seekKey(times, 4, -1.0f, cursor), 0u);
+
+    AnimationCursor state;
+    Pose pose;
+    for (float t = 0.0f; t <= 4.0f; t += 0.25f) {
+        anim.sample(t, state, pose);
+
+        TrackCursor rc, tc;
+        Quaternion r = anim.track(0).rotation.sample(t, rc);
+        vec3f tr = anim.track(0).translation.sample(t, tc);
+        BOOST_CHECK_SMALL(pose.rw[0] - r.m_w, 1e-5f);
+        BOOST_CHECK_SMALL(pose.ry[0] - r.m_v.y(), 1e-5f);
+        BOOST_CHECK_SMALL(pose.tx[0] - tr.x(), 1e-5f);
+        BOOST_CHECK_SMALL(pose.tz[0] - tr.z(), 1e-5f);
+        BOOST_CHECK_EQUAL(pose.sx[1], 1.0f);
+        BOOST_CHECK_EQUAL(pose.rw[1], 1.0f);
+    }
+
+    anim.sample(1.5f, state, pose);
+    BOOST_CHECK_SMALL(pose.tx[0] - 1.0f, 1e-4f);
+    BOOST_CHECK_SMALL(pose.ty[0] - 1.0f, 1e-4f);
+    BOOST_CHECK_SMALL(pose.tx[1] - 1.0f, 1e-4f);
+    Quaternion mid = Quaternion::fromAngleAxis(rad(135.0f), vec3f(0.0f, 1.0f, 0.0f));
+    BOOST_CHECK_SMALL(pose.rw[0] - mid.m_w, 1e-3f);
+    BOOST_CHECK_SMALL(pose.ry[0] - mid.m_v.y(), 1e-3f);
+}
+
+BOOST_AUTO_TEST_CASE(KernelDispatch)
+{
+    simd_level_t parsed;
+    BOOST_CHECK(parseSimdLevel("avx2", parsed) && parsed == SIMD_AVX2);
+    BOOST_CHECK(!parseSimdLevel("neon", parsed));
+    BOOST_CHECK(kernels().level <= detectSimdLevel());
+
+    const size_t count = 37;
+    Matrix4f a[count], b[count];
+    float x[count], y[count], z[count], r[count];
+    for (size_t i = 0; i < count; i++) {
+        a[i] = translate(i*1.0f, 2.0f, -3.0f) * rotateY(i*0.1f);
+        b[i] = rotateX(i*0.2f) * scale(1.0f, 2.0f, i+1.0f);
+        x[i] = i*0.5f - 9.0f;
+        y[i] = (i%5)*0.5f;
+        z[i] = -(i*1.0f);
+        r[i] = (i%4)*0.7f;
+    }
+
+    Frustum frustum;
+    frustum.set(45.0f, 1.0f, 1.0f, 100.0f);
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+
+    Kernels ref = kernels(SIMD_SCALAR);
+    Matrix4f mref[count];
+    float rx[count], ry[count], rz[count];
+    uint8_t cref[count];
+    ref.multiply(a, b, mref, count);
+    ref.transformPoints(a[3], x, y, z, rx, ry, rz, count);
+    ref.cullSpheres(planes, x, y, z, r, cref, count);
+
+    for (int l = SIMD_SCALAR; l <= detectSimdLevel(); l++) {
+        Kernels k = kernels((simd_level_t)l);
+        BOOST_CHECK_EQUAL(k.level, l);
+
+        Matrix4f m[count];
+        float ox[count], oy[count], oz[count];
+        uint8_t classes[count];
+        k.multiply(a, b, m, count);
+        k.transformPoints(a[3], x, y, z, ox, oy, oz, count);
+        k.cullSpheres(planes, x, y, z, r, classes, count);
+
+        for (size_t i = 0; i < count; i++) {
+            for (int j = 0; j < 4; j++)
+                for (int n = 0; n < 4; n++)
+                    BOOST_CHECK_SMALL(m[i][j][n] - mref[i][j][n], 1e-4f);
+            BOOST_CHECK_SMALL(ox[i] - rx[i], 1e-4f);
+            BOOST_CHECK_SMALL(oy[i] - ry[i], 1e-4f);
+            BOOST_CHECK_SMALL(oz[i] - rz[i], 1e-4f);
+            BOOST_CHECK_EQUAL(classes[i], cref[i]);
+        }
+    }
+
+    uint8_t classes[count];
+    frustum.containsSpheres(x, y, z, r, classes, count);
+    for (size_t i = 0; i < count; i++) {
+        vec3f c(x[i], y[i], z[i]);
+        if (classes[i] == INSIDE)
+            BOOST_CHECK_EQUAL(frustum.containsSphere(c, r[i]), INSIDE);
+        if (frustum.containsSphere(c, r[i]) == OUTSIDE)
+            BOOST_CHECK_EQUAL(classes[i], OUTSIDE);
+        if (r[i] == 0.0f)
+            BOOST_CHECK_EQUAL(classes[i] != OUTSIDE, frustum.containsPoint(c));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Transform2D)
+{
+    Matrix2x3f m;
+    m.loadIdentity().setTransform(vec2f(3.0f, -2.0f), vec2f(2.0f, 0.5f), 0.7f);
+
+    // Same as scale, then rotate, then translate in 3x3
+    Matrix3f ref = rotate2D(0.7f);
+    Matrix2x3f r(ref);
+    vec2f p(1.5f, -4.0f);
+    vec2f a = m.transformPoint(p);
+    vec2f b = r.transformPoint(vec2f(p[0]*2.0f, p[1]*0.5f));
+    BOOST_CHECK_SMALL(a[0] - (b[0] + 3.0f), 1e-5f);
+    BOOST_CHECK_SMALL(a[1] - (b[1] - 2.0f), 1e-5f);
+
+    vec2f back = m.inverse().transformPoint(a);
+    BOOST_CHECK_SMALL(back[0] - p[0], 1e-4f);
+    BOOST_CHECK_SMALL(back[1] - p[1], 1e-4f);
+
+    Matrix2x3f id;
+    id.loadIdentity();
+    Matrix2x3f c = m * m.inverse();
+    for (int j = 0; j < 2; j++)
+        for (int i = 0; i < 3; i++)
+            BOOST_CHECK_SMALL(c[j][i] - id[j][i], 1e-5f);
+    BOOST_CHECK(Matrix2x3f(m.toMatrix3()) == m);
+
+    vec2f in[7], out[7];
+    for (int i = 0; i < 7; i++)
+        in[i] = vec2f(i*1.0f, 2.0f - i);
+    transformPoints(m, in, out, 7);
+    for (int i = 0; i < 7; i++) {
+        vec2f e = m.transformPoint(in[i]);
+        BOOST_CHECK_SMALL(out[i][0] - e[0], 1e-5f);
+        BOOST_CHECK_SMALL(out[i][1] - e[1], 1e-5f);
+    }
+
+    const size_t count = 11;
+    float x[count], y[count], w[count], h[count], angle[count];
+    for (size_t i = 0; i < count; i++) {
+        x[i] = i*10.0f;
+        y[i] = -(i*3.0f);
+        w[i] = 4.0f + i;
+        h[i] = 2.0f;
+        angle[i] = i*0.4f - 2.0f;
+    }
+    vec2f corners[count*4];
+    spriteQuads(x, y, w, h, angle, corners, count);
+    for (size_t i = 0; i < count; i++) {
+        Matrix2x3f t;
+        t.loadIdentity().setTransform(vec2f(x[i], y[i]), vec2f(w[i], h[i]), angle[i]);
+        const vec2f local[4] = { vec2f(-0.5f, -0.5f), vec2f(0.5f, -0.5f),
+                                 vec2f(0.5f, 0.5f), vec2f(-0.5f, 0.5f) };
+        for (int k = 0; k < 4; k++) {
+            vec2f e = t.transformPoint(local[k]);
+            BOOST_CHECK_SMALL(corners[i*4+k][0] - e[0], 1e-4f);
+            BOOST_CHECK_SMALL(corners[i*4+k][1] - e[1], 1e-4f);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(RectBatch)
+{
+    const size_t count = 203;
+    std::vector<Rect> rects(count);
+    for (size_t i = 0; i < count; i++)
+        rects[i] = Rect((i*37)%100*1.0f, (i*53)%80*1.0f, 3.0f + i%7, 2.0f + i%5);
+
+    vec2f p(41.5f, 20.5f);
+    uint8_t inside[count];
+    pointInRects(p, &rects[0], inside, count);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK_EQUAL(inside[i], rects[i].inRect(p));
+
+    std::vector<Rect> shifted(rects);
+    for (size_t i = 0; i < count; i++) {
+        shifted[i].x += 2.0f;
+        shifted[i].y -= 1.0f;
+    }
+    std::vector<Rect> is(count), un(count);
+    intersectRects(&rects[0], &shifted[0], &is[0], count);
+    uniteRects(&rects[0], &shifted[0], &un[0], count);
+    for (size_t i = 0; i < count; i++) {
+        BOOST_CHECK(is[i] == rects[i].intersection(shifted[i]));
+        BOOST_CHECK(un[i] == rects[i].united(shifted[i]));
+    }
+    BOOST_CHECK(Rect(0, 0, 2, 2).intersection(Rect(5, 5, 1, 1)) == Rect(5, 5, 0, 0));
+
+    Rect bounds = boundingRect(&rects[0], count);
+    Rect expect = rects[0];
+    for (size_t i = 1; i < count; i++)
+        expect = expect.united(rects[i]);
+    BOOST_CHECK(bounds == expect);
+
+    RectGrid grid;
+    grid.build(&rects[0], count);
+    BOOST_CHECK_EQUAL(grid.size(), count);
+
+    std::vector<uint32_t> hits;
+    for (int n = 0; n < 50; n++) {
+        vec2f q(n*2.13f - 3.0f, n*1.71f - 2.0f);
+        grid.queryPoint(q, hits);
+        std::vector<uint32_t> brute;
+        for (size_t i = 0; i < count; i++)
+            if (rects[i].inRect(q))
+                brute.push_back(i);
+        BOOST_CHECK(hits == brute);
+        BOOST_CHECK_EQUAL(grid.hitTest(q), brute.empty() ? -1 : (int)brute.back());
+
+        Rect area(q.x(), q.y(), 6.0f, 4.0f);
+        grid.queryRect(area, hits);
+        brute.clear();
+        for (size_t i = 0; i < count; i++)
+            if (rects[i].intersects(area))
+                brute.push_back(i);
+        BOOST_CHECK(hits == brute);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Projection)
+{
+    // GL style perspective, 90 degrees vertical fov, looking down -z
+    const float n = 1.0f, f = 100.0f, aspect = 800.0f/600.0f;
+    Matrix4f proj = identity();
+    proj[0][0] = 1.0f/aspect;
+    proj[1][1] = 1.0f;
+    proj[2][2] = (f+n)/(n-f);
+    proj[2][3] = -1.0f;
+    proj[3][2] = 2.0f*f*n/(n-f);
+    proj[3][3] = 0.0f;
+    Matrix4f viewProj = proj * translate(1.0f, -2.0f, -5.0f) * rotateY(0.3f);
+    Matrix4f inv = viewProj.inverse();
+    Matrix4f id = viewProj * inv;
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            BOOST_CHECK_SMALL(id[j][i] - (i == j ? 1.0f : 0.0f), 1e-5f);
+    BOOST_CHECK_CLOSE(scale(2.0f, 3.0f, 4.0f).det(), 24.0f, 1e-4f);
+    Viewport viewport(0, 0, 800, 600);
+
+    float xc, yc, sx, sy;
+    viewport.toClipSpace(123.0f, 456.0f, xc, yc);
+    viewport.fromClipSpace(xc, yc, sx, sy);
+    BOOST_CHECK_CLOSE(sx, 123.0f, 1e-4f);
+    BOOST_CHECK_CLOSE(sy, 456.0f, 1e-4f);
+
+    const size_t count = 23;
+    vec3f points[count], screen[count];
+    uint8_t clip[count];
+    for (size_t i = 0; i < count; i++)
+        points[i] = vec3f(i*0.7f - 8.0f, (i%5)*0.9f - 2.0f, 4.0f - i*2.0f);
+    project(viewProj, viewport, points, screen, clip, count);
+
+    for (size_t i = 0; i < count; i++) {
+        vec4f c = viewProj * vec4f(points[i], 1.0f);
+        bool inside = (fabsf(c[0]) <= c[3] && fabsf(c[1]) <= c[3] && fabsf(c[2]) <= c[3]);
+        BOOST_CHECK_EQUAL(clip[i] == 0, inside);
+        if (c[3] < 0.0f)
+            BOOST_CHECK(clip[i] & CLIP_NEAR);
+        if (!inside)
+            continue;
+
+        BOOST_CHECK(screen[i][0] >= 0.0f && screen[i][0] <= 800.0f);
+        BOOST_CHECK(screen[i][1] >= 0.0f && screen[i][1] <= 600.0f);
+        vec3f back = unproject(screen[i][0], screen[i][1], screen[i][2], inv, viewport);
+        BOOST_CHECK_SMALL(distance(back, points[i]), 1e-2f);
+
+        Ray ray = unprojectRay(screen[i][0], screen[i][1], inv, viewport);
+        vec3f rel = points[i] - ray.origin;
+        BOOST_CHECK_SMALL(cross(rel, ray.dir).length(), 1e-2f);
+        BOOST_CHECK(dot(rel, ray.dir) > 0.0f);
+    }
+
+    vec2f cursors[count];
+    Ray rays[count];
+    for (size_t i = 0; i < count; i++)
+        cursors[i] = vec2f(i*31.0f, 600.0f - i*17.0f);
+    unprojectRays(inv, viewport, cursors, rays, count);
+    for (size_t i = 0; i < count; i++) {
+        Ray ray = unprojectRay(cursors[i][0], cursors[i][1], inv, viewport);
+        BOOST_CHECK_SMALL(distance(rays[i].origin, ray.origin), 1e-3f);
+        BOOST_CHECK_SMALL(distance(rays[i].dir, ray.dir), 1e-4f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(StructureOfArrays)
+{
+    const size_t count = 37;
+    vec3f points[count], back[count];
+    vec2f uv[count], uvBack[count];
+    for (size_t i = 0; i < count; i++) {
+        points[i] = vec3f(i*1.0f, i*2.0f + 0.5f, -(i*3.0f));
+        uv[i] = vec2f(i*0.25f, 1.0f - i);
+    }
+
+    SoA<vec3f> soa(points, count);
+    BOOST_CHECK_EQUAL(soa.size(), count);
+    BOOST_CHECK_EQUAL(soa.paddedSize(), 48u);
+    for (size_t k = 0; k < 3; k++)
+        BOOST_CHECK_EQUAL((uintptr_t)soa.lane(k) % 64, 0u);
+    for (size_t i = 0; i < count; i++) {
+        BOOST_CHECK_EQUAL(soa.x()[i], points[i].x());
+        BOOST_CHECK_EQUAL(soa.z()[i], points[i].z());
+        BOOST_CHECK(vec3f(soa[i]) == points[i]);
+    }
+    for (size_t i = count; i < soa.paddedSize(); i++)
+        BOOST_CHECK_EQUAL(soa.y()[i], 0.0f);
+    soa.copyTo(back);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK(back[i] == points[i]);
+
+    SoA<vec2f> uvs(uv, count);
+    uvs.copyTo(uvBack);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK(uvBack[i] == uv[i] && uvs[i] == uv[i]);
+
+    // Proxies read and write like the AoS types
+    soa[3] = vec3f(7.0f, 8.0f, 9.0f);
+    soa[4].y() += 1.0f;
+    BOOST_CHECK(soa[3] == vec3f(7.0f, 8.0f, 9.0f));
+    BOOST_CHECK_EQUAL(soa.y()[4], points[4].y() + 1.0f);
+
+    SoA<vec3f> grown;
+    for (size_t i = 0; i < count; i++)
+        grown.push_back(points[i]);
+    size_t visited = 0;
+    grown.forEachChunk([&](size_t off, size_t n) {
+        BOOST_CHECK_EQUAL(off % SOA_WIDTH, 0u);
+        for (size_t i = 0; i < n; i++)
+            BOOST_CHECK(vec3f(grown[off+i]) == points[off+i]);
+        visited += n;
+    });
+    BOOST_CHECK_EQUAL(visited, count);
+    grown.resize(5);
+    BOOST_CHECK_EQUAL(grown.x()[6], 0.0f);
+
+    Matrix4f m = translate(1.0f, 2.0f, 3.0f) * rotateZ(0.4f);
+    SoA<vec3f> moved;
+    transformPoints(m, grown, moved);
+    for (size_t i = 0; i < grown.size(); i++) {
+        vec4f e = m * vec4f(points[i], 1.0f);
+        for (int k = 0; k < 3; k++)
+            BOOST_CHECK_SMALL(vec3f(moved[i])[k] - e[k], 1e-4f);
+    }
+
+    Quaternion q[count];
+    Matrix4f a[count], b[count];
+    for (size_t i = 0; i < count; i++) {
+        q[i] = Quaternion::fromAngleAxis(i*0.1f, vec3f(1.0f, 0.5f*i, 2.0f).normalized());
+        a[i] = rotateX(i*0.2f) * translate(i*1.0f, 0.0f, 1.0f);
+        b[i] = scale(1.0f, 2.0f, 0.5f + i);
+    }
+    SoA<Quaternion> qs(q, count);
+    Quaternion qBack[count];
+    qs.copyTo(qBack);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK(qBack[i] == q[i] && Quaternion(qs[i]) == q[i]);
+
+    SoA<Matrix4f> rot;
+    toMatrices(qs, rot);
+    SoA<Quaternion> qs2;
+    fromMatrices(rot, qs2);
+    for (size_t i = 0; i < count; i++) {
+        Matrix4f e = q[i].toMatrix();
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                BOOST_CHECK_SMALL(rot[i][j][k] - e[j][k], 1e-5f);
+        float d = fabsf(dot(vec4f(qs2[i].x(), qs2[i].y(), qs2[i].z(), qs2[i].w()),
+                            vec4f(q[i].m_v, q[i].m_w)));
+        BOOST_CHECK_CLOSE(d, 1.0f, 1e-3f);
+    }
+
+    SoA<Matrix4f> sa(a, count), sb(b, count);
+    Matrix4f mBack[count];
+    sa.copyTo(mBack);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK(mBack[i] == a[i]);
+    multiply(sa, sb, sa);
+    for (size_t i = 0; i < count; i++) {
+        Matrix4f e = a[i] * b[i];
+        Matrix4f r = sa[i];
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                BOOST_CHECK_SMALL(r[j][k] - e[j][k], 1e-4f);
+    }
+
+    Frustum frustum;
+    frustum.set(45.0f, 1.0f, 1.0f, 100.0f);
+    SoA<vec4f> spheres;
+    for (size_t i = 0; i < count; i++)
+        spheres.push_back(vec4f(points[i].x()*0.3f, 0.0f, -points[i].y(), 1.5f));
+    uint8_t classes[count];
+    frustum.containsSpheres(spheres, classes);
+    for (size_t i = 0; i < count; i++) {
+        vec4f s = spheres[i];
+        uint8_t one;
+        frustum.containsSpheres(&s[0], &s[1], &s[2], &s[3], &one, 1);
+        BOOST_CHECK_EQUAL(classes[i], one);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BinaryBlob)
+{
+    const char *path = "gfxmath_test.blob";
+    const size_t count = 1000;
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > transforms(count);
+    std::vector<Rect> bounds(count);
+    Quaternion q[3];
+    for (size_t i = 0; i < count; i++) {
+        transforms[i] = translate(i*1.0f, 2.0f, 3.0f) * rotateY(i*0.01f);
+        bounds[i] = Rect(i*1.0f, i*2.0f, 3.0f, 4.0f);
+    }
+    q[1] = Quaternion::fromAngleAxis(0.5f, vec3f(0.0f, 1.0f, 0.0f));
+
+    BlobWriter writer;
+    BOOST_REQUIRE(writer.open(path));
+    BOOST_CHECK(writer.beginArray<Matrix4f>("transforms"));
+    BOOST_CHECK(writer.write(&transforms[0], 300));
+    BOOST_CHECK(!writer.write(&bounds[0], 1));
+    BOOST_CHECK(writer.write(&transforms[300], count-300));
+    BOOST_CHECK(writer.endArray());
+    BOOST_CHECK(writer.writeArray("bounds", &bounds[0], count));
+    BOOST_CHECK(writer.writeArray("rotations", q, 3));
+    BOOST_REQUIRE(writer.close());
+
+    BlobReader reader;
+    BOOST_REQUIRE(reader.open(path));
+    BOOST_CHECK_EQUAL(reader.arrayCount(), 3u);
+    BOOST_CHECK(reader.verify());
+
+    size_t n;
+    const Matrix4f *m = reader.array<Matrix4f>("transforms", n);
+    BOOST_REQUIRE(m);
+    BOOST_CHECK_EQUAL(n, count);
+    BOOST_CHECK_EQUAL((uintptr_t)m % BLOB_ALIGNMENT, 0u);
+    for (size_t i = 0; i < count; i++)
+        BOOST_CHECK(m[i] == transforms[i]);
+
+    const Rect *r = reader.array<Rect>("bounds", n);
+    BOOST_REQUIRE(r);
+    BOOST_CHECK(r[count-1] == bounds[count-1]);
+    const Quaternion *rq = reader.array<Quaternion>("rotations", n);
+    BOOST_REQUIRE(rq && n == 3);
+    BOOST_CHECK(rq[1] == q[1]);
+    BOOST_CHECK(!reader.array<vec3f>("bounds", n) && n == 0);
+    BOOST_CHECK(!reader.find("missing"));
+
+    // Same blob from memory, then corrupted
+    FILE *f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > storage(size/sizeof(Matrix4f) + 1);
+    uint8_t *bytes = reinterpret_cast<uint8_t*>(&storage[0]);
+    BOOST_REQUIRE_EQUAL(fread(bytes, 1, size, f), size);
+    fclose(f);
+    remove(path);
+
+    BlobReader mem;
+    BOOST_CHECK(mem.openMemory(bytes, size));
+    BOOST_CHECK(!mem.openMemory(bytes, size-1));
+    BOOST_CHECK(!mem.openMemory(bytes+4, size-4));
+
+    bytes[BLOB_ALIGNMENT + 5] ^= 1;
+    BOOST_CHECK(mem.openMemory(bytes, size));
+    BOOST_CHECK(!mem.verify());
+    bytes[BLOB_ALIGNMENT + 5] ^= 1;
+
+    bytes[size - 10] ^= 1;
+    BOOST_CHECK(!mem.openMemory(bytes, size));
+    BOOST_CHECK(mem.error() != NULL);
+    bytes[size - 10] ^= 1;
+
+    // A consistent header whose table is shifted off alignment
+    BlobHeader *h = reinterpret_cast<BlobHeader*>(bytes);
+    size_t table = h->tableOffset;
+    memmove(bytes + table + 4, bytes + table, size - table);
+    h->tableOffset += 4;
+    h->fileSize += 4;
+    h->checksum = 0;
+    h->checksum = crc32(bytes + table + 4, h->arrayCount*sizeof(BlobArray),
+                        crc32(h, sizeof(*h)));
+    BOOST_CHECK(!mem.openMemory(bytes, size + 4));
+}
+
+BOOST_AUTO_TEST_CASE(TextFormat)
+{
+    char buf[4096];
+    char *end = buf + sizeof(buf);
+
+    const float values[] = { 0.0f, -0.0f, 1.0f, 0.1f, -3.14159274f, 1e-30f,
+                             3.4028235e38f, 1.17549435e-38f, 123456.789f };
+    for (size_t i = 0; i < sizeof(values)/sizeof(values[0]); i++) {
+        char *p = format(buf, end, values[i]);
+        BOOST_REQUIRE(p);
+        float v;
+        BOOST_CHECK(parse(buf, p, v) == p);
+        BOOST_CHECK_EQUAL(v, values[i]);
+    }
+
+    vec3f v(1.0f/3.0f, -2.5f, 1e7f);
+    char *p = format(buf, end, v);
+    BOOST_REQUIRE(p);
+    std::ostringstream ss;
+    ss << v;
+    vec3f pv;
+    BOOST_CHECK(parse(buf, p, pv) == p);
+    BOOST_CHECK(pv == v);
+
+    // The iostream text parses too, at its lower precision
+    std::string s = ss.str();
+    BOOST_CHECK(parse(s.data(), s.data()+s.size(), pv) == s.data()+s.size());
+    BOOST_CHECK_CLOSE(pv[0], v[0], 1e-3f);
+
+    Quaternion q = Quaternion::fromAngleAxis(0.3f, vec3f(0.0f, 0.6f, 0.8f));
+    Quaternion pq;
+    p = format(buf, end, q);
+    BOOST_CHECK(parse(buf, p, pq) == p);
+    BOOST_CHECK(pq == q);
+
+    Matrix4f m[3];
+    m[0] = translate(1.5f, -2.0f, 3.25f) * rotateX(0.7f);
+    m[1] = scale(1e-5f, 2.0f, 3.0f);
+    m[2] = rotateZ(-1.1f);
+    p = formatArray(buf, end, m, 3);
+    BOOST_REQUIRE(p);
+    Matrix4f pm[3];
+    BOOST_CHECK(parseArray(buf, p, pm, 3) != NULL);
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK(pm[i] == m[i]);
+
+    BOOST_CHECK(format(buf, buf+5, v) == NULL);
+    BOOST_CHECK(formatArray(buf, buf+100, m, 3) == NULL);
+    const char bad[] = "(1, 2 3)";
+    BOOST_CHECK(parse(bad, bad+sizeof(bad)-1, pv) == NULL);
+    const char truncated[] = "(1, 2,";
+    BOOST_CHECK(parse(truncated, truncated+sizeof(truncated)-1, pv) == NULL);
+}
+
+static void countHookCalls(instr_timer_t timer, uint64_t ticks, size_t items, void *user)
+{
+    if (timer == TIMER_CULL_SPHERES)
+        *static_cast<size_t*>(user) += items;
+}
+
+BOOST_AUTO_TEST_CASE(Instrumentation)
+{
+    size_t hookItems = 0;
+    setInstrumentHook(countHookCalls, &hookItems);
+    resetInstrumentStats();
+
+    Frustum frustum;
+    frustum.set(45.0f, 1.0f, 1.0f, 100.0f);
+    Matrix4f m = rotateX(0.1f) * rotateY(0.2f);
+    Quaternion q;
+    m = m * q.toMatrix();
+
+    // Behind the near plane, inside, crossing the far plane
+    frustum.containsSphere(vec3f(0.0f, 0.0f, 5.0f), 1.0f);
+    frustum.containsSphere(vec3f(0.0f, 0.0f, -10.0f), 1.0f);
+    frustum.containsSphere(vec3f(0.0f, 0.0f, -100.0f), 1.0f);
+
+    float x[5] = { 0, 0, 0, 0, 0 }, y[5] = { 0, 0, 0, 0, 0 };
+    float z[5] = { 5, -10, -20, -100, -200 }, r[5] = { 1, 1, 1, 1, 1 };
+    uint8_t classes[5];
+    frustum.containsSpheres(x, y, z, r, classes, 5);
+
+    InstrumentStats stats = instrumentStats();
+    setInstrumentHook(NULL, NULL);
+#ifdef GFXMATH_INSTRUMENT
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_FRUSTUM_RESET], 1u);
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_MATRIX_MULTIPLY], 2u);
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_QUATERNION_TO_MATRIX], 1u);
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_CONTAINS_SPHERE], 3u);
+    BOOST_CHECK_EQUAL(stats.cullPlanes[0][OUTSIDE], 1u);
+    BOOST_CHECK_EQUAL(stats.cullPlanes[5][INSIDE], 1u);
+    BOOST_CHECK_EQUAL(stats.cullPlanes[1][INTERSECT], 1u);
+    BOOST_CHECK_EQUAL(stats.cullBatch[OUTSIDE], 2u);
+    BOOST_CHECK_EQUAL(stats.cullBatch[INSIDE], 2u);
+    BOOST_CHECK_EQUAL(stats.cullBatch[INTERSECT], 1u);
+    BOOST_CHECK_EQUAL(stats.timers[TIMER_CULL_SPHERES].calls, 1u);
+    BOOST_CHECK_EQUAL(stats.timers[TIMER_CULL_SPHERES].items, 5u);
+    BOOST_CHECK_EQUAL(hookItems, 5u);
+#else
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_MATRIX_MULTIPLY], 0u);
+    BOOST_CHECK_EQUAL(stats.timers[TIMER_CULL_SPHERES].calls, 0u);
+    BOOST_CHECK_EQUAL(hookItems, 0u);
+#endif
+    BOOST_CHECK_EQUAL(std::string(counterName(COUNT_CONTAINS_SPHERE)), "Frustum::containsSphere");
+    BOOST_CHECK_EQUAL(std::string(timerName(TIMER_PROJECT)), "project");
+}
+
+template <size_t N, typename T>
+static Matrix<N, T> randomSystem(int seed, bool spd)
+{
+    srand(seed);
+    Matrix<N, T> m;
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            m[j][i] = T(rand() % 2001 - 1000)/T(1000);
+    if (!spd)
+        return m;
+    // m^T*m + I
+    Matrix<N, T> s = m.transposed()*m;
+    for (size_t i = 0; i < N; i++)
+        s[i][i] += 1;
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(LargeMatrix)
+{
+    typedef Matrix<6, float> Matrix6f;
+    typedef Matrix<8, double> Matrix8d;
+    typedef vec<8, double> vec8d;
+
+    Matrix6f diag;
+    diag.loadIdentity();
+    for (int i = 0; i < 6; i++)
+        diag[i][i] = i+1;
+    BOOST_CHECK_CLOSE(diag.det(), 720.0f, 1e-4f);
+
+    Matrix6f singular = randomSystem<6, float>(1, false);
+    for (int j = 0; j < 6; j++)
+        singular[j][4] = singular[j][1]*2;
+    BOOST_CHECK_EQUAL(singular.det(), 0.0f);
+    BOOST_CHECK((LU<6, float>(singular).singular()));
+
+    // Blocked multiply against the textbook loop
+    Matrix<12, float> a = randomSystem<12, float>(2, false);
+    Matrix<12, float> b = randomSystem<12, float>(3, false);
+    Matrix<12, float> ab = a*b;
+    for (int j = 0; j < 12; j++)
+        for (int i = 0; i < 12; i++) {
+            float s = 0;
+            for (int k = 0; k < 12; k++)
+                s += a[k][i]*b[j][k];
+            BOOST_CHECK_SMALL(ab[j][i] - s, 1e-4f);
+        }
+    // Left-multiply in place, dest aliases b
+    Matrix<12, float> ba = b*a;
+    a *= b;
+    BOOST_CHECK(a == ba);
+
+    Matrix8d m = randomSystem<8, double>(4, false);
+    Matrix8d id = m*m.inverse();
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            BOOST_CHECK_SMALL(id[j][i] - (i == j ? 1.0 : 0.0), 1e-9);
+
+    vec8d rhs;
+    for (int i = 0; i < 8; i++)
+        rhs[i] = i - 3.5;
+    vec8d x = LU<8, double>(m).solve(rhs);
+    vec8d r = m*x;
+    for (int i = 0; i < 8; i++)
+        BOOST_CHECK_SMALL(r[i] - rhs[i], 1e-9);
+
+    Matrix8d spd = randomSystem<8, double>(5, true);
+    Cholesky<8, double> chol(spd);
+    BOOST_REQUIRE(chol.ok());
+    Matrix8d l = chol.lower();
+    Matrix8d llt = l*l.transposed();
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            BOOST_CHECK_SMALL(llt[j][i] - spd[j][i], 1e-9);
+    x = chol.solve(rhs);
+    r = spd*x;
+    for (int i = 0; i < 8; i++)
+        BOOST_CHECK_SMALL(r[i] - rhs[i], 1e-9);
+    BOOST_CHECK((!Cholesky<8, double>(m).ok()));
+}
+
+BOOST_AUTO_TEST_CASE(BatchedSolve)
+{
+    typedef Matrix<6, float> Matrix6f;
+    typedef vec<6, float> vec6f;
+
+    // Not a multiple of SOLVE_BATCH, with one singular system
+    const size_t count = 11;
+    Matrix6f a[count], spd[count];
+    vec6f b[count], x[count];
+    for (size_t k = 0; k < count; k++) {
+        a[k] = randomSystem<6, float>(10+k, false);
+        spd[k] = randomSystem<6, float>(30+k, true);
+        for (int i = 0; i < 6; i++)
+            b[k][i] = float(k) - i;
+    }
+    a[3].loadZero();
+
+    BOOST_CHECK_EQUAL(solveLU(a, b, x, count), 1u);
+    for (size_t k = 0; k < count; k++) {
+        if (k == 3) {
+            BOOST_CHECK_EQUAL(x[k], vec6f(0.0f));
+            continue;
+        }
+        vec6f ref = LU<6, float>(a[k]).solve(b[k]);
+        for (int i = 0; i < 6; i++)
+            BOOST_CHECK_CLOSE(x[k][i], ref[i], 1e-2f);
+    }
+
+    // Not positive definite
+    spd[9][2][2] = -1;
+    BOOST_CHECK_EQUAL(solveCholesky(spd, b, x, count), 1u);
+    for (size_t k = 0; k < count; k++) {
+        if (k == 9) {
+            BOOST_CHECK_EQUAL(x[k], vec6f(0.0f));
+            continue;
+        }
+        vec6f r = spd[k]*x[k];
+        for (int i = 0; i < 6; i++)
+            BOOST_CHECK_SMALL(r[i] - b[k][i], 1e-3f);
+    }
+
+    // In place
+    vec6f y[count];
+    memcpy(y, b, sizeof(b));
+    solveLU(a, y, y, count);
+    solveLU(a, b, x, count);
+    for (size_t k = 0; k < count; k++)
+        BOOST_CHECK_EQUAL(y[k], x[k]);
+}
+
+BOOST_AUTO_TEST_CASE(Swizzles)
+{
+    vec4f a(1.0f, -2.0f, 3.0f, -4.0f);
+    BOOST_CHECK_EQUAL(a.xy(), vec2f(1.0f, -2.0f));
+    BOOST_CHECK_EQUAL(a.zxy(), vec3f(3.0f, 1.0f, -2.0f));
+    BOOST_CHECK_EQUAL(a.wzyx(), vec4f(-4.0f, 3.0f, -2.0f, 1.0f));
+    BOOST_CHECK_EQUAL(a.xxyy(), vec4f(1.0f, 1.0f, -2.0f, -2.0f));
+    BOOST_CHECK_EQUAL(a.xyz(), vec3(a));
+    BOOST_CHECK_EQUAL((a.swizzle<3, 3>()), vec2f(-4.0f, -4.0f));
+    BOOST_CHECK_EQUAL(vec2i(5, 7).yx(), vec2i(7, 5));
+
+    vec4f b(0.5f, 2.0f, -3.5f, 8.0f);
+    BOOST_CHECK_EQUAL(min(a, b), vec4f(0.5f, -2.0f, -3.5f, -4.0f));
+    BOOST_CHECK_EQUAL(max(a, b), vec4f(1.0f, 2.0f, 3.0f, 8.0f));
+    BOOST_CHECK_EQUAL(abs(a), vec4f(1.0f, 2.0f, 3.0f, 4.0f));
+    BOOST_CHECK_EQUAL(floor(b), vec4f(0.0f, 2.0f, -4.0f, 8.0f));
+    BOOST_CHECK_EQUAL(select(lessThan(a, b), a, b), min(a, b));
+    BOOST_CHECK(any(greaterThan(a, b)));
+    BOOST_CHECK(!all(greaterThan(a, b)));
+    BOOST_CHECK(all(lessThan(a, a + vec4f(1.0f))));
+
+    BOOST_CHECK_EQUAL(hsum(a), -2.0f);
+    BOOST_CHECK_EQUAL(hmin(a), -4.0f);
+    BOOST_CHECK_EQUAL(hmax(b), 8.0f);
+
+    BOOST_CHECK_EQUAL(a.manhattanNorm(), 10.0f);
+    BOOST_CHECK_EQUAL(vec3f(0.5f, -0.25f, -1.0f).manhattanNorm(), 1.75f);
+    BOOST_CHECK_EQUAL(vec2i(-3, 4).manhattanNorm(), 7);
+
+    float k = 3.0f;
+    BOOST_CHECK_EQUAL(a.map([k](float x) { return x*k; }), a*3.0f);
+    BOOST_CHECK_EQUAL(b.map(floorf), floor(b));
+}
+
+BOOST_AUTO_TEST_CASE(SpatialIndex)
+{
+    srand(7);
+    const size_t count = 500;
+    std::vector<vec3f> centers(count);
+    std::vector<float> radii(count);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = vec3f(rand() % 2000 - 1000, rand() % 2000 - 1000, rand() % 2000 - 1000)*0.05f;
+        // A few don't fit in a cell
+        radii[i] = i % 50 == 0 ? 6.0f : (rand() % 100)*0.02f;
+    }
+    centers[1] = vec3f(5000.0f, 0.0f, 0.0f);
+
+    SpatialHash index(4.0f);
+    std::vector<uint32_t> handles(count);
+    index.insert(&centers[0], &radii[0], count, &handles[0]);
+    BOOST_CHECK_EQUAL(index.size(), count);
+
+    // Move half of them, some within their cell and some far away
+    for (size_t i = 0; i < count; i += 2) {
+        centers[i] += i % 4 ? vec3f(0.1f, 0.0f, 0.0f) : vec3f(-13.0f, 7.0f, 2.0f);
+        radii[i] = i % 8 == 0 ? 3.0f : radii[i];
+    }
+    std::vector<uint32_t> moved, movedHandles;
+    std::vector<vec3f> movedCenters;
+    std::vector<float> movedRadii;
+    for (size_t i = 0; i < count; i += 2) {
+        movedHandles.push_back(handles[i]);
+        movedCenters.push_back(centers[i]);
+        movedRadii.push_back(radii[i]);
+    }
+    index.move(&movedHandles[0], &movedCenters[0], &movedRadii[0], movedHandles.size());
+
+    // Remove every fifth
+    std::vector<bool> alive(count, true);
+    for (size_t i = 0; i < count; i += 5) {
+        index.remove(handles[i]);
+        alive[i] = false;
+    }
+    BOOST_CHECK_EQUAL(index.size(), count - count/5);
+    for (size_t i = 0; i < count; i++) {
+        if (alive[i]) {
+            BOOST_CHECK_EQUAL(index.center(handles[i]), centers[i]);
+            BOOST_CHECK_EQUAL(index.radius(handles[i]), radii[i]);
+        }
+    }
+
+    std::vector<uint32_t> result, expected;
+    vec3f queries[3] = { vec3f(0.0f), vec3f(10.0f, -5.0f, 3.0f), vec3f(4900.0f, 0.0f, 0.0f) };
+    float queryRadii[3] = { 5.0f, 30.0f, 150.0f };
+    for (int q = 0; q < 3; q++) {
+        index.queryRadius(queries[q], queryRadii[q], result);
+        expected.clear();
+        for (size_t i = 0; i < count; i++)
+            if (alive[i] && distance(centers[i], queries[q]) <= queryRadii[q] + radii[i])
+                expected.push_back(handles[i]);
+        std::sort(result.begin(), result.end());
+        std::sort(expected.begin(), expected.end());
+        BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(),
+                                      expected.begin(), expected.end());
+
+        // k nearest, compared by distance since ties may come in any order
+        const size_t k = 7;
+        index.queryNearest(queries[q], k, result);
+        std::vector<float> dists, expectedDists;
+        for (size_t i = 0; i < result.size(); i++)
+            dists.push_back(distance(index.center(result[i]), queries[q]));
+        for (size_t i = 0; i < count; i++)
+            if (alive[i])
+                expectedDists.push_back(distance(centers[i], queries[q]));
+        std::sort(expectedDists.begin(), expectedDists.end());
+        expectedDists.resize(k);
+        BOOST_CHECK_EQUAL_COLLECTIONS(dists.begin(), dists.end(),
+                                      expectedDists.begin(), expectedDists.end());
+    }
+    index.queryNearest(vec3f(0.0f), 1000, result);
+    BOOST_CHECK_EQUAL(result.size(), index.size());
+
+    Frustum frustum;
+    frustum.set(45.0f, 1.0f, 1.0f, 40.0f);
+    frustum.setPosition(vec3f(0.0f, 0.0f, 10.0f));
+    index.queryFrustum(frustum, result);
+    expected.clear();
+    for (size_t i = 0; i < count; i++) {
+        uint8_t cls;
+        vec3f &c = centers[i];
+        float x = c.x(), y = c.y(), z = c.z();
+        frustum.containsSpheres(&x, &y, &z, &radii[i], &cls, 1);
+        if (alive[i] && cls != OUTSIDE)
+            expected.push_back(handles[i]);
+    }
+    std::sort(result.begin(), result.end());
+    std::sort(expected.begin(), expected.end());
+    BOOST_CHECK(!expected.empty());
+    BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(),
+                                  expected.begin(), expected.end());
+
+    // Handles are reused
+    uint32_t h = index.insert(vec3f(1.0f, 2.0f, 3.0f));
+    BOOST_CHECK(h < count);
+    index.clear();
+    BOOST_CHECK_EQUAL(index.size(), 0u);
+    index.queryRadius(vec3f(0.0f), 1000.0f, result);
+    BOOST_CHECK(result.empty());
+
+    // Objects drifting far away release the cells they leave, and the
+    // queries stay exact as cells are reused
+    for (size_t i = 0; i < 100; i++) {
+        centers[i] = vec3f(float(i % 10), float(i / 10), 0.0f)*3.0f;
+        handles[i] = index.insert(centers[i], 0.5f);
+    }
+    for (int step = 1; step <= 200; step++) {
+        for (size_t i = 0; i < 100; i++) {
+            centers[i] += vec3f(2.5f, i % 2 ? 1.0f : -1.0f, 0.5f);
+            index.move(handles[i], centers[i]);
+        }
+        BOOST_CHECK(index.cellCount() <= 100);
+        if (step % 50)
+            continue;
+        vec3f q = centers[step % 100];
+        index.queryRadius(q, 10.0f, result);
+        expected.clear();
+        for (size_t i = 0; i < 100; i++)
+            if (distance(centers[i], q) <= 10.5f)
+                expected.push_back(handles[i]);
+        std::sort(result.begin(), result.end());
+        std::sort(expected.begin(), expected.end());
+        BOOST_CHECK_EQUAL_COLLECTIONS(result.begin(), result.end(),
+                                      expected.begin(), expected.end());
+        index.queryNearest(q, 3, result);
+        BOOST_CHECK_EQUAL(result.size(), 3u);
+        BOOST_CHECK_EQUAL(result[0], handles[step % 100]);
+    }
+    for (size_t i = 0; i < 100; i++)
+        index.remove(handles[i]);
+    BOOST_CHECK_EQUAL(index.cellCount(), 0u);
+}
+
+static bool closeToIdentity(const Matrix4f &m)
+{
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            if (fabs(m[j][i] - (i == j ? 1.0f : 0.0f)) > 1e-4f)
+                return false;
+    return true;
+}
+
+static float clipDepth(const Camera &camera, const vec3f &p)
+{
+    vec4f c = camera.viewProjection() * vec4f(p, 1.0f);
+    return c.z()/c.w();
+}
+
+BOOST_AUTO_TEST_CASE(CameraMatrices)
+{
+    Camera camera;
+    camera.setPerspective(45.0f, 1.5f, 1.0f, 100.0f);
+    camera.setPosition(vec3f(1.0f, 2.0f, 3.0f));
+    camera.setOrientation(Quaternion::fromMatrix(rotateY(0.5f) * rotateX(0.2f)));
+
+    BOOST_CHECK(closeToIdentity(camera.view() * camera.inverseView()));
+    BOOST_CHECK(closeToIdentity(camera.projection() * camera.inverseProjection()));
+    BOOST_CHECK(closeToIdentity(camera.viewProjection() * camera.inverseViewProjection()));
+
+    // Same planes as a Frustum set up the same way
+    Frustum frustum;
+    frustum.set(45.0f, 1.5f, 1.0f, 100.0f);
+    frustum.setPosition(camera.position());
+    frustum.setOrientation(camera.orientation());
+    vec4f expected[6], planes[6];
+    frustum.getPlanes(expected);
+    camera.frustum().getPlanes(planes);
+    for (int i = 0; i < 6; i++)
+        for (int k = 0; k < 4; k++)
+            BOOST_CHECK(fabs(planes[i][k] - expected[i][k]) < 1e-3f);
+
+    // Near and far planes land on the ends of the depth range
+    vec3f eye = camera.position();
+    vec3f dir = vec3(camera.inverseView() * vec4f(0.0f, 0.0f, -1.0f, 0.0f));
+    BOOST_CHECK_CLOSE(clipDepth(camera, eye + dir*1.0f), -1.0f, 0.01);
+    BOOST_CHECK_CLOSE(clipDepth(camera, eye + dir*100.0f), 1.0f, 0.01);
+
+    camera.setReverseZ(true);
+    BOOST_CHECK_CLOSE(clipDepth(camera, eye + dir*1.0f), 1.0f, 0.01);
+    BOOST_CHECK(fabs(clipDepth(camera, eye + dir*100.0f)) < 1e-5f);
+    BOOST_CHECK(camera.frustum().containsPoint(eye + dir*50.0f));
+    BOOST_CHECK(!camera.frustum().containsPoint(eye + dir*101.0f));
+    BOOST_CHECK(!camera.frustum().containsPoint(eye + dir*0.5f));
+
+    // Infinite far plane
+    camera.setPerspective(45.0f, 1.5f, 1.0f, INFINITY);
+    BOOST_CHECK_CLOSE(clipDepth(camera, eye + dir*1.0f), 1.0f, 0.01);
+    BOOST_CHECK_CLOSE(clipDepth(camera, eye + dir*1e4f), 1e-4f, 0.1);
+    BOOST_CHECK(camera.frustum().containsPoint(eye + dir*1e6f));
+    BOOST_CHECK(!camera.frustum().containsPoint(eye + dir*0.5f));
+    BOOST_CHECK(closeToIdentity(camera.projection() * camera.inverseProjection()));
+    camera.setReverseZ(false);
+    BOOST_CHECK_CLOSE(clipDepth(camera, eye + dir*1.0f), -1.0f, 0.01);
+    BOOST_CHECK(camera.frustum().containsPoint(eye + dir*1e6f));
+
+    // Orthographic box, 8 x 4 around the view axis
+    camera.setOrthographic(8.0f, 4.0f, 1.0f, 10.0f);
+    camera.setPosition(vec3f(0.0f));
+    camera.setOrientation(Quaternion());
+    BOOST_CHECK(camera.frustum().containsPoint(vec3f(3.9f, -1.9f, -9.0f)));
+    BOOST_CHECK(!camera.frustum().containsPoint(vec3f(4.1f, 0.0f, -5.0f)));
+    BOOST_CHECK(!camera.frustum().containsPoint(vec3f(0.0f, 2.1f, -5.0f)));
+    BOOST_CHECK(!camera.frustum().containsPoint(vec3f(0.0f, 0.0f, -10.5f)));
+    BOOST_CHECK_CLOSE(clipDepth(camera, vec3f(0.0f, 0.0f, -1.0f)), -1.0f, 0.01);
+    BOOST_CHECK_CLOSE(clipDepth(camera, vec3f(0.0f, 0.0f, -10.0f)), 1.0f, 0.01);
+    camera.setReverseZ(true);
+    BOOST_CHECK_CLOSE(clipDepth(camera, vec3f(0.0f, 0.0f, -1.0f)), 1.0f, 0.01);
+    BOOST_CHECK(fabs(clipDepth(camera, vec3f(0.0f, 0.0f, -10.0f))) < 1e-5f);
+    BOOST_CHECK(closeToIdentity(camera.viewProjection() * camera.inverseViewProjection()));
+
+    // Moving invalidates only what depends on the pose
+    Matrix4f proj = camera.projection();
+    camera.setPosition(vec3f(5.0f, 0.0f, 0.0f));
+    BOOST_CHECK(camera.projection() == proj);
+    BOOST_CHECK(camera.frustum().containsPoint(vec3f(8.9f, 0.0f, -5.0f)));
+    BOOST_CHECK(!camera.frustum().containsPoint(vec3f(0.0f, 0.0f, -5.0f)));
+
+#ifdef GFXMATH_INSTRUMENT
+    // Unchanged settings cost nothing once everything has been read
+    camera.inverseViewProjection();
+    frustum.setOrientation(camera.orientation());
+    resetInstrumentStats();
+    for (int i = 0; i < 10; i++) {
+        camera.setPosition(vec3f(5.0f, 0.0f, 0.0f));
+        camera.setOrientation(Quaternion());
+        camera.setOrthographic(8.0f, 4.0f, 1.0f, 10.0f);
+        camera.frustum();
+        camera.inverseViewProjection();
+        frustum.set(45.0f, 1.5f, 1.0f, 100.0f);
+        frustum.setOrientation(camera.orientation());
+    }
+    InstrumentStats stats = instrumentStats();
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_MATRIX_MULTIPLY], 0u);
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_QUATERNION_TO_MATRIX], 0u);
+    BOOST_CHECK_EQUAL(stats.counters[COUNT_FRUSTUM_RESET], 0u);
+#endif
+}
+
+static bool matricesClose(const Matrix4f &a, const Matrix4f &b)
+{
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            if (fabs(a[j][i] - b[j][i]) > 1e-4f)
+                return false;
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(TransformClasses)
+{
+    Matrix4f proj;
+    proj.loadZero();
+    proj[0][0] = 1.5f;
+    proj[1][1] = 2.0f;
+    proj[2][2] = -1.2f;
+    proj[2][3] = -1.0f;
+    proj[3][2] = -2.2f;
+
+    Matrix4f shear = identity();
+    shear[1][0] = 0.5f;
+
+    const Transform transforms[] = {
+        Transform(),
+        Transform::translation(vec3f(1.0f, -2.0f, 3.0f)),
+        Transform::scaling(vec3f(2.0f, 0.5f, -1.0f)),
+        Transform::rotationY(0.7f),
+        Transform::rotation(Quaternion::fromAngleAxis(1.1f, vec3f(1.0f, 1.0f, 0.0f).normalized())),
+        Transform(shear),
+        Transform(proj)
+    };
+    const transform_t classes[] = {
+        TRANSFORM_IDENTITY, TRANSFORM_TRANSLATION, TRANSFORM_SCALE,
+        TRANSFORM_RIGID, TRANSFORM_RIGID, TRANSFORM_AFFINE, TRANSFORM_PROJECTIVE
+    };
+    const size_t count = sizeof(transforms)/sizeof(transforms[0]);
+
+    for (size_t a = 0; a < count; a++) {
+        const Transform &ta = transforms[a];
+        BOOST_CHECK_EQUAL(ta.type(), classes[a]);
+        BOOST_CHECK_EQUAL(classify(ta.matrix()), classes[a]);
+        BOOST_CHECK(matricesClose((ta*ta.inverse()).matrix(), identity()));
+
+        vec3f p(0.3f, -1.5f, 2.0f);
+        vec4f h = ta.matrix()*vec4f(p, 1.0f);
+        vec3f expected = vec3(h)/h[3];
+        BOOST_CHECK(distance(ta.transformPoint(p), expected) < 1e-4f);
+        vec3f points[5] = { p, p, p, p, p };
+        ta.transformPoints(points, points, 5);
+        BOOST_CHECK(distance(points[4], expected) < 1e-4f);
+
+        for (size_t b = 0; b < count; b++) {
+            const Transform &tb = transforms[b];
+            Transform c = ta*tb;
+            BOOST_CHECK(matricesClose(c.matrix(), ta.matrix()*tb.matrix()));
+            BOOST_CHECK_EQUAL(c.type(), combine(ta.type(), tb.type()));
+            // The combined class is never tighter than the real one
+            BOOST_CHECK(classify(c.matrix()) <= c.type());
+        }
+    }
+
+    // Typical node chain stays rigid
+    Transform node = Transform::translation(vec3f(1.0f, 0.0f, 0.0f));
+    node *= Transform::rotationX(0.3f);
+    node *= Transform::translation(vec3f(0.0f, 2.0f, 0.0f));
+    BOOST_CHECK_EQUAL(node.type(), TRANSFORM_RIGID);
+    BOOST_CHECK(matricesClose(node.matrix(),
+                              translate(0.0f, 2.0f, 0.0f)*rotateX(0.3f)*translate(1.0f, 0.0f, 0.0f)));
+
+    BOOST_CHECK(scale(1.0f, -0.0f, 1.0f).isScale());
+    BOOST_CHECK(!shear.isScale());
+}
+
+BOOST_AUTO_TEST_CASE(BoundsFitting)
+{
+    // Big enough to be split over threads
+    const size_t count = 3*BOUNDS_PARALLEL_MIN + 5;
+    std::vector<vec3f> points(count);
+    srand(7);
+    for (size_t i = 0; i < count; i++) {
+        vec3f p(float(rand() % 2001 - 1000), float(rand() % 2001 - 1000), float(rand() % 2001 - 1000));
+        points[i] = p*0.01f + vec3f(5.0f, -3.0f, 1.0f);
+    }
+    points[count/2] = vec3f(50.0f, 0.0f, 0.0f);
+
+    AABB expected;
+    for (size_t i = 0; i < count; i++)
+        expected.add(points[i]);
+    for (size_t threads = 0; threads < 4; threads++) {
+        AABB box = boundingBox(&points[0], count, threads);
+        BOOST_CHECK_EQUAL(box.min, expected.min);
+        BOOST_CHECK_EQUAL(box.max, expected.max);
+    }
+    AABB small = boundingBox(&points[0], 3);
+    BOOST_CHECK(small.contains(points[2]));
+    BOOST_CHECK(boundingBox(&points[0], 0).empty());
+
+    const sphere_fit_t fits[] = { SPHERE_RITTER, SPHERE_EPOS };
+    for (int f = 0; f < 2; f++) {
+        for (size_t threads = 1; threads < 4; threads++) {
+            Sphere s = boundingSphere(&points[0], count, fits[f], threads);
+            Sphere grown(s.center, s.radius*1.0001f);
+            size_t outside = 0;
+            for (size_t i = 0; i < count; i++)
+                outside += !grown.contains(points[i]);
+            BOOST_CHECK_EQUAL(outside, 0u);
+            // The outlier sets the diameter, about 45 + 10*sqrt(3)/2
+            BOOST_CHECK(s.radius < 36.0f);
+        }
+    }
+    Sphere one = boundingSphere(&points[0], 1);
+    BOOST_CHECK_EQUAL(one.center, points[0]);
+    BOOST_CHECK_EQUAL(one.radius, 0.0f);
+    BOOST_CHECK(boundingSphere(&points[0], 0).empty());
+}
+
+BOOST_AUTO_TEST_CASE(BoundsTransform)
+{
+    const size_t count = 11;
+    std::vector<Matrix4f, AlignedAllocator<Matrix4f> > world(count);
+    std::vector<Sphere> spheres(count);
+    std::vector<AABB> boxes(count);
+    for (size_t i = 0; i < count; i++) {
+        world[i] = translate(float(i), 2.0f, -1.0f) * rotateY(0.3f*i) *
+                   scale(1.0f + i, 2.0f, 0.5f);
+        spheres[i] = Sphere(vec3f(1.0f, 0.0f, float(i)), 0.5f + i);
+        boxes[i] = AABB(vec3f(-1.0f, 0.0f, -2.0f), vec3f(1.0f, 3.0f, float(i)));
+    }
+
+    SoA<vec4f> worldSpheres;
+    transformSpheres(&world[0], &spheres[0], count, worldSpheres);
+    SoA<vec3f> centers, extents;
+    transformBoxes(&world[0], &boxes[0], count, centers, extents);
+    BOOST_CHECK_EQUAL(worldSpheres.size(), count);
+    BOOST_CHECK_EQUAL(centers.size(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        vec4f ws = worldSpheres[i];
+        vec3f c = vec3(world[i]*vec4f(spheres[i].center, 1.0f));
+        BOOST_CHECK(distance(vec3(ws), c) < 1e-4f);
+        BOOST_CHECK_CLOSE(ws[3], spheres[i].radius*std::max(1.0f + i, 2.0f), 1e-4);
+
+        // Tight around the transformed corners
+        AABB expected;
+        for (int k = 0; k < 8; k++) {
+            vec3f p((k & 1 ? boxes[i].max : boxes[i].min)[0],
+                    (k & 2 ? boxes[i].max : boxes[i].min)[1],
+                    (k & 4 ? boxes[i].max : boxes[i].min)[2]);
+            expected.add(vec3(world[i]*vec4f(p, 1.0f)));
+        }
+        BOOST_CHECK(distance(vec3f(centers[i]), expected.center()) < 1e-3f);
+        BOOST_CHECK(distance(vec3f(extents[i]), expected.extents()) < 1e-3f);
+    }
+
+    // Sheared, x += y*k, the world sphere holds the transformed surface.
+    // For k = 1 the stretch is the golden ratio, more than any axis.
+    for (size_t i = 0; i < count; i++) {
+        Matrix4f shear;
+        shear.loadIdentity();
+        shear[1][0] = 1.0f + 0.2f*i;
+        world[i] = translate(1.0f, float(i), 0.0f) * rotateX(0.2f*i) * shear;
+    }
+    transformSpheres(&world[0], &spheres[0], count, worldSpheres);
+    for (size_t i = 0; i < count; i++) {
+        vec4f ws = worldSpheres[i];
+        float farthest = 0.0f;
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b <= 32; b++) {
+                float theta = a*float(M_PI)/32, phi = b*float(M_PI)/32;
+                vec3f d(sinf(phi)*cosf(theta), sinf(phi)*sinf(theta), cosf(phi));
+                vec3f p = vec3(world[i]*vec4f(spheres[i].center + d*spheres[i].radius, 1.0f));
+                farthest = std::max(farthest, distance(p, vec3(ws)));
+            }
+        }
+        BOOST_CHECK(farthest <= ws[3]*1.0001f);
+    }
+    BOOST_CHECK(worldSpheres[0][3] >= spheres[0].radius*1.618f);
+}
+
+static bool pairLess(const BoxPair &x, const BoxPair &y)
+{
+    return x.a < y.a || (x.a == y.a && x.b < y.b);
+}
+
+static void checkPairs(SweepAndPrune &sap, const std::vector<uint32_t> &handles,
+                       const std::vector<AABB> &boxes, const std::vector<bool> &alive,
+                       size_t threads)
+{
+    std::vector<BoxPair> pairs, expected;
+    sap.findPairs(pairs, threads);
+    for (size_t i = 0; i < boxes.size(); i++) {
+        for (size_t j = i+1; j < boxes.size(); j++) {
+            const AABB &x = boxes[i], &y = boxes[j];
+            if (alive[i] && alive[j] &&
+                x.min[0] <= y.max[0] && y.min[0] <= x.max[0] &&
+                x.min[1] <= y.max[1] && y.min[1] <= x.max[1] &&
+                x.min[2] <= y.max[2] && y.min[2] <= x.max[2]) {
+                BoxPair p = { std::min(handles[i], handles[j]), std::max(handles[i], handles[j]) };
+                expected.push_back(p);
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), pairLess);
+    std::sort(expected.begin(), expected.end(), pairLess);
+    BOOST_REQUIRE_EQUAL(pairs.size(), expected.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        BOOST_CHECK_EQUAL(pairs[i].a, expected[i].a);
+        BOOST_CHECK_EQUAL(pairs[i].b, expected[i].b);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BroadPhase)
+{
+    const size_t count = 9000;
+    std::vector<AABB> boxes(count);
+    std::vector<uint32_t> handles(count);
+    std::vector<bool> alive(count, true);
+    srand(11);
+    SweepAndPrune sap;
+    for (size_t i = 0; i < count; i++) {
+        // Spread along y so the sweep picks that axis
+        vec3f c(float(rand() % 1000), float(rand() % 10000), float(rand() % 1000));
+        vec3f e(float(rand() % 20 + 1), float(rand() % 20 + 1), float(rand() % 20 + 1));
+        boxes[i] = AABB((c - e)*0.1f, (c + e)*0.1f);
+        handles[i] = sap.insert(boxes[i]);
+    }
+    BOOST_CHECK_EQUAL(sap.size(), count);
+    checkPairs(sap, handles, boxes, alive, 1);
+    BOOST_CHECK_EQUAL(sap.axis(), 1);
+    checkPairs(sap, handles, boxes, alive, 3);
+
+    // Small moves, removals and reinsertions
+    for (size_t i = 0; i < count; i++) {
+        vec3f d(float(rand() % 21 - 10), float(rand() % 21 - 10), float(rand() % 21 - 10));
+        boxes[i] = AABB(boxes[i].min + d*0.05f, boxes[i].max + d*0.05f);
+        sap.update(handles[i], boxes[i]);
+    }
+    for (size_t i = 0; i < count; i += 7) {
+        sap.remove(handles[i]);
+        alive[i] = false;
+    }
+    for (size_t i = 0; i < count; i += 21) {
+        handles[i] = sap.insert(boxes[i]);
+        alive[i] = true;
+    }
+    BOOST_CHECK_EQUAL(sap.size(), (size_t)std::count(alive.begin(), alive.end(), true));
+    checkPairs(sap, handles, boxes, alive, 1);
+
+    // From centers and extents, as transformBoxes() writes them
+    SoA<vec3f> centers, extents;
+    std::vector<uint32_t> live;
+    for (size_t i = 0; i < count; i++) {
+        if (!alive[i])
+            continue;
+        boxes[i] = AABB(boxes[i].min + vec3f(0.0f, 0.0f, 0.5f), boxes[i].max + vec3f(0.0f, 0.0f, 0.5f));
+        centers.push_back(boxes[i].center());
+        extents.push_back(boxes[i].extents());
+        live.push_back(handles[i]);
+    }
+    sap.update(&live[0], centers, extents);
+    for (size_t i = 0; i < count; i++)
+        if (alive[i])
+            boxes[i] = sap.box(handles[i]);
+    checkPairs(sap, handles, boxes, alive, 2);
+
+    // Dominant axis changes
+    for (size_t i = 0; i < count; i++) {
+        if (!alive[i])
+            continue;
+        boxes[i] = AABB(vec3f(boxes[i].min[1], boxes[i].min[0], boxes[i].min[2]),
+                        vec3f(boxes[i].max[1], boxes[i].max[0], boxes[i].max[2]));
+        sap.update(handles[i], boxes[i]);
+    }
+    checkPairs(sap, handles, boxes, alive, 1);
+    BOOST_CHECK_EQUAL(sap.axis(), 0);
+
+    sap.clear();
+    std::vector<BoxPair> pairs;
+    sap.findPairs(pairs);
+    BOOST_CHECK(pairs.empty());
+
+    // Few boxes around the origin, none overlapping, so the lanes read
+    // past the last one would pass every test but the sweep axis
+    for (size_t n = 1; n <= 20; n++) {
+        sap.clear();
+        for (size_t i = 0; i < n; i++)
+            sap.insert(AABB(vec3f(i*10.0f - 1.0f, -1.0f, -1.0f), vec3f(i*10.0f + 1.0f, 1.0f, 1.0f)));
+        sap.findPairs(pairs);
+        BOOST_CHECK(pairs.empty());
+    }
+
+    // A box unbounded along the sweep axis runs to the end of the list
+    for (size_t n = 1; n <= 20; n++) {
+        sap.clear();
+        boxes.assign(1, AABB(vec3f(0.0f), vec3f(INFINITY, 1.0f, 1.0f)));
+        for (size_t i = 1; i < n; i++) {
+            float y = i % 3 ? 0.5f : 3.0f;
+            boxes.push_back(AABB(vec3f(i*2.0f, y, 0.0f), vec3f(i*2.0f + 1.0f, y + 1.0f, 1.0f)));
+        }
+        handles.resize(n);
+        for (size_t i = 0; i < n; i++)
+            handles[i] = sap.insert(boxes[i]);
+        alive.assign(n, true);
+        checkPairs(sap, handles, boxes, alive, 1);
+        BOOST_CHECK_EQUAL(sap.axis(), 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ConvexDistance)
+{
+    Matrix3f rot;
+    rot.loadIdentity();
+    Contact c;
+
+    // Spheres and capsules are exact, also when overlapping within the radii
+    ConvexShape a = ConvexShape::sphere(vec3f(0.0f), 1.0f);
+    ConvexShape b = ConvexShape::sphere(vec3f(3.0f, 4.0f, 0.0f), 2.0f);
+    BOOST_CHECK(!closestPoints(a, b, c));
+    BOOST_CHECK_CLOSE(c.distance, 2.0f, 0.001);
+    BOOST_CHECK_SMALL((c.normal - vec3f(0.6f, 0.8f, 0.0f)).length(), 1e-6f);
+    BOOST_CHECK_SMALL((c.pointA - vec3f(0.6f, 0.8f, 0.0f)).length(), 1e-6f);
+    BOOST_CHECK_SMALL((c.pointB - vec3f(1.8f, 2.4f, 0.0f)).length(), 1e-6f);
+    b.center = vec3f(0.0f, 2.5f, 0.0f);
+    BOOST_CHECK(penetration(a, b, c));
+    BOOST_CHECK_CLOSE(c.distance, -0.5f, 0.001);
+
+    ConvexShape cap = ConvexShape::capsule(vec3f(-5.0f, 3.0f, 0.0f), vec3f(5.0f, 3.0f, 0.0f), 0.5f);
+    ConvexShape box = ConvexShape::box(vec3f(0.0f), vec3f(1.0f, 2.0f, 1.0f), rot);
+    BOOST_CHECK(!closestPoints(cap, box, c));
+    BOOST_CHECK_CLOSE(c.distance, 0.5f, 0.001);
+    BOOST_CHECK_SMALL((c.normal - vec3f(0.0f, -1.0f, 0.0f)).length(), 1e-5f);
+
+    // Boxes, separated and overlapping
+    ConvexShape box2 = ConvexShape::box(vec3f(2.5f, 0.5f, 0.0f), vec3f(1.0f), rot);
+    BOOST_CHECK(!penetration(box, box2, c));
+    BOOST_CHECK_CLOSE(c.distance, 0.5f, 0.01);
+    BOOST_CHECK_SMALL((c.normal - vec3f(1.0f, 0.0f, 0.0f)).length(), 1e-4f);
+    box2.center = vec3f(1.75f, 0.5f, 0.2f);
+    BOOST_CHECK(penetration(box, box2, c));
+    BOOST_CHECK_CLOSE(c.distance, -0.25f, 0.1);
+    BOOST_CHECK_SMALL((c.normal - vec3f(1.0f, 0.0f, 0.0f)).length(), 1e-3f);
+    BOOST_CHECK_SMALL(c.pointA[0] - 1.0f, 1e-3f);
+    BOOST_CHECK_SMALL(c.pointB[0] - 0.75f, 1e-3f);
+
+    // A rotated hull of the box corners behaves like the rotated box
+    vec3f corners[8];
+    for (int i = 0; i < 8; i++)
+        corners[i] = vec3f(i & 1 ? 1.0f : -1.0f, i & 2 ? 2.0f : -2.0f, i & 4 ? 1.0f : -1.0f);
+    Matrix3f r45(Quaternion::fromAngleAxis(float(M_PI/4), vec3f(0.0f, 0.0f, 1.0f)).toMatrix());
+    ConvexShape hull = ConvexShape::hull(corners, 8, vec3f(0.0f), r45);
+    ConvexShape rbox = ConvexShape::box(vec3f(0.0f), vec3f(1.0f, 2.0f, 1.0f), r45);
+    ConvexShape s = ConvexShape::sphere(vec3f(4.0f, 1.0f, 0.5f), 1.0f);
+    Contact ch, cb;
+    BOOST_CHECK(!closestPoints(hull, s, ch));
+    BOOST_CHECK(!closestPoints(rbox, s, cb));
+    BOOST_CHECK_CLOSE(ch.distance, cb.distance, 0.01);
+    s.center = vec3f(1.5f, 1.0f, 0.5f);
+    BOOST_CHECK(penetration(hull, s, ch));
+    BOOST_CHECK(penetration(rbox, s, cb));
+    BOOST_CHECK_CLOSE(ch.distance, cb.distance, 1.0);
+
+    // Coincident centers need EPA on the rounded shapes
+    b.center = a.center;
+    BOOST_CHECK(penetration(a, b, c));
+    BOOST_CHECK_CLOSE(c.distance, -3.0f, 1.0);
+
+    // Warm started and batched queries agree with cold ones
+    std::vector<ConvexShape> as, bs;
+    for (int i = 0; i < 64; i++) {
+        Matrix3f ri(Quaternion::fromAngleAxis(i*0.1f, vec3f(1.0f, 2.0f, 3.0f).normalized()).toMatrix());
+        vec3f p(float(i % 4), float(i/4 % 4), float(i/16));
+        as.push_back(ConvexShape::box(p, vec3f(0.6f, 0.4f, 0.3f), ri));
+        if (i % 3 == 0)
+            bs.push_back(ConvexShape::capsule(p + vec3f(0.5f, 0.9f, 0.0f), p + vec3f(0.5f, 1.2f, 0.4f), 0.2f));
+        else if (i % 3 == 1)
+            bs.push_back(ConvexShape::hull(corners, 8, p + vec3f(1.2f, 0.3f, 0.4f), ri*0.3f));
+        else
+            bs.push_back(ConvexShape::sphere(p + vec3f(0.0f, 0.0f, 0.5f + i*0.01f), 0.3f));
+    }
+    std::vector<GjkCache> caches(as.size());
+    std::vector<Contact> batch(as.size());
+    for (int frame = 0; frame < 4; frame++) {
+        size_t hits = penetration(&as[0], &bs[0], &batch[0], &caches[0], as.size());
+        size_t expected = 0;
+        for (size_t i = 0; i < as.size(); i++) {
+            expected += penetration(as[i], bs[i], c);
+            BOOST_CHECK_SMALL(batch[i].distance - c.distance, 2e-3f);
+        }
+        BOOST_CHECK_EQUAL(hits, expected);
+        for (size_t i = 0; i < bs.size(); i++)
+            bs[i].center += vec3f(0.01f, -0.02f, 0.005f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ClusterLights)
+{
+    const int columns = 16, rows = 8, slices = 24;
+    const float fov = 60.0f, aspect = 16.0f/9.0f, znear = 0.1f, zfar = 100.0f;
+    ClusterGrid grid;
+    grid.set(fov, aspect, znear, zfar, columns, rows, slices);
+    BOOST_CHECK_EQUAL(grid.size(), size_t(columns*rows*slices));
+    BOOST_CHECK_EQUAL(grid.sliceDepth(0), znear);
+    BOOST_CHECK_EQUAL(grid.sliceDepth(slices), zfar);
+    for (int z = 0; z < slices; z++) {
+        float d0 = grid.sliceDepth(z), d1 = grid.sliceDepth(z+1);
+        BOOST_CHECK_EQUAL(grid.slice((d0 + d1)*0.5f), z);
+        // Exponential, every slice the same factor deeper
+        BOOST_CHECK_CLOSE(d1/d0, powf(zfar/znear, 1.0f/slices), 0.01);
+    }
+    BOOST_CHECK_EQUAL(grid.slice(0.0f), 0);
+    BOOST_CHECK_EQUAL(grid.slice(1000.0f), slices - 1);
+
+    srand(11);
+    SoA<vec4f> lights;
+    for (int i = 0; i < 300; i++) {
+        vec3f p(float(rand() % 2001 - 1000)*0.05f, float(rand() % 2001 - 1000)*0.03f,
+                -float(rand() % 1200)*0.1f + 5.0f);
+        Sphere s = i % 3 ? Sphere(p, float(rand() % 100)*0.05f + 0.05f)
+                         : spotLightBounds(p, vec3f(0.0f, 0.0f, -1.0f), 4.0f, float(rand() % 80)*0.01f + 0.1f);
+        lights.push_back(vec4f(s.center, s.radius));
+    }
+    grid.assign(lights);
+
+    // Every listed light reaches the cluster's box, and every light
+    // containing a corner or the middle of the cluster is listed
+    float tanH = tanf(fov*float(M_PI)/360.0f), tanW = tanH*aspect;
+    size_t listed = 0;
+    for (int z = 0; z < slices; z++) {
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < columns; x++) {
+                size_t c = grid.index(x, y, z);
+                const uint32_t *l = grid.lights(c);
+                size_t n = grid.lightCount(c);
+                listed += n;
+                std::vector<bool> in(lights.size(), false);
+                for (size_t k = 0; k < n; k++) {
+                    BOOST_CHECK(k == 0 || l[k-1] < l[k]);
+                    const AABB &b = grid.bounds(c);
+                    vec3f p(lights.x()[l[k]], lights.y()[l[k]], lights.z()[l[k]]);
+                    vec3f q = max(b.min, min(p, b.max));
+                    BOOST_CHECK((q - p).length() <= lights.w()[l[k]] + 1e-4f);
+                    in[l[k]] = true;
+                }
+                for (int s = 0; s < 9; s++) {
+                    float d = s == 8 ? sqrtf(grid.sliceDepth(z)*grid.sliceDepth(z+1))
+                                     : grid.sliceDepth(z + (s & 1));
+                    float u = s == 8 ? x + 0.5f : x + float(s >> 1 & 1);
+                    float v = s == 8 ? y + 0.5f : y + float(s >> 2 & 1);
+                    vec3f p((-1.0f + 2.0f*u/columns)*tanW*d, (-1.0f + 2.0f*v/rows)*tanH*d, -d);
+                    for (size_t i = 0; i < lights.size(); i++) {
+                        vec3f lp(lights.x()[i], lights.y()[i], lights.z()[i]);
+                        if ((lp - p).length() < lights.w()[i]*0.999f)
+                            BOOST_CHECK(in[i]);
+                    }
+                }
+            }
+        }
+    }
+    BOOST_CHECK(listed > 0);
+    BOOST_CHECK_EQUAL(grid.indices().size(), listed);
+    BOOST_CHECK_EQUAL(grid.offsets().back(), listed);
+
+    // Same lists on several threads
+    std::vector<uint32_t> offsets = grid.offsets(), indices = grid.indices();
+    grid.assign(lights, 5);
+    BOOST_CHECK(grid.offsets() == offsets);
+    BOOST_CHECK(grid.indices() == indices);
+
+    // The spot bounds hold the apex, the rim and the tip of the cap, up
+    // to lights shining all around
+    for (float angle = 0.1f; angle < 3.2f; angle += 0.2f) {
+        Sphere s = spotLightBounds(vec3f(1.0f, 2.0f, 3.0f), vec3f(0.0f, 1.0f, 0.0f), 5.0f, angle);
+        BOOST_CHECK((s.center - vec3f(1.0f, 2.0f, 3.0f)).length() <= s.radius*1.0001f);
+        vec3f rim = vec3f(1.0f, 2.0f, 3.0f) + vec3f(sinf(angle), cosf(angle), 0.0f)*5.0f;
+        BOOST_CHECK((s.center - rim).length() <= s.radius*1.0001f);
+        vec3f tip = vec3f(1.0f, 2.0f, 3.0f) + vec3f(0.0f, 5.0f, 0.0f);
+        BOOST_CHECK((s.center - tip).length() <= s.radius*1.0001f);
+        BOOST_CHECK(angle < float(M_PI)/2 ? s.radius < 5.0f : s.radius <= 5.0f);
+    }
+}
+
+// Points filling a cone, on its surface, axis and base
+static std::vector<vec3f> conePoints(const Cone &c)
+{
+    vec3f u = cross(c.axis, fabsf(c.axis[0]) < 0.9f ? vec3f(1.0f, 0.0f, 0.0f) : vec3f(0.0f, 1.0f, 0.0f)).normalized();
+    vec3f v = cross(c.axis, u);
+    std::vector<vec3f> points;
+    for (int i = 0; i <= 40; i++) {
+        float t = i/40.0f;
+        for (int j = 0; j < 48; j++) {
+            float a = j*float(M_PI)/24.0f;
+            vec3f rim = u*cosf(a) + v*sinf(a);
+            for (int k = 0; k <= 4; k++)
+                points.push_back(c.apex + c.axis*(c.height*t) + rim*(c.radius*t*k/4.0f));
+        }
+    }
+    return points;
+}
+
+BOOST_AUTO_TEST_CASE(ConeCapsuleCulling)
+{
+    srand(5);
+    std::vector<Cone> cones;
+    std::vector<Capsule> capsules;
+    for (int i = 0; i < 1003; i++) {
+        vec3f p(float(rand() % 401 - 200)*0.1f, float(rand() % 401 - 200)*0.1f, -float(rand() % 1200)*0.1f);
+        vec3f d(float(rand() % 201 - 100), float(rand() % 201 - 100), float(rand() % 201 - 100));
+        if (d.lengthSquared() == 0.0f)
+            d = vec3f(0.0f, 0.0f, 1.0f);
+        d.normalize();
+        cones.push_back(Cone::spot(p, d, float(rand() % 300)*0.1f + 0.1f, float(rand() % 140)*0.01f + 0.02f));
+        capsules.push_back(Capsule(p, p + d*float(rand() % 200)*0.1f, float(rand() % 30)*0.1f));
+    }
+
+    // Plane ranges hold the extremes of the sampled cone
+    Plane plane(vec3f(0.5f, 1.0f, -2.0f), vec3f(1.0f, 2.0f, -2.0f)/3.0f);
+    for (size_t i = 0; i < 20; i++) {
+        float lo, hi, slo = INFINITY, shi = -INFINITY;
+        distanceRange(plane, cones[i], lo, hi);
+        std::vector<vec3f> points = conePoints(cones[i]);
+        for (size_t k = 0; k < points.size(); k++) {
+            slo = std::min(slo, plane.distance(points[k]));
+            shi = std::max(shi, plane.distance(points[k]));
+        }
+        float tol = 0.01f*(cones[i].height + cones[i].radius);
+        BOOST_CHECK(lo <= slo + 1e-4f && lo >= slo - tol);
+        BOOST_CHECK(hi >= shi - 1e-4f && hi <= shi + tol);
+    }
+
+    // Spheres against sampled cones: exact up to the sampling
+    for (size_t i = 0; i < 40; i++) {
+        const Cone &c = cones[i];
+        std::vector<vec3f> points = conePoints(c);
+        for (int k = 0; k < 10; k++) {
+            Sphere s(c.apex + vec3f(float(rand() % 41 - 20), float(rand() % 41 - 20),
+                                    float(rand() % 41 - 20))*c.height*0.05f,
+                     float(rand() % 20 + 1)*c.height*0.05f);
+            float nearest = INFINITY;
+            for (size_t n = 0; n < points.size(); n++)
+                nearest = std::min(nearest, (points[n] - s.center).length());
+            float tol = 0.1f*(c.height + c.radius);
+            if (nearest < s.radius)
+                BOOST_CHECK(overlaps(c, s));
+            else if (nearest > s.radius + tol)
+                BOOST_CHECK(!overlaps(c, s));
+
+            AABB box(s.center - vec3f(s.radius), s.center + vec3f(s.radius*0.5f));
+            bool inside = false;
+            for (size_t n = 0; n < points.size() && !inside; n++)
+                inside = box.contains(points[n]);
+            if (inside)
+                BOOST_CHECK(overlaps(c, box));
+        }
+    }
+
+    // Capsules against boxes and spheres, exact
+    for (size_t i = 0; i < 200; i++) {
+        const Capsule &c = capsules[i];
+        vec3f center = c.a + vec3f(float(rand() % 41 - 20), float(rand() % 41 - 20),
+                                   float(rand() % 41 - 20))*0.2f;
+        AABB box(center - vec3f(1.0f, 0.5f, 2.0f), center + vec3f(1.0f, 0.5f, 2.0f));
+        Sphere s(center, 1.5f);
+        float toBox = INFINITY, toSphere = INFINITY;
+        for (int k = 0; k <= 1000; k++) {
+            vec3f p = c.a + (c.b - c.a)*(k/1000.0f);
+            toBox = std::min(toBox, (p - max(box.min, min(p, box.max))).length());
+            toSphere = std::min(toSphere, (p - center).length() - s.radius);
+        }
+        float tol = 0.002f*(c.b - c.a).length() + 1e-3f;
+        if (toBox < c.radius - tol || toBox > c.radius + tol)
+            BOOST_CHECK_EQUAL(overlaps(c, box), toBox < c.radius);
+        if (toSphere < c.radius - tol || toSphere > c.radius + tol)
+            BOOST_CHECK_EQUAL(overlaps(c, s), toSphere < c.radius);
+    }
+
+    // Batched kernels agree with the single tests on every SIMD level
+    Frustum frustum;
+    frustum.set(60.0f, 1.5f, 0.5f, 80.0f);
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+    SoA<Cone> coneLanes(&cones[0], cones.size());
+    SoA<Capsule> capsuleLanes(&capsules[0], capsules.size());
+    BOOST_CHECK(coneLanes[7].apex == cones[7].apex);
+    BOOST_CHECK_EQUAL(coneLanes[7].radius, cones[7].radius);
+    BOOST_CHECK(capsuleLanes[9].b == capsules[9].b);
+    const float *cl[8], *kl[7];
+    coneLanes.lanes(cl);
+    capsuleLanes.lanes(kl);
+    size_t counts[3] = { 0, 0, 0 };
+    for (int l = SIMD_SCALAR; l <= detectSimdLevel(); l++) {
+        Kernels k = kernels((simd_level_t)l);
+        std::vector<uint8_t> coneClasses(cones.size()), capsuleClasses(capsules.size());
+        k.cullCones(planes, cl, &coneClasses[0], cones.size());
+        k.cullCapsules(planes, kl, &capsuleClasses[0], capsules.size());
+        for (size_t i = 0; i < cones.size(); i++) {
+            BOOST_CHECK_EQUAL(coneClasses[i], frustum.containsCone(cones[i]));
+            BOOST_CHECK_EQUAL(capsuleClasses[i], frustum.containsCapsule(capsules[i]));
+            counts[coneClasses[i]]++;
+        }
+    }
+    BOOST_CHECK(counts[OUTSIDE] > 0 && counts[INSIDE] > 0 && counts[INTERSECT] > 0);
+
+    // Cones inside a bounding sphere that is culled are culled too, the
+    // reverse is what the tighter test buys
+    std::vector<uint8_t> coneClasses(cones.size());
+    frustum.containsCones(coneLanes, &coneClasses[0]);
+    size_t tighter = 0;
+    for (size_t i = 0; i < cones.size(); i++) {
+        const Cone &c = cones[i];
+        Sphere s = spotLightBounds(c.apex, c.axis, c.height, atanf(c.radius/c.height));
+        int sphere = frustum.containsSphere(s.center, s.radius*1.001f);
+        std::vector<vec3f> points = i < 50 ? conePoints(c) : std::vector<vec3f>();
+        for (size_t k = 0; k < points.size(); k++) {
+            if (frustum.containsPoint(points[k]))
+                BOOST_CHECK(coneClasses[i] != OUTSIDE);
+        }
+        tighter += sphere != OUTSIDE && coneClasses[i] == OUTSIDE;
+    }
+    BOOST_CHECK(tighter > 0);
+
+    std::vector<uint8_t> capsuleClasses(capsules.size());
+    frustum.containsCapsules(capsuleLanes, &capsuleClasses[0]);
+    for (size_t i = 0; i < capsules.size(); i++)
+        BOOST_CHECK_EQUAL(capsuleClasses[i], frustum.containsCapsule(capsules[i]));
+}
+
+BOOST_AUTO_TEST_CASE(DepthSort)
+{
+    BOOST_CHECK(floatKey(-2.0f) < floatKey(-1.0f));
+    BOOST_CHECK(floatKey(-1.0f) < floatKey(-0.0f));
+    BOOST_CHECK(floatKey(-0.0f) < floatKey(0.0f));
+    BOOST_CHECK(floatKey(0.0f) < floatKey(1e-30f));
+    BOOST_CHECK(floatKey(1.0f) < floatKey(INFINITY));
+
+    // Stable against std::stable_sort, with duplicates, on sizes that
+    // skip passes and run an odd number of them, across thread counts
+    srand(9);
+    const size_t sizes[] = {0, 1, 2, 37, 1000, 70001};
+    const uint32_t masks[] = {0xffffffffu, 0x00ff00ffu, 0x000000ffu, 0x3f0000ffu, 0};
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        for (size_t m = 0; m < sizeof(masks)/sizeof(masks[0]); m++) {
+            size_t count = sizes[s];
+            std::vector<uint32_t> keys(count), values(count), tmpKeys(count), tmpValues(count);
+            std::vector<std::pair<uint32_t, uint32_t> > ref(count);
+            for (size_t i = 0; i < count; i++) {
+                keys[i] = (uint32_t(rand()) << 16 ^ uint32_t(rand())) & masks[m];
+                values[i] = uint32_t(i);
+                ref[i] = std::make_pair(keys[i], values[i]);
+            }
+            std::stable_sort(ref.begin(), ref.end(),
+                             [](const std::pair<uint32_t, uint32_t> &a,
+                                const std::pair<uint32_t, uint32_t> &b) {
+                                 return a.first < b.first;
+                             });
+            for (size_t threads = 1; threads <= 3; threads += 2) {
+                std::vector<uint32_t> k = keys, v = values;
+                radixSort(k.data(), v.data(), tmpKeys.data(), tmpValues.data(), count, threads);
+                bool same = true;
+                for (size_t i = 0; i < count; i++)
+                    same &= k[i] == ref[i].first && v[i] == ref[i].second;
+                BOOST_CHECK(same);
+            }
+        }
+    }
+
+    // Keys from every SIMD level match the scalar plane distance, tails too
+    Frustum frustum;
+    frustum.set(60.0f, 1.5f, 0.5f, 100.0f);
+    frustum.setPosition(vec3f(1.0f, 2.0f, 3.0f));
+    frustum.setOrientation(Quaternion::fromMatrix(rotateY(0.7f) * rotateX(-0.3f)));
+    SoA<vec3f> points;
+    for (int i = 0; i < 1037; i++)
+        points.push_back(vec3f(float(rand() % 2001 - 1000)*0.05f, float(rand() % 2001 - 1000)*0.05f,
+                               float(rand() % 2001 - 1000)*0.05f));
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+    const vec4f &plane = planes[0];
+    for (int l = SIMD_SCALAR; l <= detectSimdLevel(); l++) {
+        Kernels k = kernels((simd_level_t)l);
+        for (size_t count = 0; count < 40; count += 13) {
+            std::vector<uint32_t> keys(count + 1, 0xdeadbeef);
+            k.depthKeys(plane, points.x(), points.y(), points.z(), 0, keys.data(), count);
+            for (size_t i = 0; i < count; i++) {
+                float d = plane[0]*points.x()[i] + plane[1]*points.y()[i] + plane[2]*points.z()[i] + plane[3];
+                uint32_t u = keys[i] ^ (keys[i] & 0x80000000u ? 0x80000000u : 0xffffffffu);
+                float f;
+                memcpy(&f, &u, sizeof(f));
+                BOOST_CHECK(fabsf(f - d) <= 1e-4f*(1.0f + fabsf(d)));
+            }
+            BOOST_CHECK_EQUAL(keys[count], 0xdeadbeef);
+        }
+    }
+
+    // Sorted front to back by view depth, and the reverse
+    std::vector<uint32_t> keys(points.size()), values(points.size());
+    std::vector<uint32_t> tmpKeys(points.size()), tmpValues(points.size());
+    for (int order = SORT_FRONT_TO_BACK; order <= SORT_BACK_TO_FRONT; order++) {
+        frustum.depthKeys(points, keys.data(), (sort_order_t)order);
+        for (size_t i = 0; i < values.size(); i++)
+            values[i] = uint32_t(i);
+        radixSort(keys.data(), values.data(), tmpKeys.data(), tmpValues.data(), keys.size());
+        bool sorted = true;
+        for (size_t i = 1; i < values.size(); i++) {
+            float a = dot(vec3(plane), vec3f(points[values[i-1]])) + plane[3];
+            float b = dot(vec3(plane), vec3f(points[values[i]])) + plane[3];
+            sorted &= order == SORT_FRONT_TO_BACK ? a <= b + 1e-4f : a >= b - 1e-4f;
+        }
+        BOOST_CHECK(sorted);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(ScreenSpaceLod)
+{
+    Camera camera;
+    camera.setPerspective(50.0f, 16.0f/9.0f, 0.5f, 300.0f);
+    camera.setPosition(vec3f(2.0f, 1.0f, -3.0f));
+    camera.setOrientation(Quaternion::fromMatrix(rotateY(-0.4f) * rotateX(0.1f)));
+    Frustum frustum;
+    frustum.set(50.0f, 16.0f/9.0f, 0.5f, 300.0f);
+    frustum.setPosition(camera.position());
+    frustum.setOrientation(camera.orientation());
+    Viewport viewport(0, 0, 1280, 720);
+
+    // Both scales agree, and a radius across the view direction projects
+    // to the pixels they give
+    ScreenScale scale = frustum.screenScale(viewport), cs = camera.screenScale(viewport);
+    BOOST_CHECK_CLOSE(scale.pixels, cs.pixels, 0.01);
+    BOOST_CHECK_CLOSE(scale.minDepth, cs.minDepth, 0.01);
+    for (int k = 0; k < 4; k++)
+        BOOST_CHECK(fabsf(scale.depthPlane[k] - cs.depthPlane[k]) < 1e-4f);
+    vec3f dir = vec3(camera.inverseView() * vec4f(0.0f, 0.0f, -1.0f, 0.0f));
+    vec3f up = vec3(camera.inverseView() * vec4f(0.0f, 1.0f, 0.0f, 0.0f));
+    vec3f ends[2] = {camera.position() + dir*20.0f, camera.position() + dir*20.0f + up*1.5f};
+    vec3f screen[2];
+    uint8_t clip[2];
+    project(camera.viewProjection(), viewport, ends, screen, clip, 2);
+    float depth = dot(vec3(scale.depthPlane), ends[0]) + scale.depthPlane[3];
+    BOOST_CHECK_CLOSE(depth, 20.0f, 0.01);
+    BOOST_CHECK_CLOSE((screen[1] - screen[0]).length(), 1.5f*scale.pixels/depth, 0.1);
+
+    Camera ortho;
+    ortho.setOrthographic(40.0f, 20.0f, 0.1f, 100.0f);
+    ScreenScale os = ortho.screenScale(viewport);
+    BOOST_CHECK_CLOSE(os.pixels, 36.0f, 0.01);
+    BOOST_CHECK_EQUAL(dot(os.depthPlane, vec4f(5.0f, -3.0f, 7.0f, 1.0f)), 1.0f);
+
+    // Four levels per object from its own thresholds, with spheres around
+    // the eye, behind it and on the level boundaries
+    srand(11);
+    SoA<vec4f> spheres;
+    std::vector<vec3f> levels;
+    for (int i = 0; i < 1029; i++) {
+        vec3f c = camera.position() + vec3f(float(rand() % 401 - 200), float(rand() % 401 - 200),
+                                            float(rand() % 401 - 200))*0.5f;
+        if (i % 50 == 0)
+            c = camera.position() + dir*float(rand() % 3)*0.2f;
+        float r = float(rand() % 100 + 1)*0.05f;
+        float base = float(rand() % 40 + 10);
+        spheres.push_back(vec4f(c, r));
+        levels.push_back(vec3f(base, base*0.5f, base*0.25f));
+    }
+    SoA<vec3f> thresholds(&levels[0], levels.size());
+    const float *lanes[3] = {thresholds.x(), thresholds.y(), thresholds.z()};
+    const float minPixels = 1.5f;
+
+    std::vector<uint8_t> plain(spheres.size());
+    frustum.containsSpheres(spheres, &plain[0]);
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+    for (int l = SIMD_SCALAR; l <= detectSimdLevel(); l++) {
+        Kernels k = kernels((simd_level_t)l);
+        for (size_t count = 0; count <= spheres.size(); count += count < 40 ? 13 : 989) {
+            std::vector<uint8_t> result(count + 1, 0xee), lod(count + 1, 0xee);
+            k.cullSpheresLod(planes, scale, minPixels, spheres.x(), spheres.y(), spheres.z(),
+                             spheres.w(), lanes, 3, &result[0], &lod[0], count);
+            BOOST_CHECK_EQUAL(result[count], 0xee);
+            BOOST_CHECK_EQUAL(lod[count], 0xee);
+            for (size_t i = 0; i < count; i++) {
+                vec4f s = spheres[i];
+                float z = std::max(dot(vec3(scale.depthPlane), vec3(s)) + scale.depthPlane[3],
+                                   scale.minDepth);
+                float px = s[3]*scale.pixels/z;
+                vec3f t = thresholds[i];
+                // Skip sizes within rounding of a boundary
+                bool edge = fabsf(px - minPixels) < 1e-3f*px;
+                int level = 0;
+                for (int n = 0; n < 3; n++) {
+                    edge |= fabsf(px - t[n]) < 1e-3f*px;
+                    level += px < t[n];
+                }
+                if (edge)
+                    continue;
+                BOOST_CHECK_EQUAL(lod[i], level);
+                BOOST_CHECK_EQUAL(result[i], px < minPixels ? uint8_t(OUTSIDE) : plain[i]);
+            }
+        }
+    }
+
+    // The Frustum entry point, and no thresholds at all
+    std::vector<uint8_t> result(spheres.size()), lod(spheres.size(), 0xee);
+    frustum.containsSpheres(spheres, scale, 0.0f, NULL, 0, &result[0], &lod[0]);
+    BOOST_CHECK(result == plain);
+    BOOST_CHECK(std::count(lod.begin(), lod.end(), 0) == (int)lod.size());
+    frustum.containsSpheres(spheres, scale, minPixels, lanes, 3, &result[0], &lod[0]);
+    size_t culled = 0, small = 0;
+    for (size_t i = 0; i < spheres.size(); i++) {
+        culled += result[i] == OUTSIDE;
+        small += plain[i] != OUTSIDE && result[i] == OUTSIDE;
+    }
+    BOOST_CHECK(small > 0 && culled < spheres.size());
+}
@@ -1,185 +1,49 @@
 #include <iomanip>
 #include <iostream>
 #include <cstring>
+#include <type_traits>
 
 #include "matrix.h"
+#include "solve.h"
 
 namespace math {
 
-template <size_t N, typename T>
-Matrix<N, T>::Matrix(const T *data)
-{
-    memcpy(m_data, data, sizeof(m_data));
-}
-
-template <size_t N, typename T>
-void Matrix<N, T>::transpose()
-{
-    for (size_t j = 0; j < N-1; j++)
-        for (size_t i = j+1; i < N; i++)
-            std::swap(m_data[j][i], m_data[i][j]);
-}
-
-template <size_t N, typename T>
-Matrix<N, T> Matrix<N, T>::transposed() const
-{
-    Matrix<N, T> ret(*this);
-    ret.transpose();
-    return ret;
-}
-
-template <size_t N, typename T>
-T Matrix<N, T>::detMinor(int ox, int oy) const
-{
-    int x1 = ox % N;
-    int y1 = oy % N;
-    int x2 = (ox+1) % N;
-    int y2 = (oy+1) % N;
-
-    return (m_data[y1][x1] * m_data[y2][x2])
-        -  (m_data[y1][x2] * m_data[y2][x1]);
-}
-
-template <size_t N, typename T>
-Matrix<N, T>& Matrix<N, T>::loadZero()
-{
-    for (size_t j = 0; j < N; j++)
-        for (size_t i = 0; i < N; i++)
-            m_data[j][i] = 0;
-    return *this;
-}
-
-template <size_t N, typename T>
-Matrix<N, T>& Matrix<N, T>::loadIdentity()
-{
-    for (size_t j = 0; j < N; j++) {
-        for (size_t i = 0; i < N; i++)
-            m_data[j][i] = 0;
-        m_data[j][j] = 1;
-    }
-    return *this;
-}
-
-template <size_t N, typename T>
-Matrix<N, T>& Matrix<N, T>::setScale(T sx, T sy)
-{
-    m_data[0][0] = sx;
-    m_data[1][1] = sy;
-    return *this;
-}
-
-template <size_t N, typename T>
-Matrix<N, T>& Matrix<N, T>::setTranslate(T tx, T ty)
-{
-    m_data[N-1][0] = tx;
-    m_data[N-1][1] = ty;
-    return  *this;
-}
+static_assert(std::is_trivially_copyable<Matrix4f>::value,
+              "Matrix must stay memcpy-able");
+static_assert(alignof(Matrix4f) == 16 && sizeof(Matrix4f) == 64,
+              "Matrix4f columns must be SSE aligned and unpadded");
 
-template <size_t N, typename T>
-Matrix<N, T>& Matrix<N, T>::setScale(T sx, T sy, T sz)
-{
-    m_data[0][0] = sx;
-    m_data[1][1] = sy;
-    m_data[2][2] = sz;
-    return *this;
-}
-
-template <size_t N, typename T>
-Matrix<N, T>& Matrix<N, T>::setTranslate(T tx, T ty, T tz)
+void multiply(const Matrix4f *a, const Matrix4f *b, Matrix4f *out, size_t count)
 {
-    m_data[N-1][0] = tx;
-    m_data[N-1][1] = ty;
-    m_data[N-1][2] = tz;
-    return  *this;
+    GFXMATH_TIME(TIMER_MULTIPLY, count);
+    typedef float (*Columns)[4];
+    typedef const float (*ConstColumns)[4];
+    for (size_t i = 0; i < count; i++)
+        mmult<4, float>((Columns)out[i][0], (ConstColumns)a[i][0], (ConstColumns)b[i][0]);
 }
 
-template <size_t N, typename T>
-bool Matrix<N, T>::isIdentinty() const
-{
-    for (size_t j = 0; j < N; j++) {
-        vec<N, T> c(T(0));
-        c[j] = 1;
-        if (memcmp(m_data[j], c.data(), sizeof(m_data[j])) != 0)
-            return false;
-    }
-    return true;
-}
-
-template <size_t N, typename T>
-bool Matrix<N, T>::isScale() const
+void multiplyUnaligned(const float *a, const float *b, float *out, size_t count)
 {
-    for (size_t j = 0; j < N; j++) {
-        vec<N, T> c(T(0));
-        c[j] = m_data[j][j];
-        if (memcmp(m_data[j], c.data(), sizeof(m_data[j])) != 0)
-            return false;
-    }
-    return true;
-}
-
-template <size_t N, typename T>
-bool Matrix<N, T>::operator == (const Matrix<N, T> &m) const
-{
-    for (size_t j = 0; j < N; j++)
-        for (size_t i = 0; i < N; i++)
-            if (m_data[j][i] != m.m_data[j][i])
-                return false;
-    return true;
-}
-
-template <size_t N, typename T>
-Matrix<N, T> Matrix<N, T>::operator * (T s) const
-{
-    Matrix<N, T> ret;
-
-    for (size_t j = 0; j < N; j++)
-        for (size_t i = 0; i < N; i++)
-            ret.m_data[j][i] = m_data[j][i]*s;
-
-    return ret;
-}
-
-template <size_t N, typename T>
-void mvmult(T dest[N], const T mat[N][N], const T vec[N])
-{
-    for (size_t i = 0; i < N; i++)
-        for (size_t j = 0; j < N; j++)
-            dest[i] += mat[j][i]*vec[j];
-}
-
+    GFXMATH_TIME(TIMER_MULTIPLY, count);
+    for (size_t n = 0; n < count; n++, a += 16, b += 16, out += 16) {
 #ifdef __SSE__
-#include <xmmintrin.h>
-template <>
-void mvmult<4, float>(float dest[4], const float mat[4][4], const float vec[4])
-{
-    __m128 d;
-    d = _mm_setzero_ps();
-    for (size_t j = 0; j < 4; j++)
-        d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(mat[j]),
-                                     _mm_set_ps1(vec[j])));
-    _mm_storeu_ps(dest, d);
-}
-#endif // __SSE
-
-template <size_t N, typename T>
-Matrix<N, T> Matrix<N, T>::operator * (const Matrix<N, T> &m) const
-{
-    Matrix<N, T> ret;
-    ret.loadZero();
-
-    for (size_t j = 0; j < N; j++)
-        mvmult<N, T>(ret.m_data[j], m_data, m[j]);
-
-    return ret;
-}
-
-template <size_t N, typename T>
-vec<N, T> Matrix<N, T>::operator * (const vec<N, T> &v) const
-{
-    vec<N, T> res(T(0));
-    mvmult<N, T>(res.data(), m_data, v.data());
-    return res;
+        __m128 a0 = _mm_loadu_ps(a);
+        __m128 a1 = _mm_loadu_ps(a+4);
+        __m128 a2 = _mm_loadu_ps(a+8);
+        __m128 a3 = _mm_loadu_ps(a+12);
+        for (size_t j = 0; j < 4; j++) {
+            const float *c = b+j*4;
+            __m128 d = _mm_mul_ps(a0, _mm_set_ps1(c[0]));
+            d = _mm_add_ps(d, _mm_mul_ps(a1, _mm_set_ps1(c[1])));
+            d = _mm_add_ps(d, _mm_mul_ps(a2, _mm_set_ps1(c[2])));
+            d = _mm_add_ps(d, _mm_mul_ps(a3, _mm_set_ps1(c[3])));
+            _mm_storeu_ps(out+j*4, d);
+        }
+#else
+        Matrix4f r = Matrix4f(a)*Matrix4f(b);
+        memcpy(out, r.data(), sizeof(float)*16);
+#endif
+    }
 }
 
 template <size_t N, class T>
@@ -188,28 +52,30 @@ std::ostream &operator<<(std::ostream &out, const Matrix<N, T> &m)
     for (size_t i = 0; i < N; i++) {
         for (size_t j = 0; j < N; j++)
             out << std::left << std::setw(5) << m[j][i] << " ";
-        out << std::endl;
+        out << '\n';
     }
     return out;
 }
 
-template class Matrix<2, float>;
-template class Matrix<3, float>;
-template class Matrix<4, float>;
+template <size_t N, typename T>
+T Matrix<N, T>::det() const
+{
+    return LU<N, T>(*this).det();
+}
 
-template
-std::ostream &operator<< <2, float>(std::ostream &out, const Matrix<2, float> &m);
-template
-std::ostream &operator<< <3, float>(std::ostream &out, const Matrix<3, float> &m);
-template
-std::ostream &operator<< <4, float>(std::ostream &out, const Matrix<4, float> &m);
+template <size_t N, typename T>
+Matrix<N, T> Matrix<N, T>::inverse() const
+{
+    return LU<N, T>(*this).inverse();
+}
 
 template <>
 float Matrix3f::det() const
 {
+    // Along row 0, cyclic minors carry the cofactor signs
     return m_data[0][0]*detMinor(1, 1)
-        +  m_data[1][0]*detMinor(2, 1)
-        +  m_data[2][0]*detMinor(0, 1);
+        +  m_data[1][0]*detMinor(1, 2)
+        +  m_data[2][0]*detMinor(1, 0);
 }
 
 template <>
@@ -231,12 +97,86 @@ Matrix3f Matrix3f::inverse() const
     return minors*(1.0f/det());
 }
 
+// Cofactor expansion through 2x2 sub-determinants shared between det and
+// inverse. Storage order doesn't matter, inverse(m^T) == inverse(m)^T.
+static float cofactors4(const float m[16], float inv[16])
+{
+    float s0 = m[0]*m[5] - m[4]*m[1];
+    float s1 = m[0]*m[6] - m[4]*m[2];
+    float s2 = m[0]*m[7] - m[4]*m[3];
+    float s3 = m[1]*m[6] - m[5]*m[2];
+    float s4 = m[1]*m[7] - m[5]*m[3];
+    float s5 = m[2]*m[7] - m[6]*m[3];
+
+    float c5 = m[10]*m[15] - m[14]*m[11];
+    float c4 = m[9]*m[15] - m[13]*m[11];
+    float c3 = m[9]*m[14] - m[13]*m[10];
+    float c2 = m[8]*m[15] - m[12]*m[11];
+    float c1 = m[8]*m[14] - m[12]*m[10];
+    float c0 = m[8]*m[13] - m[12]*m[9];
+
+    if (inv) {
+        inv[0]  =  m[5]*c5 - m[6]*c4 + m[7]*c3;
+        inv[1]  = -m[1]*c5 + m[2]*c4 - m[3]*c3;
+        inv[2]  =  m[13]*s5 - m[14]*s4 + m[15]*s3;
+        inv[3]  = -m[9]*s5 + m[10]*s4 - m[11]*s3;
+        inv[4]  = -m[4]*c5 + m[6]*c2 - m[7]*c1;
+        inv[5]  =  m[0]*c5 - m[2]*c2 + m[3]*c1;
+        inv[6]  = -m[12]*s5 + m[14]*s2 - m[15]*s1;
+        inv[7]  =  m[8]*s5 - m[10]*s2 + m[11]*s1;
+        inv[8]  =  m[4]*c4 - m[5]*c2 + m[7]*c0;
+        inv[9]  = -m[0]*c4 + m[1]*c2 - m[3]*c0;
+        inv[10] =  m[12]*s4 - m[13]*s2 + m[15]*s0;
+        inv[11] = -m[8]*s4 + m[9]*s2 - m[11]*s0;
+        inv[12] = -m[4]*c3 + m[5]*c1 - m[6]*c0;
+        inv[13] =  m[0]*c3 - m[1]*c1 + m[2]*c0;
+        inv[14] = -m[12]*s3 + m[13]*s1 - m[14]*s0;
+        inv[15] =  m[8]*s3 - m[9]*s1 + m[10]*s0;
+    }
+
+    return s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+}
+
 template <>
-Matrix3f Matrix3f::inverseTransposed() const
+float Matrix4f::det() const
 {
-    Matrix3f mat = inverse();
-    mat.transpose();
-    return mat;
+    return cofactors4(m_data[0], NULL);
 }
 
+template <>
+Matrix4f Matrix4f::inverse() const
+{
+    Matrix4f r;
+    float invDet = 1.0f/cofactors4(m_data[0], r.m_data[0]);
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            r.m_data[j][i] *= invDet;
+    return r;
+}
+
+#define MATRIX_INSTANTIATE(N, T)                                        \
+    template T Matrix<N, T>::det() const;                               \
+    template Matrix<N, T> Matrix<N, T>::inverse() const;                \
+    template                                                            \
+    std::ostream &operator<< <N, T>(std::ostream &out, const Matrix<N, T> &m);
+
+#define MATRIX_INSTANTIATE_N(N)  \
+    MATRIX_INSTANTIATE(N, float) \
+    MATRIX_INSTANTIATE(N, double)
+
+MATRIX_INSTANTIATE_N(2)
+MATRIX_INSTANTIATE_N(3)
+MATRIX_INSTANTIATE_N(4)
+MATRIX_INSTANTIATE_N(5)
+MATRIX_INSTANTIATE_N(6)
+MATRIX_INSTANTIATE_N(7)
+MATRIX_INSTANTIATE_N(8)
+MATRIX_INSTANTIATE_N(9)
+MATRIX_INSTANTIATE_N(10)
+MATRIX_INSTANTIATE_N(11)
+MATRIX_INSTANTIATE_N(12)
+
+#undef MATRIX_INSTANTIATE_N
+#undef MATRIX_INSTANTIATE
+
 }; // namespace math
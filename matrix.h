@@ -2,15 +2,39 @@
 #define MATRIX_H
 
 #include "vec.h"
+#include "instrument.h"
+
+#include <algorithm>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 namespace math {
 
+/// Storage alignment of Matrix<N, T>. Matrices whose columns are a
+/// multiple of 16 bytes (Matrix4f, Matrix<2, double>) are SSE aligned so
+/// the kernels can use aligned loads, the others (Matrix2f, Matrix3f)
+/// only to T. 16 bytes is what malloc and operator new already
+/// guarantee on 64-bit targets, so such matrices are safe to keep in
+/// standard containers; use AlignedAllocator from aalloc.h elsewhere.
+template <size_t N, typename T>
+struct MatrixAlignment {
+    static const size_t value = (N*sizeof(T)) % 16 == 0 ? 16 : alignof(T);
+};
+
+/// Column-major N x N matrix, m[j] is column j. The arithmetic is
+/// defined inline below for any N and T. det() and inverse() live in
+/// matrix.cpp and are instantiated there for N = 2..12, float and double.
 template <size_t N, typename T>
 class Matrix {
 public:
     Matrix() {}
 
-    explicit Matrix(const T *data);
+    explicit Matrix(const T *data)
+    {
+        memcpy(m_data, data, sizeof(m_data));
+    }
 
     template <size_t NN>
     explicit Matrix(const Matrix<NN, T> &src)
@@ -34,10 +58,8 @@ public:
 
     Matrix operator * (const Matrix &m) const;
 
-    void operator *= (const Matrix &m)
-    {
-        *this = m * (*this);
-    }
+    /// Left-multiply in place (*this = m * *this) without a temporary
+    void operator *= (const Matrix &m);
 
     vec<N, T> operator * (const vec<N, T> &v) const;
 
@@ -48,10 +70,15 @@ public:
         return m_data[0];
     }
 
+    /// Closed form up to 4x4, LU with partial pivoting (solve.h) above
     T det() const;
 
+    /// 2x2 minor with indices wrapping around N, only meaningful as the
+    /// 3x3 cofactor it is used for
     T detMinor(int ox, int oy) const;
 
+    /// Closed form for 3x3 and 4x4, LU above. Singular matrices give
+    /// non-finite elements.
     Matrix inverse() const;
 
     void transpose();
@@ -68,10 +95,12 @@ public:
     Matrix& setScale(T sx, T sy, T sz);
     Matrix& setTranslate(T tx, T ty, T tz);
 
+    /// Scan every element, see Transform (transform.h) to keep the
+    /// answer around
     bool isIdentinty() const;
     bool isScale() const;
 private:
-    T m_data[N][N];
+    alignas(MatrixAlignment<N, T>::value) T m_data[N][N];
 };
 
 template <size_t N, class T>
@@ -81,18 +110,284 @@ typedef Matrix<2, float> Matrix2f;
 typedef Matrix<3, float> Matrix3f;
 typedef Matrix<4, float> Matrix4f;
 
+// Closed forms in matrix.cpp
+template <> float Matrix2f::det() const;
+template <> float Matrix3f::det() const;
+template <> Matrix3f Matrix3f::inverse() const;
+template <> float Matrix4f::det() const;
+template <> Matrix4f Matrix4f::inverse() const;
+
+/// out[i] = a[i]*b[i], out may alias a or b
+void multiply(const Matrix4f *a, const Matrix4f *b, Matrix4f *out, size_t count);
+
+/// Same as multiply() on raw column-major arrays of 16 floats with no
+/// alignment requirement, for matrices living in externally owned memory
+void multiplyUnaligned(const float *a, const float *b, float *out, size_t count);
+
 /////
 
-inline Matrix4f identity()
+template <size_t N, typename T>
+inline void Matrix<N, T>::transpose()
+{
+    for (size_t j = 0; j < N-1; j++)
+        for (size_t i = j+1; i < N; i++)
+            std::swap(m_data[j][i], m_data[i][j]);
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T> Matrix<N, T>::transposed() const
+{
+    Matrix<N, T> ret(*this);
+    ret.transpose();
+    return ret;
+}
+
+template <size_t N, typename T>
+inline T Matrix<N, T>::detMinor(int ox, int oy) const
+{
+    int x1 = ox % N;
+    int y1 = oy % N;
+    int x2 = (ox+1) % N;
+    int y2 = (oy+1) % N;
+
+    return (m_data[y1][x1] * m_data[y2][x2])
+        -  (m_data[y1][x2] * m_data[y2][x1]);
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T>& Matrix<N, T>::loadZero()
+{
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            m_data[j][i] = 0;
+    return *this;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T>& Matrix<N, T>::loadIdentity()
+{
+    for (size_t j = 0; j < N; j++) {
+        for (size_t i = 0; i < N; i++)
+            m_data[j][i] = 0;
+        m_data[j][j] = 1;
+    }
+    return *this;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T>& Matrix<N, T>::setScale(T sx, T sy)
+{
+    m_data[0][0] = sx;
+    m_data[1][1] = sy;
+    return *this;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T>& Matrix<N, T>::setTranslate(T tx, T ty)
+{
+    m_data[N-1][0] = tx;
+    m_data[N-1][1] = ty;
+    return  *this;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T>& Matrix<N, T>::setScale(T sx, T sy, T sz)
+{
+    m_data[0][0] = sx;
+    m_data[1][1] = sy;
+    m_data[2][2] = sz;
+    return *this;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T>& Matrix<N, T>::setTranslate(T tx, T ty, T tz)
+{
+    m_data[N-1][0] = tx;
+    m_data[N-1][1] = ty;
+    m_data[N-1][2] = tz;
+    return  *this;
+}
+
+template <size_t N, typename T>
+inline bool Matrix<N, T>::isIdentinty() const
+{
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            if (m_data[j][i] != (i == j ? T(1) : T(0)))
+                return false;
+    return true;
+}
+
+template <size_t N, typename T>
+inline bool Matrix<N, T>::isScale() const
+{
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            if (i != j && m_data[j][i] != T(0))
+                return false;
+    return true;
+}
+
+template <size_t N, typename T>
+inline bool Matrix<N, T>::operator == (const Matrix<N, T> &m) const
+{
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            if (m_data[j][i] != m.m_data[j][i])
+                return false;
+    return true;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T> Matrix<N, T>::operator * (T s) const
+{
+    Matrix<N, T> ret;
+
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            ret.m_data[j][i] = m_data[j][i]*s;
+
+    return ret;
+}
+
+// Accumulates whole columns so the inner loop is contiguous and vectorizes
+template <size_t N, typename T>
+inline void mvmult(T dest[N], const T mat[N][N], const T vec[N])
+{
+    for (size_t j = 0; j < N; j++)
+        for (size_t i = 0; i < N; i++)
+            dest[i] += mat[j][i]*vec[j];
+}
+
+// dest = a*b, dest may alias a or b. Same column accumulation as mvmult,
+// unrolled over four columns of the result so each column of a loaded is
+// used four times. For matrices larger than L1 the columns of a are
+// walked in blocks. Each element still sums in k order, so the result
+// doesn't depend on the blocking.
+template <size_t N, typename T>
+inline void mmult(T dest[N][N], const T a[N][N], const T b[N][N])
+{
+    const size_t L1 = 16*1024;
+    const size_t KB = N*N*sizeof(T) <= L1 ? N : std::max<size_t>(L1/(N*sizeof(T)), 1);
+
+    T r[N][N];
+    memset(r, 0, sizeof(r));
+    for (size_t k0 = 0; k0 < N; k0 += KB) {
+        size_t k1 = std::min(k0+KB, N);
+        size_t j = 0;
+        for (; j+4 <= N; j += 4) {
+            T *r0 = r[j], *r1 = r[j+1], *r2 = r[j+2], *r3 = r[j+3];
+            for (size_t k = k0; k < k1; k++) {
+                const T *c = a[k];
+                T b0 = b[j][k], b1 = b[j+1][k], b2 = b[j+2][k], b3 = b[j+3][k];
+                for (size_t i = 0; i < N; i++) {
+                    r0[i] += c[i]*b0;
+                    r1[i] += c[i]*b1;
+                    r2[i] += c[i]*b2;
+                    r3[i] += c[i]*b3;
+                }
+            }
+        }
+        for (; j < N; j++)
+            for (size_t k = k0; k < k1; k++)
+                for (size_t i = 0; i < N; i++)
+                    r[j][i] += a[k][i]*b[j][k];
+    }
+    memcpy(dest, r, sizeof(r));
+}
+
+#ifdef __SSE__
+template <>
+inline void mvmult<4, float>(float dest[4], const float mat[4][4], const float vec[4])
+{
+    __m128 d;
+    d = _mm_setzero_ps();
+    for (size_t j = 0; j < 4; j++)
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_load_ps(mat[j]),
+                                     _mm_set_ps1(vec[j])));
+    _mm_storeu_ps(dest, d);
+}
+
+// Columns of a are kept in registers, so dest may alias a or b
+template <>
+inline void mmult<4, float>(float dest[4][4], const float a[4][4], const float b[4][4])
+{
+    __m128 a0 = _mm_load_ps(a[0]);
+    __m128 a1 = _mm_load_ps(a[1]);
+    __m128 a2 = _mm_load_ps(a[2]);
+    __m128 a3 = _mm_load_ps(a[3]);
+    for (size_t j = 0; j < 4; j++) {
+        __m128 d = _mm_mul_ps(a0, _mm_set_ps1(b[j][0]));
+        d = _mm_add_ps(d, _mm_mul_ps(a1, _mm_set_ps1(b[j][1])));
+        d = _mm_add_ps(d, _mm_mul_ps(a2, _mm_set_ps1(b[j][2])));
+        d = _mm_add_ps(d, _mm_mul_ps(a3, _mm_set_ps1(b[j][3])));
+        _mm_store_ps(dest[j], d);
+    }
+}
+#endif // __SSE
+
+template <size_t N, typename T>
+inline Matrix<N, T> Matrix<N, T>::operator * (const Matrix<N, T> &m) const
+{
+    GFXMATH_COUNT(COUNT_MATRIX_MULTIPLY);
+    Matrix<N, T> ret;
+    mmult<N, T>(ret.m_data, m_data, m.m_data);
+    return ret;
+}
+
+template <size_t N, typename T>
+inline void Matrix<N, T>::operator *= (const Matrix<N, T> &m)
+{
+    mmult<N, T>(m_data, m.m_data, m_data);
+}
+
+template <size_t N, typename T>
+inline vec<N, T> Matrix<N, T>::operator * (const vec<N, T> &v) const
+{
+    vec<N, T> res(T(0));
+    mvmult<N, T>(res.data(), m_data, v.data());
+    return res;
+}
+
+template <size_t N, typename T>
+inline Matrix<N, T> Matrix<N, T>::inverseTransposed() const
+{
+    Matrix<N, T> mat = inverse();
+    mat.transpose();
+    return mat;
+}
+
+/////
+
+/// Set a whole column. The helpers below build matrices this way rather
+/// than with loadIdentity() and element stores, so that once inlined the
+/// SSE loads that follow are forwarded from the stores instead of
+/// stalling on them.
+inline void setColumn(Matrix4f &m, int j, float x, float y, float z, float w)
+{
+#ifdef __SSE__
+    _mm_store_ps(m[j], _mm_setr_ps(x, y, z, w));
+#else
+    m[j][0] = x;
+    m[j][1] = y;
+    m[j][2] = z;
+    m[j][3] = w;
+#endif
+}
+
+inline Matrix4f scale(float sx, float sy, float sz)
 {
     Matrix4f m;
-    m.loadIdentity();
+    setColumn(m, 0, sx, 0, 0, 0);
+    setColumn(m, 1, 0, sy, 0, 0);
+    setColumn(m, 2, 0, 0, sz, 0);
+    setColumn(m, 3, 0, 0, 0, 1);
     return m;
 }
 
-inline Matrix4f scale(float sx, float sy, float sz)
+inline Matrix4f identity()
 {
-    return identity().setScale(sx, sy, sz);
+    return scale(1, 1, 1);
 }
 
 inline Matrix4f scale(const vec3f &s)
@@ -102,7 +397,12 @@ inline Matrix4f scale(const vec3f &s)
 
 inline Matrix4f translate(float tx, float ty, float tz)
 {
-    return identity().setTranslate(tx, ty, tz);
+    Matrix4f m;
+    setColumn(m, 0, 1, 0, 0, 0);
+    setColumn(m, 1, 0, 1, 0, 0);
+    setColumn(m, 2, 0, 0, 1, 0);
+    setColumn(m, 3, tx, ty, tz, 1);
+    return m;
 }
 
 inline Matrix4f translate(const vec3f &s)
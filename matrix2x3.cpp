@@ -0,0 +1,93 @@
+#include <iomanip>
+#include <iostream>
+
+#include "matrix2x3.h"
+#include "fastmath.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+Matrix2x3f Matrix2x3f::inverse() const
+{
+    float a = m_data[0][0], b = m_data[0][1];
+    float c = m_data[1][0], d = m_data[1][1];
+    float invDet = 1.0f/(a*d - b*c);
+
+    Matrix2x3f r;
+    r.m_data[0][0] =  d*invDet;
+    r.m_data[0][1] = -b*invDet;
+    r.m_data[1][0] = -c*invDet;
+    r.m_data[1][1] =  a*invDet;
+
+    vec2f t = r.transformDirection(vec2f(m_data[0][2], m_data[1][2]));
+    r.m_data[0][2] = -t[0];
+    r.m_data[1][2] = -t[1];
+
+    return r;
+}
+
+Matrix2x3f& Matrix2x3f::loadIdentity()
+{
+    m_data[0][0] = 1; m_data[0][1] = 0; m_data[0][2] = 0;
+    m_data[1][0] = 0; m_data[1][1] = 1; m_data[1][2] = 0;
+    return *this;
+}
+
+Matrix2x3f& Matrix2x3f::setScale(float sx, float sy)
+{
+    m_data[0][0] = sx;
+    m_data[1][1] = sy;
+    return *this;
+}
+
+Matrix2x3f& Matrix2x3f::setTranslate(float tx, float ty)
+{
+    m_data[0][2] = tx;
+    m_data[1][2] = ty;
+    return *this;
+}
+
+Matrix2x3f& Matrix2x3f::setTransform(const vec2f &pos, const vec2f &scale, float angle)
+{
+    float s, c;
+    Trig<>::sincos(angle, s, c);
+    m_data[0][0] = c*scale[0]; m_data[0][1] = -s*scale[1]; m_data[0][2] = pos[0];
+    m_data[1][0] = s*scale[0]; m_data[1][1] =  c*scale[1]; m_data[1][2] = pos[1];
+    return *this;
+}
+
+std::ostream &operator<<(std::ostream &out, const Matrix2x3f &m)
+{
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 3; i++)
+            out << std::left << std::setw(5) << m[j][i] << " ";
+        out << '\n';
+    }
+    return out;
+}
+
+void transformPoints(const Matrix2x3f &m, const vec2f *in,
+                     vec2f *out, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    // Two points per register: (x0, y0, x1, y1)
+    __m128 cx = _mm_set_ps(m[1][0], m[0][0], m[1][0], m[0][0]);
+    __m128 cy = _mm_set_ps(m[1][1], m[0][1], m[1][1], m[0][1]);
+    __m128 ct = _mm_set_ps(m[1][2], m[0][2], m[1][2], m[0][2]);
+    for (; i+2 <= count; i += 2) {
+        __m128 p = _mm_loadu_ps(in[i].data());
+        __m128 xx = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128 yy = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+        __m128 r = _mm_add_ps(ct, _mm_add_ps(_mm_mul_ps(cx, xx), _mm_mul_ps(cy, yy)));
+        _mm_storeu_ps(out[i].data(), r);
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = m.transformPoint(in[i]);
+}
+
+}; // namespace math
@@ -0,0 +1,116 @@
+#ifndef MATRIX2X3_H
+#define MATRIX2X3_H
+
+#include "matrix.h"
+
+namespace math {
+
+/// 2D affine transform stored as the upper two rows of a 3x3 matrix, the
+/// last row is implicitly (0, 0, 1). m[i] is (x, y, translation) of the
+/// i-th output component.
+class Matrix2x3f {
+public:
+    Matrix2x3f() {}
+
+    explicit Matrix2x3f(const float *data)
+    {
+        memcpy(m_data, data, sizeof(m_data));
+    }
+
+    /// From a 3x3 matrix such as rotate2D(), the last row is dropped
+    explicit Matrix2x3f(const Matrix3f &m)
+    {
+        for (int j = 0; j < 2; j++)
+            for (int i = 0; i < 3; i++)
+                m_data[j][i] = m[i][j];
+    }
+
+    Matrix3f toMatrix3() const
+    {
+        Matrix3f m;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 2; j++)
+                m[i][j] = m_data[j][i];
+            m[i][2] = 0.0f;
+        }
+        m[2][2] = 1.0f;
+        return m;
+    }
+
+    const float* operator [] (int j) const
+    {
+        return m_data[j];
+    }
+
+    float* operator [] (int j)
+    {
+        return m_data[j];
+    }
+
+    const float* data() const
+    {
+        return m_data[0];
+    }
+
+    /// Compose, (a*b) applies b first
+    Matrix2x3f operator * (const Matrix2x3f &m) const
+    {
+        Matrix2x3f r;
+        for (int j = 0; j < 2; j++) {
+            for (int i = 0; i < 3; i++)
+                r.m_data[j][i] = m_data[j][0]*m.m_data[0][i] + m_data[j][1]*m.m_data[1][i];
+            r.m_data[j][2] += m_data[j][2];
+        }
+        return r;
+    }
+
+    void operator *= (const Matrix2x3f &m)
+    {
+        *this = m * (*this);
+    }
+
+    bool operator == (const Matrix2x3f &m) const
+    {
+        return memcmp(m_data, m.m_data, sizeof(m_data)) == 0;
+    }
+
+    bool operator != (const Matrix2x3f &m) const
+    {
+        return !(*this == m);
+    }
+
+    vec2f transformPoint(const vec2f &p) const
+    {
+        return vec2f(m_data[0][0]*p[0] + m_data[0][1]*p[1] + m_data[0][2],
+                     m_data[1][0]*p[0] + m_data[1][1]*p[1] + m_data[1][2]);
+    }
+
+    vec2f transformDirection(const vec2f &d) const
+    {
+        return vec2f(m_data[0][0]*d[0] + m_data[0][1]*d[1],
+                     m_data[1][0]*d[0] + m_data[1][1]*d[1]);
+    }
+
+    Matrix2x3f inverse() const;
+
+    Matrix2x3f& loadIdentity();
+
+    Matrix2x3f& setScale(float sx, float sy);
+    Matrix2x3f& setTranslate(float tx, float ty);
+
+    /// Scale, then rotate by angle (radians), then translate
+    Matrix2x3f& setTransform(const vec2f &pos, const vec2f &scale, float angle);
+
+private:
+    float m_data[2][3];
+};
+
+std::ostream &operator<<(std::ostream &out, const Matrix2x3f &m);
+
+/// Transform points by a single matrix, in and out may alias
+void transformPoints(const Matrix2x3f &m, const vec2f *in,
+                     vec2f *out, size_t count);
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,154 @@
+#include <iomanip>
+#include <iostream>
+
+#include "matrix3x4.h"
+#include "instrument.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+// dest = a*b, dest may alias either argument
+static inline void compose(float dest[3][4], const float a[3][4], const float b[3][4])
+{
+#ifdef __SSE__
+    __m128 b0 = _mm_load_ps(b[0]);
+    __m128 b1 = _mm_load_ps(b[1]);
+    __m128 b2 = _mm_load_ps(b[2]);
+    __m128 b3 = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    for (int j = 0; j < 3; j++) {
+        __m128 r = _mm_mul_ps(_mm_set1_ps(a[j][0]), b0);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[j][1]), b1));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[j][2]), b2));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[j][3]), b3));
+        _mm_store_ps(dest[j], r);
+    }
+#else
+    float r[3][4];
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 4; i++)
+            r[j][i] = a[j][0]*b[0][i] + a[j][1]*b[1][i] + a[j][2]*b[2][i];
+        r[j][3] += a[j][3];
+    }
+    memcpy(dest, r, sizeof(r));
+#endif
+}
+
+Matrix3x4f Matrix3x4f::operator * (const Matrix3x4f &m) const
+{
+    Matrix3x4f ret;
+    compose(ret.m_data, m_data, m.m_data);
+    return ret;
+}
+
+Matrix3x4f Matrix3x4f::inverse() const
+{
+    vec3f r0(m_data[0][0], m_data[0][1], m_data[0][2]);
+    vec3f r1(m_data[1][0], m_data[1][1], m_data[1][2]);
+    vec3f r2(m_data[2][0], m_data[2][1], m_data[2][2]);
+
+    // Columns of the inverse are cross products of the rows
+    vec3f c0 = cross(r1, r2);
+    vec3f c1 = cross(r2, r0);
+    vec3f c2 = cross(r0, r1);
+    float invDet = 1.0f/dot(r0, c0);
+
+    Matrix3x4f ret;
+    for (int j = 0; j < 3; j++) {
+        ret.m_data[j][0] = c0[j]*invDet;
+        ret.m_data[j][1] = c1[j]*invDet;
+        ret.m_data[j][2] = c2[j]*invDet;
+    }
+
+    vec3f t = ret.transformDirection(getTranslate());
+    ret.m_data[0][3] = -t[0];
+    ret.m_data[1][3] = -t[1];
+    ret.m_data[2][3] = -t[2];
+
+    return ret;
+}
+
+Matrix3x4f& Matrix3x4f::loadIdentity()
+{
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 4; i++)
+            m_data[j][i] = 0;
+        m_data[j][j] = 1;
+    }
+    return *this;
+}
+
+Matrix3x4f& Matrix3x4f::setScale(float sx, float sy, float sz)
+{
+    m_data[0][0] = sx;
+    m_data[1][1] = sy;
+    m_data[2][2] = sz;
+    return *this;
+}
+
+Matrix3x4f& Matrix3x4f::setTranslate(float tx, float ty, float tz)
+{
+    m_data[0][3] = tx;
+    m_data[1][3] = ty;
+    m_data[2][3] = tz;
+    return *this;
+}
+
+std::ostream &operator<<(std::ostream &out, const Matrix3x4f &m)
+{
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 4; i++)
+            out << std::left << std::setw(5) << m[j][i] << " ";
+        out << '\n';
+    }
+    return out;
+}
+
+void multiply(const Matrix3x4f *a, const Matrix3x4f *b,
+              Matrix3x4f *out, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = a[i]*b[i];
+}
+
+template <bool point>
+static void transform(const Matrix3x4f &m, const vec3f *in,
+                      vec3f *out, size_t count)
+{
+#ifdef __SSE__
+    __m128 c0 = _mm_set_ps(0.0f, m[2][0], m[1][0], m[0][0]);
+    __m128 c1 = _mm_set_ps(0.0f, m[2][1], m[1][1], m[0][1]);
+    __m128 c2 = _mm_set_ps(0.0f, m[2][2], m[1][2], m[0][2]);
+    __m128 c3 = point ? _mm_set_ps(0.0f, m[2][3], m[1][3], m[0][3])
+                      : _mm_setzero_ps();
+    for (size_t i = 0; i < count; i++) {
+        const float *p = in[i].data();
+        __m128 r = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(p[0])));
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(p[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(p[2])));
+        float *d = out[i].data();
+        _mm_storel_pi((__m64*)d, r);
+        _mm_store_ss(d+2, _mm_movehl_ps(r, r));
+    }
+#else
+    for (size_t i = 0; i < count; i++)
+        out[i] = point ? m.transformPoint(in[i]) : m.transformDirection(in[i]);
+#endif
+}
+
+void transformPoints(const Matrix3x4f &m, const vec3f *in,
+                     vec3f *out, size_t count)
+{
+    GFXMATH_TIME(TIMER_TRANSFORM_POINTS, count);
+    transform<true>(m, in, out, count);
+}
+
+void transformDirections(const Matrix3x4f &m, const vec3f *in,
+                         vec3f *out, size_t count)
+{
+    transform<false>(m, in, out, count);
+}
+
+}; // namespace math
@@ -0,0 +1,121 @@
+#ifndef MATRIX3X4_H
+#define MATRIX3X4_H
+
+#include "matrix.h"
+
+namespace math {
+
+/// Affine transform stored as the upper three rows of a 4x4 matrix, the
+/// last row is implicitly (0, 0, 0, 1). Rows are stored contiguously so
+/// m[i] is (x, y, z, translation) of the i-th output component.
+class Matrix3x4f {
+public:
+    Matrix3x4f() {}
+
+    explicit Matrix3x4f(const float *data)
+    {
+        memcpy(m_data, data, sizeof(m_data));
+    }
+
+    /// From a 4x4 matrix, the last row is dropped. Lossless for any
+    /// matrix built by translate(), scale(), rotate*() or toMatrix().
+    explicit Matrix3x4f(const Matrix4f &m)
+    {
+        for (int j = 0; j < 3; j++)
+            for (int i = 0; i < 4; i++)
+                m_data[j][i] = m[i][j];
+    }
+
+    Matrix4f toMatrix4() const
+    {
+        Matrix4f m;
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 3; j++)
+                m[i][j] = m_data[j][i];
+            m[i][3] = 0.0f;
+        }
+        m[3][3] = 1.0f;
+        return m;
+    }
+
+    const float* operator [] (int j) const
+    {
+        return m_data[j];
+    }
+
+    float* operator [] (int j)
+    {
+        return m_data[j];
+    }
+
+    const float* data() const
+    {
+        return m_data[0];
+    }
+
+    /// Compose, (a*b) applies b first as with Matrix4f
+    Matrix3x4f operator * (const Matrix3x4f &m) const;
+
+    void operator *= (const Matrix3x4f &m)
+    {
+        *this = m * (*this);
+    }
+
+    bool operator == (const Matrix3x4f &m) const
+    {
+        return memcmp(m_data, m.m_data, sizeof(m_data)) == 0;
+    }
+
+    bool operator != (const Matrix3x4f &m) const
+    {
+        return !(*this == m);
+    }
+
+    vec3f transformPoint(const vec3f &p) const
+    {
+        return vec3f(
+            m_data[0][0]*p[0] + m_data[0][1]*p[1] + m_data[0][2]*p[2] + m_data[0][3],
+            m_data[1][0]*p[0] + m_data[1][1]*p[1] + m_data[1][2]*p[2] + m_data[1][3],
+            m_data[2][0]*p[0] + m_data[2][1]*p[1] + m_data[2][2]*p[2] + m_data[2][3]);
+    }
+
+    vec3f transformDirection(const vec3f &d) const
+    {
+        return vec3f(
+            m_data[0][0]*d[0] + m_data[0][1]*d[1] + m_data[0][2]*d[2],
+            m_data[1][0]*d[0] + m_data[1][1]*d[1] + m_data[1][2]*d[2],
+            m_data[2][0]*d[0] + m_data[2][1]*d[1] + m_data[2][2]*d[2]);
+    }
+
+    vec3f getTranslate() const
+    {
+        return vec3f(m_data[0][3], m_data[1][3], m_data[2][3]);
+    }
+
+    /// Inverse of a general (non-singular) affine transform
+    Matrix3x4f inverse() const;
+
+    Matrix3x4f& loadIdentity();
+
+    Matrix3x4f& setScale(float sx, float sy, float sz);
+    Matrix3x4f& setTranslate(float tx, float ty, float tz);
+
+private:
+    alignas(16) float m_data[3][4];
+};
+
+std::ostream &operator<<(std::ostream &out, const Matrix3x4f &m);
+
+/// out[i] = a[i]*b[i]
+void multiply(const Matrix3x4f *a, const Matrix3x4f *b,
+              Matrix3x4f *out, size_t count);
+
+/// Transform points or directions by a single matrix, in and out may alias
+void transformPoints(const Matrix3x4f &m, const vec3f *in,
+                     vec3f *out, size_t count);
+void transformDirections(const Matrix3x4f &m, const vec3f *in,
+                         vec3f *out, size_t count);
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace math {
+
+// Fork-join over index ranges for the batched functions that take a
+// thread count. No pool, threads are started per call, so only worth it
+// for work well above the cost of starting one.
+
+/// Number of parts to split count items into for threads threads (0 for
+/// one per hardware thread), keeping at least minPart items per part
+inline size_t partCount(size_t count, size_t threads, size_t minPart)
+{
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    return std::max<size_t>(std::min(threads, count/std::max<size_t>(minPart, 1)), 1);
+}
+
+/// Call f(begin, end, part) for each of parts consecutive ranges of
+/// [0, count), all but the first on threads of their own
+template <typename F>
+void forEachPart(size_t count, size_t parts, F f)
+{
+    std::vector<std::thread> workers;
+    for (size_t k = 1; k < parts; k++)
+        workers.push_back(std::thread(f, count*k/parts, count*(k+1)/parts, k));
+    f(size_t(0), count/parts, size_t(0));
+    for (size_t k = 0; k < workers.size(); k++)
+        workers[k].join();
+}
+
+/// Reusable barrier for the parts of one forEachPart() that go through
+/// several phases, so threads are started once
+class Barrier {
+public:
+    explicit Barrier(size_t count)
+        : m_count(count)
+        , m_waiting(0)
+        , m_generation(0)
+    {}
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        size_t generation = m_generation;
+        if (++m_waiting == m_count) {
+            m_waiting = 0;
+            m_generation++;
+            m_done.notify_all();
+            return;
+        }
+        while (generation == m_generation)
+            m_done.wait(lock);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_done;
+    size_t m_count, m_waiting, m_generation;
+};
+
+}; // namespace math
+
+#endif
@@ -25,6 +25,17 @@ public:
             /  dot(ray.dir, m_n);
     }
 
+    /// Plane equation (n, d) with distance(p) = dot(n, p) + d
+    vec4f equation() const
+    {
+        return vec4f(m_n, -dot(m_n, m_p0));
+    }
+
+    const vec3f& normal() const
+    {
+        return m_n;
+    }
+
     // set from normal and origin
     void set(const vec3f &p0, const vec3f &n)
     {
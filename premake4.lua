@@ -1,2 +1,42 @@
 files { "**.h", "**.cpp" }
-excludes { "math_test.cpp" }
\ No newline at end of file
+excludes { "math_test.cpp", "math_bench.cpp" }
+
+newoption {
+    trigger = "unity",
+    description = "Build the library as one translation unit (unity.cpp)"
+}
+if _OPTIONS["unity"] then
+    for _, f in ipairs(os.matchfiles("*.cpp")) do
+        if f ~= "unity.cpp" then
+            excludes { f }
+        end
+    end
+else
+    excludes { "unity.cpp" }
+end
+
+-- C++11 is required (alignas, static_assert), C++17 enables the
+-- std::to_chars/from_chars paths in format.cpp
+configuration "gmake"
+    buildoptions { "-std=c++17" }
+configuration {}
+
+newoption {
+    trigger = "instrument",
+    description = "Enable the GFXMATH_* hot path counters and timers"
+}
+configuration "instrument"
+    defines { "GFXMATH_INSTRUMENT" }
+configuration {}
+
+newoption {
+    trigger = "lto",
+    description = "Enable link time optimization"
+}
+configuration { "lto", "gmake" }
+    buildoptions { "-flto" }
+    linkoptions { "-flto" }
+configuration { "lto", "vs*" }
+    buildoptions { "/GL" }
+    linkoptions { "/LTCG" }
+configuration {}
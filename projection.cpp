@@ -0,0 +1,191 @@
+#include "projection.h"
+#include "instrument.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace math {
+
+static inline uint8_t clipFlags(float cx, float cy, float cz, float cw)
+{
+    return ((cx < -cw ? CLIP_LEFT : 0) |
+            (cx >  cw ? CLIP_RIGHT : 0) |
+            (cy < -cw ? CLIP_BOTTOM : 0) |
+            (cy >  cw ? CLIP_TOP : 0) |
+            (cz < -cw ? CLIP_NEAR : 0) |
+            (cz >  cw ? CLIP_FAR : 0));
+}
+
+#ifdef __SSE2__
+static inline __m128i clipBit(__m128 cmp, int bit)
+{
+    return _mm_and_si128(_mm_castps_si128(cmp), _mm_set1_epi32(bit));
+}
+#endif
+
+void project(const Matrix4f &m, const Viewport &viewport,
+             const float *x, const float *y, const float *z,
+             float *sx, float *sy, float *sz, uint8_t *clip, size_t count)
+{
+    GFXMATH_TIME(TIMER_PROJECT, count);
+    const float hw = viewport.width*0.5f;
+    const float hh = viewport.height*0.5f;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 vhw = _mm_set1_ps(hw);
+    const __m128 vhh = _mm_set1_ps(hh);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    for (; i+4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x+i);
+        __m128 py = _mm_loadu_ps(y+i);
+        __m128 pz = _mm_loadu_ps(z+i);
+        __m128 c[4];
+        for (int k = 0; k < 4; k++) {
+            c[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][k]), px), _mm_set1_ps(m[3][k]));
+            c[k] = _mm_add_ps(c[k], _mm_mul_ps(_mm_set1_ps(m[1][k]), py));
+            c[k] = _mm_add_ps(c[k], _mm_mul_ps(_mm_set1_ps(m[2][k]), pz));
+        }
+
+        if (clip) {
+            __m128 nw = _mm_xor_ps(c[3], sign);
+            __m128i f = clipBit(_mm_cmplt_ps(c[0], nw), CLIP_LEFT);
+            f = _mm_or_si128(f, clipBit(_mm_cmpgt_ps(c[0], c[3]), CLIP_RIGHT));
+            f = _mm_or_si128(f, clipBit(_mm_cmplt_ps(c[1], nw), CLIP_BOTTOM));
+            f = _mm_or_si128(f, clipBit(_mm_cmpgt_ps(c[1], c[3]), CLIP_TOP));
+            f = _mm_or_si128(f, clipBit(_mm_cmplt_ps(c[2], nw), CLIP_NEAR));
+            f = _mm_or_si128(f, clipBit(_mm_cmpgt_ps(c[2], c[3]), CLIP_FAR));
+            f = _mm_packs_epi32(f, f);
+            f = _mm_packus_epi16(f, f);
+            int packed = _mm_cvtsi128_si32(f);
+            memcpy(clip+i, &packed, 4);
+        }
+
+        __m128 invW = _mm_div_ps(one, c[3]);
+        __m128 nx = _mm_mul_ps(c[0], invW);
+        __m128 ny = _mm_mul_ps(c[1], invW);
+        __m128 nz = _mm_mul_ps(c[2], invW);
+        _mm_storeu_ps(sx+i, _mm_mul_ps(_mm_add_ps(nx, one), vhw));
+        _mm_storeu_ps(sy+i, _mm_mul_ps(_mm_sub_ps(one, ny), vhh));
+        _mm_storeu_ps(sz+i, _mm_add_ps(_mm_mul_ps(nz, half), half));
+    }
+#endif
+    for (; i < count; i++) {
+        float px = x[i], py = y[i], pz = z[i];
+        float cx = m[0][0]*px + m[1][0]*py + m[2][0]*pz + m[3][0];
+        float cy = m[0][1]*px + m[1][1]*py + m[2][1]*pz + m[3][1];
+        float cz = m[0][2]*px + m[1][2]*py + m[2][2]*pz + m[3][2];
+        float cw = m[0][3]*px + m[1][3]*py + m[2][3]*pz + m[3][3];
+        if (clip)
+            clip[i] = clipFlags(cx, cy, cz, cw);
+
+        float invW = 1.0f/cw;
+        sx[i] = (cx*invW + 1.0f)*hw;
+        sy[i] = (1.0f - cy*invW)*hh;
+        sz[i] = cz*invW*0.5f + 0.5f;
+    }
+}
+
+void project(const Matrix4f &viewProj, const Viewport &viewport,
+             const vec3f *points, vec3f *out, uint8_t *clip, size_t count)
+{
+    // Deinterleave through small buffers and reuse the SoA path
+    const size_t CHUNK = 64;
+    float x[CHUNK], y[CHUNK], z[CHUNK];
+
+    for (size_t base = 0; base < count; base += CHUNK) {
+        size_t n = count-base < CHUNK ? count-base : CHUNK;
+        for (size_t i = 0; i < n; i++) {
+            const vec3f &p = points[base+i];
+            x[i] = p[0];
+            y[i] = p[1];
+            z[i] = p[2];
+        }
+        project(viewProj, viewport, x, y, z, x, y, z,
+                clip ? clip+base : NULL, n);
+        for (size_t i = 0; i < n; i++)
+            out[base+i] = vec3f(x[i], y[i], z[i]);
+    }
+}
+
+void project(const Matrix4f &viewProj, const Viewport &viewport,
+             const SoA<vec3f> &points, SoA<vec3f> &out, uint8_t *clip)
+{
+    out.resize(points.size());
+    project(viewProj, viewport, points.x(), points.y(), points.z(),
+            out.x(), out.y(), out.z(), clip, points.size());
+}
+
+vec3f unproject(float x, float y, float depth,
+                const Matrix4f &invViewProj, const Viewport &viewport)
+{
+    float xc, yc;
+    viewport.toClipSpace(x, y, xc, yc);
+    vec4f p = invViewProj * vec4f(xc, yc, depth*2.0f - 1.0f, 1.0f);
+    return vec3f(p[0], p[1], p[2]) / p[3];
+}
+
+Ray unprojectRay(float x, float y,
+                 const Matrix4f &invViewProj, const Viewport &viewport)
+{
+    Ray ray;
+    ray.origin = unproject(x, y, 0.0f, invViewProj, viewport);
+    ray.dir = (unproject(x, y, 1.0f, invViewProj, viewport) - ray.origin).normalized();
+    return ray;
+}
+
+void unprojectRays(const Matrix4f &m, const Viewport &viewport,
+                   const vec2f *points, Ray *rays, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 invHw = _mm_set1_ps(1.0f/(viewport.width*0.5f));
+    const __m128 invHh = _mm_set1_ps(1.0f/(viewport.height*0.5f));
+    for (; i+4 <= count; i += 4) {
+        // (x0, y0, x1, y1), (x2, y2, x3, y3) -> xs, ys
+        __m128 p01 = _mm_loadu_ps(points[i].data());
+        __m128 p23 = _mm_loadu_ps(points[i+2].data());
+        __m128 px = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 py = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 xc = _mm_sub_ps(_mm_mul_ps(px, invHw), one);
+        __m128 yc = _mm_sub_ps(one, _mm_mul_ps(py, invHh));
+
+        // Near (z = -1) and far (z = 1) points share the xy terms
+        __m128 nearP[4], farP[4];
+        for (int k = 0; k < 4; k++) {
+            __m128 xy = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][k]), xc),
+                                   _mm_mul_ps(_mm_set1_ps(m[1][k]), yc));
+            xy = _mm_add_ps(xy, _mm_set1_ps(m[3][k]));
+            nearP[k] = _mm_sub_ps(xy, _mm_set1_ps(m[2][k]));
+            farP[k] = _mm_add_ps(xy, _mm_set1_ps(m[2][k]));
+        }
+        __m128 invNear = _mm_div_ps(one, nearP[3]);
+        __m128 invFar = _mm_div_ps(one, farP[3]);
+
+        float o[3][4], d[3][4];
+        __m128 dir[3];
+        for (int k = 0; k < 3; k++) {
+            __m128 n = _mm_mul_ps(nearP[k], invNear);
+            dir[k] = _mm_sub_ps(_mm_mul_ps(farP[k], invFar), n);
+            _mm_storeu_ps(o[k], n);
+        }
+        __m128 len = _mm_add_ps(_mm_mul_ps(dir[0], dir[0]), _mm_mul_ps(dir[1], dir[1]));
+        len = _mm_sqrt_ps(_mm_add_ps(len, _mm_mul_ps(dir[2], dir[2])));
+        for (int k = 0; k < 3; k++)
+            _mm_storeu_ps(d[k], _mm_div_ps(dir[k], len));
+
+        for (int l = 0; l < 4; l++) {
+            rays[i+l].origin = vec3f(o[0][l], o[1][l], o[2][l]);
+            rays[i+l].dir = vec3f(d[0][l], d[1][l], d[2][l]);
+        }
+    }
+#endif
+    for (; i < count; i++)
+        rays[i] = unprojectRay(points[i][0], points[i][1], m, viewport);
+}
+
+}; // namespace math
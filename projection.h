@@ -0,0 +1,53 @@
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <stdint.h>
+
+#include "matrix.h"
+#include "viewport.h"
+#include "soa.h"
+
+namespace math {
+
+/// Bits set by project() for each clip plane a point is outside of
+typedef enum {
+    CLIP_LEFT   = 1 << 0,
+    CLIP_RIGHT  = 1 << 1,
+    CLIP_BOTTOM = 1 << 2,
+    CLIP_TOP    = 1 << 3,
+    CLIP_NEAR   = 1 << 4,
+    CLIP_FAR    = 1 << 5
+} clip_flags_t;
+
+/// Project world points through viewProj to window coordinates (same
+/// space as Viewport::toClipSpace input) with depth in [0, 1]. Points
+/// outside the clip volume are still projected, check clip[i] (may be
+/// NULL). out may alias points.
+void project(const Matrix4f &viewProj, const Viewport &viewport,
+             const vec3f *points, vec3f *out, uint8_t *clip, size_t count);
+
+/// Same as above for structure of arrays, outputs may alias inputs
+void project(const Matrix4f &viewProj, const Viewport &viewport,
+             const float *x, const float *y, const float *z,
+             float *sx, float *sy, float *sz, uint8_t *clip, size_t count);
+
+/// Same as above for SoA containers, out is resized and may be points
+void project(const Matrix4f &viewProj, const Viewport &viewport,
+             const SoA<vec3f> &points, SoA<vec3f> &out, uint8_t *clip);
+
+/// Window point and depth in [0, 1] back to world space
+vec3f unproject(float x, float y, float depth,
+                const Matrix4f &invViewProj, const Viewport &viewport);
+
+/// Picking ray from the near to the far plane through a window point,
+/// dir is normalized
+Ray unprojectRay(float x, float y,
+                 const Matrix4f &invViewProj, const Viewport &viewport);
+
+/// Batched unprojectRay
+void unprojectRays(const Matrix4f &invViewProj, const Viewport &viewport,
+                   const vec2f *points, Ray *rays, size_t count);
+
+}; // namespace math
+
+#endif
@@ -1,5 +1,11 @@
 #include <iostream>
 #include "quaternion.h"
+#include "fastmath.h"
+#include "instrument.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 namespace math {
 
@@ -14,33 +20,95 @@ std::ostream &operator<<(std::ostream &out, const Quaternion &q)
 }
 
 
+// Rotation matrix of (x, y, z, w) as rows r[row][col]
+static inline void rotationRows(float x, float y, float z, float w, float r[3][3])
+{
+    float x2 = x+x, y2 = y+y, z2 = z+z;
+    float xx = x*x2, yy = y*y2, zz = z*z2;
+    float xy = x*y2, xz = x*z2, yz = y*z2;
+    float wx = x2*w, wy = y2*w, wz = z2*w;
+
+    r[0][0]=1.0f-(yy+zz); r[0][1]=xy-wz;        r[0][2]=xz+wy;
+    r[1][0]=xy+wz;        r[1][1]=1.0f-(xx+zz); r[1][2]=yz-wx;
+    r[2][0]=xz-wy;        r[2][1]=yz+wx;        r[2][2]=1.0f-(xx+yy);
+}
+
+// Shepperd's method: pick the largest of w, x, y, z from the diagonal to
+// keep the square root away from zero
+static inline void quaternionFromRows(const float r[3][3],
+                                      float &x, float &y, float &z, float &w)
+{
+    float t = r[0][0]+r[1][1]+r[2][2];
+    if (t >= r[0][0] && t >= r[1][1] && t >= r[2][2]) {
+        float q = 0.5f*sqrtf(1.0f+t);
+        float s = 0.25f/q;
+        w = q;
+        x = (r[2][1]-r[1][2])*s;
+        y = (r[0][2]-r[2][0])*s;
+        z = (r[1][0]-r[0][1])*s;
+    } else if (r[0][0] >= r[1][1] && r[0][0] >= r[2][2]) {
+        float q = 0.5f*sqrtf(1.0f+r[0][0]-r[1][1]-r[2][2]);
+        float s = 0.25f/q;
+        w = (r[2][1]-r[1][2])*s;
+        x = q;
+        y = (r[0][1]+r[1][0])*s;
+        z = (r[0][2]+r[2][0])*s;
+    } else if (r[1][1] >= r[2][2]) {
+        float q = 0.5f*sqrtf(1.0f-r[0][0]+r[1][1]-r[2][2]);
+        float s = 0.25f/q;
+        w = (r[0][2]-r[2][0])*s;
+        x = (r[0][1]+r[1][0])*s;
+        y = q;
+        z = (r[1][2]+r[2][1])*s;
+    } else {
+        float q = 0.5f*sqrtf(1.0f-r[0][0]-r[1][1]+r[2][2]);
+        float s = 0.25f/q;
+        w = (r[1][0]-r[0][1])*s;
+        x = (r[0][2]+r[2][0])*s;
+        y = (r[1][2]+r[2][1])*s;
+        z = q;
+    }
+}
+
 Matrix4f Quaternion::toMatrix() const
 {
+    GFXMATH_COUNT(COUNT_QUATERNION_TO_MATRIX);
+    float r[3][3];
+    rotationRows(m_v.x(), m_v.y(), m_v.z(), m_w, r);
+
     Matrix4f m;
-    m.loadIdentity();
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            m[i][j] = r[j][i];
+        m[i][3] = 0.0f;
+        m[3][i] = 0.0f;
+    }
+    m[3][3] = 1.0f;
 
-    vec3f v2 = m_v+m_v;
-    vec3f vv = m_v*v2;
-    vec3f v2w = v2*m_w;
+    return m;
+}
 
-    float x = m_v.x();
-    float y = m_v.y();
-    float xy = x * v2.y();
-    float xz = x * v2.z();
-    float yz = y * v2.z();
+template <typename M>
+static Quaternion fromMatrixColumns(const M &m)
+{
+    float r[3][3];
+    for (int j = 0; j < 3; j++)
+        for (int i = 0; i < 3; i++)
+            r[j][i] = m[i][j];
 
-    float xx = vv.x();
-    float yy = vv.y();
-    float zz = vv.z();
-    float wx = v2w.x();
-    float wy = v2w.y();
-    float wz = v2w.z();
+    float x, y, z, w;
+    quaternionFromRows(r, x, y, z, w);
+    return Quaternion(w, vec3f(x, y, z));
+}
 
-    m[0][0]=1.0f-(yy+zz); m[1][0]=xy-wz;        m[2][0]=xz+wy;
-    m[0][1]=xy+wz;        m[1][1]=1.0f-(xx+zz); m[2][1]=yz-wx;
-    m[0][2]=xz-wy;        m[1][2]=yz+wx;        m[2][2]=1.0f-(xx+yy);
+Quaternion Quaternion::fromMatrix(const Matrix4f &m)
+{
+    return fromMatrixColumns(m);
+}
 
-    return m;
+Quaternion Quaternion::fromMatrix(const Matrix3f &m)
+{
+    return fromMatrixColumns(m);
 }
 
 vec3f Quaternion::toEuler() const
@@ -48,24 +116,25 @@ vec3f Quaternion::toEuler() const
     float sqw = m_w*m_w;
     vec3f sqv = m_v*m_v;
 
-    float z = atan2f(2.f * (m_v.x()*m_v.y() + m_v.z()*m_w), sqv.x() - sqv.y() - sqv.z() + sqw);
-    float y = asinf(-2.f * (m_v.x()*m_v.z() - m_v.y()*m_w));
-    float x = atan2f(2.f * (m_v.y()*m_v.z() + m_v.x()*m_w), -sqv.x() - sqv.y() + sqv.z() + sqw);
+    float z = Trig<>::atan2(2.f * (m_v.x()*m_v.y() + m_v.z()*m_w), sqv.x() - sqv.y() - sqv.z() + sqw);
+    float y = Trig<>::asin(-2.f * (m_v.x()*m_v.z() - m_v.y()*m_w));
+    float x = Trig<>::atan2(2.f * (m_v.y()*m_v.z() + m_v.x()*m_w), -sqv.x() - sqv.y() + sqv.z() + sqw);
 
     return vec3f(x, y, z);
 }
 
 void Quaternion::toAngleAxis(float &angle, vec3f &axis) const
 {
-    float a = acosf(m_w);
+    float a = Trig<>::acos(m_w);
     axis = m_v*(1.0f/sinf(a));
     angle = a*2;
 }
 
 Quaternion Quaternion::fromAngleAxis(float angle, const vec3f &axis)
 {
-    float a = angle*0.5f;
-    return Quaternion(cosf(a), axis.normalized()*sinf(a));
+    float s, c;
+    Trig<>::sincos(angle*0.5f, s, c);
+    return Quaternion(c, axis.normalized()*s);
 }
 
 Quaternion Quaternion::fromEuler(float rx, float ry, float rz)
@@ -73,18 +142,10 @@ Quaternion Quaternion::fromEuler(float rx, float ry, float rz)
     return fromEuler(vec3f(rx, ry, rz));
 }
 
-Quaternion Quaternion::fromEuler(const vec3f &rv)
+static Quaternion fromHalfAngles(float sin_x_2, float cos_x_2,
+                                 float sin_y_2, float cos_y_2,
+                                 float sin_z_2, float cos_z_2)
 {
-    vec3f half = rv*0.5f;
-
-    float cos_z_2 = cosf(half.z());
-    float cos_y_2 = cosf(half.y());
-    float cos_x_2 = cosf(half.x());
-
-    float sin_z_2 = sinf(half.z());
-    float sin_y_2 = sinf(half.y());
-    float sin_x_2 = sinf(half.x());
-
     float w = cos_z_2*cos_y_2*cos_x_2 + sin_z_2*sin_y_2*sin_x_2;
     float x = cos_z_2*cos_y_2*sin_x_2 - sin_z_2*sin_y_2*cos_x_2;
     float y = cos_z_2*sin_y_2*cos_x_2 + sin_z_2*cos_y_2*sin_x_2;
@@ -93,10 +154,43 @@ Quaternion Quaternion::fromEuler(const vec3f &rv)
     return Quaternion(w, vec3f(x, y, z));
 }
 
+Quaternion Quaternion::fromEuler(const vec3f &rv)
+{
+    vec3f half = rv*0.5f;
+
+    float sin_x_2, cos_x_2, sin_y_2, cos_y_2, sin_z_2, cos_z_2;
+    Trig<>::sincos(half.x(), sin_x_2, cos_x_2);
+    Trig<>::sincos(half.y(), sin_y_2, cos_y_2);
+    Trig<>::sincos(half.z(), sin_z_2, cos_z_2);
+
+    return fromHalfAngles(sin_x_2, cos_x_2, sin_y_2, cos_y_2, sin_z_2, cos_z_2);
+}
+
+void Quaternion::fromEuler(const vec3f *rv, Quaternion *out, size_t count)
+{
+    const size_t CHUNK = 32;
+    float half[CHUNK*3], s[CHUNK*3], c[CHUNK*3];
+
+    for (size_t base = 0; base < count; base += CHUNK) {
+        size_t n = count-base < CHUNK ? count-base : CHUNK;
+        for (size_t i = 0; i < n; i++) {
+            half[i]         = rv[base+i].x()*0.5f;
+            half[i+CHUNK]   = rv[base+i].y()*0.5f;
+            half[i+CHUNK*2] = rv[base+i].z()*0.5f;
+        }
+        for (size_t k = 0; k < 3; k++)
+            fastSincos(half+k*CHUNK, s+k*CHUNK, c+k*CHUNK, n);
+        for (size_t i = 0; i < n; i++)
+            out[base+i] = fromHalfAngles(s[i], c[i],
+                                         s[i+CHUNK], c[i+CHUNK],
+                                         s[i+CHUNK*2], c[i+CHUNK*2]);
+    }
+}
+
 Quaternion Quaternion::fromDirection(const vec3f &dir)
 {
     static vec3f xaxis(1.0f, 0.0f, 0.0f);
-    float angle = acosf(dot(xaxis, dir));
+    float angle = Trig<>::acos(dot(xaxis, dir));
     vec3f axis = cross(xaxis, dir);
     return fromAngleAxis(angle, axis);
 }
@@ -107,4 +201,233 @@ void Quaternion::loadIdentity()
     m_w = 1.0f;
 }
 
+#ifdef __SSE__
+// Lane-wise versions of rotationRows/quaternionFromRows, four
+// quaternions per register
+
+static inline void rotationRows4(__m128 x, __m128 y, __m128 z, __m128 w,
+                                 __m128 r[3][3])
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+    __m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+    __m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+    __m128 wx = _mm_mul_ps(x2, w), wy = _mm_mul_ps(y2, w), wz = _mm_mul_ps(z2, w);
+
+    r[0][0] = _mm_sub_ps(one, _mm_add_ps(yy, zz));
+    r[0][1] = _mm_sub_ps(xy, wz);
+    r[0][2] = _mm_add_ps(xz, wy);
+    r[1][0] = _mm_add_ps(xy, wz);
+    r[1][1] = _mm_sub_ps(one, _mm_add_ps(xx, zz));
+    r[1][2] = _mm_sub_ps(yz, wx);
+    r[2][0] = _mm_sub_ps(xz, wy);
+    r[2][1] = _mm_add_ps(yz, wx);
+    r[2][2] = _mm_sub_ps(one, _mm_add_ps(xx, yy));
+}
+
+static inline __m128 select4(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline void quaternionFromRows4(const __m128 r[3][3],
+                                       __m128 &x, __m128 &y, __m128 &z, __m128 &w)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 d0 = r[0][0], d1 = r[1][1], d2 = r[2][2];
+    __m128 t = _mm_add_ps(_mm_add_ps(d0, d1), d2);
+
+    // Same case order and tie breaking as the scalar version
+    __m128 mw = _mm_and_ps(_mm_cmpge_ps(t, d0),
+                           _mm_and_ps(_mm_cmpge_ps(t, d1), _mm_cmpge_ps(t, d2)));
+    __m128 mx = _mm_andnot_ps(mw, _mm_and_ps(_mm_cmpge_ps(d0, d1), _mm_cmpge_ps(d0, d2)));
+    __m128 my = _mm_andnot_ps(_mm_or_ps(mw, mx), _mm_cmpge_ps(d1, d2));
+
+    __m128 qw = _mm_add_ps(one, t);
+    __m128 qx = _mm_sub_ps(_mm_add_ps(one, d0), _mm_add_ps(d1, d2));
+    __m128 qy = _mm_sub_ps(_mm_add_ps(one, d1), _mm_add_ps(d0, d2));
+    __m128 qz = _mm_sub_ps(_mm_add_ps(one, d2), _mm_add_ps(d0, d1));
+    __m128 qq = select4(mw, qw, select4(mx, qx, select4(my, qy, qz)));
+
+    __m128 q = _mm_mul_ps(_mm_set1_ps(0.5f), _mm_sqrt_ps(qq));
+    __m128 s = _mm_div_ps(_mm_set1_ps(0.25f), q);
+
+    __m128 a = _mm_mul_ps(_mm_sub_ps(r[2][1], r[1][2]), s);
+    __m128 b = _mm_mul_ps(_mm_sub_ps(r[0][2], r[2][0]), s);
+    __m128 c = _mm_mul_ps(_mm_sub_ps(r[1][0], r[0][1]), s);
+    __m128 d = _mm_mul_ps(_mm_add_ps(r[0][1], r[1][0]), s);
+    __m128 e = _mm_mul_ps(_mm_add_ps(r[0][2], r[2][0]), s);
+    __m128 f = _mm_mul_ps(_mm_add_ps(r[1][2], r[2][1]), s);
+
+    //        case w   case x   case y   case z
+    // w      q        a        b        c
+    // x      a        q        d        e
+    // y      b        d        q        f
+    // z      c        e        f        q
+    w = select4(mw, q, select4(mx, a, select4(my, b, c)));
+    x = select4(mw, a, select4(mx, q, select4(my, d, e)));
+    y = select4(mw, b, select4(mx, d, select4(my, q, f)));
+    z = select4(mw, c, select4(mx, e, select4(my, f, q)));
+}
+#endif // __SSE__
+
+void toMatrices(const float *x, const float *y, const float *z, const float *w,
+                Matrix3f *out, size_t count)
+{
+    GFXMATH_TIME(TIMER_TO_MATRICES, count);
+    size_t i = 0;
+#ifdef __SSE__
+    for (; i+4 <= count; i += 4) {
+        __m128 r[3][3];
+        rotationRows4(_mm_loadu_ps(x+i), _mm_loadu_ps(y+i),
+                      _mm_loadu_ps(z+i), _mm_loadu_ps(w+i), r);
+        float lanes[3][3][4];
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                _mm_storeu_ps(lanes[j][k], r[j][k]);
+        for (int n = 0; n < 4; n++)
+            for (int j = 0; j < 3; j++)
+                for (int k = 0; k < 3; k++)
+                    out[i+n][k][j] = lanes[j][k][n];
+    }
+#endif
+    for (; i < count; i++) {
+        float r[3][3];
+        rotationRows(x[i], y[i], z[i], w[i], r);
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                out[i][k][j] = r[j][k];
+    }
+}
+
+void toMatrices(const float *x, const float *y, const float *z, const float *w,
+                Matrix3x4f *out, size_t count)
+{
+    GFXMATH_TIME(TIMER_TO_MATRICES, count);
+    size_t i = 0;
+#ifdef __SSE__
+    for (; i+4 <= count; i += 4) {
+        __m128 r[3][3];
+        rotationRows4(_mm_loadu_ps(x+i), _mm_loadu_ps(y+i),
+                      _mm_loadu_ps(z+i), _mm_loadu_ps(w+i), r);
+        for (int j = 0; j < 3; j++) {
+            __m128 c0 = r[j][0], c1 = r[j][1], c2 = r[j][2];
+            __m128 c3 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            _mm_store_ps(out[i+0][j], c0);
+            _mm_store_ps(out[i+1][j], c1);
+            _mm_store_ps(out[i+2][j], c2);
+            _mm_store_ps(out[i+3][j], c3);
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        float r[3][3];
+        rotationRows(x[i], y[i], z[i], w[i], r);
+        for (int j = 0; j < 3; j++) {
+            for (int k = 0; k < 3; k++)
+                out[i][j][k] = r[j][k];
+            out[i][j][3] = 0.0f;
+        }
+    }
+}
+
+void toMatrices(const float *x, const float *y, const float *z, const float *w,
+                Matrix4f *out, size_t count)
+{
+    GFXMATH_TIME(TIMER_TO_MATRICES, count);
+    size_t i = 0;
+#ifdef __SSE__
+    const __m128 axisW = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    for (; i+4 <= count; i += 4) {
+        __m128 r[3][3];
+        rotationRows4(_mm_loadu_ps(x+i), _mm_loadu_ps(y+i),
+                      _mm_loadu_ps(z+i), _mm_loadu_ps(w+i), r);
+        for (int k = 0; k < 3; k++) {
+            __m128 c0 = r[0][k], c1 = r[1][k], c2 = r[2][k];
+            __m128 c3 = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            _mm_store_ps(out[i+0][k], c0);
+            _mm_store_ps(out[i+1][k], c1);
+            _mm_store_ps(out[i+2][k], c2);
+            _mm_store_ps(out[i+3][k], c3);
+        }
+        for (int n = 0; n < 4; n++)
+            _mm_store_ps(out[i+n][3], axisW);
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = Quaternion(w[i], vec3f(x[i], y[i], z[i])).toMatrix();
+}
+
+void fromMatrices(const Matrix4f *m,
+                  float *x, float *y, float *z, float *w, size_t count)
+{
+    GFXMATH_TIME(TIMER_FROM_MATRICES, count);
+    size_t i = 0;
+#ifdef __SSE__
+    for (; i+4 <= count; i += 4) {
+        __m128 r[3][3];
+        for (int k = 0; k < 3; k++) {
+            __m128 c0 = _mm_load_ps(m[i+0][k]);
+            __m128 c1 = _mm_load_ps(m[i+1][k]);
+            __m128 c2 = _mm_load_ps(m[i+2][k]);
+            __m128 c3 = _mm_load_ps(m[i+3][k]);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            r[0][k] = c0;
+            r[1][k] = c1;
+            r[2][k] = c2;
+        }
+        __m128 qx, qy, qz, qw;
+        quaternionFromRows4(r, qx, qy, qz, qw);
+        _mm_storeu_ps(x+i, qx);
+        _mm_storeu_ps(y+i, qy);
+        _mm_storeu_ps(z+i, qz);
+        _mm_storeu_ps(w+i, qw);
+    }
+#endif
+    for (; i < count; i++) {
+        Quaternion q = Quaternion::fromMatrix(m[i]);
+        x[i] = q.m_v.x();
+        y[i] = q.m_v.y();
+        z[i] = q.m_v.z();
+        w[i] = q.m_w;
+    }
+}
+
+void fromMatrices(const Matrix3x4f *m,
+                  float *x, float *y, float *z, float *w, size_t count)
+{
+    GFXMATH_TIME(TIMER_FROM_MATRICES, count);
+    size_t i = 0;
+#ifdef __SSE__
+    for (; i+4 <= count; i += 4) {
+        __m128 r[3][3];
+        for (int j = 0; j < 3; j++) {
+            __m128 c0 = _mm_load_ps(m[i+0][j]);
+            __m128 c1 = _mm_load_ps(m[i+1][j]);
+            __m128 c2 = _mm_load_ps(m[i+2][j]);
+            __m128 c3 = _mm_load_ps(m[i+3][j]);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            r[j][0] = c0;
+            r[j][1] = c1;
+            r[j][2] = c2;
+        }
+        __m128 qx, qy, qz, qw;
+        quaternionFromRows4(r, qx, qy, qz, qw);
+        _mm_storeu_ps(x+i, qx);
+        _mm_storeu_ps(y+i, qy);
+        _mm_storeu_ps(z+i, qz);
+        _mm_storeu_ps(w+i, qw);
+    }
+#endif
+    for (; i < count; i++) {
+        float r[3][3];
+        for (int j = 0; j < 3; j++)
+            for (int k = 0; k < 3; k++)
+                r[j][k] = m[i][j][k];
+        quaternionFromRows(r, x[i], y[i], z[i], w[i]);
+    }
+}
+
 }; // namespace math
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include "vec.h"
 #include "matrix.h"
+#include "matrix3x4.h"
 
 namespace math {
 
@@ -70,6 +71,10 @@ struct Quaternion {
     // To rotation matrix
     Matrix4f toMatrix() const;
 
+    // From pure rotation matrix (Shepperd's method)
+    static Quaternion fromMatrix(const Matrix4f &m);
+    static Quaternion fromMatrix(const Matrix3f &m);
+
     // To vector of euler angles (degrees)
     vec3f toEuler() const;
 
@@ -82,6 +87,9 @@ struct Quaternion {
     // From vector of euler angles
     static Quaternion fromEuler(const vec3f &v);
 
+    // Batched fromEuler using the vectorized fastSincos
+    static void fromEuler(const vec3f *v, Quaternion *out, size_t count);
+
     static Quaternion fromDirection(const vec3f &dir);
 
     void loadIdentity();
@@ -89,6 +97,20 @@ struct Quaternion {
 
 std::ostream &operator<<(std::ostream &out, const Quaternion &q);
 
+// Batched conversions between rotation matrices and quaternions stored as
+// structure of arrays (one array per component), 4 at a time with SSE.
+void toMatrices(const float *x, const float *y, const float *z, const float *w,
+                Matrix3f *out, size_t count);
+void toMatrices(const float *x, const float *y, const float *z, const float *w,
+                Matrix3x4f *out, size_t count);
+void toMatrices(const float *x, const float *y, const float *z, const float *w,
+                Matrix4f *out, size_t count);
+
+void fromMatrices(const Matrix4f *m,
+                  float *x, float *y, float *z, float *w, size_t count);
+void fromMatrices(const Matrix3x4f *m,
+                  float *x, float *y, float *z, float *w, size_t count);
+
 }; // namespace math
 
 #endif
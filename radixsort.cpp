@@ -0,0 +1,113 @@
+#include "radixsort.h"
+#include "parallel.h"
+#include "instrument.h"
+
+namespace math {
+
+// Three passes of 11 bits, the counters of a pass still fit in L1
+static const int RADIX_BITS = 11;
+static const int RADIX_SIZE = 1 << RADIX_BITS;
+static const int RADIX_PASSES = (32 + RADIX_BITS - 1)/RADIX_BITS;
+
+static inline uint32_t digit(uint32_t key, int pass)
+{
+    return (key >> (pass*RADIX_BITS)) & (RADIX_SIZE - 1);
+}
+
+void radixSort(uint32_t *keys, uint32_t *values, uint32_t *tmpKeys,
+               uint32_t *tmpValues, size_t count, size_t threads)
+{
+    GFXMATH_TIME(TIMER_RADIX_SORT, count);
+    if (count < 2)
+        return;
+
+    // Histograms of every pass for each part, in one read of the keys
+    // On the stack for one part, so single threaded sorts don't allocate
+    size_t parts = partCount(count, threads, RADIX_PARALLEL_MIN);
+    uint32_t local[RADIX_PASSES*RADIX_SIZE];
+    std::vector<uint32_t> shared;
+    uint32_t *hist = local;
+    if (parts > 1) {
+        shared.assign(parts*RADIX_PASSES*RADIX_SIZE, 0);
+        hist = shared.data();
+    } else {
+        memset(local, 0, sizeof(local));
+    }
+    auto histogram = [&](size_t k, int pass) {
+        return hist + (k*RADIX_PASSES + pass)*RADIX_SIZE;
+    };
+    forEachPart(count, parts, [&](size_t begin, size_t end, size_t k) {
+        uint32_t *h = histogram(k, 0);
+        for (size_t i = begin; i < end; i++) {
+            uint32_t key = keys[i];
+            for (int pass = 0; pass < RADIX_PASSES; pass++)
+                h[pass*RADIX_SIZE + digit(key, pass)]++;
+        }
+    });
+
+    // Digit totals don't change as the keys move, so the start of each
+    // digit and the passes with a single digit are known up front
+    uint32_t start[RADIX_PASSES][RADIX_SIZE];
+    bool skip[RADIX_PASSES];
+    int passes = 0;
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+        uint32_t sum = 0;
+        skip[pass] = false;
+        for (int d = 0; d < RADIX_SIZE; d++) {
+            uint32_t total = 0;
+            for (size_t k = 0; k < parts; k++)
+                total += histogram(k, pass)[d];
+            skip[pass] |= total == count;
+            start[pass][d] = sum;
+            sum += total;
+        }
+        passes += !skip[pass];
+    }
+
+    // Each part scatters its range of the keys, in part order within each
+    // digit, which keeps the sort stable
+    Barrier barrier(parts);
+    forEachPart(count, parts, [&](size_t begin, size_t end, size_t k) {
+        uint32_t *srcKeys = keys, *srcValues = values;
+        uint32_t *dstKeys = tmpKeys, *dstValues = tmpValues;
+        bool first = true;
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            if (skip[pass])
+                continue;
+            uint32_t *h = histogram(k, pass);
+            if (!first && parts > 1) {
+                // The range holds other keys after the previous pass
+                memset(h, 0, RADIX_SIZE*sizeof(uint32_t));
+                for (size_t i = begin; i < end; i++)
+                    h[digit(srcKeys[i], pass)]++;
+            }
+            barrier.wait();
+
+            uint32_t offsets[RADIX_SIZE];
+            for (int d = 0; d < RADIX_SIZE; d++) {
+                uint32_t off = start[pass][d];
+                for (size_t p = 0; p < k; p++)
+                    off += histogram(p, pass)[d];
+                offsets[d] = off;
+            }
+            for (size_t i = begin; i < end; i++) {
+                uint32_t key = srcKeys[i];
+                uint32_t o = offsets[digit(key, pass)]++;
+                dstKeys[o] = key;
+                dstValues[o] = srcValues[i];
+            }
+            barrier.wait();
+
+            std::swap(srcKeys, dstKeys);
+            std::swap(srcValues, dstValues);
+            first = false;
+        }
+    });
+
+    if (passes % 2) {
+        memcpy(keys, tmpKeys, count*sizeof(uint32_t));
+        memcpy(values, tmpValues, count*sizeof(uint32_t));
+    }
+}
+
+}; // namespace math
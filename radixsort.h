@@ -0,0 +1,40 @@
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace math {
+
+typedef enum {
+    SORT_FRONT_TO_BACK,     // nearest first, for opaque objects
+    SORT_BACK_TO_FRONT      // farthest first, for blending
+} sort_order_t;
+
+/// Unsigned key ordering like f: flip all bits of negatives, only the
+/// sign bit of the rest. -0 sorts before +0, NaNs at the ends.
+inline uint32_t floatKey(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u ^ (uint32_t(int32_t(u) >> 31) | 0x80000000u);
+}
+
+/// Inputs at least this large are split over the threads asked for
+static const size_t RADIX_PARALLEL_MIN = 1 << 15;
+
+/// Stable LSD radix sort of keys, carrying values along (e.g. object
+/// indices), 11 bits per pass. Passes where every key has the same
+/// digit are skipped, as the top bits of depth keys often are. tmpKeys
+/// and tmpValues are count entries of scratch, passed in so frame to
+/// frame sorting doesn't allocate. threads > 1 splits large inputs over
+/// that many threads, 0 uses one per hardware thread; the result is the
+/// same. Sorts split over threads start them and allocate their
+/// histograms per call.
+void radixSort(uint32_t *keys, uint32_t *values, uint32_t *tmpKeys,
+               uint32_t *tmpValues, size_t count, size_t threads = 1);
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,100 @@
+#include "rect.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+void pointInRects(const vec2f &p, const Rect *rects, uint8_t *result, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    __m128 px = _mm_set1_ps(p.x());
+    __m128 py = _mm_set1_ps(p.y());
+    for (; i+4 <= count; i += 4) {
+        // Rect is (x, y, w, h), transpose four of them to lanes
+        __m128 x = _mm_loadu_ps(&rects[i].x);
+        __m128 y = _mm_loadu_ps(&rects[i+1].x);
+        __m128 w = _mm_loadu_ps(&rects[i+2].x);
+        __m128 h = _mm_loadu_ps(&rects[i+3].x);
+        _MM_TRANSPOSE4_PS(x, y, w, h);
+
+        __m128 in = _mm_and_ps(_mm_cmpge_ps(px, x), _mm_cmplt_ps(px, _mm_add_ps(x, w)));
+        in = _mm_and_ps(in, _mm_cmpge_ps(py, y));
+        in = _mm_and_ps(in, _mm_cmplt_ps(py, _mm_add_ps(y, h)));
+
+        int mask = _mm_movemask_ps(in);
+        for (int k = 0; k < 4; k++)
+            result[i+k] = (mask >> k) & 1;
+    }
+#endif
+    for (; i < count; i++)
+        result[i] = rects[i].inRect(p);
+}
+
+#ifdef __SSE__
+// (x, y, w, h) -> (x+w, y+h, *, *)
+static inline __m128 rectEnd(__m128 r)
+{
+    return _mm_add_ps(r, _mm_movehl_ps(r, r));
+}
+#endif
+
+void intersectRects(const Rect *a, const Rect *b, Rect *out, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    for (; i < count; i++) {
+        __m128 ra = _mm_loadu_ps(&a[i].x);
+        __m128 rb = _mm_loadu_ps(&b[i].x);
+        __m128 lo = _mm_max_ps(ra, rb);
+        __m128 hi = _mm_min_ps(rectEnd(ra), rectEnd(rb));
+        __m128 size = _mm_max_ps(_mm_sub_ps(hi, lo), _mm_setzero_ps());
+        _mm_storeu_ps(&out[i].x, _mm_movelh_ps(lo, size));
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = a[i].intersection(b[i]);
+}
+
+void uniteRects(const Rect *a, const Rect *b, Rect *out, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    for (; i < count; i++) {
+        __m128 ra = _mm_loadu_ps(&a[i].x);
+        __m128 rb = _mm_loadu_ps(&b[i].x);
+        __m128 lo = _mm_min_ps(ra, rb);
+        __m128 hi = _mm_max_ps(rectEnd(ra), rectEnd(rb));
+        _mm_storeu_ps(&out[i].x, _mm_movelh_ps(lo, _mm_sub_ps(hi, lo)));
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = a[i].united(b[i]);
+}
+
+Rect boundingRect(const Rect *rects, size_t count)
+{
+    if (count == 0)
+        return Rect(0, 0, 0, 0);
+
+    size_t i = 1;
+    Rect r = rects[0];
+#ifdef __SSE__
+    __m128 first = _mm_loadu_ps(&r.x);
+    __m128 lo = first;
+    __m128 hi = rectEnd(first);
+    for (; i < count; i++) {
+        __m128 v = _mm_loadu_ps(&rects[i].x);
+        lo = _mm_min_ps(lo, v);
+        hi = _mm_max_ps(hi, rectEnd(v));
+    }
+    _mm_storeu_ps(&r.x, _mm_movelh_ps(lo, _mm_sub_ps(hi, lo)));
+#endif
+    for (; i < count; i++)
+        r = r.united(rects[i]);
+    return r;
+}
+
+}; // namespace math
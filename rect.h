@@ -2,6 +2,9 @@
 #define RECT_H
 #include "vec.h"
 
+#include <algorithm>
+#include <stdint.h>
+
 namespace math {
 
 struct Rect {
@@ -60,6 +63,32 @@ struct Rect {
         y = pos.y()-h*0.5f;
     }
 
+    bool intersects(const Rect &b) const
+    {
+        return (x < b.x+b.w && b.x < x+w &&
+                y < b.y+b.h && b.y < y+h);
+    }
+
+    /// Overlapping area, zero sized if the rects don't intersect
+    Rect intersection(const Rect &b) const
+    {
+        float x0 = std::max(x, b.x);
+        float y0 = std::max(y, b.y);
+        float x1 = std::min(x+w, b.x+b.w);
+        float y1 = std::min(y+h, b.y+b.h);
+        return Rect(x0, y0, std::max(x1-x0, 0.0f), std::max(y1-y0, 0.0f));
+    }
+
+    /// Smallest rect containing both
+    Rect united(const Rect &b) const
+    {
+        float x0 = std::min(x, b.x);
+        float y0 = std::min(y, b.y);
+        float x1 = std::max(x+w, b.x+b.w);
+        float y1 = std::max(y+h, b.y+b.h);
+        return Rect(x0, y0, x1-x0, y1-y0);
+    }
+
     bool operator == (const Rect &b) const
     {
         return (x == b.x &&
@@ -86,6 +115,20 @@ struct Rect {
     }
 };
 
+// Batched versions of the above, vectorized with SSE
+
+/// result[i] = rects[i].inRect(p)
+void pointInRects(const vec2f &p, const Rect *rects, uint8_t *result, size_t count);
+
+/// out[i] = a[i].intersection(b[i]), out may alias a or b
+void intersectRects(const Rect *a, const Rect *b, Rect *out, size_t count);
+
+/// out[i] = a[i].united(b[i]), out may alias a or b
+void uniteRects(const Rect *a, const Rect *b, Rect *out, size_t count);
+
+/// Bounding rect of all rects
+Rect boundingRect(const Rect *rects, size_t count);
+
 }; // namespace math
 
 #endif
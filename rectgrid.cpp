@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+
+#include "rectgrid.h"
+
+namespace math {
+
+static const int MAX_GRID_DIM = 1024;
+
+RectGrid::RectGrid()
+    : m_bounds(0, 0, 0, 0)
+    , m_invCell(0)
+    , m_cols(0)
+    , m_rows(0)
+{}
+
+void RectGrid::clear()
+{
+    m_rects.clear();
+    m_cellStart.clear();
+    m_items.clear();
+    m_bounds = Rect(0, 0, 0, 0);
+    m_cols = m_rows = 0;
+}
+
+int RectGrid::cellX(float x) const
+{
+    int c = (int)((x - m_bounds.x)*m_invCell);
+    return std::min(std::max(c, 0), m_cols-1);
+}
+
+int RectGrid::cellY(float y) const
+{
+    int c = (int)((y - m_bounds.y)*m_invCell);
+    return std::min(std::max(c, 0), m_rows-1);
+}
+
+void RectGrid::build(const Rect *rects, size_t count, float cellSize)
+{
+    clear();
+    if (count == 0)
+        return;
+
+    m_rects.assign(rects, rects+count);
+    m_bounds = boundingRect(rects, count);
+
+    if (cellSize <= 0.0f) {
+        float sum = 0;
+        for (size_t i = 0; i < count; i++)
+            sum += std::max(rects[i].w, rects[i].h);
+        cellSize = sum/count;
+    }
+    // Keep the grid bounded for tiny cells or sparse huge extents
+    float extent = std::max(m_bounds.w, m_bounds.h);
+    float minCell = extent/MAX_GRID_DIM;
+    float cells = (m_bounds.w/cellSize + 1)*(m_bounds.h/cellSize + 1);
+    if (cells > 4.0f*count + 64)
+        cellSize *= std::sqrt(cells/(4.0f*count + 64));
+    cellSize = std::max(cellSize, minCell);
+    if (!(cellSize > 0.0f))
+        cellSize = 1.0f;
+
+    m_invCell = 1.0f/cellSize;
+    m_cols = std::min((int)(m_bounds.w*m_invCell) + 1, MAX_GRID_DIM);
+    m_rows = std::min((int)(m_bounds.h*m_invCell) + 1, MAX_GRID_DIM);
+
+    // Counting sort: count per cell, prefix sum, then scatter in index
+    // order so every cell lists its rects ascending
+    m_cellStart.assign(m_cols*m_rows + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        const Rect &r = rects[i];
+        int x0 = cellX(r.x), x1 = cellX(r.x+r.w);
+        int y0 = cellY(r.y), y1 = cellY(r.y+r.h);
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                m_cellStart[y*m_cols + x + 1]++;
+    }
+    for (size_t c = 1; c < m_cellStart.size(); c++)
+        m_cellStart[c] += m_cellStart[c-1];
+
+    m_items.resize(m_cellStart.back());
+    std::vector<uint32_t> fill(m_cellStart.begin(), m_cellStart.end()-1);
+    for (size_t i = 0; i < count; i++) {
+        const Rect &r = rects[i];
+        int x0 = cellX(r.x), x1 = cellX(r.x+r.w);
+        int y0 = cellY(r.y), y1 = cellY(r.y+r.h);
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++)
+                m_items[fill[y*m_cols + x]++] = (uint32_t)i;
+    }
+}
+
+void RectGrid::queryPoint(const vec2f &p, std::vector<uint32_t> &result) const
+{
+    result.clear();
+    if (m_rects.empty() || !m_bounds.inRect(p))
+        return;
+
+    int cell = cellY(p.y())*m_cols + cellX(p.x());
+    for (uint32_t k = m_cellStart[cell]; k < m_cellStart[cell+1]; k++) {
+        uint32_t i = m_items[k];
+        if (m_rects[i].inRect(p))
+            result.push_back(i);
+    }
+}
+
+int RectGrid::hitTest(const vec2f &p) const
+{
+    if (m_rects.empty() || !m_bounds.inRect(p))
+        return -1;
+
+    int cell = cellY(p.y())*m_cols + cellX(p.x());
+    for (uint32_t k = m_cellStart[cell+1]; k > m_cellStart[cell]; k--) {
+        uint32_t i = m_items[k-1];
+        if (m_rects[i].inRect(p))
+            return (int)i;
+    }
+    return -1;
+}
+
+void RectGrid::queryRect(const Rect &r, std::vector<uint32_t> &result) const
+{
+    result.clear();
+    if (m_rects.empty() || !m_bounds.intersects(r))
+        return;
+
+    int x0 = cellX(r.x), x1 = cellX(r.x+r.w);
+    int y0 = cellY(r.y), y1 = cellY(r.y+r.h);
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            int cell = y*m_cols + x;
+            for (uint32_t k = m_cellStart[cell]; k < m_cellStart[cell+1]; k++) {
+                uint32_t i = m_items[k];
+                if (m_rects[i].intersects(r))
+                    result.push_back(i);
+            }
+        }
+    }
+    // Rects spanning several cells are reported once per cell
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+}
+
+}; // namespace math
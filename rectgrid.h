@@ -0,0 +1,54 @@
+#ifndef RECTGRID_H
+#define RECTGRID_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "rect.h"
+
+namespace math {
+
+/// Uniform grid over a static set of rects for hit testing. Each rect is
+/// stored in every cell it overlaps, cells are packed in one array
+/// (counting sort) so a query touches a single contiguous range.
+/// Rebuild when the rects change.
+class RectGrid {
+public:
+    RectGrid();
+
+    /// Index rects, they are referred to by their position in the array.
+    /// cellSize of 0 picks one from the average rect size.
+    void build(const Rect *rects, size_t count, float cellSize = 0.0f);
+
+    void clear();
+
+    /// Indices of rects containing p, in ascending order
+    void queryPoint(const vec2f &p, std::vector<uint32_t> &result) const;
+
+    /// Indices of rects intersecting r, in ascending order
+    void queryRect(const Rect &r, std::vector<uint32_t> &result) const;
+
+    /// Highest index containing p (the topmost one if rects are in
+    /// draw order), -1 if none
+    int hitTest(const vec2f &p) const;
+
+    size_t size() const
+    {
+        return m_rects.size();
+    }
+
+private:
+    int cellX(float x) const;
+    int cellY(float y) const;
+
+    std::vector<Rect> m_rects;
+    std::vector<uint32_t> m_cellStart;  // m_cols*m_rows+1 offsets
+    std::vector<uint32_t> m_items;
+    Rect m_bounds;
+    float m_invCell;
+    int m_cols, m_rows;
+};
+
+}; // namespace math
+
+#endif
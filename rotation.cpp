@@ -1,11 +1,10 @@
 #include "rotation.h"
+#include "fastmath.h"
 
 namespace math {
 
-Matrix4f rotateX(float a)
+static Matrix4f rotationX(float sa, float ca)
 {
-    float ca = cosf(a);
-    float sa = sinf(a);
     Matrix4f m;
     m.loadIdentity();
 
@@ -16,10 +15,8 @@ Matrix4f rotateX(float a)
     return m;
 }
 
-Matrix4f rotateY(float a)
+static Matrix4f rotationY(float sa, float ca)
 {
-    float ca = cosf(a);
-    float sa = sinf(a);
     Matrix4f m;
     m.loadIdentity();
 
@@ -30,10 +27,8 @@ Matrix4f rotateY(float a)
     return m;
 }
 
-Matrix4f rotateZ(float a)
+static Matrix4f rotationZ(float sa, float ca)
 {
-    float ca = cosf(a);
-    float sa = sinf(a);
     Matrix4f m;
     m.loadIdentity();
 
@@ -44,10 +39,8 @@ Matrix4f rotateZ(float a)
     return m;
 }
 
-Matrix3f rotate2D(float a)
+static Matrix3f rotation2D(float sa, float ca)
 {
-    float ca = cosf(a);
-    float sa = sinf(a);
     Matrix3f m;
     m.loadIdentity();
 
@@ -57,4 +50,68 @@ Matrix3f rotate2D(float a)
     return m;
 }
 
-}; // namespace math
\ No newline at end of file
+Matrix4f rotateX(float a)
+{
+    float sa, ca;
+    Trig<>::sincos(a, sa, ca);
+    return rotationX(sa, ca);
+}
+
+Matrix4f rotateY(float a)
+{
+    float sa, ca;
+    Trig<>::sincos(a, sa, ca);
+    return rotationY(sa, ca);
+}
+
+Matrix4f rotateZ(float a)
+{
+    float sa, ca;
+    Trig<>::sincos(a, sa, ca);
+    return rotationZ(sa, ca);
+}
+
+Matrix3f rotate2D(float a)
+{
+    float sa, ca;
+    Trig<>::sincos(a, sa, ca);
+    return rotation2D(sa, ca);
+}
+
+// Angles are processed in chunks small enough to keep sin/cos on the stack
+static const size_t CHUNK = 64;
+
+template <typename M>
+static void rotateBatch(const float *angles, M *out, size_t count,
+                        M (*build)(float, float))
+{
+    float s[CHUNK], c[CHUNK];
+    for (size_t base = 0; base < count; base += CHUNK) {
+        size_t n = count-base < CHUNK ? count-base : CHUNK;
+        fastSincos(angles+base, s, c, n);
+        for (size_t i = 0; i < n; i++)
+            out[base+i] = build(s[i], c[i]);
+    }
+}
+
+void rotateX(const float *angles, Matrix4f *out, size_t count)
+{
+    rotateBatch(angles, out, count, rotationX);
+}
+
+void rotateY(const float *angles, Matrix4f *out, size_t count)
+{
+    rotateBatch(angles, out, count, rotationY);
+}
+
+void rotateZ(const float *angles, Matrix4f *out, size_t count)
+{
+    rotateBatch(angles, out, count, rotationZ);
+}
+
+void rotate2D(const float *angles, Matrix3f *out, size_t count)
+{
+    rotateBatch(angles, out, count, rotation2D);
+}
+
+}; // namespace math
@@ -12,6 +12,13 @@ Matrix4f rotateZ(float angle);
 
 Matrix3f rotate2D(float a);
 
+/// Batched builders, one matrix per angle. Always use the vectorized
+/// fastSincos regardless of the precision policy.
+void rotateX(const float *angles, Matrix4f *out, size_t count);
+void rotateY(const float *angles, Matrix4f *out, size_t count);
+void rotateZ(const float *angles, Matrix4f *out, size_t count);
+void rotate2D(const float *angles, Matrix3f *out, size_t count);
+
 inline Matrix4f rotateAxis(float angle, const vec3f &axis)
 {
     return Quaternion::fromAngleAxis(angle, axis).toMatrix();
@@ -0,0 +1,202 @@
+#include "soa.h"
+#include "kernels.h"
+#include "instrument.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+void deinterleave(const float *in, size_t lanes, float *const *out, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    if (lanes == 2) {
+        for (; i+4 <= count; i += 4) {
+            __m128 a = _mm_loadu_ps(in + i*2);      // x0 y0 x1 y1
+            __m128 b = _mm_loadu_ps(in + i*2 + 4);  // x2 y2 x3 y3
+            _mm_storeu_ps(out[0]+i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(out[1]+i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+    } else if (lanes == 3) {
+        for (; i+4 <= count; i += 4) {
+            __m128 a = _mm_loadu_ps(in + i*3);      // x0 y0 z0 x1
+            __m128 b = _mm_loadu_ps(in + i*3 + 4);  // y1 z1 x2 y2
+            __m128 c = _mm_loadu_ps(in + i*3 + 8);  // z2 x3 y3 z3
+
+            __m128 bc = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2));
+            __m128 x = _mm_shuffle_ps(a, bc, _MM_SHUFFLE(3, 0, 3, 0));
+            __m128 ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+            bc = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+            __m128 y = _mm_shuffle_ps(ab, bc, _MM_SHUFFLE(2, 0, 2, 0));
+            ab = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+            __m128 cc = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+            __m128 z = _mm_shuffle_ps(ab, cc, _MM_SHUFFLE(2, 0, 2, 0));
+
+            _mm_storeu_ps(out[0]+i, x);
+            _mm_storeu_ps(out[1]+i, y);
+            _mm_storeu_ps(out[2]+i, z);
+        }
+    } else if (lanes%4 == 0) {
+        // 4x4 blocks: four elements by four consecutive lanes
+        for (; i+4 <= count; i += 4) {
+            const float *p = in + i*lanes;
+            for (size_t k = 0; k < lanes; k += 4) {
+                __m128 r0 = _mm_loadu_ps(p + k);
+                __m128 r1 = _mm_loadu_ps(p + lanes + k);
+                __m128 r2 = _mm_loadu_ps(p + 2*lanes + k);
+                __m128 r3 = _mm_loadu_ps(p + 3*lanes + k);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(out[k]+i, r0);
+                _mm_storeu_ps(out[k+1]+i, r1);
+                _mm_storeu_ps(out[k+2]+i, r2);
+                _mm_storeu_ps(out[k+3]+i, r3);
+            }
+        }
+    }
+#endif
+    for (; i < count; i++)
+        for (size_t k = 0; k < lanes; k++)
+            out[k][i] = in[i*lanes + k];
+}
+
+void interleave(const float *const *in, size_t lanes, float *out, size_t count)
+{
+    size_t i = 0;
+#ifdef __SSE__
+    if (lanes == 2) {
+        for (; i+4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(in[0]+i);
+            __m128 y = _mm_loadu_ps(in[1]+i);
+            _mm_storeu_ps(out + i*2, _mm_unpacklo_ps(x, y));
+            _mm_storeu_ps(out + i*2 + 4, _mm_unpackhi_ps(x, y));
+        }
+    } else if (lanes == 3) {
+        for (; i+4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(in[0]+i);
+            __m128 y = _mm_loadu_ps(in[1]+i);
+            __m128 z = _mm_loadu_ps(in[2]+i);
+            __m128 xy01 = _mm_unpacklo_ps(x, y);    // x0 y0 x1 y1
+            __m128 xy23 = _mm_unpackhi_ps(x, y);    // x2 y2 x3 y3
+
+            __m128 zx = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+            __m128 a = _mm_shuffle_ps(xy01, zx, _MM_SHUFFLE(2, 0, 1, 0));
+            __m128 yz = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+            __m128 b = _mm_shuffle_ps(yz, xy23, _MM_SHUFFLE(1, 0, 2, 0));
+            zx = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+            yz = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+            __m128 c = _mm_shuffle_ps(zx, yz, _MM_SHUFFLE(2, 0, 2, 0));
+
+            _mm_storeu_ps(out + i*3, a);
+            _mm_storeu_ps(out + i*3 + 4, b);
+            _mm_storeu_ps(out + i*3 + 8, c);
+        }
+    } else if (lanes%4 == 0) {
+        for (; i+4 <= count; i += 4) {
+            float *p = out + i*lanes;
+            for (size_t k = 0; k < lanes; k += 4) {
+                __m128 r0 = _mm_loadu_ps(in[k]+i);
+                __m128 r1 = _mm_loadu_ps(in[k+1]+i);
+                __m128 r2 = _mm_loadu_ps(in[k+2]+i);
+                __m128 r3 = _mm_loadu_ps(in[k+3]+i);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(p + k, r0);
+                _mm_storeu_ps(p + lanes + k, r1);
+                _mm_storeu_ps(p + 2*lanes + k, r2);
+                _mm_storeu_ps(p + 3*lanes + k, r3);
+            }
+        }
+    }
+#endif
+    for (; i < count; i++)
+        for (size_t k = 0; k < lanes; k++)
+            out[i*lanes + k] = in[k][i];
+}
+
+void transformPoints(const Matrix4f &m, const SoA<vec3f> &in, SoA<vec3f> &out)
+{
+    GFXMATH_TIME(TIMER_TRANSFORM_POINTS, in.size());
+    out.resize(in.size());
+    kernels().transformPoints(m, in.x(), in.y(), in.z(),
+                              out.x(), out.y(), out.z(), in.size());
+}
+
+void multiply(const SoA<Matrix4f> &a, const SoA<Matrix4f> &b, SoA<Matrix4f> &out)
+{
+    assert(a.size() == b.size());
+    out.resize(a.size());
+
+    // (a*b)[j][i] = sum a[k][i]*b[j][k] over padded lanes
+#ifdef __SSE__
+    // All of a is loaded before any store and column j of b is read just
+    // before column j of out is written, so out may alias a or b
+    for (size_t n = 0; n < a.paddedSize(); n += 4) {
+        __m128 ma[16];
+        for (size_t l = 0; l < 16; l++)
+            ma[l] = _mm_load_ps(a.lane(l) + n);
+        for (size_t j = 0; j < 4; j++) {
+            __m128 mb[4];
+            for (size_t k = 0; k < 4; k++)
+                mb[k] = _mm_load_ps(b.lane(j, k) + n);
+            for (size_t i = 0; i < 4; i++) {
+                __m128 r = _mm_mul_ps(ma[i], mb[0]);
+                r = _mm_add_ps(r, _mm_mul_ps(ma[4+i], mb[1]));
+                r = _mm_add_ps(r, _mm_mul_ps(ma[8+i], mb[2]));
+                r = _mm_add_ps(r, _mm_mul_ps(ma[12+i], mb[3]));
+                _mm_store_ps(out.lane(j, i) + n, r);
+            }
+        }
+    }
+#else
+    // Whole chunks go through a local tile so out may alias a or b
+    for (size_t off = 0; off < a.paddedSize(); off += SOA_WIDTH) {
+        float tile[16][SOA_WIDTH];
+        for (size_t j = 0; j < 4; j++) {
+            for (size_t i = 0; i < 4; i++) {
+                float *t = tile[j*4+i];
+                for (size_t n = 0; n < SOA_WIDTH; n++)
+                    t[n] = 0.0f;
+                for (size_t k = 0; k < 4; k++) {
+                    const float *ak = a.lane(k, i) + off;
+                    const float *bj = b.lane(j, k) + off;
+                    for (size_t n = 0; n < SOA_WIDTH; n++)
+                        t[n] += ak[n]*bj[n];
+                }
+            }
+        }
+        for (size_t l = 0; l < 16; l++)
+            memcpy(out.lane(l) + off, tile[l], sizeof(tile[l]));
+    }
+#endif
+}
+
+void toMatrices(const SoA<Quaternion> &q, SoA<Matrix4f> &out)
+{
+    out.resize(q.size());
+
+    alignas(16) Matrix4f tmp[SOA_WIDTH];
+    float *lanes[16];
+    q.forEachChunk([&](size_t off, size_t n) {
+        toMatrices(q.x()+off, q.y()+off, q.z()+off, q.w()+off, tmp, n);
+        for (size_t l = 0; l < 16; l++)
+            lanes[l] = out.lane(l) + off;
+        deinterleave(tmp[0][0], 16, lanes, n);
+    });
+}
+
+void fromMatrices(const SoA<Matrix4f> &m, SoA<Quaternion> &out)
+{
+    out.resize(m.size());
+
+    alignas(16) Matrix4f tmp[SOA_WIDTH];
+    const float *lanes[16];
+    m.forEachChunk([&](size_t off, size_t n) {
+        for (size_t l = 0; l < 16; l++)
+            lanes[l] = m.lane(l) + off;
+        interleave(lanes, 16, tmp[0][0], n);
+        fromMatrices(tmp, out.x()+off, out.y()+off, out.z()+off, out.w()+off, n);
+    });
+}
+
+}; // namespace math
@@ -0,0 +1,499 @@
+#ifndef SOA_H
+#define SOA_H
+
+#include <vector>
+#include <string.h>
+
+#include "aalloc.h"
+#include "vec.h"
+#include "matrix.h"
+#include "quaternion.h"
+
+namespace math {
+
+/// Lane alignment and padding in floats: one cache line, which is also
+/// the widest SIMD register (AVX-512)
+static const size_t SOA_WIDTH = 16;
+
+/// Split count elements of `lanes` floats each into lane arrays out[k],
+/// with SSE shuffles for 2, 3 and multiple of 4 lanes
+void deinterleave(const float *in, size_t lanes, float *const *out, size_t count);
+
+/// Inverse of deinterleave
+void interleave(const float *const *in, size_t lanes, float *out, size_t count);
+
+/// Storage shared by the SoA containers: Lanes float arrays in one
+/// allocation, each aligned to SOA_WIDTH floats. Elements past size() up
+/// to paddedSize() are kept zero so kernels can run whole chunks.
+template <size_t Lanes>
+class SoAStorage {
+public:
+    SoAStorage()
+        : m_size(0)
+        , m_capacity(0)
+    {}
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    /// size() rounded up to SOA_WIDTH
+    size_t paddedSize() const
+    {
+        return (m_size + SOA_WIDTH-1) & ~(SOA_WIDTH-1);
+    }
+
+    const float* lane(size_t k) const
+    {
+        return m_data.data() + k*m_capacity;
+    }
+
+    float* lane(size_t k)
+    {
+        return m_data.data() + k*m_capacity;
+    }
+
+    /// New elements are zero
+    void resize(size_t n)
+    {
+        if (n > m_capacity) {
+            size_t grow = m_capacity*2;
+            reallocate(n > grow ? n : grow);
+        } else if (n < m_size) {
+            for (size_t k = 0; k < Lanes; k++)
+                memset(lane(k) + n, 0, (m_size-n)*sizeof(float));
+        }
+        m_size = n;
+    }
+
+    void reserve(size_t n)
+    {
+        if (n > m_capacity)
+            reallocate(n);
+    }
+
+    void clear()
+    {
+        resize(0);
+    }
+
+    /// Call f(offset, n) for consecutive chunks of SOA_WIDTH elements, n
+    /// is the number of valid ones (less than SOA_WIDTH only for the last)
+    template <typename F>
+    void forEachChunk(F f) const
+    {
+        for (size_t off = 0; off < m_size; off += SOA_WIDTH)
+            f(off, m_size-off < SOA_WIDTH ? m_size-off : SOA_WIDTH);
+    }
+
+protected:
+    void lanes(float *out[Lanes])
+    {
+        for (size_t k = 0; k < Lanes; k++)
+            out[k] = lane(k);
+    }
+
+    void lanes(const float *out[Lanes]) const
+    {
+        for (size_t k = 0; k < Lanes; k++)
+            out[k] = lane(k);
+    }
+
+    /// Replace contents with count AoS elements of Lanes floats
+    void load(const float *aos, size_t count)
+    {
+        resize(0);
+        resize(count);
+        float *out[Lanes];
+        lanes(out);
+        deinterleave(aos, Lanes, out, count);
+    }
+
+    /// Grow by one zero element and return its index, push_back without
+    /// the shrinking half of resize()
+    size_t append()
+    {
+        if (m_size == m_capacity)
+            reallocate(m_capacity ? m_capacity*2 : 1);
+        return m_size++;
+    }
+
+    void store(float *aos) const
+    {
+        const float *in[Lanes];
+        lanes(in);
+        interleave(in, Lanes, aos, m_size);
+    }
+
+    std::vector<float, AlignedAllocator<float, SOA_WIDTH*sizeof(float)> > m_data;
+    size_t m_size;
+    size_t m_capacity;
+
+private:
+    void reallocate(size_t n)
+    {
+        size_t capacity = (n + SOA_WIDTH-1) & ~(SOA_WIDTH-1);
+        // Lanes a multiple of 4KB apart map to the same cache sets and
+        // evict each other when walked together, skew them by a line
+        if ((capacity*sizeof(float)) % 4096 == 0)
+            capacity += SOA_WIDTH;
+        std::vector<float, AlignedAllocator<float, SOA_WIDTH*sizeof(float)> >
+            data(Lanes*capacity, 0.0f);
+        for (size_t k = 0; k < Lanes && m_size; k++)
+            memcpy(&data[k*capacity], lane(k), m_size*sizeof(float));
+        m_data.swap(data);
+        m_capacity = capacity;
+    }
+};
+
+template <typename T>
+class SoA;
+
+/// Vectors as one lane per component: x(), y(), ... are the lane arrays
+/// and soa[i] reads and writes like a vec
+template <size_t N>
+class SoA<vec<N, float> > : public SoAStorage<N> {
+public:
+    typedef vec<N, float> value_type;
+
+    /// Element proxy
+    class Ref {
+    public:
+        Ref(float *p, size_t stride)
+            : m_p(p), m_stride(stride)
+        {}
+
+        float& operator [] (size_t k) const
+        {
+            return m_p[k*m_stride];
+        }
+
+        float& x() const { return (*this)[0]; }
+        float& y() const { return (*this)[1]; }
+        float& z() const { static_assert(N > 2, "no z lane"); return (*this)[2]; }
+        float& w() const { static_assert(N > 3, "no w lane"); return (*this)[3]; }
+
+        operator value_type () const
+        {
+            value_type v;
+            for (size_t k = 0; k < N; k++)
+                v[k] = (*this)[k];
+            return v;
+        }
+
+        const Ref& operator = (const value_type &v) const
+        {
+            for (size_t k = 0; k < N; k++)
+                (*this)[k] = v[k];
+            return *this;
+        }
+
+        const Ref& operator = (const Ref &r) const
+        {
+            return *this = value_type(r);
+        }
+
+        bool operator == (const value_type &v) const
+        {
+            return value_type(*this) == v;
+        }
+
+        bool operator != (const value_type &v) const
+        {
+            return value_type(*this) != v;
+        }
+
+    private:
+        float *m_p;
+        size_t m_stride;
+    };
+
+    SoA() {}
+
+    SoA(const value_type *v, size_t count)
+    {
+        assign(v, count);
+    }
+
+    Ref operator [] (size_t i)
+    {
+        return Ref(this->lane(0) + i, this->m_capacity);
+    }
+
+    value_type operator [] (size_t i) const
+    {
+        value_type v;
+        for (size_t k = 0; k < N; k++)
+            v[k] = this->lane(k)[i];
+        return v;
+    }
+
+    void push_back(const value_type &v)
+    {
+        (*this)[this->append()] = v;
+    }
+
+    /// Transpose from / to an array of vectors
+    void assign(const value_type *v, size_t count)
+    {
+        static_assert(sizeof(value_type) == N*sizeof(float), "vec is not packed");
+        this->load(reinterpret_cast<const float*>(v), count);
+    }
+
+    void copyTo(value_type *v) const
+    {
+        this->store(reinterpret_cast<float*>(v));
+    }
+
+    float* x() { return this->lane(0); }
+    float* y() { return this->lane(1); }
+    float* z() { static_assert(N > 2, "no z lane"); return this->lane(2); }
+    float* w() { static_assert(N > 3, "no w lane"); return this->lane(3); }
+    const float* x() const { return this->lane(0); }
+    const float* y() const { return this->lane(1); }
+    const float* z() const { static_assert(N > 2, "no z lane"); return this->lane(2); }
+    const float* w() const { static_assert(N > 3, "no w lane"); return this->lane(3); }
+};
+
+/// Quaternions as x, y, z, w lanes
+template <>
+class SoA<Quaternion> : public SoAStorage<4> {
+public:
+    typedef Quaternion value_type;
+
+    /// Element proxy
+    class Ref {
+    public:
+        Ref(float *p, size_t stride)
+            : m_p(p), m_stride(stride)
+        {}
+
+        float& x() const { return m_p[0]; }
+        float& y() const { return m_p[m_stride]; }
+        float& z() const { return m_p[2*m_stride]; }
+        float& w() const { return m_p[3*m_stride]; }
+
+        operator Quaternion () const
+        {
+            return Quaternion(w(), vec3f(x(), y(), z()));
+        }
+
+        const Ref& operator = (const Quaternion &q) const
+        {
+            x() = q.m_v.x();
+            y() = q.m_v.y();
+            z() = q.m_v.z();
+            w() = q.m_w;
+            return *this;
+        }
+
+        const Ref& operator = (const Ref &r) const
+        {
+            return *this = Quaternion(r);
+        }
+
+    private:
+        float *m_p;
+        size_t m_stride;
+    };
+
+    SoA() {}
+
+    SoA(const Quaternion *q, size_t count)
+    {
+        assign(q, count);
+    }
+
+    Ref operator [] (size_t i)
+    {
+        return Ref(lane(0) + i, m_capacity);
+    }
+
+    Quaternion operator [] (size_t i) const
+    {
+        return Quaternion(w()[i], vec3f(x()[i], y()[i], z()[i]));
+    }
+
+    void push_back(const Quaternion &q)
+    {
+        (*this)[append()] = q;
+    }
+
+    void assign(const Quaternion *q, size_t count)
+    {
+        static_assert(sizeof(Quaternion) == 4*sizeof(float), "Quaternion is not packed");
+        load(reinterpret_cast<const float*>(q), count);
+    }
+
+    void copyTo(Quaternion *q) const
+    {
+        store(reinterpret_cast<float*>(q));
+    }
+
+    float* x() { return lane(0); }
+    float* y() { return lane(1); }
+    float* z() { return lane(2); }
+    float* w() { return lane(3); }
+    const float* x() const { return lane(0); }
+    const float* y() const { return lane(1); }
+    const float* z() const { return lane(2); }
+    const float* w() const { return lane(3); }
+};
+
+/// 4x4 matrices as 16 lanes, lane(j, i) holds m[j][i] of every matrix
+template <>
+class SoA<Matrix4f> : public SoAStorage<16> {
+public:
+    typedef Matrix4f value_type;
+
+    /// Column of an element proxy, m[j][i] reads like Matrix4f
+    class Column {
+    public:
+        Column(float *p, size_t stride)
+            : m_p(p), m_stride(stride)
+        {}
+
+        float& operator [] (size_t i) const
+        {
+            return m_p[i*m_stride];
+        }
+
+    private:
+        float *m_p;
+        size_t m_stride;
+    };
+
+    /// Element proxy
+    class Ref {
+    public:
+        Ref(float *p, size_t stride)
+            : m_p(p), m_stride(stride)
+        {}
+
+        Column operator [] (size_t j) const
+        {
+            return Column(m_p + j*4*m_stride, m_stride);
+        }
+
+        operator Matrix4f () const
+        {
+            Matrix4f m;
+            for (int j = 0; j < 4; j++)
+                for (int i = 0; i < 4; i++)
+                    m[j][i] = m_p[(j*4+i)*m_stride];
+            return m;
+        }
+
+        const Ref& operator = (const Matrix4f &m) const
+        {
+            for (int j = 0; j < 4; j++)
+                for (int i = 0; i < 4; i++)
+                    m_p[(j*4+i)*m_stride] = m[j][i];
+            return *this;
+        }
+
+        const Ref& operator = (const Ref &r) const
+        {
+            return *this = Matrix4f(r);
+        }
+
+    private:
+        float *m_p;
+        size_t m_stride;
+    };
+
+    SoA() {}
+
+    SoA(const Matrix4f *m, size_t count)
+    {
+        assign(m, count);
+    }
+
+    Ref operator [] (size_t i)
+    {
+        return Ref(lane(0) + i, m_capacity);
+    }
+
+    Matrix4f operator [] (size_t i) const
+    {
+        Matrix4f m;
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                m[j][k] = lane(j, k)[i];
+        return m;
+    }
+
+    void push_back(const Matrix4f &m)
+    {
+        (*this)[append()] = m;
+    }
+
+    void assign(const Matrix4f *m, size_t count)
+    {
+        load(reinterpret_cast<const float*>(m), count);
+    }
+
+    void copyTo(Matrix4f *m) const
+    {
+        store(reinterpret_cast<float*>(m));
+    }
+
+    float* lane(size_t j, size_t i)
+    {
+        return SoAStorage<16>::lane(j*4+i);
+    }
+
+    const float* lane(size_t j, size_t i) const
+    {
+        return SoAStorage<16>::lane(j*4+i);
+    }
+
+    using SoAStorage<16>::lane;
+};
+
+typedef SoA<vec2f> SoAVec2f;
+typedef SoA<vec3f> SoAVec3f;
+typedef SoA<vec4f> SoAVec4f;
+typedef SoA<Quaternion> SoAQuaternion;
+typedef SoA<Matrix4f> SoAMatrix4f;
+
+// Batched kernels taking SoA containers, outputs are resized to match
+// and may be the same container as the input
+
+/// out[i] = m * in[i] (w = 1, no divide), through kernels()
+void transformPoints(const Matrix4f &m, const SoA<vec3f> &in, SoA<vec3f> &out);
+
+/// out[i] = a[i]*b[i]
+void multiply(const SoA<Matrix4f> &a, const SoA<Matrix4f> &b, SoA<Matrix4f> &out);
+
+/// Rotation matrices from unit quaternions
+void toMatrices(const SoA<Quaternion> &q, SoA<Matrix4f> &out);
+
+inline void toMatrices(const SoA<Quaternion> &q, Matrix4f *out)
+{
+    toMatrices(q.x(), q.y(), q.z(), q.w(), out, q.size());
+}
+
+inline void toMatrices(const SoA<Quaternion> &q, Matrix3x4f *out)
+{
+    toMatrices(q.x(), q.y(), q.z(), q.w(), out, q.size());
+}
+
+/// Quaternions from pure rotation matrices
+void fromMatrices(const SoA<Matrix4f> &m, SoA<Quaternion> &out);
+
+inline void fromMatrices(const Matrix4f *m, size_t count, SoA<Quaternion> &out)
+{
+    out.resize(count);
+    fromMatrices(m, out.x(), out.y(), out.z(), out.w(), count);
+}
+
+}; // namespace math
+
+#endif
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "solve.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace math {
+
+// Pivots at or below this are treated as zero, relative to the largest
+// magnitude in the input so that scaling a system doesn't change the result
+template <size_t N, typename T>
+static inline T tolerance(T maxAbs)
+{
+    return maxAbs * T(N) * std::numeric_limits<T>::epsilon();
+}
+
+template <size_t N, typename T>
+static inline vec<N, T> nanVec()
+{
+    return vec<N, T>(std::numeric_limits<T>::quiet_NaN());
+}
+
+/////
+// LU
+
+template <size_t N, typename T>
+bool LU<N, T>::decompose(const Matrix<N, T> &a)
+{
+    // Work on rows, the transpose of the column-major input
+    T maxAbs = 0;
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = 0; j < N; j++) {
+            m_lu[i][j] = a[j][i];
+            maxAbs = std::max(maxAbs, std::abs(a[j][i]));
+        }
+        m_perm[i] = i;
+    }
+    m_sign = 1;
+    m_singular = false;
+    const T tol = tolerance<N>(maxAbs);
+
+    for (size_t k = 0; k < N; k++) {
+        size_t p = k;
+        for (size_t i = k+1; i < N; i++)
+            if (std::abs(m_lu[i][k]) > std::abs(m_lu[p][k]))
+                p = i;
+        if (!(std::abs(m_lu[p][k]) > tol)) {
+            m_singular = true;
+            return false;
+        }
+        if (p != k) {
+            for (size_t j = 0; j < N; j++)
+                std::swap(m_lu[k][j], m_lu[p][j]);
+            std::swap(m_perm[k], m_perm[p]);
+            m_sign = -m_sign;
+        }
+
+        const T *rk = m_lu[k];
+        T inv = T(1)/rk[k];
+        for (size_t i = k+1; i < N; i++) {
+            T *ri = m_lu[i];
+            T l = ri[k] *= inv;
+            for (size_t j = k+1; j < N; j++)
+                ri[j] -= l*rk[j];
+        }
+    }
+    return true;
+}
+
+template <size_t N, typename T>
+T LU<N, T>::det() const
+{
+    if (m_singular)
+        return 0;
+    T d = T(m_sign);
+    for (size_t i = 0; i < N; i++)
+        d *= m_lu[i][i];
+    return d;
+}
+
+template <size_t N, typename T>
+vec<N, T> LU<N, T>::solve(const vec<N, T> &b) const
+{
+    if (m_singular)
+        return nanVec<N, T>();
+
+    vec<N, T> x;
+    for (size_t i = 0; i < N; i++) {
+        T s = b[m_perm[i]];
+        for (size_t j = 0; j < i; j++)
+            s -= m_lu[i][j]*x[j];
+        x[i] = s;
+    }
+    for (size_t i = N; i-- > 0;) {
+        T s = x[i];
+        for (size_t j = i+1; j < N; j++)
+            s -= m_lu[i][j]*x[j];
+        x[i] = s/m_lu[i][i];
+    }
+    return x;
+}
+
+template <size_t N, typename T>
+Matrix<N, T> LU<N, T>::inverse() const
+{
+    Matrix<N, T> r;
+    for (size_t j = 0; j < N; j++) {
+        vec<N, T> e(T(0));
+        e[j] = 1;
+        vec<N, T> c = solve(e);
+        memcpy(r[j], c.data(), sizeof(T)*N);
+    }
+    return r;
+}
+
+/////
+// Cholesky
+
+template <size_t N, typename T>
+bool Cholesky<N, T>::decompose(const Matrix<N, T> &a)
+{
+    T maxDiag = 0;
+    for (size_t i = 0; i < N; i++)
+        maxDiag = std::max(maxDiag, std::abs(a[i][i]));
+    const T tol = tolerance<N>(maxDiag);
+
+    m_l.loadZero();
+    m_ok = false;
+    for (size_t j = 0; j < N; j++) {
+        T *lj = m_l[j];
+        T d = a[j][j];
+        for (size_t k = 0; k < j; k++)
+            d -= lj[k]*lj[k];
+        if (!(d > tol))
+            return false;
+        lj[j] = std::sqrt(d);
+
+        T inv = T(1)/lj[j];
+        for (size_t i = j+1; i < N; i++) {
+            T *li = m_l[i];
+            T s = a[j][i];
+            for (size_t k = 0; k < j; k++)
+                s -= li[k]*lj[k];
+            li[j] = s*inv;
+        }
+    }
+    m_ok = true;
+    return true;
+}
+
+template <size_t N, typename T>
+Matrix<N, T> Cholesky<N, T>::lower() const
+{
+    return m_l.transposed();
+}
+
+template <size_t N, typename T>
+vec<N, T> Cholesky<N, T>::solve(const vec<N, T> &b) const
+{
+    if (!m_ok)
+        return nanVec<N, T>();
+
+    vec<N, T> x;
+    for (size_t i = 0; i < N; i++) {
+        T s = b[i];
+        for (size_t k = 0; k < i; k++)
+            s -= m_l[i][k]*x[k];
+        x[i] = s/m_l[i][i];
+    }
+    for (size_t i = N; i-- > 0;) {
+        T s = x[i];
+        for (size_t k = i+1; k < N; k++)
+            s -= m_l[k][i]*x[k];
+        x[i] = s/m_l[i][i];
+    }
+    return x;
+}
+
+/////
+// Batched solvers
+//
+// SOLVE_BATCH systems are interleaved with the system index innermost,
+// m[i][j][w] is row i, column j of system w. Every step of the
+// factorization is then a lane-wise operation across systems, only the
+// pivot search and row swaps are done per system. Unused and failed
+// systems carry on with a unit pivot so nothing turns into NaN.
+
+static const size_t W = SOLVE_BATCH;
+
+// Lane-wise helpers on T[W]: d -= a*b, d = a*b, d = a/b, d = sqrt(a)
+template <typename T>
+static inline void lanesSubMul(T *d, const T *a, const T *b)
+{
+    for (size_t w = 0; w < W; w++)
+        d[w] -= a[w]*b[w];
+}
+
+template <typename T>
+static inline void lanesMul(T *d, const T *a, const T *b)
+{
+    for (size_t w = 0; w < W; w++)
+        d[w] = a[w]*b[w];
+}
+
+template <typename T>
+static inline void lanesDiv(T *d, const T *a, const T *b)
+{
+    for (size_t w = 0; w < W; w++)
+        d[w] = a[w]/b[w];
+}
+
+template <typename T>
+static inline void lanesSqrt(T *d, const T *a)
+{
+    for (size_t w = 0; w < W; w++)
+        d[w] = std::sqrt(a[w]);
+}
+
+#ifdef __SSE__
+template <>
+inline void lanesSubMul<float>(float *d, const float *a, const float *b)
+{
+    for (size_t w = 0; w < W; w += 4)
+        _mm_storeu_ps(d+w, _mm_sub_ps(_mm_loadu_ps(d+w),
+                                      _mm_mul_ps(_mm_loadu_ps(a+w), _mm_loadu_ps(b+w))));
+}
+
+template <>
+inline void lanesMul<float>(float *d, const float *a, const float *b)
+{
+    for (size_t w = 0; w < W; w += 4)
+        _mm_storeu_ps(d+w, _mm_mul_ps(_mm_loadu_ps(a+w), _mm_loadu_ps(b+w)));
+}
+
+template <>
+inline void lanesDiv<float>(float *d, const float *a, const float *b)
+{
+    for (size_t w = 0; w < W; w += 4)
+        _mm_storeu_ps(d+w, _mm_div_ps(_mm_loadu_ps(a+w), _mm_loadu_ps(b+w)));
+}
+
+template <>
+inline void lanesSqrt<float>(float *d, const float *a)
+{
+    for (size_t w = 0; w < W; w += 4)
+        _mm_storeu_ps(d+w, _mm_sqrt_ps(_mm_loadu_ps(a+w)));
+}
+#endif // __SSE__
+
+#ifdef __SSE2__
+template <>
+inline void lanesSubMul<double>(double *d, const double *a, const double *b)
+{
+    for (size_t w = 0; w < W; w += 2)
+        _mm_storeu_pd(d+w, _mm_sub_pd(_mm_loadu_pd(d+w),
+                                      _mm_mul_pd(_mm_loadu_pd(a+w), _mm_loadu_pd(b+w))));
+}
+
+template <>
+inline void lanesMul<double>(double *d, const double *a, const double *b)
+{
+    for (size_t w = 0; w < W; w += 2)
+        _mm_storeu_pd(d+w, _mm_mul_pd(_mm_loadu_pd(a+w), _mm_loadu_pd(b+w)));
+}
+
+template <>
+inline void lanesDiv<double>(double *d, const double *a, const double *b)
+{
+    for (size_t w = 0; w < W; w += 2)
+        _mm_storeu_pd(d+w, _mm_div_pd(_mm_loadu_pd(a+w), _mm_loadu_pd(b+w)));
+}
+
+template <>
+inline void lanesSqrt<double>(double *d, const double *a)
+{
+    for (size_t w = 0; w < W; w += 2)
+        _mm_storeu_pd(d+w, _mm_sqrt_pd(_mm_loadu_pd(a+w)));
+}
+#endif // __SSE2__
+
+template <size_t N, typename T>
+struct SolveBatch {
+    T m[N][N][W];
+    T y[N][W];
+    T tol[W];
+    bool failed[W];
+
+    void load(const Matrix<N, T> *a, const vec<N, T> *b, size_t n, bool diagonal)
+    {
+        for (size_t w = 0; w < W; w++) {
+            T maxAbs = 0;
+            for (size_t i = 0; i < N; i++) {
+                for (size_t j = 0; j < N; j++) {
+                    T v = w < n ? a[w][j][i] : T(i == j);
+                    m[i][j][w] = v;
+                    if (!diagonal || i == j)
+                        maxAbs = std::max(maxAbs, std::abs(v));
+                }
+                y[i][w] = w < n ? b[w][i] : T(0);
+            }
+            tol[w] = tolerance<N>(maxAbs);
+            failed[w] = false;
+        }
+    }
+
+    size_t store(vec<N, T> *x, size_t n) const
+    {
+        size_t count = 0;
+        for (size_t w = 0; w < n; w++) {
+            for (size_t i = 0; i < N; i++)
+                x[w][i] = failed[w] ? T(0) : y[i][w];
+            count += failed[w];
+        }
+        return count;
+    }
+
+    void solveLU()
+    {
+        for (size_t k = 0; k < N; k++) {
+            for (size_t w = 0; w < W; w++) {
+                size_t p = k;
+                for (size_t i = k+1; i < N; i++)
+                    if (std::abs(m[i][k][w]) > std::abs(m[p][k][w]))
+                        p = i;
+                if (p != k) {
+                    for (size_t j = k; j < N; j++)
+                        std::swap(m[k][j][w], m[p][j][w]);
+                    std::swap(y[k][w], y[p][w]);
+                }
+                if (!(std::abs(m[k][k][w]) > tol[w])) {
+                    failed[w] = true;
+                    m[k][k][w] = 1;
+                }
+            }
+
+            // Eliminate below the pivot and forward substitute y with it
+            for (size_t i = k+1; i < N; i++) {
+                T l[W];
+                lanesDiv(l, m[i][k], m[k][k]);
+                for (size_t j = k+1; j < N; j++)
+                    lanesSubMul(m[i][j], l, m[k][j]);
+                lanesSubMul(y[i], l, y[k]);
+            }
+        }
+
+        for (size_t i = N; i-- > 0;) {
+            for (size_t j = i+1; j < N; j++)
+                lanesSubMul(y[i], m[i][j], y[j]);
+            lanesDiv(y[i], y[i], m[i][i]);
+        }
+    }
+
+    // L overwrites the lower triangle of m
+    void solveCholesky()
+    {
+        for (size_t j = 0; j < N; j++) {
+            T *d = m[j][j];
+            for (size_t k = 0; k < j; k++)
+                lanesSubMul(d, m[j][k], m[j][k]);
+            for (size_t w = 0; w < W; w++) {
+                if (!(d[w] > tol[w])) {
+                    failed[w] = true;
+                    d[w] = 1;
+                }
+            }
+            lanesSqrt(d, d);
+
+            // Lower triangle of the input, row i column j
+            for (size_t i = j+1; i < N; i++) {
+                for (size_t k = 0; k < j; k++)
+                    lanesSubMul(m[i][j], m[i][k], m[j][k]);
+                lanesDiv(m[i][j], m[i][j], d);
+            }
+        }
+
+        for (size_t i = 0; i < N; i++) {
+            for (size_t k = 0; k < i; k++)
+                lanesSubMul(y[i], m[i][k], y[k]);
+            lanesDiv(y[i], y[i], m[i][i]);
+        }
+        for (size_t i = N; i-- > 0;) {
+            for (size_t k = i+1; k < N; k++)
+                lanesSubMul(y[i], m[k][i], y[k]);
+            lanesDiv(y[i], y[i], m[i][i]);
+        }
+    }
+};
+
+template <size_t N, typename T>
+size_t solveLU(const Matrix<N, T> *a, const vec<N, T> *b, vec<N, T> *x, size_t count)
+{
+    SolveBatch<N, T> batch;
+    size_t failed = 0;
+    for (size_t k = 0; k < count; k += SOLVE_BATCH) {
+        size_t n = std::min(count - k, SOLVE_BATCH);
+        batch.load(a+k, b+k, n, false);
+        batch.solveLU();
+        failed += batch.store(x+k, n);
+    }
+    return failed;
+}
+
+template <size_t N, typename T>
+size_t solveCholesky(const Matrix<N, T> *a, const vec<N, T> *b, vec<N, T> *x, size_t count)
+{
+    SolveBatch<N, T> batch;
+    size_t failed = 0;
+    for (size_t k = 0; k < count; k += SOLVE_BATCH) {
+        size_t n = std::min(count - k, SOLVE_BATCH);
+        batch.load(a+k, b+k, n, true);
+        batch.solveCholesky();
+        failed += batch.store(x+k, n);
+    }
+    return failed;
+}
+
+#define SOLVE_INSTANTIATE(N, T)                                         \
+    template class LU<N, T>;                                            \
+    template class Cholesky<N, T>;                                      \
+    template size_t solveLU<N, T>(const Matrix<N, T>*, const vec<N, T>*, \
+                                  vec<N, T>*, size_t);                  \
+    template size_t solveCholesky<N, T>(const Matrix<N, T>*, const vec<N, T>*, \
+                                        vec<N, T>*, size_t);
+
+#define SOLVE_INSTANTIATE_N(N)  \
+    SOLVE_INSTANTIATE(N, float) \
+    SOLVE_INSTANTIATE(N, double)
+
+SOLVE_INSTANTIATE_N(2)
+SOLVE_INSTANTIATE_N(3)
+SOLVE_INSTANTIATE_N(4)
+SOLVE_INSTANTIATE_N(5)
+SOLVE_INSTANTIATE_N(6)
+SOLVE_INSTANTIATE_N(7)
+SOLVE_INSTANTIATE_N(8)
+SOLVE_INSTANTIATE_N(9)
+SOLVE_INSTANTIATE_N(10)
+SOLVE_INSTANTIATE_N(11)
+SOLVE_INSTANTIATE_N(12)
+
+#undef SOLVE_INSTANTIATE_N
+#undef SOLVE_INSTANTIATE
+
+}; // namespace math
@@ -0,0 +1,101 @@
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include "matrix.h"
+
+namespace math {
+
+// Dense decompositions and solvers for small systems such as constraint
+// blocks and least squares normal equations. Instantiated for N = 2..12,
+// float and double, like Matrix itself.
+
+/// LU decomposition with partial pivoting, P*A = L*U
+template <size_t N, typename T>
+class LU {
+public:
+    LU()
+        : m_singular(true)
+        , m_sign(1)
+    {}
+
+    explicit LU(const Matrix<N, T> &a)
+    {
+        decompose(a);
+    }
+
+    /// Returns false if a is singular to working precision
+    bool decompose(const Matrix<N, T> &a);
+
+    bool singular() const
+    {
+        return m_singular;
+    }
+
+    /// 0 if singular
+    T det() const;
+
+    /// Solve a*x = b, NaN if singular
+    vec<N, T> solve(const vec<N, T> &b) const;
+
+    /// NaN if singular
+    Matrix<N, T> inverse() const;
+
+private:
+    // Row-major, m_lu[i] is row i: unit lower L below the diagonal and U
+    // on and above it. Row i of P*A is row m_perm[i] of A.
+    Matrix<N, T> m_lu;
+    int m_perm[N];
+    bool m_singular;
+    int m_sign;
+};
+
+/// Cholesky decomposition A = L*L^T of a symmetric positive definite
+/// matrix. Only the lower triangle of A is read. Needs no pivoting, but
+/// fails on matrices that aren't positive definite.
+template <size_t N, typename T>
+class Cholesky {
+public:
+    Cholesky()
+        : m_ok(false)
+    {}
+
+    explicit Cholesky(const Matrix<N, T> &a)
+    {
+        decompose(a);
+    }
+
+    bool decompose(const Matrix<N, T> &a);
+
+    bool ok() const
+    {
+        return m_ok;
+    }
+
+    /// L in column-major like any Matrix, zero above the diagonal
+    Matrix<N, T> lower() const;
+
+    /// Solve a*x = b, NaN if the decomposition failed
+    vec<N, T> solve(const vec<N, T> &b) const;
+
+private:
+    Matrix<N, T> m_l;   // row-major, m_l[i] is row i
+    bool m_ok;
+};
+
+/// Systems factorized side by side in the batched solvers
+static const size_t SOLVE_BATCH = 8;
+
+/// Solve a[k]*x[k] = b[k] for count independent systems. Runs
+/// SOLVE_BATCH systems at once with the elimination vectorized across
+/// systems. x may alias b. Singular systems get x = 0, returns how many.
+template <size_t N, typename T>
+size_t solveLU(const Matrix<N, T> *a, const vec<N, T> *b, vec<N, T> *x, size_t count);
+
+/// Same as solveLU() for symmetric positive definite systems, reads
+/// only the lower triangles. Failed systems get x = 0, returns how many.
+template <size_t N, typename T>
+size_t solveCholesky(const Matrix<N, T> *a, const vec<N, T> *b, vec<N, T> *x, size_t count);
+
+}; // namespace math
+
+#endif
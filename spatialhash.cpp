@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <cmath>
+
+#include "spatialhash.h"
+#include "kernels.h"
+
+namespace math {
+
+// Keeps cell coordinates and their differences well inside int range
+static const int MAX_COORD = 1 << 28;
+
+static const size_t MIN_TABLE = 64;
+
+static inline uint32_t hashCell(int x, int y, int z)
+{
+    return (uint32_t)x*73856093u ^ (uint32_t)y*19349663u ^ (uint32_t)z*83492791u;
+}
+
+const uint32_t SpatialHash::INVALID;
+const size_t SpatialHash::CHUNK_SIZE;
+
+SpatialHash::SpatialHash(float cellSize)
+{
+    reset(cellSize);
+}
+
+void SpatialHash::reset(float cellSize)
+{
+    m_cellSize = cellSize > 0.0f ? cellSize : 1.0f;
+    m_invCell = 1.0f/m_cellSize;
+    clear();
+}
+
+void SpatialHash::clear()
+{
+    m_size = 0;
+    m_cells.clear();
+    Cell overflow = { 0, 0, 0, INVALID, 0 };
+    m_cells.push_back(overflow);
+    m_freeCells.clear();
+    m_table.assign(MIN_TABLE, INVALID);
+    updateBounds();
+    m_chunks.clear();
+    m_freeChunk = INVALID;
+    m_objects.clear();
+    m_freeObjects.clear();
+}
+
+int SpatialHash::coord(float v) const
+{
+    float c = std::floor(v*m_invCell);
+    if (!(c > -MAX_COORD))
+        return c != c ? 0 : -MAX_COORD;     // NaN lands in cell 0
+    return c < MAX_COORD ? (int)c : MAX_COORD;
+}
+
+uint32_t SpatialHash::findCell(int x, int y, int z) const
+{
+    size_t mask = m_table.size()-1;
+    for (size_t i = hashCell(x, y, z) & mask;; i = (i+1) & mask) {
+        uint32_t c = m_table[i];
+        if (c == INVALID)
+            return INVALID;
+        const Cell &cell = m_cells[c];
+        if (cell.x == x && cell.y == y && cell.z == z)
+            return c;
+    }
+}
+
+void SpatialHash::insertCell(uint32_t c)
+{
+    const Cell &cell = m_cells[c];
+    size_t mask = m_table.size()-1;
+    size_t i = hashCell(cell.x, cell.y, cell.z) & mask;
+    while (m_table[i] != INVALID)
+        i = (i+1) & mask;
+    m_table[i] = c;
+}
+
+// Cells in the table, those with objects, skipping free ones and one
+// cellFor() is about to insert
+void SpatialHash::rehash(size_t tableSize)
+{
+    m_table.assign(tableSize, INVALID);
+    for (size_t c = 1; c < m_cells.size(); c++)
+        if (m_cells[c].count)
+            insertCell(c);
+}
+
+void SpatialHash::releaseCell(uint32_t c)
+{
+    // Backward shift deletion, entries after the hole move into it unless
+    // their home slot lies cyclically between the hole and them
+    const Cell &cell = m_cells[c];
+    size_t mask = m_table.size()-1;
+    size_t i = hashCell(cell.x, cell.y, cell.z) & mask;
+    while (m_table[i] != c)
+        i = (i+1) & mask;
+    for (size_t j = (i+1) & mask; m_table[j] != INVALID; j = (j+1) & mask) {
+        const Cell &other = m_cells[m_table[j]];
+        size_t home = hashCell(other.x, other.y, other.z) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            m_table[i] = m_table[j];
+            i = j;
+        }
+    }
+    m_table[i] = INVALID;
+    m_freeCells.push_back(c);
+
+    if (m_table.size() > MIN_TABLE && liveCells()*8 < m_table.size())
+        rehash(m_table.size()/2);
+    // Shrink the bounds once as many cells went away as are left, which
+    // keeps the cost per release constant
+    if (++m_staleBounds > liveCells())
+        updateBounds();
+}
+
+void SpatialHash::updateBounds()
+{
+    for (int a = 0; a < 3; a++) {
+        m_min[a] = MAX_COORD;
+        m_max[a] = -MAX_COORD;
+    }
+    for (size_t c = 1; c < m_cells.size(); c++) {
+        const Cell &cell = m_cells[c];
+        if (!cell.count)
+            continue;
+        int p[3] = { cell.x, cell.y, cell.z };
+        for (int a = 0; a < 3; a++) {
+            m_min[a] = std::min(m_min[a], p[a]);
+            m_max[a] = std::max(m_max[a], p[a]);
+        }
+    }
+    m_staleBounds = 0;
+}
+
+uint32_t SpatialHash::cellFor(const vec3f &center, float radius)
+{
+    if (!(radius <= 0.5f*m_cellSize))
+        return 0;
+
+    int x = coord(center.x()), y = coord(center.y()), z = coord(center.z());
+    uint32_t c = findCell(x, y, z);
+    if (c != INVALID)
+        return c;
+
+    Cell cell = { x, y, z, INVALID, 0 };
+    if (!m_freeCells.empty()) {
+        c = m_freeCells.back();
+        m_freeCells.pop_back();
+        m_cells[c] = cell;
+    } else {
+        c = m_cells.size();
+        m_cells.push_back(cell);
+    }
+    int p[3] = { x, y, z };
+    for (int a = 0; a < 3; a++) {
+        m_min[a] = std::min(m_min[a], p[a]);
+        m_max[a] = std::max(m_max[a], p[a]);
+    }
+
+    // Keep the load factor under a half
+    if (liveCells()*2 > m_table.size())
+        rehash(m_table.size()*2);
+    insertCell(c);
+    return c;
+}
+
+uint32_t SpatialHash::allocObject()
+{
+    if (!m_freeObjects.empty()) {
+        uint32_t h = m_freeObjects.back();
+        m_freeObjects.pop_back();
+        return h;
+    }
+    Object o = { INVALID, INVALID, 0 };
+    m_objects.push_back(o);
+    return m_objects.size()-1;
+}
+
+void SpatialHash::link(uint32_t handle, uint32_t cell, const vec3f &center, float radius)
+{
+    Cell &c = m_cells[cell];
+    if (c.head == INVALID || m_chunks[c.head].count == CHUNK_SIZE) {
+        uint32_t n = m_freeChunk;
+        if (n != INVALID) {
+            m_freeChunk = m_chunks[n].next;
+        } else {
+            n = m_chunks.size();
+            m_chunks.push_back(Chunk());
+        }
+        m_chunks[n].count = 0;
+        m_chunks[n].next = c.head;
+        c.head = n;
+    }
+
+    Chunk &chunk = m_chunks[c.head];
+    uint32_t slot = chunk.count++;
+    chunk.x[slot] = center.x();
+    chunk.y[slot] = center.y();
+    chunk.z[slot] = center.z();
+    chunk.r[slot] = radius;
+    chunk.id[slot] = handle;
+    c.count++;
+
+    Object &o = m_objects[handle];
+    o.cell = cell;
+    o.chunk = c.head;
+    o.slot = slot;
+}
+
+void SpatialHash::unlink(uint32_t handle)
+{
+    Object &o = m_objects[handle];
+    Cell &c = m_cells[o.cell];
+    uint32_t headIndex = c.head;
+    Chunk &head = m_chunks[headIndex];
+    uint32_t last = head.count-1;
+
+    // Fill the hole with the last entry of the cell
+    if (o.chunk != headIndex || o.slot != last) {
+        Chunk &chunk = m_chunks[o.chunk];
+        chunk.x[o.slot] = head.x[last];
+        chunk.y[o.slot] = head.y[last];
+        chunk.z[o.slot] = head.z[last];
+        chunk.r[o.slot] = head.r[last];
+        chunk.id[o.slot] = head.id[last];
+        Object &moved = m_objects[head.id[last]];
+        moved.chunk = o.chunk;
+        moved.slot = o.slot;
+    }
+
+    c.count--;
+    if (--head.count == 0) {
+        c.head = head.next;
+        head.next = m_freeChunk;
+        m_freeChunk = headIndex;
+    }
+    if (c.count == 0 && o.cell != 0)
+        releaseCell(o.cell);
+    o.cell = INVALID;
+}
+
+uint32_t SpatialHash::insert(const vec3f &center, float radius)
+{
+    uint32_t h = allocObject();
+    link(h, cellFor(center, radius), center, radius);
+    m_size++;
+    return h;
+}
+
+void SpatialHash::insert(const vec3f *centers, const float *radii, size_t count,
+                         uint32_t *handles)
+{
+    m_objects.reserve(m_objects.size() + count);
+    for (size_t i = 0; i < count; i++)
+        handles[i] = insert(centers[i], radii ? radii[i] : 0.0f);
+}
+
+void SpatialHash::move(uint32_t handle, const vec3f &center)
+{
+    const Object &o = m_objects[handle];
+    move(handle, center, m_chunks[o.chunk].r[o.slot]);
+}
+
+void SpatialHash::move(uint32_t handle, const vec3f &center, float radius)
+{
+    Object &o = m_objects[handle];
+    assert(o.cell != INVALID);
+    // Look the cell up without making it, so the old one is unlinked and
+    // maybe released before a new one goes into the table
+    uint32_t cell = 0;
+    if (radius <= 0.5f*m_cellSize)
+        cell = findCell(coord(center.x()), coord(center.y()), coord(center.z()));
+    if (cell == o.cell) {
+        Chunk &chunk = m_chunks[o.chunk];
+        chunk.x[o.slot] = center.x();
+        chunk.y[o.slot] = center.y();
+        chunk.z[o.slot] = center.z();
+        chunk.r[o.slot] = radius;
+        return;
+    }
+    unlink(handle);
+    link(handle, cellFor(center, radius), center, radius);
+}
+
+void SpatialHash::move(const uint32_t *handles, const vec3f *centers,
+                       const float *radii, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (radii)
+            move(handles[i], centers[i], radii[i]);
+        else
+            move(handles[i], centers[i]);
+    }
+}
+
+void SpatialHash::remove(uint32_t handle)
+{
+    assert(m_objects[handle].cell != INVALID);
+    unlink(handle);
+    m_freeObjects.push_back(handle);
+    m_size--;
+}
+
+vec3f SpatialHash::center(uint32_t handle) const
+{
+    const Object &o = m_objects[handle];
+    const Chunk &chunk = m_chunks[o.chunk];
+    return vec3f(chunk.x[o.slot], chunk.y[o.slot], chunk.z[o.slot]);
+}
+
+float SpatialHash::radius(uint32_t handle) const
+{
+    const Object &o = m_objects[handle];
+    return m_chunks[o.chunk].r[o.slot];
+}
+
+void SpatialHash::queryRadius(const vec3f &center, float radius,
+                              std::vector<uint32_t> &result) const
+{
+    result.clear();
+
+    const Chunk *chunks = m_chunks.data();
+    float cx = center.x(), cy = center.y(), cz = center.z();
+    auto visit = [&](const Cell &cell) {
+        for (uint32_t k = cell.head; k != INVALID; k = chunks[k].next) {
+            const Chunk &ch = chunks[k];
+            for (uint32_t i = 0; i < ch.count; i++) {
+                float dx = ch.x[i]-cx, dy = ch.y[i]-cy, dz = ch.z[i]-cz;
+                float rr = radius + ch.r[i];
+                if (dx*dx + dy*dy + dz*dz <= rr*rr)
+                    result.push_back(ch.id[i]);
+            }
+        }
+    };
+
+    visit(m_cells[0]);
+
+    // Cell contents reach half a cell past the cell
+    float reach = radius + 0.5f*m_cellSize;
+    int x0 = std::max(coord(cx-reach), m_min[0]), x1 = std::min(coord(cx+reach), m_max[0]);
+    int y0 = std::max(coord(cy-reach), m_min[1]), y1 = std::min(coord(cy+reach), m_max[1]);
+    int z0 = std::max(coord(cz-reach), m_min[2]), z1 = std::min(coord(cz+reach), m_max[2]);
+    if (x0 > x1 || y0 > y1 || z0 > z1)
+        return;
+
+    // Large queries walk the occupied cells instead of the box
+    double boxCells = double(x1-x0+1)*(y1-y0+1)*(z1-z0+1);
+    if (boxCells > liveCells()) {
+        for (size_t c = 1; c < m_cells.size(); c++) {
+            const Cell &cell = m_cells[c];
+            if (cell.count && cell.x >= x0 && cell.x <= x1 && cell.y >= y0 &&
+                cell.y <= y1 && cell.z >= z0 && cell.z <= z1)
+                visit(cell);
+        }
+        return;
+    }
+
+    for (int z = z0; z <= z1; z++)
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++) {
+                uint32_t c = findCell(x, y, z);
+                if (c != INVALID)
+                    visit(m_cells[c]);
+            }
+}
+
+void SpatialHash::queryNearest(const vec3f &p, size_t k, std::vector<uint32_t> &result) const
+{
+    result.clear();
+    if (k == 0 || m_size == 0)
+        return;
+
+    // Max-heap of the best k (squared distance, handle) so far
+    typedef std::pair<float, uint32_t> Candidate;
+    std::vector<Candidate> heap;
+    heap.reserve(std::min(k, m_size) + 1);
+
+    const Chunk *chunks = m_chunks.data();
+    float px = p.x(), py = p.y(), pz = p.z();
+    auto visit = [&](const Cell &cell) {
+        for (uint32_t n = cell.head; n != INVALID; n = chunks[n].next) {
+            const Chunk &ch = chunks[n];
+            for (uint32_t i = 0; i < ch.count; i++) {
+                float dx = ch.x[i]-px, dy = ch.y[i]-py, dz = ch.z[i]-pz;
+                float d = dx*dx + dy*dy + dz*dz;
+                if (heap.size() < k) {
+                    heap.push_back(Candidate(d, ch.id[i]));
+                    std::push_heap(heap.begin(), heap.end());
+                } else if (d < heap.front().first) {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.back() = Candidate(d, ch.id[i]);
+                    std::push_heap(heap.begin(), heap.end());
+                }
+            }
+        }
+    };
+    // Nothing left can beat the current k-th best
+    auto done = [&](float bound) {
+        return heap.size() == k && heap.front().first <= bound*bound;
+    };
+
+    visit(m_cells[0]);
+
+    if (liveCells() > 0) {
+        // Centers lie inside their cell, so every cell of the ring at
+        // Chebyshev distance r + 1 around p's cell is at least r cells away
+        int cx = coord(px), cy = coord(py), cz = coord(pz);
+        int rmax = 0;
+        int pc[3] = { cx, cy, cz };
+        for (int a = 0; a < 3; a++)
+            rmax = std::max(rmax, std::max(pc[a] - m_min[a], m_max[a] - pc[a]));
+
+        int r = 0;
+        bool scan = false;
+        for (; r <= rmax; r++) {
+            // Rings grow quadratically, switch to a scan of the occupied
+            // cells once a ring has more cells than that
+            double ringCells = r == 0 ? 1.0 : 24.0*r*r + 2.0;
+            if (ringCells > liveCells()) {
+                scan = true;
+                break;
+            }
+            for (int z = cz-r; z <= cz+r; z++) {
+                for (int y = cy-r; y <= cy+r; y++) {
+                    bool face = z == cz-r || z == cz+r || y == cy-r || y == cy+r;
+                    int step = face ? 1 : std::max(2*r, 1);
+                    for (int x = cx-r; x <= cx+r; x += step) {
+                        uint32_t c = findCell(x, y, z);
+                        if (c != INVALID)
+                            visit(m_cells[c]);
+                    }
+                }
+            }
+            if (done(r*m_cellSize))
+                break;
+        }
+
+        // Rings below r are done
+        if (scan) {
+            for (size_t c = 1; c < m_cells.size(); c++) {
+                const Cell &cell = m_cells[c];
+                int ring = std::max(std::abs(cell.x-cx), std::max(std::abs(cell.y-cy), std::abs(cell.z-cz)));
+                if (ring < r || !cell.count)
+                    continue;
+                // Distance from p to the cell box
+                float x0 = cell.x*m_cellSize, y0 = cell.y*m_cellSize, z0 = cell.z*m_cellSize;
+                float dx = std::max(std::max(x0-px, px-x0-m_cellSize), 0.0f);
+                float dy = std::max(std::max(y0-py, py-y0-m_cellSize), 0.0f);
+                float dz = std::max(std::max(z0-pz, pz-z0-m_cellSize), 0.0f);
+                if (!done(std::sqrt(dx*dx + dy*dy + dz*dz)))
+                    visit(cell);
+            }
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+    result.resize(heap.size());
+    for (size_t i = 0; i < heap.size(); i++)
+        result[i] = heap[i].second;
+}
+
+void SpatialHash::queryFrustum(const Frustum &frustum, std::vector<uint32_t> &result) const
+{
+    result.clear();
+
+    vec4f planes[6];
+    frustum.getPlanes(planes);
+    const Kernels &k = kernels();
+
+    // Bounding sphere of a cell and the half cell its contents reach past it
+    float half = 0.5f*m_cellSize;
+    float bound = half*(std::sqrt(3.0f) + 1.0f);
+
+    uint8_t classes[CHUNK_SIZE];
+    for (size_t c = 0; c < m_cells.size(); c++) {
+        const Cell &cell = m_cells[c];
+        if (!cell.count)
+            continue;
+
+        uint8_t cls = INTERSECT;
+        if (c != 0) {
+            float x = cell.x*m_cellSize + half;
+            float y = cell.y*m_cellSize + half;
+            float z = cell.z*m_cellSize + half;
+            k.cullSpheres(planes, &x, &y, &z, &bound, &cls, 1);
+            if (cls == OUTSIDE)
+                continue;
+        }
+
+        for (uint32_t n = cell.head; n != INVALID; n = m_chunks[n].next) {
+            const Chunk &ch = m_chunks[n];
+            if (cls == INSIDE) {
+                result.insert(result.end(), ch.id, ch.id + ch.count);
+                continue;
+            }
+            k.cullSpheres(planes, ch.x, ch.y, ch.z, ch.r, classes, ch.count);
+            for (uint32_t i = 0; i < ch.count; i++)
+                if (classes[i] != OUTSIDE)
+                    result.push_back(ch.id[i]);
+        }
+    }
+}
+
+}; // namespace math
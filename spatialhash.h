@@ -0,0 +1,143 @@
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "vec.h"
+#include "frustum.h"
+
+namespace math {
+
+/// Loose uniform grid over moving points and spheres, hashed so only
+/// occupied cells take memory. An object lives in the cell holding its
+/// center, so a move within the cell just rewrites its entry. Spheres up
+/// to half a cell in radius are kept in cells, larger ones in an overflow
+/// list that every query scans, so pick a cell size around the diameter
+/// of typical objects.
+///
+/// Cell contents are stored as structure of arrays in fixed-size chunks
+/// from a pool shared by all cells. Cells are released as soon as they
+/// empty, so memory and query cost follow the occupied cells rather than
+/// every cell objects ever passed through. Objects are referred to by
+/// handles from insert(), valid until removed.
+class SpatialHash {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFF;
+
+    explicit SpatialHash(float cellSize = 1.0f);
+
+    /// Remove everything and change the cell size
+    void reset(float cellSize);
+
+    void clear();
+
+    uint32_t insert(const vec3f &center, float radius = 0.0f);
+
+    /// radii may be NULL for points, handles receives count handles
+    void insert(const vec3f *centers, const float *radii, size_t count,
+                uint32_t *handles);
+
+    void move(uint32_t handle, const vec3f &center);
+    void move(uint32_t handle, const vec3f &center, float radius);
+
+    /// radii may be NULL to keep the current radii
+    void move(const uint32_t *handles, const vec3f *centers,
+              const float *radii, size_t count);
+
+    void remove(uint32_t handle);
+
+    vec3f center(uint32_t handle) const;
+    float radius(uint32_t handle) const;
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    float cellSize() const
+    {
+        return m_cellSize;
+    }
+
+    /// Grid cells holding objects
+    size_t cellCount() const
+    {
+        return liveCells();
+    }
+
+    /// Objects whose sphere touches the query sphere, unordered
+    void queryRadius(const vec3f &center, float radius,
+                     std::vector<uint32_t> &result) const;
+
+    /// Up to k objects with centers nearest to p, nearest first
+    void queryNearest(const vec3f &p, size_t k, std::vector<uint32_t> &result) const;
+
+    /// Objects not outside the frustum, unordered
+    void queryFrustum(const Frustum &frustum, std::vector<uint32_t> &result) const;
+
+private:
+    static const size_t CHUNK_SIZE = 16;
+
+    struct Chunk {
+        float x[CHUNK_SIZE];
+        float y[CHUNK_SIZE];
+        float z[CHUNK_SIZE];
+        float r[CHUNK_SIZE];
+        uint32_t id[CHUNK_SIZE];
+        uint32_t count;
+        uint32_t next;
+    };
+
+    // Only the head chunk of a cell is partially filled
+    struct Cell {
+        int x, y, z;
+        uint32_t head;
+        uint32_t count;
+    };
+
+    struct Object {
+        uint32_t cell;      // INVALID if free
+        uint32_t chunk;
+        uint32_t slot;
+    };
+
+    int coord(float v) const;
+    uint32_t findCell(int x, int y, int z) const;
+    uint32_t cellFor(const vec3f &center, float radius);
+    void rehash(size_t tableSize);
+    void insertCell(uint32_t c);
+    void releaseCell(uint32_t c);
+    void updateBounds();
+
+    size_t liveCells() const
+    {
+        return m_cells.size() - 1 - m_freeCells.size();
+    }
+
+    uint32_t allocObject();
+    void link(uint32_t handle, uint32_t cell, const vec3f &center, float radius);
+    void unlink(uint32_t handle);
+
+    float m_cellSize;
+    float m_invCell;
+    size_t m_size;
+
+    // m_cells[0] is the overflow list, the rest are grid cells. Emptied
+    // ones leave the table and are reused from m_freeCells.
+    std::vector<Cell> m_cells;
+    std::vector<uint32_t> m_freeCells;
+    std::vector<uint32_t> m_table;      // linear probing, indices into m_cells
+    int m_min[3], m_max[3];             // bounds of the grid cells
+    size_t m_staleBounds;               // cells released since the bounds were updated
+
+    std::vector<Chunk> m_chunks;
+    uint32_t m_freeChunk;
+
+    std::vector<Object> m_objects;
+    std::vector<uint32_t> m_freeObjects;
+};
+
+}; // namespace math
+
+#endif
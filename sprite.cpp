@@ -0,0 +1,75 @@
+#include "sprite.h"
+#include "fastmath.h"
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+namespace math {
+
+static const float CORNER_X[4] = { -0.5f, 0.5f, 0.5f, -0.5f };
+static const float CORNER_Y[4] = { -0.5f, -0.5f, 0.5f, 0.5f };
+
+static inline void spriteQuad(float x, float y, float w, float h,
+                              float s, float c, vec2f *corners)
+{
+    for (int k = 0; k < 4; k++) {
+        float lx = CORNER_X[k]*w;
+        float ly = CORNER_Y[k]*h;
+        corners[k] = vec2f(x + c*lx - s*ly, y + s*lx + c*ly);
+    }
+}
+
+void spriteQuads(const float *x, const float *y,
+                 const float *w, const float *h, const float *angle,
+                 vec2f *corners, size_t count)
+{
+    const size_t CHUNK = 64;
+    float sn[CHUNK], cs[CHUNK];
+
+    for (size_t base = 0; base < count; base += CHUNK) {
+        size_t n = count-base < CHUNK ? count-base : CHUNK;
+        fastSincos(angle+base, sn, cs, n);
+
+        size_t i = 0;
+#ifdef __SSE__
+        for (; i+4 <= n; i += 4) {
+            size_t g = base+i;
+            __m128 px = _mm_loadu_ps(x+g);
+            __m128 py = _mm_loadu_ps(y+g);
+            __m128 hw = _mm_mul_ps(_mm_loadu_ps(w+g), _mm_set1_ps(0.5f));
+            __m128 hh = _mm_mul_ps(_mm_loadu_ps(h+g), _mm_set1_ps(0.5f));
+            __m128 s = _mm_loadu_ps(sn+i);
+            __m128 c = _mm_loadu_ps(cs+i);
+
+            // Rotated half extents, corners are pos +- ax +- ay
+            __m128 axx = _mm_mul_ps(c, hw), axy = _mm_mul_ps(s, hw);
+            __m128 ayx = _mm_mul_ps(s, hh), ayy = _mm_mul_ps(c, hh);
+
+            __m128 cx0 = _mm_add_ps(_mm_sub_ps(px, axx), ayx);
+            __m128 cy0 = _mm_sub_ps(_mm_sub_ps(py, axy), ayy);
+            __m128 cx1 = _mm_add_ps(_mm_add_ps(px, axx), ayx);
+            __m128 cy1 = _mm_sub_ps(_mm_add_ps(py, axy), ayy);
+            __m128 cx2 = _mm_sub_ps(_mm_add_ps(px, axx), ayx);
+            __m128 cy2 = _mm_add_ps(_mm_add_ps(py, axy), ayy);
+            __m128 cx3 = _mm_sub_ps(_mm_sub_ps(px, axx), ayx);
+            __m128 cy3 = _mm_add_ps(_mm_sub_ps(py, axy), ayy);
+
+            // Each sprite's corners are 8 contiguous floats
+            _MM_TRANSPOSE4_PS(cx0, cy0, cx1, cy1);
+            _MM_TRANSPOSE4_PS(cx2, cy2, cx3, cy3);
+            float *out = corners[g*4].data();
+            _mm_storeu_ps(out,    cx0); _mm_storeu_ps(out+4,  cx2);
+            _mm_storeu_ps(out+8,  cy0); _mm_storeu_ps(out+12, cy2);
+            _mm_storeu_ps(out+16, cx1); _mm_storeu_ps(out+20, cx3);
+            _mm_storeu_ps(out+24, cy1); _mm_storeu_ps(out+28, cy3);
+        }
+#endif
+        for (; i < n; i++) {
+            size_t g = base+i;
+            spriteQuad(x[g], y[g], w[g], h[g], sn[i], cs[i], corners+g*4);
+        }
+    }
+}
+
+}; // namespace math
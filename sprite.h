@@ -0,0 +1,18 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include "vec.h"
+
+namespace math {
+
+/// Corners of sprites centered on (x, y) with size (w, h), rotated by
+/// angle (radians). Inputs are structure of arrays, corners receives 4
+/// points per sprite in counter-clockwise order starting at the
+/// (-w/2, -h/2) corner. Angles go through the vectorized fastSincos.
+void spriteQuads(const float *x, const float *y,
+                 const float *w, const float *h, const float *angle,
+                 vec2f *corners, size_t count);
+
+}; // namespace math
+
+#endif
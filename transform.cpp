@@ -0,0 +1,122 @@
+#include "transform.h"
+#include "matrix3x4.h"
+#include "rotation.h"
+
+namespace math {
+
+transform_t classify(const Matrix4f &m)
+{
+    if (m[0][3] != 0.0f || m[1][3] != 0.0f || m[2][3] != 0.0f || m[3][3] != 1.0f)
+        return TRANSFORM_PROJECTIVE;
+
+    bool diagonal = true, unit = true;
+    for (int j = 0; j < 3; j++) {
+        for (int i = 0; i < 3; i++) {
+            if (i != j && m[j][i] != 0.0f)
+                diagonal = false;
+        }
+        if (m[j][j] != 1.0f)
+            unit = false;
+    }
+
+    if (diagonal && unit)
+        return m[3][0] == 0.0f && m[3][1] == 0.0f && m[3][2] == 0.0f
+            ? TRANSFORM_IDENTITY : TRANSFORM_TRANSLATION;
+    if (diagonal)
+        return TRANSFORM_SCALE;
+
+    // Orthonormal columns, as toMatrix() and rotate*() produce
+    const float eps = 1e-5f;
+    for (int j = 0; j < 3; j++) {
+        for (int k = j; k < 3; k++) {
+            float d = m[j][0]*m[k][0] + m[j][1]*m[k][1] + m[j][2]*m[k][2];
+            if (fabs(d - (j == k ? 1.0f : 0.0f)) > eps)
+                return TRANSFORM_AFFINE;
+        }
+    }
+    return TRANSFORM_RIGID;
+}
+
+Transform Transform::rotationX(float angle)
+{
+    return Transform(rotateX(angle), TRANSFORM_RIGID);
+}
+
+Transform Transform::rotationY(float angle)
+{
+    return Transform(rotateY(angle), TRANSFORM_RIGID);
+}
+
+Transform Transform::rotationZ(float angle)
+{
+    return Transform(rotateZ(angle), TRANSFORM_RIGID);
+}
+
+Transform Transform::inverse() const
+{
+    const Matrix4f &m = m_matrix;
+    Transform ret(m, m_class);
+    Matrix4f &r = ret.m_matrix;
+    switch (m_class) {
+    case TRANSFORM_IDENTITY:
+        break;
+    case TRANSFORM_TRANSLATION:
+        for (int i = 0; i < 3; i++)
+            r[3][i] = -m[3][i];
+        break;
+    case TRANSFORM_SCALE:
+        for (int i = 0; i < 3; i++) {
+            r[i][i] = 1.0f/m[i][i];
+            r[3][i] = -m[3][i]*r[i][i];
+        }
+        break;
+    case TRANSFORM_RIGID:
+        // Transposed rotation and translation rotated back, -R^T*t
+        for (int j = 0; j < 3; j++) {
+            for (int i = 0; i < 3; i++)
+                r[j][i] = m[i][j];
+            r[3][j] = -(m[j][0]*m[3][0] + m[j][1]*m[3][1] + m[j][2]*m[3][2]);
+        }
+        break;
+    case TRANSFORM_AFFINE:
+        r = Matrix3x4f(m).inverse().toMatrix4();
+        break;
+    default:
+        r = m.inverse();
+        break;
+    }
+    return ret;
+}
+
+void Transform::transformPoints(const vec3f *in, vec3f *out, size_t count) const
+{
+    switch (m_class) {
+    case TRANSFORM_IDENTITY:
+        if (in != out)
+            memmove(out, in, count*sizeof(vec3f));
+        break;
+    case TRANSFORM_TRANSLATION: {
+        vec3f t = getTranslate();
+        for (size_t i = 0; i < count; i++)
+            out[i] = in[i] + t;
+        break;
+    }
+    case TRANSFORM_SCALE: {
+        vec3f s(m_matrix[0][0], m_matrix[1][1], m_matrix[2][2]);
+        vec3f t = getTranslate();
+        for (size_t i = 0; i < count; i++)
+            out[i] = in[i]*s + t;
+        break;
+    }
+    case TRANSFORM_RIGID:
+    case TRANSFORM_AFFINE:
+        math::transformPoints(Matrix3x4f(m_matrix), in, out, count);
+        break;
+    default:
+        for (size_t i = 0; i < count; i++)
+            out[i] = transformPoint(in[i]);
+        break;
+    }
+}
+
+}; // namespace math
@@ -0,0 +1,216 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "matrix.h"
+#include "quaternion.h"
+
+namespace math {
+
+/// Transform classes, each including the ones before it
+typedef enum {
+    TRANSFORM_IDENTITY,
+    TRANSFORM_TRANSLATION,
+    TRANSFORM_SCALE,            // per axis scale, then translation
+    TRANSFORM_RIGID,            // rotation, then translation
+    TRANSFORM_AFFINE,
+    TRANSFORM_PROJECTIVE
+} transform_t;
+
+/// Class of a*b given the classes of a and b
+inline transform_t combine(transform_t a, transform_t b)
+{
+    transform_t lo = std::min(a, b), hi = std::max(a, b);
+    // Scaling and rotating gives shear
+    if (lo == TRANSFORM_SCALE && hi == TRANSFORM_RIGID)
+        return TRANSFORM_AFFINE;
+    return hi;
+}
+
+/// Tightest class of m. Exact except for rigid, where the rotation part
+/// only has to be orthonormal to within float rounding.
+transform_t classify(const Matrix4f &m);
+
+/// Matrix4f tagged with its transform class, which multiplies, inverts
+/// and transforms points with kernels specialized for the class. Build
+/// with the named constructors to get the tag for free, a plain matrix
+/// is classified once on construction. Matrix4f itself stays an untagged
+/// 64-byte array of floats.
+class Transform {
+public:
+    Transform()
+        : m_matrix(identity())
+        , m_class(TRANSFORM_IDENTITY)
+    {}
+
+    explicit Transform(const Matrix4f &m)
+        : m_matrix(m)
+        , m_class(classify(m))
+    {}
+
+    /// m must belong to cls, which isn't checked
+    Transform(const Matrix4f &m, transform_t cls)
+        : m_matrix(m)
+        , m_class(cls)
+    {}
+
+    static Transform translation(const vec3f &t)
+    {
+        return Transform(translate(t), TRANSFORM_TRANSLATION);
+    }
+
+    static Transform scaling(const vec3f &s)
+    {
+        return Transform(scale(s), TRANSFORM_SCALE);
+    }
+
+    static Transform rotation(const Quaternion &q)
+    {
+        return Transform(q.toMatrix(), TRANSFORM_RIGID);
+    }
+
+    static Transform rotationX(float angle);
+    static Transform rotationY(float angle);
+    static Transform rotationZ(float angle);
+
+    const Matrix4f& matrix() const
+    {
+        return m_matrix;
+    }
+
+    transform_t type() const
+    {
+        return m_class;
+    }
+
+    bool isIdentity() const
+    {
+        return m_class == TRANSFORM_IDENTITY;
+    }
+
+    vec3f getTranslate() const
+    {
+        return vec3f(m_matrix[3][0], m_matrix[3][1], m_matrix[3][2]);
+    }
+
+    Transform operator * (const Transform &b) const;
+
+    /// Left-multiply in place, *this = b * *this, like Matrix
+    void operator *= (const Transform &b)
+    {
+        *this = b * (*this);
+    }
+
+    Transform inverse() const;
+
+    /// Divided by w for projective transforms
+    vec3f transformPoint(const vec3f &p) const;
+
+    /// Batched transformPoint(), in and out may alias
+    void transformPoints(const vec3f *in, vec3f *out, size_t count) const;
+
+private:
+    // Matrix left for the caller to fill
+    explicit Transform(transform_t cls)
+        : m_class(cls)
+    {}
+
+    Matrix4f m_matrix;
+    transform_t m_class;
+};
+
+/////
+
+/// dest = a*b where both have a (0, 0, 0, 1) bottom row, so the bottom
+/// row of b needn't be multiplied in. dest may alias a or b.
+inline void multiplyAffine(Matrix4f &dest, const Matrix4f &a, const Matrix4f &b)
+{
+#ifdef __SSE__
+    __m128 a0 = _mm_load_ps(a[0]);
+    __m128 a1 = _mm_load_ps(a[1]);
+    __m128 a2 = _mm_load_ps(a[2]);
+    __m128 a3 = _mm_load_ps(a[3]);
+    __m128 d[4];
+    for (int j = 0; j < 4; j++) {
+        d[j] = _mm_mul_ps(a0, _mm_set_ps1(b[j][0]));
+        d[j] = _mm_add_ps(d[j], _mm_mul_ps(a1, _mm_set_ps1(b[j][1])));
+        d[j] = _mm_add_ps(d[j], _mm_mul_ps(a2, _mm_set_ps1(b[j][2])));
+    }
+    _mm_store_ps(dest[0], d[0]);
+    _mm_store_ps(dest[1], d[1]);
+    _mm_store_ps(dest[2], d[2]);
+    _mm_store_ps(dest[3], _mm_add_ps(d[3], a3));
+#else
+    Matrix4f r;
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 3; i++)
+            r[j][i] = a[0][i]*b[j][0] + a[1][i]*b[j][1] + a[2][i]*b[j][2];
+    for (int i = 0; i < 3; i++) {
+        r[3][i] += a[3][i];
+        r[i][3] = 0.0f;
+    }
+    r[3][3] = 1.0f;
+    dest = r;
+#endif
+}
+
+inline Transform Transform::operator * (const Transform &b) const
+{
+    if (m_class == TRANSFORM_IDENTITY)
+        return b;
+    if (b.m_class == TRANSFORM_IDENTITY)
+        return *this;
+
+    transform_t cls = combine(m_class, b.m_class);
+    const Matrix4f &x = m_matrix, &y = b.m_matrix;
+    Transform ret(cls);
+    Matrix4f &r = ret.m_matrix;
+    if (m_class == TRANSFORM_TRANSLATION && cls != TRANSFORM_PROJECTIVE) {
+        // Only the translation of b moves
+        r = y;
+        setColumn(r, 3, y[3][0] + x[3][0], y[3][1] + x[3][1], y[3][2] + x[3][2], 1.0f);
+    } else if (b.m_class == TRANSFORM_TRANSLATION) {
+        // Columns of a with a*t as the translation
+        vec4f t = x*vec4f(y[3][0], y[3][1], y[3][2], 1.0f);
+        r = x;
+        setColumn(r, 3, t[0], t[1], t[2], t[3]);
+    } else if (cls == TRANSFORM_SCALE) {
+        setColumn(r, 0, x[0][0]*y[0][0], 0, 0, 0);
+        setColumn(r, 1, 0, x[1][1]*y[1][1], 0, 0);
+        setColumn(r, 2, 0, 0, x[2][2]*y[2][2], 0);
+        setColumn(r, 3, x[0][0]*y[3][0] + x[3][0], x[1][1]*y[3][1] + x[3][1],
+                  x[2][2]*y[3][2] + x[3][2], 1.0f);
+    } else if (cls != TRANSFORM_PROJECTIVE) {
+        multiplyAffine(r, x, y);
+    } else {
+        r = x*y;
+    }
+    return ret;
+}
+
+inline vec3f Transform::transformPoint(const vec3f &p) const
+{
+    const Matrix4f &m = m_matrix;
+    switch (m_class) {
+    case TRANSFORM_IDENTITY:
+        return p;
+    case TRANSFORM_TRANSLATION:
+        return p + getTranslate();
+    case TRANSFORM_SCALE:
+        return vec3f(m[0][0]*p[0] + m[3][0],
+                     m[1][1]*p[1] + m[3][1],
+                     m[2][2]*p[2] + m[3][2]);
+    case TRANSFORM_RIGID:
+    case TRANSFORM_AFFINE:
+        return vec3f(m[0][0]*p[0] + m[1][0]*p[1] + m[2][0]*p[2] + m[3][0],
+                     m[0][1]*p[0] + m[1][1]*p[1] + m[2][1]*p[2] + m[3][1],
+                     m[0][2]*p[0] + m[1][2]*p[1] + m[2][2]*p[2] + m[3][2]);
+    default: {
+        vec4f r = m*vec4f(p, 1.0f);
+        return vec3(r)/r[3];
+    }
+    }
+}
+
+}; // namespace math
+
+#endif
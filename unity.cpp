@@ -0,0 +1,32 @@
+// Whole library as a single translation unit, built instead of the
+// individual sources with premake4 --unity. List every library source.
+
+#include "animation.cpp"
+#include "blob.cpp"
+#include "bounds.cpp"
+#include "broadphase.cpp"
+#include "camera.cpp"
+#include "cluster.cpp"
+#include "cpu.cpp"
+#include "fastmath.cpp"
+#include "format.cpp"
+#include "frustum.cpp"
+#include "gjk.cpp"
+#include "instrument.cpp"
+#include "kernels.cpp"
+#include "matrix.cpp"
+#include "matrix2x3.cpp"
+#include "matrix3x4.cpp"
+#include "projection.cpp"
+#include "quaternion.cpp"
+#include "radixsort.cpp"
+#include "rect.cpp"
+#include "rectgrid.cpp"
+#include "rotation.cpp"
+#include "soa.cpp"
+#include "solve.cpp"
+#include "spatialhash.cpp"
+#include "sprite.cpp"
+#include "transform.cpp"
+#include "vec.cpp"
+#include "volumes.cpp"
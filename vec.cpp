@@ -39,4 +39,24 @@ std::ostream& operator<< <2, float>(std::ostream &out, const vec<2, float> &v);
 template
 std::ostream& operator<< <2, int>(std::ostream &out, const vec<2, int> &v);
 
+// Columns and right hand sides of the larger matrices and solvers
+#define VEC_INSTANTIATE(N, T) \
+    template std::ostream& operator<< <N, T>(std::ostream &out, const vec<N, T> &v);
+
+VEC_INSTANTIATE(2, double)
+VEC_INSTANTIATE(3, double)
+VEC_INSTANTIATE(4, double)
+#define VEC_INSTANTIATE_N(N) VEC_INSTANTIATE(N, float) VEC_INSTANTIATE(N, double)
+VEC_INSTANTIATE_N(5)
+VEC_INSTANTIATE_N(6)
+VEC_INSTANTIATE_N(7)
+VEC_INSTANTIATE_N(8)
+VEC_INSTANTIATE_N(9)
+VEC_INSTANTIATE_N(10)
+VEC_INSTANTIATE_N(11)
+VEC_INSTANTIATE_N(12)
+
+#undef VEC_INSTANTIATE_N
+#undef VEC_INSTANTIATE
+
 }; // namespace math
\ No newline at end of file
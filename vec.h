@@ -10,6 +10,20 @@
 
 namespace math {
 
+/// True if every swizzle index is below N
+template <size_t N, size_t... I>
+struct SwizzleCheck;
+
+template <size_t N>
+struct SwizzleCheck<N> {
+    static const bool valid = true;
+};
+
+template <size_t N, size_t I, size_t... R>
+struct SwizzleCheck<N, I, R...> {
+    static const bool valid = I < N && SwizzleCheck<N, R...>::valid;
+};
+
 template <size_t N, typename T>
 class vec {
 public:
@@ -61,11 +75,6 @@ public:
         m_data[3] = w;
     }
 
-    vec(const vec& src)
-    {
-        memcpy(m_data, src.m_data, sizeof(m_data));
-    }
-
     explicit vec(const T* src)
     {
         memcpy(m_data, src, sizeof(m_data));
@@ -96,6 +105,64 @@ public:
     T& z() { return m_data[2]; }
     T& w() { return m_data[3]; }
 
+    /// Components by index, v.swizzle<2, 0, 1>() == vec(v.z(), v.x(), v.y()).
+    /// Indices are checked at compile time and the copy folds into
+    /// register shuffles, see also the named swizzles below.
+    template <size_t... I>
+    vec<sizeof...(I), T> swizzle() const
+    {
+        static_assert(SwizzleCheck<N, I...>::valid, "swizzle index out of range");
+        const T r[] = { m_data[I]... };
+        return vec<sizeof...(I), T>(r);
+    }
+
+    // Named swizzles of 2 to 4 components: xy(), zxy(), wzyx(), ...
+#define VEC_INDEX_x 0
+#define VEC_INDEX_y 1
+#define VEC_INDEX_z 2
+#define VEC_INDEX_w 3
+#define VEC_SWIZZLE2(a, b)                                              \
+    vec<2, T> a##b() const                                              \
+    { return swizzle<VEC_INDEX_##a, VEC_INDEX_##b>(); }
+#define VEC_SWIZZLE3(a, b, c)                                           \
+    vec<3, T> a##b##c() const                                           \
+    { return swizzle<VEC_INDEX_##a, VEC_INDEX_##b, VEC_INDEX_##c>(); }
+#define VEC_SWIZZLE4(a, b, c, d)                                        \
+    vec<4, T> a##b##c##d() const                                        \
+    { return swizzle<VEC_INDEX_##a, VEC_INDEX_##b, VEC_INDEX_##c, VEC_INDEX_##d>(); }
+#define VEC_SWIZZLE_EACH(M) M(x) M(y) M(z) M(w)
+#define VEC_SWIZZLE2_A(a) VEC_SWIZZLE2(a, x) VEC_SWIZZLE2(a, y) \
+                          VEC_SWIZZLE2(a, z) VEC_SWIZZLE2(a, w)
+#define VEC_SWIZZLE3_B(a, b) VEC_SWIZZLE3(a, b, x) VEC_SWIZZLE3(a, b, y) \
+                             VEC_SWIZZLE3(a, b, z) VEC_SWIZZLE3(a, b, w)
+#define VEC_SWIZZLE3_A(a) VEC_SWIZZLE3_B(a, x) VEC_SWIZZLE3_B(a, y) \
+                          VEC_SWIZZLE3_B(a, z) VEC_SWIZZLE3_B(a, w)
+#define VEC_SWIZZLE4_C(a, b, c) VEC_SWIZZLE4(a, b, c, x) VEC_SWIZZLE4(a, b, c, y) \
+                                VEC_SWIZZLE4(a, b, c, z) VEC_SWIZZLE4(a, b, c, w)
+#define VEC_SWIZZLE4_B(a, b) VEC_SWIZZLE4_C(a, b, x) VEC_SWIZZLE4_C(a, b, y) \
+                             VEC_SWIZZLE4_C(a, b, z) VEC_SWIZZLE4_C(a, b, w)
+#define VEC_SWIZZLE4_A(a) VEC_SWIZZLE4_B(a, x) VEC_SWIZZLE4_B(a, y) \
+                          VEC_SWIZZLE4_B(a, z) VEC_SWIZZLE4_B(a, w)
+
+    VEC_SWIZZLE_EACH(VEC_SWIZZLE2_A)
+    VEC_SWIZZLE_EACH(VEC_SWIZZLE3_A)
+    VEC_SWIZZLE_EACH(VEC_SWIZZLE4_A)
+
+#undef VEC_SWIZZLE4_A
+#undef VEC_SWIZZLE4_B
+#undef VEC_SWIZZLE4_C
+#undef VEC_SWIZZLE3_A
+#undef VEC_SWIZZLE3_B
+#undef VEC_SWIZZLE2_A
+#undef VEC_SWIZZLE_EACH
+#undef VEC_SWIZZLE4
+#undef VEC_SWIZZLE3
+#undef VEC_SWIZZLE2
+#undef VEC_INDEX_w
+#undef VEC_INDEX_z
+#undef VEC_INDEX_y
+#undef VEC_INDEX_x
+
     T operator [](size_t i) const
     {
         return m_data[i];
@@ -142,10 +209,13 @@ public:
         return *this;
     }
 
+    /// Sum of absolute components
     T manhattanNorm() const
     {
-        // TODO: use generic abs
-        return abs(x())+abs(y());
+        T sum = 0;
+        for (size_t i = 0; i < N; i++)
+            sum += std::abs(m_data[i]);
+        return sum;
     }
 
     /// Unary minus (invert vector)
@@ -204,6 +274,17 @@ public:
         return res;
     }
 
+    /// Same with any callable, a lambda or functor inlines where the
+    /// function pointer above may stay an indirect call
+    template <typename F>
+    vec map(F func) const
+    {
+        vec res;
+        for (size_t i = 0; i < N; i++)
+            res[i] = func(m_data[i]);
+        return res;
+    }
+
     bool operator == (const vec &b) const
     {
         for (size_t i = 0; i < N; i++)
@@ -267,6 +348,117 @@ inline vec3f cross(const vec3f &a, const vec3f &b)
                  a[0]*b[1]-a[1]*b[0]);
 }
 
+// Component-wise functions. Plain loops over N that the compiler keeps
+// in registers and vectorizes, no calls through function pointers.
+
+template <size_t N, typename T>
+inline vec<N, T> min(const vec<N, T> &a, const vec<N, T> &b)
+{
+    vec<N, T> r;
+    for (size_t i = 0; i < N; i++)
+        r[i] = b[i] < a[i] ? b[i] : a[i];
+    return r;
+}
+
+template <size_t N, typename T>
+inline vec<N, T> max(const vec<N, T> &a, const vec<N, T> &b)
+{
+    vec<N, T> r;
+    for (size_t i = 0; i < N; i++)
+        r[i] = a[i] < b[i] ? b[i] : a[i];
+    return r;
+}
+
+template <size_t N, typename T>
+inline vec<N, T> abs(const vec<N, T> &a)
+{
+    vec<N, T> r;
+    for (size_t i = 0; i < N; i++)
+        r[i] = std::abs(a[i]);
+    return r;
+}
+
+template <size_t N, typename T>
+inline vec<N, T> floor(const vec<N, T> &a)
+{
+    vec<N, T> r;
+    for (size_t i = 0; i < N; i++)
+        r[i] = (T)std::floor(a[i]);
+    return r;
+}
+
+template <size_t N, typename T>
+inline vec<N, bool> lessThan(const vec<N, T> &a, const vec<N, T> &b)
+{
+    vec<N, bool> r;
+    for (size_t i = 0; i < N; i++)
+        r[i] = a[i] < b[i];
+    return r;
+}
+
+template <size_t N, typename T>
+inline vec<N, bool> greaterThan(const vec<N, T> &a, const vec<N, T> &b)
+{
+    return lessThan(b, a);
+}
+
+/// mask[i] ? a[i] : b[i]
+template <size_t N, typename T>
+inline vec<N, T> select(const vec<N, bool> &mask, const vec<N, T> &a, const vec<N, T> &b)
+{
+    vec<N, T> r;
+    for (size_t i = 0; i < N; i++)
+        r[i] = mask[i] ? a[i] : b[i];
+    return r;
+}
+
+// Horizontal reductions
+
+template <size_t N, typename T>
+inline T hsum(const vec<N, T> &a)
+{
+    T r = a[0];
+    for (size_t i = 1; i < N; i++)
+        r += a[i];
+    return r;
+}
+
+template <size_t N, typename T>
+inline T hmin(const vec<N, T> &a)
+{
+    T r = a[0];
+    for (size_t i = 1; i < N; i++)
+        r = a[i] < r ? a[i] : r;
+    return r;
+}
+
+template <size_t N, typename T>
+inline T hmax(const vec<N, T> &a)
+{
+    T r = a[0];
+    for (size_t i = 1; i < N; i++)
+        r = r < a[i] ? a[i] : r;
+    return r;
+}
+
+template <size_t N>
+inline bool any(const vec<N, bool> &mask)
+{
+    for (size_t i = 0; i < N; i++)
+        if (mask[i])
+            return true;
+    return false;
+}
+
+template <size_t N>
+inline bool all(const vec<N, bool> &mask)
+{
+    for (size_t i = 0; i < N; i++)
+        if (!mask[i])
+            return false;
+    return true;
+}
+
 /// Distance between two vectors
 template <size_t N, typename T>
 inline float distance(const vec<N, T> &a, const vec<N, T> &b)
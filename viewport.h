@@ -13,11 +13,19 @@ struct Viewport {
     {}
 
     void toClipSpace(float x, float y,
-                     float &xc, float &yc)
+                     float &xc, float &yc) const
     {
         xc = x/(width*0.5f) - 1.0f;
         yc = 1.0f - y/(height*0.5f);
     }
+
+    /// Inverse of toClipSpace
+    void fromClipSpace(float xc, float yc,
+                       float &x, float &y) const
+    {
+        x = (xc + 1.0f)*(width*0.5f);
+        y = (1.0f - yc)*(height*0.5f);
+    }
 };
 
 #endif
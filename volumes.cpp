@@ -0,0 +1,94 @@
+#include <algorithm>
+
+#include "volumes.h"
+#include "gjk.h"
+
+namespace math {
+
+void distanceRange(const Plane &p, const Cone &c, float &lo, float &hi)
+{
+    // The base disc reaches out radius times the sine of the angle
+    // between the plane normal and the axis
+    float da = p.distance(c.apex);
+    float na = dot(p.normal(), c.axis);
+    float db = da + c.height*na;
+    float k = c.radius*sqrtf(std::max(1.0f - na*na, 0.0f));
+    lo = std::min(da, db - k);
+    hi = std::max(da, db + k);
+}
+
+void distanceRange(const Plane &p, const Capsule &c, float &lo, float &hi)
+{
+    float da = p.distance(c.a), db = p.distance(c.b);
+    lo = std::min(da, db) - c.radius;
+    hi = std::max(da, db) + c.radius;
+}
+
+static inline float segmentDistanceSquared(const vec2f &p, const vec2f &a, const vec2f &b)
+{
+    vec2f ab = b - a;
+    float len2 = ab.lengthSquared();
+    float t = len2 > 0.0f ? std::min(std::max(dot(p - a, ab)/len2, 0.0f), 1.0f) : 0.0f;
+    return (a + ab*t - p).lengthSquared();
+}
+
+bool overlaps(const Cone &c, const Sphere &s)
+{
+    // Both are solids of revolution around lines through the center of the
+    // sphere, so the distance is the one in the half plane through the axis
+    // and the center, from (along, off) the axis to the triangle (0, 0),
+    // (height, radius), (height, 0)
+    vec3f v = s.center - c.apex;
+    float along = dot(v, c.axis);
+    float off = sqrtf(std::max(v.lengthSquared() - along*along, 0.0f));
+    if (along >= 0.0f && along <= c.height && off*c.height <= along*c.radius)
+        return true;
+    vec2f p(along, off), rim(c.height, c.radius);
+    float d2 = std::min(segmentDistanceSquared(p, vec2f(0.0f, 0.0f), rim),
+                        segmentDistanceSquared(p, vec2f(c.height, 0.0f), rim));
+    return d2 <= s.radius*s.radius;
+}
+
+bool overlaps(const Cone &c, const AABB &b)
+{
+    vec3f base = c.apex + c.axis*c.height;
+    for (int k = 0; k < 3; k++) {
+        float r = c.radius*sqrtf(std::max(1.0f - c.axis[k]*c.axis[k], 0.0f));
+        if (std::max(c.apex[k], base[k] + r) < b.min[k] ||
+            std::min(c.apex[k], base[k] - r) > b.max[k])
+            return false;
+    }
+
+    vec3f center = b.center(), ext = b.extents();
+    float along = dot(center - c.apex, c.axis);
+    float r = ext[0]*fabsf(c.axis[0]) + ext[1]*fabsf(c.axis[1]) + ext[2]*fabsf(c.axis[2]);
+    if (along + r < 0.0f || along - r > c.height)
+        return false;
+
+    return overlaps(c, Sphere(center, ext.length()));
+}
+
+bool overlaps(const Capsule &c, const Sphere &s)
+{
+    vec3f ab = c.b - c.a;
+    float len2 = ab.lengthSquared();
+    float t = len2 > 0.0f ? std::min(std::max(dot(s.center - c.a, ab)/len2, 0.0f), 1.0f) : 0.0f;
+    float r = c.radius + s.radius;
+    return (c.a + ab*t - s.center).lengthSquared() <= r*r;
+}
+
+bool overlaps(const Capsule &c, const AABB &b)
+{
+    for (int k = 0; k < 3; k++) {
+        if (std::max(c.a[k], c.b[k]) + c.radius < b.min[k] ||
+            std::min(c.a[k], c.b[k]) - c.radius > b.max[k])
+            return false;
+    }
+    Matrix3f axes;
+    axes.loadIdentity();
+    Contact contact;
+    return closestPoints(ConvexShape::capsule(c.a, c.b, c.radius),
+                         ConvexShape::box(b.center(), b.extents(), axes), contact);
+}
+
+}; // namespace math
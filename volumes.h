@@ -0,0 +1,170 @@
+#ifndef VOLUMES_H
+#define VOLUMES_H
+
+#include "bounds.h"
+#include "plane.h"
+
+namespace math {
+
+/// Cone with a flat base, the apex, unit axis, height along it and base
+/// radius. Packed like two vec4f.
+struct Cone {
+    vec3f apex;
+    float height;
+    vec3f axis;
+    float radius;
+
+    Cone() {}
+
+    Cone(const vec3f &apex, const vec3f &axis, float height, float radius)
+        : apex(apex)
+        , height(height)
+        , axis(axis)
+        , radius(radius)
+    {}
+
+    /// Cone around a spot light at pos along unit dir lighting the
+    /// spherical sector of radius range, half angle below 90 degrees
+    static Cone spot(const vec3f &pos, const vec3f &dir, float range, float angle)
+    {
+        return Cone(pos, dir, range, range*tanf(angle));
+    }
+};
+
+/// Segment from a to b swept by a sphere
+struct Capsule {
+    vec3f a, b;
+    float radius;
+
+    Capsule() {}
+
+    Capsule(const vec3f &a, const vec3f &b, float radius)
+        : a(a)
+        , b(b)
+        , radius(radius)
+    {}
+};
+
+/// Signed distances of the nearest and farthest points to the plane, exact
+void distanceRange(const Plane &p, const Cone &c, float &lo, float &hi);
+void distanceRange(const Plane &p, const Capsule &c, float &lo, float &hi);
+
+/// Exact
+bool overlaps(const Cone &c, const Sphere &s);
+
+/// Conservative, may report a box just off the cone's curved side as
+/// overlapping. Separating axes of the box and the cone axis, then the
+/// sphere around the box.
+bool overlaps(const Cone &c, const AABB &b);
+
+/// Exact
+bool overlaps(const Capsule &c, const Sphere &s);
+
+/// Exact, closestPoints() (gjk.h) after the box axes fail to separate
+bool overlaps(const Capsule &c, const AABB &b);
+
+/// Cones as 8 lanes in the order of the struct, apex x, y, z, height,
+/// axis x, y, z, radius
+template <>
+class SoA<Cone> : public SoAStorage<8> {
+public:
+    typedef Cone value_type;
+
+    SoA() {}
+
+    SoA(const Cone *c, size_t count)
+    {
+        assign(c, count);
+    }
+
+    Cone operator [] (size_t i) const
+    {
+        const float *l[8];
+        lanes(l);
+        return Cone(vec3f(l[0][i], l[1][i], l[2][i]), vec3f(l[4][i], l[5][i], l[6][i]),
+                    l[3][i], l[7][i]);
+    }
+
+    void set(size_t i, const Cone &c)
+    {
+        const float *v = reinterpret_cast<const float*>(&c);
+        for (size_t k = 0; k < 8; k++)
+            lane(k)[i] = v[k];
+    }
+
+    void push_back(const Cone &c)
+    {
+        set(append(), c);
+    }
+
+    void assign(const Cone *c, size_t count)
+    {
+        static_assert(sizeof(Cone) == 8*sizeof(float), "Cone is not packed");
+        load(reinterpret_cast<const float*>(c), count);
+    }
+
+    void copyTo(Cone *c) const
+    {
+        store(reinterpret_cast<float*>(c));
+    }
+
+    /// All 8 lane pointers, as the kernels take them
+    void lanes(const float *out[8]) const
+    {
+        SoAStorage<8>::lanes(out);
+    }
+};
+
+/// Capsules as 7 lanes, a x, y, z, b x, y, z, radius
+template <>
+class SoA<Capsule> : public SoAStorage<7> {
+public:
+    typedef Capsule value_type;
+
+    SoA() {}
+
+    SoA(const Capsule *c, size_t count)
+    {
+        assign(c, count);
+    }
+
+    Capsule operator [] (size_t i) const
+    {
+        const float *l[7];
+        lanes(l);
+        return Capsule(vec3f(l[0][i], l[1][i], l[2][i]), vec3f(l[3][i], l[4][i], l[5][i]),
+                       l[6][i]);
+    }
+
+    void set(size_t i, const Capsule &c)
+    {
+        const float *v = reinterpret_cast<const float*>(&c);
+        for (size_t k = 0; k < 7; k++)
+            lane(k)[i] = v[k];
+    }
+
+    void push_back(const Capsule &c)
+    {
+        set(append(), c);
+    }
+
+    void assign(const Capsule *c, size_t count)
+    {
+        static_assert(sizeof(Capsule) == 7*sizeof(float), "Capsule is not packed");
+        load(reinterpret_cast<const float*>(c), count);
+    }
+
+    void copyTo(Capsule *c) const
+    {
+        store(reinterpret_cast<float*>(c));
+    }
+
+    void lanes(const float *out[7]) const
+    {
+        SoAStorage<7>::lanes(out);
+    }
+};
+
+}; // namespace math
+
+#endif